@@ -6,6 +6,7 @@
 #include <stddef.h>
 
 #include "endian.h"
+#include "dns.h"
 
 namespace webserver {
 
@@ -48,6 +49,15 @@ static uint32_t CountBytes(T value) {
     return result; // 返回1的位数
 }
 
+/**
+ * @brief 是否为数字地址(IPv4点分十进制或IPv6)
+ */
+static bool IsNumericHost(const std::string& node) {
+    in_addr addr;
+    return node.find(':') != std::string::npos
+        || inet_pton(AF_INET, node.c_str(), &addr) == 1;
+}
+
 /**
  * @brief Address::LookupAny函数用于在给定主机名、协议族、套接字类型和协议的情况下查找可用的地址。
  *          通过host返回任意Address
@@ -163,6 +173,42 @@ bool Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
         node = host;
     }
     
+    // 在开启hook的协程中解析域名时使用DnsResolver, 只挂起当前协程而不阻塞调度线程;
+    // 数字地址不需要查询, 仍交给getaddrinfo
+    if ((family == AF_INET || family == AF_INET6 || family == AF_UNSPEC)
+            && DnsResolver::CanUse() && !IsNumericHost(node)) {
+        uint16_t port = 0;
+        if (service && *service) {
+            if (strspn(service, "0123456789") == strlen(service)) {
+                port = atoi(service);
+            } else {
+                // 服务名(如http)从/etc/services中查找
+                servent se, *res = nullptr;
+                char buf[1024];
+                getservbyname_r(service, type == SOCK_DGRAM ? "udp" : "tcp", &se, buf, sizeof(buf), &res);
+                if (!res) {
+                    WEBSERVER_LOG_DEBUG(g_logger) << "Address::Lookup unknown service("
+                        << host << ", " << service << ")";
+                    return false;
+                }
+                port = ntohs(res->s_port);
+            }
+        }
+        std::vector<IPAddress::ptr> addrs;
+        int error = DnsResolverMgr::GetInstance()->resolve(addrs, node, family);
+        if (error) {
+            WEBSERVER_LOG_DEBUG(g_logger) << "Address::Lookup resolve(" << host << ", "
+                << family << ", " << type << ") err=" << error << " errstr="
+                << gai_strerror(error);
+            return false;
+        }
+        for (auto& i : addrs) {
+            i->setPort(port);
+            result.push_back(i);
+        }
+        return !result.empty();
+    }
+
     // 获得地址链表
     // 调用getaddrinfo函数查询地址信息
     int error = getaddrinfo(node.c_str(), service, &hints, &results);
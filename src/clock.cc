@@ -0,0 +1,102 @@
+#include "clock.h"
+#include <string.h>
+
+namespace webserver {
+
+/**
+ * @brief 线程缓存的时间
+ */
+struct ClockCache {
+    /// 是否开启缓存
+    bool enabled = false;
+    /// 缓存的单调时钟(微秒)
+    uint64_t us = 0;
+    /// 缓存的墙上时间(秒)
+    time_t sec = 0;
+    /// httpDate对应的秒
+    time_t dateSec = -1;
+    /// 格式化好的HTTP Date
+    std::string httpDate;
+    /// localTime对应的秒和格式
+    time_t localSec = -1;
+    std::string localFormat;
+    /// 格式化好的本地时间
+    std::string localTime;
+};
+
+static thread_local ClockCache t_clock;
+
+/**
+ * @brief 读取墙上时间的秒, 精度只要求到秒, 用粗粒度时钟
+ */
+static time_t RealtimeSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+uint64_t Clock::PreciseUS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
+uint64_t Clock::PreciseMS() {
+    return PreciseUS() / 1000;
+}
+
+uint64_t Clock::NowUS() {
+    ClockCache& c = t_clock;
+    return c.enabled ? c.us : PreciseUS();
+}
+
+uint64_t Clock::NowMS() {
+    return NowUS() / 1000;
+}
+
+time_t Clock::NowSec() {
+    ClockCache& c = t_clock;
+    return c.enabled ? c.sec : RealtimeSec();
+}
+
+uint64_t Clock::Update() {
+    ClockCache& c = t_clock;
+    c.us = PreciseUS();
+    c.sec = RealtimeSec();
+    c.enabled = true;
+    return c.us / 1000;
+}
+
+void Clock::Disable() {
+    t_clock.enabled = false;
+}
+
+const std::string& Clock::HttpDate() {
+    ClockCache& c = t_clock;
+    time_t sec = NowSec();
+    if(c.dateSec != sec) {
+        struct tm tm;
+        gmtime_r(&sec, &tm);
+        char buf[64];
+        size_t n = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        c.httpDate.assign(buf, n);
+        c.dateSec = sec;
+    }
+    return c.httpDate;
+}
+
+const std::string& Clock::LocalTime(time_t sec, const std::string& format) {
+    ClockCache& c = t_clock;
+    if(c.localSec != sec || c.localFormat != format) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        char buf[128];
+        size_t n = strftime(buf, sizeof(buf), format.c_str(), &tm);
+        c.localTime.assign(buf, n);
+        c.localSec = sec;
+        c.localFormat = format;
+    }
+    return c.localTime;
+}
+
+}
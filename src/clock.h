@@ -0,0 +1,75 @@
+#ifndef __WEBSERVER_CLOCK_H__
+#define __WEBSERVER_CLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+namespace webserver {
+
+/**
+ * @brief 时钟
+ * @details 调度线程每轮反应器循环(epoll_wait前后, 从空闲协程返回时)调用Update()刷新本线程缓存的时间,
+ *          之后NowMS/NowUS/NowSec直接返回缓存, 两次刷新之间的任务不再读系统时钟;
+ *          缓存是线程局部的, 不会在线程间产生缓存行争用.
+ *          没有开启缓存的线程(非调度线程)读取系统时间.
+ *          NowMS/NowUS/PreciseMS/PreciseUS是单调时钟(CLOCK_MONOTONIC), 系统时间被调整时不会跳变,
+ *          用于定时器和超时; 不能与GetCurrentMS/GetCurrentUS(墙上时间)混用比较.
+ *          NowSec/HttpDate/LocalTime是墙上时间(CLOCK_REALTIME).
+ */
+class Clock {
+public:
+    /**
+     * @brief 单调时钟的毫秒(粗粒度)
+     */
+    static uint64_t NowMS();
+
+    /**
+     * @brief 单调时钟的微秒(粗粒度)
+     */
+    static uint64_t NowUS();
+
+    /**
+     * @brief 墙上时间的秒(粗粒度), 代替time(0)
+     */
+    static time_t NowSec();
+
+    /**
+     * @brief 单调时钟的毫秒, 总是读取系统时钟
+     */
+    static uint64_t PreciseMS();
+
+    /**
+     * @brief 单调时钟的微秒, 总是读取系统时钟
+     */
+    static uint64_t PreciseUS();
+
+    /**
+     * @brief 读取系统时钟刷新当前线程缓存的时间, 并开启当前线程的缓存
+     * @return 单调时钟的毫秒
+     */
+    static uint64_t Update();
+
+    /**
+     * @brief 关闭当前线程的缓存, 调度线程退出调度循环时调用
+     */
+    static void Disable();
+
+    /**
+     * @brief HTTP Date头部格式(RFC 7231)的当前时间, 如 "Sun, 06 Nov 1994 08:49:37 GMT"
+     * @details 每个线程每秒只格式化一次
+     */
+    static const std::string& HttpDate();
+
+    /**
+     * @brief 按format格式化本地时间
+     * @details 每个线程缓存最近一次的结果, 同一秒内相同的格式直接返回
+     * @param[in] sec 时间(秒)
+     * @param[in] format strftime格式
+     */
+    static const std::string& LocalTime(time_t sec, const std::string& format);
+};
+
+}
+
+#endif
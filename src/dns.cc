@@ -0,0 +1,868 @@
+#include "dns.h"
+#include "config.h"
+#include "log.h"
+#include "clock.h"
+#include "hook.h"
+#include "iomanager.h"
+#include "socket.h"
+#include "util.h"
+#include <netdb.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+
+namespace webserver {
+
+static webserver::Logger::ptr g_logger = WEBSERVER_LOG_NAME("system");
+
+static webserver::ConfigVar<bool>::ptr g_dns_enable =
+    webserver::Config::Lookup("dns.enable", true, "use fiber dns resolver in Address::Lookup");
+
+static webserver::ConfigVar<std::vector<std::string> >::ptr g_dns_servers =
+    webserver::Config::Lookup("dns.servers", std::vector<std::string>()
+            , "dns servers(ip[:port]), empty to use resolv.conf");
+
+static webserver::ConfigVar<std::string>::ptr g_dns_resolv_conf =
+    webserver::Config::Lookup("dns.resolv_conf", std::string("/etc/resolv.conf"), "resolv.conf path");
+
+static webserver::ConfigVar<std::string>::ptr g_dns_hosts =
+    webserver::Config::Lookup("dns.hosts", std::string("/etc/hosts"), "hosts path");
+
+static webserver::ConfigVar<uint32_t>::ptr g_dns_timeout =
+    webserver::Config::Lookup("dns.timeout_ms", (uint32_t)0, "dns query timeout ms, 0 to use resolv.conf");
+
+static webserver::ConfigVar<uint32_t>::ptr g_dns_negative_ttl =
+    webserver::Config::Lookup("dns.negative_ttl", (uint32_t)30, "max negative cache ttl seconds");
+
+static webserver::ConfigVar<uint32_t>::ptr g_dns_max_ttl =
+    webserver::Config::Lookup("dns.max_ttl", (uint32_t)3600, "max positive cache ttl seconds");
+
+static webserver::ConfigVar<uint32_t>::ptr g_dns_cache_size =
+    webserver::Config::Lookup("dns.cache_size", (uint32_t)10000, "max dns cache entries");
+
+/// hosts/resolv.conf检查修改的间隔(毫秒)
+static const uint64_t s_reload_interval = 5000;
+
+static const uint16_t DNS_TYPE_A = 1;
+static const uint16_t DNS_TYPE_CNAME = 5;
+static const uint16_t DNS_TYPE_SOA = 6;
+static const uint16_t DNS_TYPE_AAAA = 28;
+static const uint16_t DNS_CLASS_IN = 1;
+
+static const int DNS_RCODE_NOERROR = 0;
+static const int DNS_RCODE_NXDOMAIN = 3;
+
+/**
+ * @brief 一个类型的查询应答
+ */
+struct DnsReply {
+    /// 应答码
+    int rcode = -1;
+    /// 是否被截断
+    bool truncated = false;
+    /// 地址
+    std::vector<IPAddress::ptr> addrs;
+    /// 使用到的记录的最小TTL(秒)
+    uint32_t ttl = (uint32_t)-1;
+};
+
+/**
+ * @brief 解析"ip", "ip:port", "[ipv6]:port"格式的服务器地址
+ */
+static IPAddress::ptr ParseServer(const std::string& str, uint16_t default_port) {
+    std::string host = str;
+    uint16_t port = default_port;
+    if(!str.empty() && str[0] == '[') {
+        size_t pos = str.find(']');
+        if(pos == std::string::npos) {
+            return nullptr;
+        }
+        host = str.substr(1, pos - 1);
+        if(pos + 1 < str.size() && str[pos + 1] == ':') {
+            port = atoi(str.c_str() + pos + 2);
+        }
+    } else if(std::count(str.begin(), str.end(), ':') == 1) {
+        size_t pos = str.find(':');
+        host = str.substr(0, pos);
+        port = atoi(str.c_str() + pos + 1);
+    }
+    return IPAddress::Create(host.c_str(), port);
+}
+
+static std::vector<IPAddress::ptr> ParseServers(const std::vector<std::string>& strs) {
+    std::vector<IPAddress::ptr> rt;
+    for(auto& i : strs) {
+        auto addr = ParseServer(i, 53);
+        if(addr) {
+            rt.push_back(addr);
+        } else {
+            WEBSERVER_LOG_ERROR(g_logger) << "invalid dns server: " << i;
+        }
+    }
+    return rt;
+}
+
+static uint16_t RandomId() {
+    static thread_local std::mt19937 s_rng(std::random_device{}());
+    return (uint16_t)s_rng();
+}
+
+/**
+ * @brief 复制地址追加到result, 调用者可以修改返回的地址(如设置端口)而不影响缓存
+ */
+static void AppendCopies(std::vector<IPAddress::ptr>& result, const std::vector<IPAddress::ptr>& addrs) {
+    for(auto& i : addrs) {
+        result.push_back(std::dynamic_pointer_cast<IPAddress>(
+                    Address::Create(i->getAddr(), i->getAddrLen())));
+    }
+}
+
+static void PutU16(std::string& out, uint16_t v) {
+    out.push_back((char)(v >> 8));
+    out.push_back((char)(v & 0xff));
+}
+
+static uint16_t GetU16(const uint8_t* p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t GetU32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/**
+ * @brief 构造查询报文
+ * @return 域名不合法返回false
+ */
+static bool BuildQuery(std::string& out, uint16_t id, const std::string& name, uint16_t qtype) {
+    out.clear();
+    PutU16(out, id);
+    PutU16(out, 0x0100);    // RD
+    PutU16(out, 1);         // QDCOUNT
+    PutU16(out, 0);
+    PutU16(out, 0);
+    PutU16(out, 0);
+    if(name.size() > 253) {
+        return false;
+    }
+    size_t begin = 0;
+    while(begin < name.size()) {
+        size_t end = name.find('.', begin);
+        if(end == std::string::npos) {
+            end = name.size();
+        }
+        size_t len = end - begin;
+        if(len == 0 || len > 63) {
+            return false;
+        }
+        out.push_back((char)len);
+        out.append(name, begin, len);
+        begin = end + 1;
+    }
+    out.push_back(0);
+    PutU16(out, qtype);
+    PutU16(out, DNS_CLASS_IN);
+    return true;
+}
+
+/**
+ * @brief 读取报文中的域名(支持压缩指针), 结果为小写
+ * @param[in, out] pos 域名起始位置, 返回时为域名之后的位置
+ */
+static bool ReadName(const uint8_t* buf, size_t len, size_t& pos, std::string& name) {
+    name.clear();
+    size_t p = pos;
+    bool jumped = false;
+    int hops = 0;
+    while(true) {
+        if(p >= len) {
+            return false;
+        }
+        uint8_t c = buf[p];
+        if(c == 0) {
+            ++p;
+            break;
+        }
+        if((c & 0xC0) == 0xC0) {
+            if(p + 1 >= len || ++hops > 16) {
+                return false;
+            }
+            if(!jumped) {
+                pos = p + 2;
+                jumped = true;
+            }
+            p = ((c & 0x3F) << 8) | buf[p + 1];
+            continue;
+        }
+        if((c & 0xC0) || p + 1 + c > len) {
+            return false;
+        }
+        if(!name.empty()) {
+            name.push_back('.');
+        }
+        for(size_t i = 0; i < c; ++i) {
+            name.push_back(::tolower(buf[p + 1 + i]));
+        }
+        if(name.size() > 255) {
+            return false;
+        }
+        p += 1 + c;
+    }
+    if(!jumped) {
+        pos = p;
+    }
+    return true;
+}
+
+/**
+ * @brief 资源记录
+ */
+struct DnsRecord {
+    std::string owner;
+    uint16_t type;
+    uint32_t ttl;
+    size_t rdata;
+    uint16_t rdlen;
+};
+
+/**
+ * @brief 解析应答报文
+ * @param[in] qname 查询的域名
+ * @param[in] qtype 查询的类型
+ * @param[in] negative_ttl 否定应答没有SOA时使用的TTL
+ * @return 报文格式错误或者与问题不匹配返回false
+ */
+static bool ParseReply(const uint8_t* buf, size_t len, const std::string& qname
+                       ,uint16_t qtype, uint32_t negative_ttl, DnsReply& reply) {
+    if(len < 12) {
+        return false;
+    }
+    uint16_t flags = GetU16(buf + 2);
+    if(!(flags & 0x8000)) {
+        return false;
+    }
+    reply.truncated = flags & 0x0200;
+    reply.rcode = flags & 0x0f;
+    uint16_t qdcount = GetU16(buf + 4);
+    uint16_t ancount = GetU16(buf + 6);
+    uint16_t nscount = GetU16(buf + 8);
+    if(qdcount != 1) {
+        return false;
+    }
+    size_t pos = 12;
+    std::string name;
+    if(!ReadName(buf, len, pos, name) || pos + 4 > len) {
+        return false;
+    }
+    if(name != qname || GetU16(buf + pos) != qtype
+            || GetU16(buf + pos + 2) != DNS_CLASS_IN) {
+        return false;
+    }
+    pos += 4;
+
+    std::vector<DnsRecord> answers;
+    std::vector<DnsRecord> authority;
+    for(int i = 0; i < ancount + nscount; ++i) {
+        DnsRecord r;
+        if(!ReadName(buf, len, pos, r.owner) || pos + 10 > len) {
+            // 截断的应答可能不完整
+            if(reply.truncated) {
+                break;
+            }
+            return false;
+        }
+        r.type = GetU16(buf + pos);
+        uint16_t cls = GetU16(buf + pos + 2);
+        r.ttl = GetU32(buf + pos + 4);
+        r.rdlen = GetU16(buf + pos + 8);
+        r.rdata = pos + 10;
+        pos = r.rdata + r.rdlen;
+        if(pos > len) {
+            if(reply.truncated) {
+                break;
+            }
+            return false;
+        }
+        if(cls != DNS_CLASS_IN) {
+            continue;
+        }
+        (i < ancount ? answers : authority).push_back(r);
+    }
+
+    // 沿CNAME链收集别名, 只接受属于这条链的地址记录
+    std::vector<std::string> names{qname};
+    for(size_t hop = 0; hop < 8; ++hop) {
+        bool added = false;
+        for(auto& r : answers) {
+            if(r.type != DNS_TYPE_CNAME
+                    || std::find(names.begin(), names.end(), r.owner) == names.end()) {
+                continue;
+            }
+            size_t p = r.rdata;
+            std::string target;
+            if(!ReadName(buf, len, p, target)) {
+                return false;
+            }
+            if(std::find(names.begin(), names.end(), target) == names.end()) {
+                names.push_back(target);
+                reply.ttl = std::min(reply.ttl, r.ttl);
+                added = true;
+            }
+        }
+        if(!added) {
+            break;
+        }
+    }
+
+    uint32_t addr_ttl = (uint32_t)-1;
+    for(auto& r : answers) {
+        if(r.type != qtype
+                || std::find(names.begin(), names.end(), r.owner) == names.end()) {
+            continue;
+        }
+        if(r.type == DNS_TYPE_A && r.rdlen == 4) {
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            memcpy(&addr.sin_addr, buf + r.rdata, 4);
+            reply.addrs.push_back(std::make_shared<IPv4Address>(addr));
+        } else if(r.type == DNS_TYPE_AAAA && r.rdlen == 16) {
+            sockaddr_in6 addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin6_family = AF_INET6;
+            memcpy(&addr.sin6_addr, buf + r.rdata, 16);
+            reply.addrs.push_back(std::make_shared<IPv6Address>(addr));
+        } else {
+            continue;
+        }
+        addr_ttl = std::min(addr_ttl, r.ttl);
+    }
+
+    if(!reply.addrs.empty()) {
+        reply.ttl = std::min(reply.ttl, addr_ttl);
+        return true;
+    }
+
+    // 否定应答: TTL取SOA记录的TTL和minimum中较小者(RFC 2308)
+    reply.ttl = negative_ttl;
+    for(auto& r : authority) {
+        if(r.type != DNS_TYPE_SOA || r.rdlen < 22) {
+            continue;
+        }
+        uint32_t minimum = GetU32(buf + r.rdata + r.rdlen - 4);
+        reply.ttl = std::min(negative_ttl, std::min(r.ttl, minimum));
+        break;
+    }
+    return true;
+}
+
+/**
+ * @brief 从sock读满length字节
+ */
+static bool RecvFull(Socket::ptr sock, void* buffer, size_t length) {
+    size_t offset = 0;
+    while(offset < length) {
+        int rt = sock->recv((char*)buffer + offset, length - offset);
+        if(rt <= 0) {
+            return false;
+        }
+        offset += rt;
+    }
+    return true;
+}
+
+/**
+ * @brief 通过TCP查询(UDP应答被截断时)
+ */
+static bool ExchangeTcp(IPAddress::ptr server, const std::string& name, uint16_t qtype
+                        ,uint64_t timeout_ms, uint32_t negative_ttl, DnsReply& reply) {
+    std::string query;
+    uint16_t id = RandomId();
+    if(!BuildQuery(query, id, name, qtype)) {
+        return false;
+    }
+    Socket::ptr sock = Socket::CreateTCP(server);
+    if(!sock->connect(server, timeout_ms)) {
+        return false;
+    }
+    sock->setSendTimeout(timeout_ms);
+    sock->setRecvTimeout(timeout_ms);
+    std::string data;
+    PutU16(data, query.size());
+    data.append(query);
+    if(sock->send(data.c_str(), data.size()) != (int)data.size()) {
+        return false;
+    }
+    uint8_t head[2];
+    if(!RecvFull(sock, head, 2)) {
+        return false;
+    }
+    std::string buf(GetU16(head), '\0');
+    if(buf.size() < 2 || !RecvFull(sock, &buf[0], buf.size())) {
+        return false;
+    }
+    const uint8_t* p = (const uint8_t*)buf.c_str();
+    reply = DnsReply();
+    if(GetU16(p) != id || !ParseReply(p, buf.size(), name, qtype, negative_ttl, reply)) {
+        return false;
+    }
+    reply.truncated = false;
+    return true;
+}
+
+/**
+ * @brief 在一个UDP socket上向server并发查询name的多个类型
+ * @return 所有类型都拿到了确定的应答(NOERROR/NXDOMAIN)返回true
+ */
+static bool Exchange(IPAddress::ptr server, const std::string& name
+                     ,const std::vector<uint16_t>& qtypes, uint64_t timeout_ms
+                     ,uint32_t negative_ttl, std::vector<DnsReply>& replies) {
+    replies.assign(qtypes.size(), DnsReply());
+    std::vector<uint16_t> ids(qtypes.size());
+    std::vector<bool> done(qtypes.size(), false);
+
+    Socket::ptr sock = Socket::CreateUDP(server);
+    // connect之后内核只会交付来自server的报文
+    if(!sock->isValid() || !sock->connect(server)) {
+        return false;
+    }
+    std::string query;
+    for(size_t i = 0; i < qtypes.size(); ++i) {
+        ids[i] = RandomId();
+        if(!BuildQuery(query, ids[i], name, qtypes[i])) {
+            return false;
+        }
+        if(sock->send(query.c_str(), query.size()) != (int)query.size()) {
+            return false;
+        }
+    }
+
+    uint64_t deadline = Clock::PreciseMS() + timeout_ms;
+    size_t left = qtypes.size();
+    uint8_t buf[4096];
+    while(left) {
+        uint64_t now = Clock::PreciseMS();
+        if(now >= deadline) {
+            return false;
+        }
+        sock->setRecvTimeout(deadline - now);
+        int rt = sock->recv(buf, sizeof(buf));
+        if(rt < 0) {
+            // 超时, 或者ICMP端口不可达(ECONNREFUSED)
+            return false;
+        }
+        if(rt < 12) {
+            continue;
+        }
+        uint16_t id = GetU16(buf);
+        for(size_t i = 0; i < qtypes.size(); ++i) {
+            if(done[i] || ids[i] != id) {
+                continue;
+            }
+            DnsReply reply;
+            if(!ParseReply(buf, rt, name, qtypes[i], negative_ttl, reply)) {
+                break;
+            }
+            if(reply.rcode != DNS_RCODE_NOERROR && reply.rcode != DNS_RCODE_NXDOMAIN) {
+                // SERVFAIL/REFUSED等, 换下一个服务器
+                return false;
+            }
+            if(reply.truncated && !ExchangeTcp(server, name, qtypes[i]
+                        ,deadline - now, negative_ttl, reply)) {
+                return false;
+            }
+            replies[i] = reply;
+            done[i] = true;
+            --left;
+            break;
+        }
+    }
+    return true;
+}
+
+DnsResolver::DnsResolver()
+    :m_timeoutMs(5000)
+    ,m_attempts(2)
+    ,m_ndots(1)
+    ,m_resolvMtime(0)
+    ,m_hostsMtime(0)
+    ,m_lastCheck(0) {
+    m_configServers = ParseServers(g_dns_servers->getValue());
+    g_dns_servers->addListener([this](const std::vector<std::string>& old_value
+                                      ,const std::vector<std::string>& new_value) {
+        auto servers = ParseServers(new_value);
+        MutexType::Lock lock(m_mutex);
+        m_configServers.swap(servers);
+    });
+    loadResolvConf(g_dns_resolv_conf->getValue());
+    loadHosts(g_dns_hosts->getValue());
+    m_lastCheck = Clock::NowMS();
+}
+
+bool DnsResolver::CanUse() {
+    // 需要hook后的socket在IOManager上挂起协程
+    return g_dns_enable->getValue() && is_hook_enable() && IOManager::GetThis();
+}
+
+void DnsResolver::setServers(const std::vector<IPAddress::ptr>& servers) {
+    MutexType::Lock lock(m_mutex);
+    m_overrideServers = servers;
+}
+
+std::vector<IPAddress::ptr> DnsResolver::getServers() {
+    MutexType::Lock lock(m_mutex);
+    if(!m_overrideServers.empty()) {
+        return m_overrideServers;
+    }
+    if(!m_configServers.empty()) {
+        return m_configServers;
+    }
+    if(!m_servers.empty()) {
+        return m_servers;
+    }
+    // 与glibc一致, 没有配置nameserver时使用本机
+    return {IPAddress::Create("127.0.0.1", 53)};
+}
+
+bool DnsResolver::loadResolvConf(const std::string& path) {
+    std::ifstream ifs(path);
+    struct stat st;
+    time_t mtime = stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+    if(!ifs) {
+        MutexType::Lock lock(m_mutex);
+        m_resolvPath = path;
+        m_resolvMtime = mtime;
+        return false;
+    }
+    std::vector<IPAddress::ptr> servers;
+    std::vector<std::string> search;
+    uint32_t timeout = 5;
+    uint32_t attempts = 2;
+    uint32_t ndots = 1;
+    std::string line;
+    while(std::getline(ifs, line)) {
+        size_t pos = line.find_first_of("#;");
+        if(pos != std::string::npos) {
+            line.resize(pos);
+        }
+        std::istringstream iss(line);
+        std::string key;
+        if(!(iss >> key)) {
+            continue;
+        }
+        std::string value;
+        if(key == "nameserver") {
+            if(iss >> value) {
+                auto addr = IPAddress::Create(value.c_str(), 53);
+                if(addr) {
+                    servers.push_back(addr);
+                }
+            }
+        } else if(key == "search" || key == "domain") {
+            // 后出现的search/domain覆盖之前的
+            search.clear();
+            while(iss >> value) {
+                if(!value.empty() && value.back() == '.') {
+                    value.pop_back();
+                }
+                if(!value.empty()) {
+                    search.push_back(ToLower(value));
+                }
+            }
+        } else if(key == "options") {
+            while(iss >> value) {
+                if(value.compare(0, 8, "timeout:") == 0) {
+                    timeout = std::max(0, std::min(atoi(value.c_str() + 8), 30));
+                } else if(value.compare(0, 9, "attempts:") == 0) {
+                    attempts = std::max(0, std::min(atoi(value.c_str() + 9), 5));
+                } else if(value.compare(0, 6, "ndots:") == 0) {
+                    ndots = std::max(0, std::min(atoi(value.c_str() + 6), 15));
+                }
+            }
+        }
+    }
+    MutexType::Lock lock(m_mutex);
+    m_servers.swap(servers);
+    m_search.swap(search);
+    m_timeoutMs = std::max(timeout, 1u) * 1000;
+    m_attempts = std::max(attempts, 1u);
+    m_ndots = ndots;
+    m_resolvPath = path;
+    m_resolvMtime = mtime;
+    return true;
+}
+
+bool DnsResolver::loadHosts(const std::string& path) {
+    std::ifstream ifs(path);
+    struct stat st;
+    time_t mtime = stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+    std::unordered_map<std::string, std::vector<IPAddress::ptr> > hosts;
+    std::string line;
+    while(ifs && std::getline(ifs, line)) {
+        size_t pos = line.find('#');
+        if(pos != std::string::npos) {
+            line.resize(pos);
+        }
+        std::istringstream iss(line);
+        std::string ip;
+        if(!(iss >> ip)) {
+            continue;
+        }
+        auto addr = IPAddress::Create(ip.c_str());
+        if(!addr) {
+            continue;
+        }
+        std::string name;
+        while(iss >> name) {
+            hosts[ToLower(name)].push_back(addr);
+        }
+    }
+    MutexType::Lock lock(m_mutex);
+    m_hosts.swap(hosts);
+    m_hostsPath = path;
+    m_hostsMtime = mtime;
+    return (bool)ifs || ifs.eof();
+}
+
+void DnsResolver::clearCache() {
+    MutexType::Lock lock(m_mutex);
+    m_cache.clear();
+}
+
+void DnsResolver::checkReload() {
+    uint64_t now = Clock::NowMS();
+    std::string resolv_path;
+    std::string hosts_path;
+    time_t resolv_mtime;
+    time_t hosts_mtime;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(now < m_lastCheck + s_reload_interval) {
+            return;
+        }
+        m_lastCheck = now;
+        resolv_path = m_resolvPath;
+        hosts_path = m_hostsPath;
+        resolv_mtime = m_resolvMtime;
+        hosts_mtime = m_hostsMtime;
+    }
+    struct stat st;
+    if(stat(resolv_path.c_str(), &st) == 0 && st.st_mtime != resolv_mtime) {
+        WEBSERVER_LOG_INFO(g_logger) << "reload " << resolv_path;
+        loadResolvConf(resolv_path);
+    }
+    if(stat(hosts_path.c_str(), &st) == 0 && st.st_mtime != hosts_mtime) {
+        WEBSERVER_LOG_INFO(g_logger) << "reload " << hosts_path;
+        loadHosts(hosts_path);
+    }
+}
+
+bool DnsResolver::lookupHosts(std::vector<IPAddress::ptr>& result, const std::string& name, int family) {
+    MutexType::Lock lock(m_mutex);
+    auto it = m_hosts.find(name);
+    if(it == m_hosts.end()) {
+        return false;
+    }
+    size_t old_size = result.size();
+    for(int f : {AF_INET, AF_INET6}) {
+        if(family != AF_UNSPEC && family != f) {
+            continue;
+        }
+        for(auto& i : it->second) {
+            if(i->getFamily() == f) {
+                AppendCopies(result, {i});
+            }
+        }
+    }
+    return result.size() != old_size;
+}
+
+DnsResolver::CacheEntry DnsResolver::query(const std::string& name, int family) {
+    std::vector<uint16_t> qtypes;
+    if(family == AF_INET || family == AF_UNSPEC) {
+        qtypes.push_back(DNS_TYPE_A);
+    }
+    if(family == AF_INET6 || family == AF_UNSPEC) {
+        qtypes.push_back(DNS_TYPE_AAAA);
+    }
+
+    std::vector<IPAddress::ptr> servers = getServers();
+    std::vector<std::string> candidates;
+    uint64_t timeout_ms;
+    uint32_t attempts;
+    {
+        MutexType::Lock lock(m_mutex);
+        timeout_ms = g_dns_timeout->getValue() ? g_dns_timeout->getValue() : m_timeoutMs;
+        attempts = m_attempts;
+        // 与res_search一致: 点数不少于ndots时先查原名, 否则先查search域
+        bool absolute = (size_t)std::count(name.begin(), name.end(), '.') >= m_ndots;
+        if(absolute) {
+            candidates.push_back(name);
+        }
+        for(auto& i : m_search) {
+            candidates.push_back(name + "." + i);
+        }
+        if(!absolute) {
+            candidates.push_back(name);
+        }
+    }
+
+    uint32_t negative_ttl = g_dns_negative_ttl->getValue();
+    uint32_t max_ttl = g_dns_max_ttl->getValue();
+    CacheEntry entry;
+    entry.error = EAI_NONAME;
+    uint32_t ttl = negative_ttl;
+    for(auto& qname : candidates) {
+        std::vector<DnsReply> replies;
+        bool ok = false;
+        for(uint32_t i = 0; i < attempts && !ok; ++i) {
+            for(auto& server : servers) {
+                ++m_queries;
+                if(Exchange(server, qname, qtypes, timeout_ms, negative_ttl, replies)) {
+                    ok = true;
+                    break;
+                }
+                WEBSERVER_LOG_DEBUG(g_logger) << "dns query " << qname << " @"
+                    << *server << " failed";
+            }
+        }
+        if(!ok) {
+            // 服务器不可用, 不缓存
+            entry.addrs.clear();
+            entry.error = EAI_AGAIN;
+            entry.expire = 0;
+            return entry;
+        }
+
+        uint32_t pos_ttl = (uint32_t)-1;
+        uint32_t neg_ttl = negative_ttl;
+        for(auto& r : replies) {
+            if(r.addrs.empty()) {
+                neg_ttl = std::min(neg_ttl, r.ttl);
+            } else {
+                entry.addrs.insert(entry.addrs.end(), r.addrs.begin(), r.addrs.end());
+                pos_ttl = std::min(pos_ttl, r.ttl);
+            }
+        }
+        if(!entry.addrs.empty()) {
+            entry.error = 0;
+            ttl = std::min(pos_ttl, max_ttl);
+            break;
+        }
+        ttl = std::min(ttl, neg_ttl);
+    }
+    entry.expire = Clock::NowMS() + ttl * 1000ul;
+    return entry;
+}
+
+int DnsResolver::resolve(std::vector<IPAddress::ptr>& result, const std::string& name, int family) {
+    std::string lname = ToLower(name);
+    if(!lname.empty() && lname.back() == '.') {
+        lname.pop_back();
+    }
+    if(lname.empty()) {
+        return EAI_NONAME;
+    }
+    if(family != AF_INET && family != AF_INET6 && family != AF_UNSPEC) {
+        return EAI_FAMILY;
+    }
+
+    checkReload();
+    if(lookupHosts(result, lname, family)) {
+        return 0;
+    }
+
+    std::string key = lname + "/" + std::to_string(family);
+    Inflight::ptr inflight;
+    bool leader = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        auto it = m_cache.find(key);
+        if(it != m_cache.end()) {
+            if(it->second.expire > Clock::NowMS()) {
+                ++m_hits;
+                AppendCopies(result, it->second.addrs);
+                return it->second.error;
+            }
+            m_cache.erase(it);
+        }
+        auto iit = m_inflight.find(key);
+        if(iit != m_inflight.end()) {
+            inflight = iit->second;
+            ++inflight->waiters;
+        } else {
+            inflight = std::make_shared<Inflight>();
+            m_inflight[key] = inflight;
+            leader = true;
+        }
+    }
+
+    if(!leader) {
+        // 相同的查询正在进行, 等待它的结果
+        ++m_coalesced;
+        inflight->sem.wait();
+        const CacheEntry& entry = inflight->entry;
+        AppendCopies(result, entry.addrs);
+        return entry.error;
+    }
+
+    CacheEntry entry = query(lname, family);
+    size_t waiters = 0;
+    {
+        MutexType::Lock lock(m_mutex);
+        inflight->entry = entry;
+        waiters = inflight->waiters;
+        m_inflight.erase(key);
+        if(entry.expire > Clock::NowMS()) {
+            if(m_cache.size() >= g_dns_cache_size->getValue()) {
+                uint64_t now = Clock::NowMS();
+                for(auto it = m_cache.begin(); it != m_cache.end();) {
+                    if(it->second.expire <= now) {
+                        it = m_cache.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                if(m_cache.size() >= g_dns_cache_size->getValue()) {
+                    m_cache.clear();
+                }
+            }
+            m_cache[key] = entry;
+        }
+    }
+    for(size_t i = 0; i < waiters; ++i) {
+        inflight->sem.notify();
+    }
+    AppendCopies(result, entry.addrs);
+    return entry.error;
+}
+
+std::ostream& DnsResolver::dump(std::ostream& os) {
+    MutexType::Lock lock(m_mutex);
+    os << "[DnsResolver servers=";
+    auto& servers = !m_overrideServers.empty() ? m_overrideServers
+                    : (!m_configServers.empty() ? m_configServers : m_servers);
+    for(size_t i = 0; i < servers.size(); ++i) {
+        os << (i ? "," : "") << *servers[i];
+    }
+    os << " search=";
+    for(size_t i = 0; i < m_search.size(); ++i) {
+        os << (i ? "," : "") << m_search[i];
+    }
+    os << " timeout=" << m_timeoutMs
+       << " attempts=" << m_attempts
+       << " ndots=" << m_ndots
+       << " hosts=" << m_hosts.size()
+       << " cache=" << m_cache.size()
+       << " inflight=" << m_inflight.size()
+       << " queries=" << m_queries
+       << " hits=" << m_hits
+       << " coalesced=" << m_coalesced
+       << "]";
+    return os;
+}
+
+}
@@ -0,0 +1,166 @@
+#ifndef __WEBSERVER_DNS_H__
+#define __WEBSERVER_DNS_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <iostream>
+#include <atomic>
+#include "address.h"
+#include "mutex.h"
+#include "singleton.h"
+#include "noncopyable.h"
+
+namespace webserver {
+
+/**
+ * @brief 协程化的DNS解析器
+ * @details getaddrinfo是阻塞调用, 在调度线程里解析一次域名会卡住整个线程上的所有协程.
+ *          DnsResolver通过hook过的UDP socket直接向resolv.conf中的nameserver发送A/AAAA查询,
+ *          等待应答时只挂起当前协程; 应答被截断(TC)时改用TCP重新查询.
+ *          解析顺序与nsswitch的"files dns"一致: 先查/etc/hosts, 再查DNS.
+ *          结果按记录的TTL缓存, 不存在的域名(NXDOMAIN/NODATA)按SOA的minimum做否定缓存;
+ *          同一个域名同时只有一个协程真正发出查询, 其余协程等待它的结果.
+ *          Address::Lookup在开启hook的协程中自动使用DnsResolver.
+ */
+class DnsResolver : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 构造函数, 加载resolv.conf和hosts
+     */
+    DnsResolver();
+
+    /**
+     * @brief 解析域名
+     * @param[out] result 解析到的地址(端口为0), A记录在前
+     * @param[in] name 域名
+     * @param[in] family 协议族(AF_INET, AF_INET6, AF_UNSPEC)
+     * @return 0成功, 否则返回EAI_*错误码(可以用gai_strerror转换)
+     */
+    int resolve(std::vector<IPAddress::ptr>& result, const std::string& name, int family = AF_INET);
+
+    /**
+     * @brief 设置DNS服务器, 覆盖resolv.conf和dns.servers配置
+     */
+    void setServers(const std::vector<IPAddress::ptr>& servers);
+
+    /**
+     * @brief 返回当前使用的DNS服务器
+     */
+    std::vector<IPAddress::ptr> getServers();
+
+    /**
+     * @brief 加载resolv.conf(nameserver, search/domain, options timeout/attempts/ndots)
+     * @param[in] path 文件路径
+     * @return 是否读取成功
+     */
+    bool loadResolvConf(const std::string& path);
+
+    /**
+     * @brief 加载hosts文件
+     * @param[in] path 文件路径
+     * @return 是否读取成功
+     */
+    bool loadHosts(const std::string& path);
+
+    /**
+     * @brief 清空解析缓存
+     */
+    void clearCache();
+
+    /**
+     * @brief 发往DNS服务器的查询次数(不含hosts和缓存命中)
+     */
+    uint64_t getQueryCount() const { return m_queries;}
+
+    /**
+     * @brief 输出解析器状态
+     */
+    std::ostream& dump(std::ostream& os);
+
+    /**
+     * @brief 当前线程能否使用DnsResolver(在开启hook的协程中)
+     */
+    static bool CanUse();
+private:
+    /**
+     * @brief 缓存项
+     */
+    struct CacheEntry {
+        /// 解析结果, 为空表示否定缓存
+        std::vector<IPAddress::ptr> addrs;
+        /// 错误码
+        int error = 0;
+        /// 过期时间(毫秒)
+        uint64_t expire = 0;
+    };
+
+    /**
+     * @brief 正在进行的查询, 相同域名的后来者在这里等待
+     */
+    struct Inflight {
+        typedef std::shared_ptr<Inflight> ptr;
+        /// 等待者数量
+        size_t waiters = 0;
+        /// 等待者在这里挂起
+        FiberSemaphore sem;
+        /// 查询结果
+        CacheEntry entry;
+    };
+
+    /**
+     * @brief 查询DNS服务器(依次尝试search列表)
+     */
+    CacheEntry query(const std::string& name, int family);
+
+    /**
+     * @brief 查询hosts
+     * @return 是否找到
+     */
+    bool lookupHosts(std::vector<IPAddress::ptr>& result, const std::string& name, int family);
+
+    /**
+     * @brief hosts或resolv.conf被修改时重新加载, 每隔几秒检查一次
+     */
+    void checkReload();
+private:
+    MutexType m_mutex;
+    /// resolv.conf中的nameserver
+    std::vector<IPAddress::ptr> m_servers;
+    /// dns.servers配置的服务器
+    std::vector<IPAddress::ptr> m_configServers;
+    /// setServers设置的服务器
+    std::vector<IPAddress::ptr> m_overrideServers;
+    /// search列表
+    std::vector<std::string> m_search;
+    /// options
+    uint32_t m_timeoutMs;
+    uint32_t m_attempts;
+    uint32_t m_ndots;
+    /// hosts中的<域名, 地址>
+    std::unordered_map<std::string, std::vector<IPAddress::ptr> > m_hosts;
+    /// 已加载的文件路径和修改时间, 用于重新加载
+    std::string m_resolvPath;
+    std::string m_hostsPath;
+    time_t m_resolvMtime;
+    time_t m_hostsMtime;
+    uint64_t m_lastCheck;
+    /// <域名/协议族, 缓存项>
+    std::unordered_map<std::string, CacheEntry> m_cache;
+    /// <域名/协议族, 正在进行的查询>
+    std::unordered_map<std::string, Inflight::ptr> m_inflight;
+    /// 统计
+    std::atomic<uint64_t> m_queries{0};
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_coalesced{0};
+};
+
+typedef webserver::Singleton<DnsResolver> DnsResolverMgr;
+
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "fd_manager.h"
 #include "hook.h"
+#include "macro.h"
+#include <algorithm>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -9,6 +11,7 @@ namespace webserver {
 FdCtx::FdCtx(int fd)
     :m_isInit(false)
     ,m_isSocket(false)
+    ,m_isRegularFile(false)
     ,m_sysNonblock(false)
     ,m_userNonblock(false)
     ,m_isClosed(false)
@@ -39,10 +42,12 @@ bool FdCtx::init() {
         // 如果获取失败，则标记为未初始化，不是套接字
         m_isInit = false;
         m_isSocket = false;
+        m_isRegularFile = false;
     } else {
         // 如果获取成功，则标记为已初始化，根据文件类型判断是否为套接字
         m_isInit = true;
         m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        m_isRegularFile = S_ISREG(fd_stat.st_mode);
     }
 
     // 如果是套接字
@@ -85,65 +90,188 @@ uint64_t FdCtx::getTimeout(int type) {
     }
 }
 
+/// 每个线程同时借用的上限, 借用不能跨越协程切换, 只有嵌套调用时才会用到多个
+static const size_t HAZARD_PER_THREAD = 4;
+/// 攒够这么多已删除的FdCtx才扫描一次借用记录
+static const size_t RECLAIM_THRESHOLD = 64;
+
+/**
+ * @brief 线程的借用记录(hazard pointer)
+ * @details 记录只追加到全局链表, 线程退出后标记为空闲给新线程复用, 不会释放
+ */
+struct HazardRecord {
+    std::atomic<FdCtx*> slots[HAZARD_PER_THREAD];
+    std::atomic<bool> active;
+    HazardRecord* next;
+};
+
+static std::atomic<HazardRecord*> s_hazards(nullptr);
+
+/**
+ * @brief 线程退出时归还借用记录
+ */
+struct HazardHolder {
+    HazardRecord* record = nullptr;
+    ~HazardHolder() {
+        if(record) {
+            record->active.store(false, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local HazardHolder t_hazard;
+
+static HazardRecord* GetHazardRecord() {
+    if(WEBSERVER_LIKELY(t_hazard.record != nullptr)) {
+        return t_hazard.record;
+    }
+    // 优先复用已退出线程的记录
+    for(HazardRecord* r = s_hazards.load(std::memory_order_acquire); r; r = r->next) {
+        bool expect = false;
+        if(!r->active.load(std::memory_order_relaxed)
+                && r->active.compare_exchange_strong(expect, true)) {
+            t_hazard.record = r;
+            return r;
+        }
+    }
+    HazardRecord* r = new HazardRecord;
+    for(size_t i = 0; i < HAZARD_PER_THREAD; ++i) {
+        r->slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+    r->active.store(true, std::memory_order_relaxed);
+    r->next = s_hazards.load(std::memory_order_relaxed);
+    while(!s_hazards.compare_exchange_weak(r->next, r
+                ,std::memory_order_release, std::memory_order_relaxed));
+    t_hazard.record = r;
+    return r;
+}
+
 FdManager::FdManager() {
-    m_datas.resize(64);
+    for(size_t i = 0; i < CHUNK_COUNT; ++i) {
+        m_chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+FdManager::~FdManager() {
+    for(size_t i = 0; i < CHUNK_COUNT; ++i) {
+        delete m_chunks[i].load(std::memory_order_relaxed);
+    }
+}
+
+std::atomic<FdCtx*>* FdManager::getSlot(int fd, bool create) {
+    if(fd < 0 || (size_t)fd >= CHUNK_SIZE * CHUNK_COUNT) {
+        return nullptr;
+    }
+    std::atomic<Chunk*>& chunk_slot = m_chunks[fd / CHUNK_SIZE];
+    Chunk* chunk = chunk_slot.load(std::memory_order_acquire);
+    if(!chunk) {
+        if(!create) {
+            return nullptr;
+        }
+        // 分块只在持有m_mutex时创建, 发布后不再改变
+        chunk = new Chunk;
+        for(size_t i = 0; i < CHUNK_SIZE; ++i) {
+            chunk->slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+        chunk_slot.store(chunk, std::memory_order_release);
+    }
+    return &chunk->slots[fd % CHUNK_SIZE];
 }
 
 // 获取文件描述符上下文信息
 // 获取/创建文件句柄类FdCtx
 // auto_create：是否自动创建FdCtx
 FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    // 如果文件描述符为 -1，直接返回空指针
-    if (fd == -1) {
-        return nullptr;
+    // 先借用, 再在借用的保护下增加引用计数
+    Borrowed ctx = borrow(fd, auto_create);
+    return ctx.ref();
+}
+
+// 借用文件描述符上下文信息
+FdManager::Borrowed FdManager::borrow(int fd, bool auto_create) {
+    std::atomic<FdCtx*>* slot = getSlot(fd, false);
+    FdCtx* ctx = slot ? slot->load(std::memory_order_acquire) : nullptr;
+    if(!ctx) {
+        // 集合中没有，并且不自动创建，返回空
+        if(!auto_create) {
+            return Borrowed();
+        }
+        MutexType::Lock lock(m_mutex);
+        slot = getSlot(fd, true);
+        if(!slot) {
+            return Borrowed();
+        }
+        ctx = slot->load(std::memory_order_relaxed);
+        if(!ctx) {
+            // 创建文件描述符上下文对象, 放入集合中
+            FdCtx::ptr new_ctx(new FdCtx(fd));
+            ctx = new_ctx.get();
+            m_chunks[fd / CHUNK_SIZE].load(std::memory_order_relaxed)
+                ->owners[fd % CHUNK_SIZE].swap(new_ctx);
+            slot->store(ctx, std::memory_order_release);
+        }
     }
-    // 集合中没有，并且不自动创建，返回nullptr
-    // 获取读锁以避免竞态条件
-    RWMutexType::ReadLock lock(m_mutex);
-    // 如果文件描述符超出当前数据容器大小，且不需要自动创建，则返回空指针
-    if ((int)m_datas.size() <= fd) {
-        if (auto_create == false) {
-            return nullptr;
+
+    // 在当前线程的借用记录中登记, 再确认槽位没有变化;
+    // del先清空槽位再扫描借用记录, 两边都是seq_cst, 不会出现双方都没看到对方的情况
+    HazardRecord* record = GetHazardRecord();
+    std::atomic<FdCtx*>* hazard = nullptr;
+    for(size_t i = 0; i < HAZARD_PER_THREAD; ++i) {
+        if(!record->slots[i].load(std::memory_order_relaxed)) {
+            hazard = &record->slots[i];
+            break;
         }
-    } else {
-        // 找到了直接返回
-        // 否则，如果文件描述符对应的上下文已存在且不需要自动创建，则直接返回该上下文
-        if (m_datas[fd] || !auto_create) {
-            return m_datas[fd];
+    }
+    WEBSERVER_ASSERT2(hazard, "FdManager::borrow too many nested borrows");
+    while(ctx) {
+        hazard->store(ctx, std::memory_order_seq_cst);
+        FdCtx* cur = slot->load(std::memory_order_seq_cst);
+        if(cur == ctx) {
+            return Borrowed(ctx, hazard);
         }
+        // 期间被删除或替换, 以最新的为准
+        ctx = cur;
     }
-    // 释放读锁
-    lock.unlock();
-
-    // 获取写锁以进行数据修改
-    RWMutexType::WriteLock lock2(m_mutex);
-    // 创建新的FdCtx
-    // 创建文件描述符上下文对象
-    FdCtx::ptr ctx(new FdCtx(fd));
-    // 如果文件描述符大于当前数据容器大小，则扩展容器大小
-    // fd比集合下标大，扩充
-    if (fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
-    }
-    // 存储文件描述符上下文到数据容器中
-    // 放入集合中
-    m_datas[fd] = ctx;
-    // 返回创建的文件描述符上下文对象
-    return ctx;
+    hazard->store(nullptr, std::memory_order_relaxed);
+    return Borrowed();
 }
 
 // 删除文件描述符上下文信息
 // 删除文件句柄类
 void FdManager::del(int fd) {
-    // 获取写锁以进行数据修改
-    RWMutexType::WriteLock lock(m_mutex);
+    MutexType::Lock lock(m_mutex);
+    std::atomic<FdCtx*>* slot = getSlot(fd, false);
     // 如果文件描述符超出当前数据容器大小，直接返回
-    if ((int)m_datas.size() <= fd) {
+    if(!slot || !slot->load(std::memory_order_relaxed)) {
         return;
     }
-    // 释放文件描述符对应的上下文对象
-    m_datas[fd].reset();
+    slot->store(nullptr, std::memory_order_seq_cst);
+    // 可能还有线程正在借用, 先放入回收列表
+    m_retired.push_back(nullptr);
+    m_retired.back().swap(m_chunks[fd / CHUNK_SIZE].load(std::memory_order_relaxed)
+            ->owners[fd % CHUNK_SIZE]);
+    if(m_retired.size() >= RECLAIM_THRESHOLD) {
+        reclaim();
+    }
 }
 
+void FdManager::reclaim() {
+    std::vector<FdCtx*> hazards;
+    for(HazardRecord* r = s_hazards.load(std::memory_order_acquire); r; r = r->next) {
+        for(size_t i = 0; i < HAZARD_PER_THREAD; ++i) {
+            FdCtx* ctx = r->slots[i].load(std::memory_order_seq_cst);
+            if(ctx) {
+                hazards.push_back(ctx);
+            }
+        }
+    }
+    std::sort(hazards.begin(), hazards.end());
+    // 没有被借用的释放掉持有的引用, 其他地方持有FdCtx::ptr时由它们最后释放
+    auto it = std::remove_if(m_retired.begin(), m_retired.end()
+            ,[&hazards](const FdCtx::ptr& ctx) {
+        return !std::binary_search(hazards.begin(), hazards.end(), ctx.get());
+    });
+    m_retired.erase(it, m_retired.end());
+}
 
 }
@@ -11,6 +11,7 @@
 
 #include <memory>
 #include <vector>
+#include <atomic>
 #include "thread.h"
 #include "singleton.h"
 
@@ -43,11 +44,23 @@ public:
      */
     bool isSocket() const { return m_isSocket;}
 
+    /**
+     * @brief 是否普通文件
+     * @details 初始化时由fstat得到, 开启offload.file_io时据此决定读写是否交给阻塞任务线程池
+     */
+    bool isRegularFile() const { return m_isRegularFile;}
+
     /**
      * @brief 是否已关闭
      */
     bool isClose() const { return m_isClosed;}
 
+    /**
+     * @brief 标记为已关闭
+     * @details 在close时先于取消事件调用, 被唤醒的协程据此返回EBADF而不是重新注册事件
+     */
+    void setClose() { m_isClosed = true;}
+
     /**
      * @brief 设置用户主动设置非阻塞
      * @param[in] v 是否阻塞
@@ -93,6 +106,8 @@ private:
     bool m_isInit: 1;
     /// 是否socket
     bool m_isSocket: 1;
+    /// 是否普通文件
+    bool m_isRegularFile: 1;
     /// 是否hook非阻塞
     bool m_sysNonblock: 1;
     /// 是否用户主动设置非阻塞
@@ -109,15 +124,75 @@ private:
 
 /**
  * @brief 文件句柄管理类
+ * @details 两级分块表, 分块和槽位都用原子指针发布, 查找不加锁;
+ *          创建和删除由m_mutex串行化, 删除的FdCtx先放到回收列表,
+ *          确认没有线程借用(hazard pointer)之后才释放引用
  */
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
+    typedef Mutex MutexType;
+    /// 每个分块的槽位个数
+    static const size_t CHUNK_SIZE = 1024;
+    /// 分块个数, 可管理的fd上限为CHUNK_SIZE * CHUNK_COUNT
+    static const size_t CHUNK_COUNT = 4096;
+
+    /**
+     * @brief 借用的文件句柄上下文, 不增加引用计数
+     * @details 借用期间FdCtx不会被释放, 即使其他线程close了该fd;
+     *          借用记录在当前线程上, 不能跨越协程切换持有, 需要让出协程时先用ref()换成FdCtx::ptr
+     */
+    class Borrowed {
+    public:
+        Borrowed() : m_ctx(nullptr), m_hazard(nullptr) {}
+        Borrowed(Borrowed&& rhs)
+            :m_ctx(rhs.m_ctx), m_hazard(rhs.m_hazard) {
+            rhs.m_ctx = nullptr;
+            rhs.m_hazard = nullptr;
+        }
+        ~Borrowed() { reset();}
+
+        FdCtx* get() const { return m_ctx;}
+        FdCtx* operator->() const { return m_ctx;}
+        explicit operator bool() const { return m_ctx != nullptr;}
+
+        /**
+         * @brief 返回持有引用计数的智能指针
+         */
+        FdCtx::ptr ref() const { return m_ctx ? m_ctx->shared_from_this() : nullptr;}
+
+        /**
+         * @brief 归还借用
+         */
+        void reset() {
+            if(m_hazard) {
+                m_hazard->store(nullptr, std::memory_order_release);
+                m_hazard = nullptr;
+            }
+            m_ctx = nullptr;
+        }
+    private:
+        Borrowed(FdCtx* ctx, std::atomic<FdCtx*>* hazard)
+            :m_ctx(ctx), m_hazard(hazard) {}
+        Borrowed(const Borrowed&) = delete;
+        Borrowed& operator=(const Borrowed&) = delete;
+    private:
+        friend class FdManager;
+        /// 借用的上下文
+        FdCtx* m_ctx;
+        /// 当前线程记录借用的槽位
+        std::atomic<FdCtx*>* m_hazard;
+    };
+
     /**
      * @brief 无参构造函数
      */
     FdManager();
 
+    /**
+     * @brief 析构函数
+     */
+    ~FdManager();
+
     /**
      * @brief 获取/创建文件句柄类FdCtx
      * @param[in] fd 文件句柄
@@ -126,16 +201,46 @@ public:
      */
     FdCtx::ptr get(int fd, bool auto_create = false);
 
+    /**
+     * @brief 借用文件句柄类FdCtx, 热路径上使用, 没有锁和引用计数的开销
+     * @param[in] fd 文件句柄
+     * @param[in] auto_create 是否自动创建
+     */
+    Borrowed borrow(int fd, bool auto_create = false);
+
     /**
      * @brief 删除文件句柄类
      * @param[in] fd 文件句柄
      */
     void del(int fd);
 private:
-    /// 读写锁
-    RWMutexType m_mutex;
-    /// 文件句柄集合
-    std::vector<FdCtx::ptr> m_datas;
+    /**
+     * @brief fd的分块
+     */
+    struct Chunk {
+        /// 无锁查找的槽位
+        std::atomic<FdCtx*> slots[CHUNK_SIZE];
+        /// 槽位的所有者, 只在持有m_mutex时访问
+        FdCtx::ptr owners[CHUNK_SIZE];
+    };
+
+    /**
+     * @brief 返回fd所在的槽位
+     * @param[in] create 分块不存在时是否创建, 调用者需持有m_mutex
+     */
+    std::atomic<FdCtx*>* getSlot(int fd, bool create);
+
+    /**
+     * @brief 释放没有被任何线程借用的已删除FdCtx, 调用者需持有m_mutex
+     */
+    void reclaim();
+private:
+    /// 创建/删除的锁
+    MutexType m_mutex;
+    /// 分块表
+    std::atomic<Chunk*> m_chunks[CHUNK_COUNT];
+    /// 已删除, 等待确认没有借用的FdCtx
+    std::vector<FdCtx::ptr> m_retired;
 };
 
 /// 文件句柄单例
@@ -3,7 +3,12 @@
 #include "macro.h"
 #include "log.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
 #include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <vector>
 
 namespace webserver {
 
@@ -18,18 +23,113 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
-class MallocStackAllocator {
+// 每个线程协程池最多缓存的协程个数, 0表示不缓存
+static ConfigVar<uint32_t>::ptr g_fiber_pool_size =
+    Config::Lookup<uint32_t>("fiber.pool_size", 64, "fiber pool size per thread");
+
+static std::atomic<uint32_t> s_fiber_pool_size {64};
+
+static std::atomic<uint64_t> s_pool_hits {0};
+static std::atomic<uint64_t> s_pool_misses {0};
+static std::atomic<uint64_t> s_pool_recycled {0};
+static std::atomic<uint64_t> s_pool_size {0};
+
+struct _FiberPoolIniter {
+    _FiberPoolIniter() {
+        s_fiber_pool_size = g_fiber_pool_size->getValue();
+        g_fiber_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            WEBSERVER_LOG_INFO(g_logger) << "fiber pool size changed from "
+                                     << old_value << " to " << new_value;
+            s_fiber_pool_size = new_value;
+        });
+    }
+};
+
+static _FiberPoolIniter s_fiber_pool_initer;
+
+/**
+ * @brief 线程本地的协程池, 保存已结束的协程(保留运行栈)
+ */
+class FiberPool {
 public:
-    static void* Alloc(size_t size) {
-        return malloc(size);
+    ~FiberPool() {
+        for(auto i : m_fibers) {
+            --s_pool_size;
+            delete i;
+        }
+        m_fibers.clear();
     }
 
-    static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+    Fiber* pop() {
+        if(m_fibers.empty()) {
+            return nullptr;
+        }
+        Fiber* f = m_fibers.back();
+        m_fibers.pop_back();
+        --s_pool_size;
+        return f;
+    }
+
+    bool push(Fiber* f) {
+        if(m_fibers.size() >= s_fiber_pool_size) {
+            return false;
+        }
+        m_fibers.push_back(f);
+        ++s_pool_size;
+        return true;
     }
+private:
+    std::vector<Fiber*> m_fibers;
 };
 
-using StackAllocator = MallocStackAllocator;
+// 线程退出时t_fiber_pool被置空, 之后释放的协程直接delete
+static thread_local FiberPool* t_fiber_pool = nullptr;
+
+struct FiberPoolHolder {
+    FiberPool pool;
+    FiberPoolHolder() {
+        t_fiber_pool = &pool;
+    }
+    ~FiberPoolHolder() {
+        t_fiber_pool = nullptr;
+    }
+};
+
+static FiberPool* GetFiberPool() {
+    static thread_local FiberPoolHolder s_holder;
+    return t_fiber_pool;
+}
+
+// 共享栈模式下每个线程的共享运行栈大小
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024 * 1024, "fiber shared stack size per thread");
+
+static std::atomic<uint64_t> s_shared_fibers {0};
+static std::atomic<uint64_t> s_shared_saves {0};
+static std::atomic<uint64_t> s_shared_restores {0};
+static std::atomic<uint64_t> s_shared_copy_bytes {0};
+static std::atomic<uint64_t> s_shared_buffer_bytes {0};
+static std::atomic<uint64_t> s_shared_max_used {0};
+
+/**
+ * @brief 线程的共享运行栈
+ */
+struct SharedStack {
+    /// 运行栈起始地址
+    void* stack = nullptr;
+    /// 运行栈大小
+    size_t size = 0;
+    /// 当前栈上保存着其栈内容的协程
+    Fiber* occupant = nullptr;
+
+    ~SharedStack() {
+        if(stack) {
+            StackAllocator::Dealloc(stack, size);
+        }
+    }
+};
+
+static thread_local SharedStack t_shared_stack;
 
 uint64_t Fiber::GetFiberId() {
     if(t_fiber) {
@@ -41,34 +141,33 @@ uint64_t Fiber::GetFiberId() {
 Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
-
-    if(getcontext(&m_ctx)) {
-        WEBSERVER_ASSERT2(false, "getcontext");
-    }
+    // 线程主协程使用线程自身的栈, 上下文在第一次切出时保存
 
     ++s_fiber_count;
 
     WEBSERVER_LOG_DEBUG(g_logger) << "Fiber::Fiber main";
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller, bool shared_stack)
     :m_id(++s_fiber_id)
-    ,m_cb(cb) {
+    ,m_cb(cb)
+    ,m_sharedStack(shared_stack) {
     ++s_fiber_count;
+    if(m_sharedStack) {
+        // 运行栈和上下文在第一次换入时绑定
+        WEBSERVER_ASSERT2(!use_caller, "shared stack fiber can not use caller");
+        ++s_shared_fibers;
+        WEBSERVER_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id << " shared_stack";
+        return;
+    }
     m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
 
     m_stack = StackAllocator::Alloc(m_stacksize);
-    if(getcontext(&m_ctx)) {
-        WEBSERVER_ASSERT2(false, "getcontext");
-    }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
+    WEBSERVER_ASSERT2(m_stack, "alloc fiber stack");
     if(!use_caller) {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        MakeFiberContext(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
     } else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        MakeFiberContext(&m_ctx, m_stack, m_stacksize, &Fiber::CallerMainFunc);
     }
 
     WEBSERVER_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id;
@@ -76,7 +175,16 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
 
 Fiber::~Fiber() {
     --s_fiber_count;
-    if(m_stack) {
+    if(m_sharedStack) {
+        WEBSERVER_ASSERT(m_state == TERM
+                || m_state == EXCEPT
+                || m_state == INIT);
+        --s_shared_fibers;
+        if(m_saveBuf) {
+            s_shared_buffer_bytes -= m_saveCap;
+            free(m_saveBuf);
+        }
+    } else if(m_stack) {
         WEBSERVER_ASSERT(m_state == TERM
                 || m_state == EXCEPT
                 || m_state == INIT);
@@ -95,57 +203,167 @@ Fiber::~Fiber() {
                               << " total=" << s_fiber_count;
 }
 
+Fiber::ptr Fiber::Create(std::function<void()> cb, size_t stacksize, bool use_caller, bool shared_stack) {
+    if(use_caller || shared_stack) {
+        return Fiber::ptr(new Fiber(cb, stacksize, use_caller, shared_stack));
+    }
+    if(!stacksize || stacksize == g_fiber_stack_size->getValue()) {
+        FiberPool* pool = GetFiberPool();
+        Fiber* f = pool ? pool->pop() : nullptr;
+        if(f) {
+            ++s_pool_hits;
+            f->m_id = ++s_fiber_id;
+            f->reset(cb);
+            return Fiber::ptr(f, &Fiber::Recycle);
+        }
+        ++s_pool_misses;
+    }
+    return Fiber::ptr(new Fiber(cb, stacksize, use_caller), &Fiber::Recycle);
+}
+
+void Fiber::Recycle(Fiber* fiber) {
+    if(fiber->m_stacksize == g_fiber_stack_size->getValue()
+            && (fiber->m_state == TERM
+                || fiber->m_state == EXCEPT
+                || fiber->m_state == INIT)) {
+        FiberPool* pool = GetFiberPool();
+        if(pool) {
+            // 释放回调函数持有的资源, 协程可能在INIT/EXCEPT状态下被释放
+            fiber->m_cb = nullptr;
+            if(pool->push(fiber)) {
+                ++s_pool_recycled;
+                return;
+            }
+        }
+    }
+    delete fiber;
+}
+
+std::string Fiber::PoolToString() {
+    std::stringstream ss;
+    ss << "[FiberPool hits=" << s_pool_hits
+       << " misses=" << s_pool_misses
+       << " recycled=" << s_pool_recycled
+       << " pooled=" << s_pool_size
+       << "]";
+    return ss.str();
+}
+
+std::string Fiber::SharedStackToString() {
+    std::stringstream ss;
+    ss << "[SharedStack fibers=" << s_shared_fibers
+       << " saves=" << s_shared_saves
+       << " restores=" << s_shared_restores
+       << " copy_bytes=" << s_shared_copy_bytes
+       << " buffer_bytes=" << s_shared_buffer_bytes
+       << " max_used=" << s_shared_max_used
+       << "]";
+    return ss.str();
+}
+
+void Fiber::acquireSharedStack() {
+    SharedStack& ss = t_shared_stack;
+    if(!ss.stack) {
+        ss.size = g_fiber_shared_stack_size->getValue();
+        ss.stack = StackAllocator::Alloc(ss.size);
+        WEBSERVER_ASSERT2(ss.stack, "alloc shared stack");
+    }
+    WEBSERVER_ASSERT2(m_homeThread == -1 || m_homeThread == webserver::GetThreadId()
+            , "shared stack fiber resumed on another thread");
+    if(ss.occupant == this) {
+        return;
+    }
+
+    char* top = (char*)ss.stack + ss.size;
+    if(ss.occupant) {
+        // 保存占用者已使用的栈
+        Fiber* f = ss.occupant;
+        char* sp = (char*)GetFiberContextSP(&f->m_ctx);
+        if(!sp || sp < (char*)ss.stack) {
+            sp = (char*)ss.stack;
+        }
+        size_t used = top - sp;
+        if(f->m_saveCap < used || f->m_saveCap > used * 2) {
+            s_shared_buffer_bytes -= f->m_saveCap;
+            free(f->m_saveBuf);
+            f->m_saveBuf = malloc(used);
+            WEBSERVER_ASSERT2(f->m_saveBuf, "alloc shared stack save buffer");
+            f->m_saveCap = used;
+            s_shared_buffer_bytes += used;
+        }
+        memcpy(f->m_saveBuf, sp, used);
+        f->m_saveSize = used;
+        ++s_shared_saves;
+        s_shared_copy_bytes += used;
+        uint64_t max_used = s_shared_max_used;
+        while(used > max_used
+                && !s_shared_max_used.compare_exchange_weak(max_used, used)) {
+        }
+        ss.occupant = nullptr;
+    }
+
+    if(m_homeThread == -1) {
+        // 第一次运行, 在共享栈上初始化上下文并绑定到当前线程
+        MakeFiberContext(&m_ctx, ss.stack, ss.size, &Fiber::MainFunc);
+        m_homeThread = webserver::GetThreadId();
+    } else if(m_saveSize) {
+        memcpy(top - m_saveSize, m_saveBuf, m_saveSize);
+        ++s_shared_restores;
+        s_shared_copy_bytes += m_saveSize;
+    }
+    ss.occupant = this;
+}
+
+void Fiber::releaseSharedStack() {
+    if(t_shared_stack.occupant == this) {
+        t_shared_stack.occupant = nullptr;
+    }
+    m_saveSize = 0;
+}
+
 //重置协程函数，并重置状态
 //INIT，TERM, EXCEPT
 void Fiber::reset(std::function<void()> cb) {
-    WEBSERVER_ASSERT(m_stack);
+    WEBSERVER_ASSERT(m_stack || m_sharedStack);
     WEBSERVER_ASSERT(m_state == TERM
             || m_state == EXCEPT
             || m_state == INIT);
     m_cb = cb;
-    if(getcontext(&m_ctx)) {
-        WEBSERVER_ASSERT2(false, "getcontext");
+    if(m_sharedStack) {
+        // 重新运行时可以绑定到新的线程
+        m_homeThread = -1;
+    } else {
+        MakeFiberContext(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
     }
-
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
     m_state = INIT;
 }
 
 void Fiber::call() {
     SetThis(this);
     m_state = EXEC;
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-        WEBSERVER_ASSERT2(false, "swapcontext");
-    }
+    SwapFiberContext(&t_threadFiber->m_ctx, &m_ctx);
 }
 
 void Fiber::back() {
     SetThis(t_threadFiber.get());
-    if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        WEBSERVER_ASSERT2(false, "swapcontext");
-    }
+    SwapFiberContext(&m_ctx, &t_threadFiber->m_ctx);
 }
 
 //切换到当前协程执行
 void Fiber::swapIn() {
     SetThis(this);
     WEBSERVER_ASSERT(m_state != EXEC);
-    m_state = EXEC;
-    if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-        WEBSERVER_ASSERT2(false, "swapcontext");
+    if(m_sharedStack) {
+        acquireSharedStack();
     }
+    m_state = EXEC;
+    SwapFiberContext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx);
 }
 
 //切换到后台执行
 void Fiber::swapOut() {
     SetThis(Scheduler::GetMainFiber());
-    if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-        WEBSERVER_ASSERT2(false, "swapcontext");
-    }
+    SwapFiberContext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx);
 }
 
 //设置当前协程
@@ -208,6 +426,9 @@ void Fiber::MainFunc() {
 
     auto raw_ptr = cur.get();
     cur.reset();
+    if(raw_ptr->m_sharedStack) {
+        raw_ptr->releaseSharedStack();
+    }
     raw_ptr->swapOut();
 
     WEBSERVER_ASSERT2(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
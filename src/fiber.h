@@ -3,7 +3,8 @@
 
 #include <memory>
 #include <functional>
-#include <ucontext.h>
+#include <string>
+#include "fiber_context.h"
 
 namespace webserver {
 
@@ -67,14 +68,31 @@ public:
      * @param[in] cb 协程执行的函数
      * @param[in] stacksize 协程栈大小
      * @param[in] use_caller 是否在MainFiber上调度
+     * @param[in] shared_stack 是否使用共享栈模式
+     * @details 共享栈模式下协程没有独立的运行栈, 而是运行在所在线程的共享栈上,
+     *          切出后被其他共享栈协程换入时, 只把已使用部分拷贝到按需分配的保存缓冲区,
+     *          再次换入时拷贝回原地址. 因此协程第一次运行后就固定在该线程上执行.
+     *          适合大量长时间挂起、栈使用很浅的连接协程. 不支持use_caller
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false, bool shared_stack = false);
 
     /**
      * @brief 析构函数
      */
     ~Fiber();
 
+    /**
+     * @brief 创建协程, 优先复用当前线程协程池中已结束的协程
+     * @details 使用默认栈大小且不在MainFiber上调度的协程才会进入协程池,
+     *          最后一个引用释放时协程(及其运行栈)被放回当前线程的协程池, 池满时才真正释放
+     *          协程池大小由配置项fiber.pool_size控制
+     * @param[in] cb 协程执行的函数
+     * @param[in] stacksize 协程栈大小
+     * @param[in] use_caller 是否在MainFiber上调度
+     * @param[in] shared_stack 是否使用共享栈模式(共享栈协程不进入协程池)
+     */
+    static Fiber::ptr Create(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false, bool shared_stack = false);
+
     /**
      * @brief 重置协程执行函数,并设置状态
      * @pre getState() 为 INIT, TERM, EXCEPT
@@ -116,6 +134,16 @@ public:
      * @brief 返回协程状态
      */
     State getState() const { return m_state;}
+
+    /**
+     * @brief 是否为共享栈协程
+     */
+    bool isSharedStack() const { return m_sharedStack;}
+
+    /**
+     * @brief 返回共享栈协程绑定的线程id, 未绑定(或非共享栈协程)返回-1
+     */
+    int getHomeThread() const { return m_homeThread;}
 public:
 
     /**
@@ -162,6 +190,32 @@ public:
      * @brief 获取当前协程的id
      */
     static uint64_t GetFiberId();
+
+    /**
+     * @brief 返回协程池的统计信息
+     */
+    static std::string PoolToString();
+
+    /**
+     * @brief 返回共享栈的统计信息
+     */
+    static std::string SharedStackToString();
+private:
+    /**
+     * @brief 换入前把当前线程的共享栈切换给本协程
+     * @details 保存共享栈当前占用者的已使用部分, 再恢复本协程的栈内容(第一次运行时初始化上下文)
+     */
+    void acquireSharedStack();
+
+    /**
+     * @brief 协程结束时释放共享栈的占用, 其栈内容无需再保存
+     */
+    void releaseSharedStack();
+
+    /**
+     * @brief Create创建的协程的删除器, 可复用时放回当前线程的协程池
+     */
+    static void Recycle(Fiber* fiber);
 private:
     /// 协程id
     uint64_t m_id = 0;
@@ -170,11 +224,21 @@ private:
     /// 协程状态
     State m_state = INIT;
     /// 协程上下文
-    ucontext_t m_ctx;
+    FiberContext m_ctx;
     /// 协程运行栈指针
     void* m_stack = nullptr;
     /// 协程运行函数
     std::function<void()> m_cb;
+    /// 是否为共享栈协程
+    bool m_sharedStack = false;
+    /// 共享栈协程绑定的线程id
+    int m_homeThread = -1;
+    /// 共享栈协程切出后的栈内容保存缓冲区
+    void* m_saveBuf = nullptr;
+    /// 保存的栈内容大小
+    size_t m_saveSize = 0;
+    /// 保存缓冲区容量
+    size_t m_saveCap = 0;
 };
 
 }
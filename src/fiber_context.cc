@@ -0,0 +1,193 @@
+#include "fiber_context.h"
+#include "macro.h"
+#include <stdint.h>
+#include <string.h>
+
+namespace webserver {
+
+#ifdef WEBSERVER_FIBER_UCONTEXT
+
+void MakeFiberContext(FiberContext* ctx, void* stack, size_t size, FiberEntry fn) {
+    if(getcontext(&ctx->uc)) {
+        WEBSERVER_ASSERT2(false, "getcontext");
+    }
+    ctx->uc.uc_link = nullptr;
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    makecontext(&ctx->uc, fn, 0);
+}
+
+void SwapFiberContext(FiberContext* from, FiberContext* to) {
+    if(swapcontext(&from->uc, &to->uc)) {
+        WEBSERVER_ASSERT2(false, "swapcontext");
+    }
+}
+
+void* GetFiberContextSP(const FiberContext* ctx) {
+    // 多保留128字节, 覆盖x86-64 ABI的red zone
+#if defined(__x86_64__)
+    return (char*)ctx->uc.uc_mcontext.gregs[REG_RSP] - 128;
+#elif defined(__aarch64__)
+    return (void*)ctx->uc.uc_mcontext.sp;
+#else
+    return nullptr;
+#endif
+}
+
+const char* FiberContextBackend() {
+    return "ucontext";
+}
+
+#else
+
+extern "C" {
+/**
+ * @brief 保存被调用者保存寄存器到当前栈, 将栈顶写入*from_sp, 再从to_sp恢复寄存器并返回
+ */
+void webserver_fiber_swap(void** from_sp, void* to_sp);
+/**
+ * @brief 新协程的第一条指令, 调用保存在寄存器中的入口函数
+ */
+void webserver_fiber_trampoline();
+}
+
+#if defined(__x86_64__)
+
+// 栈帧(低地址->高地址): mxcsr, x87控制字, r15, r14, r13, r12, rbx, rbp, 返回地址
+asm(R"(
+    .text
+    .globl webserver_fiber_swap
+    .hidden webserver_fiber_swap
+    .type webserver_fiber_swap,@function
+    .align 16
+webserver_fiber_swap:
+    .cfi_startproc
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .cfi_endproc
+    .size webserver_fiber_swap,.-webserver_fiber_swap
+
+    .globl webserver_fiber_trampoline
+    .hidden webserver_fiber_trampoline
+    .type webserver_fiber_trampoline,@function
+    .align 16
+webserver_fiber_trampoline:
+    .cfi_startproc
+    .cfi_undefined rip
+    callq *%r12
+    ud2
+    .cfi_endproc
+    .size webserver_fiber_trampoline,.-webserver_fiber_trampoline
+)");
+
+void MakeFiberContext(FiberContext* ctx, void* stack, size_t size, FiberEntry fn) {
+    // 进入trampoline时rsp需16字节对齐, 这样call入口函数时满足ABI要求
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 16) - 8;
+    memset(sp, 0, sizeof(uint64_t) * 8);
+    uint32_t* csr = (uint32_t*)sp;
+    csr[0] = 0x1F80;                        // mxcsr 默认值
+    csr[1] = 0x037F;                        // x87 控制字默认值
+    sp[4] = (uint64_t)fn;                   // r12
+    sp[7] = (uint64_t)&webserver_fiber_trampoline;
+    ctx->sp = sp;
+}
+
+#elif defined(__aarch64__)
+
+// 栈帧(低地址->高地址): x19-x28, x29(fp), x30(lr), d8-d15
+asm(R"(
+    .text
+    .globl webserver_fiber_swap
+    .hidden webserver_fiber_swap
+    .type webserver_fiber_swap,%function
+    .align 4
+webserver_fiber_swap:
+    .cfi_startproc
+    sub sp, sp, #160
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8, d9, [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mov x2, sp
+    str x2, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8, d9, [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    add sp, sp, #160
+    ret
+    .cfi_endproc
+    .size webserver_fiber_swap,.-webserver_fiber_swap
+
+    .globl webserver_fiber_trampoline
+    .hidden webserver_fiber_trampoline
+    .type webserver_fiber_trampoline,%function
+    .align 4
+webserver_fiber_trampoline:
+    .cfi_startproc
+    .cfi_undefined x30
+    blr x19
+    brk #0
+    .cfi_endproc
+    .size webserver_fiber_trampoline,.-webserver_fiber_trampoline
+)");
+
+void MakeFiberContext(FiberContext* ctx, void* stack, size_t size, FiberEntry fn) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 16) - 20;
+    memset(sp, 0, sizeof(uint64_t) * 20);
+    sp[0] = (uint64_t)fn;                   // x19
+    sp[11] = (uint64_t)&webserver_fiber_trampoline; // x30
+    ctx->sp = sp;
+}
+
+#endif
+
+void SwapFiberContext(FiberContext* from, FiberContext* to) {
+    webserver_fiber_swap(&from->sp, to->sp);
+}
+
+void* GetFiberContextSP(const FiberContext* ctx) {
+    return ctx->sp;
+}
+
+const char* FiberContextBackend() {
+    return "asm";
+}
+
+#endif
+
+}
@@ -0,0 +1,68 @@
+#ifndef __WEBSERVER_FIBER_CONTEXT_H__
+#define __WEBSERVER_FIBER_CONTEXT_H__
+
+#include <stddef.h>
+
+/**
+ * 协程上下文切换后端
+ * 默认在x86-64/aarch64上使用手写汇编切换, 只保存被调用者保存寄存器, 不产生系统调用
+ * 定义 WEBSERVER_FIBER_UCONTEXT (cmake -DFIBER_USE_UCONTEXT=ON) 或在其他架构上回退到ucontext
+ */
+#if !defined(WEBSERVER_FIBER_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define WEBSERVER_FIBER_UCONTEXT
+#endif
+
+#ifdef WEBSERVER_FIBER_UCONTEXT
+#include <ucontext.h>
+#endif
+
+namespace webserver {
+
+/**
+ * @brief 协程上下文
+ */
+struct FiberContext {
+#ifdef WEBSERVER_FIBER_UCONTEXT
+    /// ucontext上下文
+    ucontext_t uc;
+#else
+    /// 切出时的栈顶指针, 寄存器保存在栈上
+    void* sp = nullptr;
+#endif
+};
+
+/**
+ * @brief 协程入口函数, 不允许返回
+ */
+typedef void (*FiberEntry)();
+
+/**
+ * @brief 初始化协程上下文, 第一次切换到该上下文时在stack上执行fn
+ * @param[out] ctx 协程上下文
+ * @param[in] stack 协程栈的起始(低)地址
+ * @param[in] size 协程栈大小
+ * @param[in] fn 入口函数
+ */
+void MakeFiberContext(FiberContext* ctx, void* stack, size_t size, FiberEntry fn);
+
+/**
+ * @brief 保存当前上下文到from, 并切换到to
+ * @param[out] from 保存当前上下文
+ * @param[in] to 要切换到的上下文
+ */
+void SwapFiberContext(FiberContext* from, FiberContext* to);
+
+/**
+ * @brief 返回已切出的上下文在栈上使用的最低地址
+ * @details 用于共享栈模式下计算需要保存的栈大小, 无法确定时返回nullptr
+ */
+void* GetFiberContextSP(const FiberContext* ctx);
+
+/**
+ * @brief 返回上下文切换后端的名称(asm/ucontext)
+ */
+const char* FiberContextBackend();
+
+}
+
+#endif
@@ -7,6 +7,12 @@
 #include "iomanager.h"
 #include "fd_manager.h"
 #include "macro.h"
+#include "worker.h"
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 webserver::Logger::ptr g_logger = WEBSERVER_LOG_NAME("system");
 namespace webserver {
@@ -16,6 +22,10 @@ static webserver::ConfigVar<int>::ptr g_tcp_connect_timeout =
     // 查找名为 "tcp.connect.timeout" 的配置项，如果找不到，则默认值为 5000 毫秒，描述为 "tcp connect timeout"
     webserver::Config::Lookup("tcp.connect.timeout", 5000, "tcp connect timeout");
 
+// 普通文件的读写是否放到阻塞任务线程池(offload)中执行
+static webserver::ConfigVar<bool>::ptr g_offload_file_io =
+    webserver::Config::Lookup("offload.file_io", false, "offload regular file io to blocking pool");
+
 // 线程局部变量，用于标识当前线程是否启用了 hook 功能，默认为 false
 // 定义线程局部变量，来控制是否开启hook
 static thread_local bool t_hook_enable = false;
@@ -41,6 +51,8 @@ static thread_local bool t_hook_enable = false;
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendfile) \
+    XX(splice) \
     XX(close) \
     XX(fcntl) \
     XX(ioctl) \
@@ -82,6 +94,8 @@ void hook_init() {
 
 // 静态变量，用于保存连接超时时间，默认值为 -1
 static uint64_t s_connect_timeout = -1;
+// 是否offload普通文件的读写
+static bool s_offload_file_io = false;
 
 // 结构体 _HookIniter 的定义
 struct _HookIniter {
@@ -101,6 +115,13 @@ struct _HookIniter {
                 // 更新 s_connect_timeout 的值为新值
                 s_connect_timeout = new_value;
         });
+
+        s_offload_file_io = g_offload_file_io->getValue();
+        g_offload_file_io->addListener([](const bool& old_value, const bool& new_value){
+                WEBSERVER_LOG_INFO(g_logger) << "offload file io changed from "
+                                         << old_value << " to " << new_value;
+                s_offload_file_io = new_value;
+        });
     }
 };
 
@@ -119,12 +140,6 @@ void set_hook_enable(bool flag) {
 }
 
 
-// 定时器超时条件
-struct timer_info {
-    int cancelled = 0;
-};
-
-
 /*
 这段代码实现了一个模板函数 do_io，用于执行 I/O 操作。具体功能如下：
 
@@ -133,7 +148,7 @@ struct timer_info {
 如果文件描述符上下文不存在，则直接调用原始函数执行 I/O 操作。
 如果文件描述符已关闭，则设置错误码并返回 -1。
 如果文件描述符不是套接字或用户设置了非阻塞标志，则直接调用原始函数执行 I/O 操作。
-如果需要阻塞等待，并且设置了超时时间，则创建定时器以实现超时机制。
+如果需要阻塞等待，并且设置了超时时间，则把超时时间点记录在IOManager的fd上下文中。
 执行原始函数进行 I/O 操作，处理返回值和错误码。
 如果发生 EAGAIN 错误（表示暂时无法完成 I/O 操作），则使用 IO 管理器添加事件并挂起当前协程，等待事件完成或超时。
 如果超时或被取消，则设置错误码并返回 -1。
@@ -149,15 +164,42 @@ struct timer_info {
 1. 先进行一系列判断，是否按原函数执行。
 2. 执行原始函数进行操作，若errno = EINTR，则为系统中断，应该不断重新尝试操作。
 3. 若errno = EAGIN，系统已经隐式的将socket设置为非阻塞模式，此时资源暂不可用。
-4. 若设置了超时时间，则设置一个执行周期为超时时间的条件定时器，它保证若在超时之前数据就已经来了，
-然后操作完do_io执行完毕，智能指针tinfo已经销毁了，但是定时器还在，此时弱指针拿到的就是个空指针，将不会执行定时器的回调函数。
-在条件定时器的回调函数中设置错误为ETIMEDOUT超时，并且使用cancelEvent强制执行该任务，继续回到该协程执行。
-5. 通过addEvent添加事件，若添加事件失败，则将条件定时器删除并返回错误。成功则让出协程执行权。
-6. 只有两种情况协程会被拉起： a. 超时了，通过定时器回调函数 cancelEvent ---> triggerEvent会唤醒回来 b. addEvent数据回来了会唤醒回来
-7. 将定时器取消，若为超时则返回-1并设置errno = ETIMEDOUT，并返回-1。
+4. 通过waitEvent添加事件并让出协程执行权，若设置了超时时间，超时时间点记录在fd上下文中，
+由fd上下文复用的定时器到期时检查，超时则cancelEvent强制唤醒该协程。每次等待不再创建定时器，
+数据先来时也不需要取消定时器，整个过程不分配内存。
+5. 若添加事件失败，则返回错误。
+6. 只有两种情况协程会被拉起： a. 超时了，fd上下文的定时器 cancelEvent ---> triggerEvent会唤醒回来 b. addEvent数据回来了会唤醒回来
+7. 若为超时则返回-1并设置errno = ETIMEDOUT。
 8. 若为数据来了则retry，重新操作。
 
 */
+// 构造io_uring请求, len超过uint32时截断(与一次读写的部分完成语义一致)
+static webserver::IOManager::IoRequest make_io_request(uint8_t opcode, const void* addr,
+        size_t len, uint64_t off = 0, uint32_t flags = 0, uint16_t ioprio = 0) {
+    webserver::IOManager::IoRequest req;
+    req.opcode = opcode;
+    req.addr = (void*)addr;
+    req.len = len > UINT32_MAX ? UINT32_MAX : len;
+    req.off = off;
+    req.flags = flags;
+    req.ioprio = ioprio;
+    return req;
+}
+
+// fd是否为普通文件, 普通文件的读写可以offload到阻塞任务线程池.
+// 普通文件第一次读写时创建FdCtx缓存文件类型, 之后不再fstat; 管道, eventfd等不创建FdCtx
+static bool is_regular_file(int fd, webserver::FdCtx* ctx) {
+    if (ctx) {
+        return ctx->isRegularFile();
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    webserver::FdMgr::GetInstance()->get(fd, true);
+    return true;
+}
+
 // do_io: 执行I/O操作的通用函数模板，可以处理钩子、非阻塞和超时。
 // 参数:
 // fd - 文件描述符
@@ -165,12 +207,14 @@ struct timer_info {
 // hook_fun_name - 钩子函数的名称，用于日志或调试
 // event - 事件类型，用于非阻塞操作的事件监听
 // timeout_so - 超时设置的选项
+// ureq - 对应的io_uring请求, 为nullptr或IOManager未启用io_uring时使用epoll等待
 // args - 原始I/O函数需要的参数， 可变参数
 // 返回值:
 // ssize_t - 成功时返回操作的字节数，失败时返回-1，并设置errno
 template<typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
-        uint32_t event, int timeout_so, Args&&... args) {
+        uint32_t event, int timeout_so, const webserver::IOManager::IoRequest* ureq,
+        Args&&... args) {
     // 如果钩子未启用，直接调用原始函数
     if (!webserver::t_hook_enable) {
         /* 可以将传入的可变参数args以原始类型的方式传递给函数fun。
@@ -179,10 +223,19 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     }
 
     // 尝试从文件描述符管理器获取文件描述符的上下文
-    // 获取fd对应的FdCtx
-    webserver::FdCtx::ptr ctx = webserver::FdMgr::GetInstance()->get(fd);
+    // 借用fd对应的FdCtx, 不加锁也不增加引用计数
+    webserver::FdManager::Borrowed ctx = webserver::FdMgr::GetInstance()->borrow(fd);
     // 如果上下文不存在，直接调用原始函数
-    if (!ctx) {
+    if (!ctx || !ctx->isSocket()) {
+        bool regular = webserver::s_offload_file_io && is_regular_file(fd, ctx.get());
+        // 借用不能跨越协程切换, offload之前归还
+        ctx.reset();
+        // 普通文件无法用epoll等待, 开启offload.file_io时交给阻塞任务线程池, 只挂起当前协程
+        if (regular) {
+            return webserver::offload([&]() {
+                return fun(fd, std::forward<Args>(args)...);
+            });
+        }
         return fun(fd, std::forward<Args>(args)...);
     }
 
@@ -194,93 +247,86 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         return -1;
     }
 
-    // 如果文件描述符不是套接字或设置为非阻塞模式，直接调用原始函数
-    // 不是socket 或 用户设置了非阻塞
-    if (!ctx->isSocket() || ctx->getUserNonblock()) {
+    // 如果设置为非阻塞模式，直接调用原始函数
+    // 用户设置了非阻塞
+    if (ctx->getUserNonblock()) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
     // ------ hook要做了 ------异步IO
     // 获得超时时间
-    // 获取根据timeout_so指定的超时时间
+    // 获取根据timeout_so指定的超时时间, 超时由IOManager在fd上下文中检查, 这里不分配任何对象
     uint64_t to = ctx->getTimeout(timeout_so);
-    // 设置超时条件
-    // 创建一个新的timer_info结构，用于超时处理
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    // 需要等待时才持有的引用, 借用不能跨越协程切换
+    webserver::FdCtx::ptr hold;
 
+    // 等待之后协程可能在其他线程上恢复, 从这里开始errno都通过GetErrno/SetErrno读写
     // 重试标签，用于在某些情况下重复尝试I/O操作
 retry:
     // 先执行fun 读数据或写数据 若函数返回值有效就直接返回
     // 调用原始的I/O函数，传入所有参数
     ssize_t n = fun(fd, std::forward<Args>(args)...);
     // 如果遇到中断错误，重新尝试调用
-    while (n == -1 && errno == EINTR) {
+    while (n == -1 && webserver::GetErrno() == EINTR) {
         n = fun(fd, std::forward<Args>(args)...);
     }
     // 如果遇到EAGAIN错误，表示操作需要阻塞等待
     // 若为阻塞状态
-    if (n == -1 && errno == EAGAIN) {
+    if (n == -1 && webserver::GetErrno() == EAGAIN) {
+        // 让出协程之前把借用换成引用计数, 等待期间fd被close时FdCtx仍然有效
+        if (!hold) {
+            hold = ctx.ref();
+            ctx.reset();
+        }
         // 获取当前IO管理器实例
         webserver::IOManager* iom = webserver::IOManager::GetThis();
-        // 初始化定时器指针为空
-        webserver::Timer::ptr timer;
-        // 创建一个弱引用指向timer_info，用于定时器回调
-        // tinfo的弱指针，可以判断tinfo是否已经销毁
-        std::weak_ptr<timer_info> winfo(tinfo);
-
-        // 如果设置了超时，创建一个定时器
-        if (to != (uint64_t)-1) {
-            /*	添加条件定时器
-             *	to时间消息还没来就触发callback */ 
-            timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
-                auto t = winfo.lock();
-                /* tinfo失效 || 设了错误
-                 * 定时器失效了 */
-                if (!t || t->cancelled) {
-                    return;
-                }
-                // 没错误的话设置为超时而失败
-                t->cancelled = ETIMEDOUT;
-                // 取消事件强制唤醒
-                iom->cancelEvent(fd, (webserver::IOManager::Event)(event));
-            }, winfo);
-        }
-        /* addEvent error:-1 acc:0  
-         * cb为空， 任务为执行当前协程 */
-        // 尝试添加事件，并使当前协程等待或超时
-        int rt = iom->addEvent(fd, (webserver::IOManager::Event)(event));
-        // addEvent失败， 取消上面加的定时器
-        if (rt) {
-            // 如果添加事件失败，记录错误并取消定时器（如果已设置）
-            WEBSERVER_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
-                << fd << ", " << event << ")";
-            if (timer) {
-                timer->cancel();
+        // io_uring: 由内核在就绪时直接完成操作, 不需要epoll_ctl和重试
+        // 超时和close同样通过cancelEvent/cancelAll取消请求
+        int res = 0;
+        if (ureq && iom->hasURing()
+                && iom->submitIo(fd, (webserver::IOManager::Event)(event), *ureq, res, to) == 0) {
+            if (res == -ETIMEDOUT) {
+                webserver::SetErrno(ETIMEDOUT);
+                return -1;
             }
-            return -1;
-        } else {
-            /*	addEvent成功，把执行时间让出来
-             *	只有两种情况会从这回来：
-             * 	1) 超时了， timer cancelEvent triggerEvent会唤醒回来
-             * 	2) addEvent数据回来了会唤醒回来 */
-
-            // 挂起当前协程，等待I/O事件完成或超时
-            webserver::Fiber::YieldToHold();
-            // 回来了还有定时器就取消掉
-            if (timer) {
-                // 如果存在定时器，取消它
-                timer->cancel();
+            if (hold->isClose()) {
+                webserver::SetErrno(EBADF);
+                return -1;
+            }
+            // 被cancelEvent取消或暂时不可用, 与epoll一样重新操作
+            if (res == -ECANCELED || res == -EAGAIN || res == -EINTR) {
+                goto retry;
             }
-            // 从定时任务唤醒，超时失败
-            // 如果因为超时而被取消，设置错误码并返回
-            if (tinfo->cancelled) {
-                errno = tinfo->cancelled;
+            if (res < 0) {
+                webserver::SetErrno(-res);
                 return -1;
             }
-            // 数据来了就直接重新去操作
-            // 如果未因超时被取消，重试I/O操作
-            goto retry;
+            return res;
+        }
+
+        /*	添加事件并把执行时间让出来, 超时时间to记录在fd上下文中
+         *	只有两种情况会从这回来：
+         * 	1) 超时了， fd上下文的定时器cancelEvent triggerEvent会唤醒回来
+         * 	2) addEvent数据回来了会唤醒回来 */
+        int rt = iom->waitEvent(fd, (webserver::IOManager::Event)(event), to);
+        if (rt == -1) {
+            // 如果添加事件失败，记录错误
+            WEBSERVER_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
+                << fd << ", " << event << ")";
+            return -1;
         }
+        // 从超时唤醒，超时失败
+        if (rt == ETIMEDOUT) {
+            webserver::SetErrno(ETIMEDOUT);
+            return -1;
+        }
+        // 被close唤醒, fd已经(或即将)关闭
+        if (hold->isClose()) {
+            webserver::SetErrno(EBADF);
+            return -1;
+        }
+        // 数据来了就直接重新去操作
+        goto retry;
     }
     
     // 返回原始函数的调用结果
@@ -465,53 +511,28 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
 
     // 获取当前 IO 管理器
     webserver::IOManager* iom = webserver::IOManager::GetThis();
-    // 创建一个定时器对象
-    webserver::Timer::ptr timer;
-    // 创建一个共享指针用于存储定时器信息
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    // 使用弱引用保存定时器信息的共享指针
-    std::weak_ptr<timer_info> winfo(tinfo);
-
-    // 如果设置了连接超时时间，则创建一个条件定时器
-    if (timeout_ms != (uint64_t)-1) {
-        // 加条件定时器
-        timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom]() {
-            auto t = winfo.lock();
-            if (!t || t->cancelled) {
-                return;
-            }
-            t->cancelled = ETIMEDOUT;
-            // 取消事件监听
-            iom->cancelEvent(fd, webserver::IOManager::WRITE);
-        }, winfo);
-    }
-
-    // 将文件描述符添加到 IO 管理器的事件监听中
-    // 添加一个写事件
-    int rt = iom->addEvent(fd, webserver::IOManager::WRITE);
-    // 如果添加事件失败，则打印错误日志
-    if (rt == 0) {
-        /* 	只有两种情况唤醒：
-         * 	1. 超时，从定时器唤醒
-         *	2. 连接成功，从epoll_wait拿到事件 */
-        // 让出当前协程的执行权，切换到 IO 管理器中运行的其他协程
-        webserver::Fiber::YieldToHold();
-        // 如果定时器存在，则取消定时器
-        if (timer) {
-            timer->cancel();
-        }
-        // 从定时器唤醒，超时失败
-        // 如果定时器被取消，则返回相应的错误码
-        if (tinfo->cancelled) {
-            errno = tinfo->cancelled;
+
+    // io_uring下用一次性的POLL_ADD等待连接完成, 超时同样通过cancelEvent取消
+    int res = 0;
+    webserver::IOManager::IoRequest req = make_io_request(IORING_OP_POLL_ADD, nullptr, 0, 0, POLLOUT);
+    if (iom->hasURing() && iom->submitIo(fd, webserver::IOManager::WRITE, req, res, timeout_ms) == 0) {
+        if (res == -ETIMEDOUT) {
+            webserver::SetErrno(ETIMEDOUT);
             return -1;
         }
     } else {
-        // 如果添加事件失败，则取消定时器，并打印错误日志
-        if (timer) {
-            timer->cancel();
+        /* 	添加一个写事件并让出执行权, 只有两种情况唤醒：
+         * 	1. 超时，fd上下文的定时器唤醒
+         *	2. 连接成功，从epoll_wait拿到事件 */
+        int rt = iom->waitEvent(fd, webserver::IOManager::WRITE, timeout_ms);
+        // 从定时器唤醒，超时失败
+        if (rt == ETIMEDOUT) {
+            webserver::SetErrno(ETIMEDOUT);
+            return -1;
+        } else if (rt == -1) {
+            // 如果添加事件失败，则打印错误日志
+            WEBSERVER_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
         }
-        WEBSERVER_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
     }
 
     // 获取套接字的错误状态
@@ -525,7 +546,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return 0;
     } else {
         // 如果获取到的错误状态不为 0，则将错误状态设置为 errno，并返回 -1
-        errno = error;
+        webserver::SetErrno(error);
         return -1;
     }
 }
@@ -550,9 +571,12 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
     // SO_RCVTIMEO：套接字选项，用于设置接收超时时间
     // addr：用于保存客户端地址信息的结构体指针
     // addrlen：地址信息结构体的长度指针
-    int fd = do_io(s, accept_f, "accept", webserver::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    webserver::IOManager::IoRequest req = make_io_request(IORING_OP_ACCEPT, addr, 0, (uint64_t)addrlen);
+    int fd = do_io(s, accept_f, "accept", webserver::IOManager::READ, SO_RCVTIMEO, &req, addr, addrlen);
     // 将新创建的连接放到文件管理中
     // 如果 accept 操作成功，则将新建的文件描述符添加到文件描述符管理器中
+    // 这里不分配分片: 处理连接的可能是另一个IOManager(TcpServer的accept_worker和io_worker),
+    // 由知道目标IOManager的调用者调用assignShard, 否则在第一次等待事件时分给等待的线程
     if (fd >= 0) {
         webserver::FdMgr::GetInstance()->get(fd, true);
     }
@@ -573,7 +597,9 @@ ssize_t read(int fd, void *buf, size_t count) {
     // SO_RCVTIMEO：套接字选项，用于设置接收超时时间
     // buf：用于存储读取数据的缓冲区指针
     // count：读取数据的字节数
-    return do_io(fd, read_f, "read", webserver::IOManager::READ, SO_RCVTIMEO, buf, count);
+    // socket上的read等价于flags为0的recv; 走到io_uring时刚返回EAGAIN, 先等待就绪再读
+    webserver::IOManager::IoRequest req = make_io_request(IORING_OP_RECV, buf, count, 0, 0, IORING_RECVSEND_POLL_FIRST);
+    return do_io(fd, read_f, "read", webserver::IOManager::READ, SO_RCVTIMEO, &req, buf, count);
 }
 
 // 封装了 readv 函数，实现了非阻塞的读操作
@@ -587,7 +613,7 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
     // SO_RCVTIMEO：套接字选项，用于设置接收超时时间
     // iov：用于存储读取数据的缓冲区结构体指针
     // iovcnt：缓冲区结构体的数量
-    return do_io(fd, readv_f, "readv", webserver::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+    return do_io(fd, readv_f, "readv", webserver::IOManager::READ, SO_RCVTIMEO, nullptr, iov, iovcnt);
 }
 
 
@@ -603,7 +629,8 @@ ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
     // buf：用于存储接收数据的缓冲区指针
     // len：接收数据的最大长度
     // flags：接收标志
-    return do_io(sockfd, recv_f, "recv", webserver::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    webserver::IOManager::IoRequest req = make_io_request(IORING_OP_RECV, buf, len, 0, flags, IORING_RECVSEND_POLL_FIRST);
+    return do_io(sockfd, recv_f, "recv", webserver::IOManager::READ, SO_RCVTIMEO, &req, buf, len, flags);
 }
 
 // 封装了 recvfrom 函数，实现了非阻塞的接收操作
@@ -620,7 +647,7 @@ ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *
     // flags：接收标志
     // src_addr：用于保存发送端地址信息的结构体指针
     // addrlen：地址信息结构体的长度指针
-    return do_io(sockfd, recvfrom_f, "recvfrom", webserver::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    return do_io(sockfd, recvfrom_f, "recvfrom", webserver::IOManager::READ, SO_RCVTIMEO, nullptr, buf, len, flags, src_addr, addrlen);
 }
 
 // 封装了 recvmsg 函数，实现了非阻塞的接收操作
@@ -634,7 +661,7 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     // SO_RCVTIMEO：套接字选项，用于设置接收超时时间
     // msg：用于存储接收数据的消息头结构体指针
     // flags：接收标志
-    return do_io(sockfd, recvmsg_f, "recvmsg", webserver::IOManager::READ, SO_RCVTIMEO, msg, flags);
+    return do_io(sockfd, recvmsg_f, "recvmsg", webserver::IOManager::READ, SO_RCVTIMEO, nullptr, msg, flags);
 }
 
 
@@ -649,7 +676,8 @@ ssize_t write(int fd, const void *buf, size_t count) {
     // SO_SNDTIMEO：套接字选项，用于设置发送超时时间
     // buf：待发送数据的缓冲区指针
     // count：待发送数据的字节数
-    return do_io(fd, write_f, "write", webserver::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+    webserver::IOManager::IoRequest req = make_io_request(IORING_OP_SEND, buf, count, 0, 0, IORING_RECVSEND_POLL_FIRST);
+    return do_io(fd, write_f, "write", webserver::IOManager::WRITE, SO_SNDTIMEO, &req, buf, count);
 }
 
 // 封装了 writev 函数，实现了非阻塞的写操作
@@ -663,7 +691,7 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
     // SO_SNDTIMEO：套接字选项，用于设置发送超时时间
     // iov：待发送数据的缓冲区结构体指针
     // iovcnt：缓冲区结构体的数量
-    return do_io(fd, writev_f, "writev", webserver::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    return do_io(fd, writev_f, "writev", webserver::IOManager::WRITE, SO_SNDTIMEO, nullptr, iov, iovcnt);
 }
 
 // 封装了 send 函数，实现了非阻塞的发送操作
@@ -678,7 +706,8 @@ ssize_t send(int s, const void *msg, size_t len, int flags) {
     // msg：待发送数据的缓冲区指针
     // len：待发送数据的字节数
     // flags：发送标志
-    return do_io(s, send_f, "send", webserver::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+    webserver::IOManager::IoRequest req = make_io_request(IORING_OP_SEND, msg, len, 0, flags, IORING_RECVSEND_POLL_FIRST);
+    return do_io(s, send_f, "send", webserver::IOManager::WRITE, SO_SNDTIMEO, &req, msg, len, flags);
 }
 
 // 封装了 sendto 函数，实现了非阻塞的发送操作
@@ -695,7 +724,7 @@ ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct socka
     // flags：发送标志
     // to：目标地址信息的结构体指针
     // tolen：目标地址信息结构体的长度
-    return do_io(s, sendto_f, "sendto", webserver::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+    return do_io(s, sendto_f, "sendto", webserver::IOManager::WRITE, SO_SNDTIMEO, nullptr, msg, len, flags, to, tolen);
 }
 
 // 封装了 sendmsg 函数，实现了非阻塞的发送操作
@@ -709,7 +738,29 @@ ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
     // SO_SNDTIMEO：套接字选项，用于设置发送超时时间
     // msg：待发送数据的消息头结构体指针
     // flags：发送标志
-    return do_io(s, sendmsg_f, "sendmsg", webserver::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+    return do_io(s, sendmsg_f, "sendmsg", webserver::IOManager::WRITE, SO_SNDTIMEO, nullptr, msg, flags);
+}
+
+// 文件到socket的零拷贝发送, 等待out_fd可写
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, "sendfile", webserver::IOManager::WRITE, SO_SNDTIMEO, nullptr, in_fd, offset, count);
+}
+
+// 管道与socket之间的零拷贝传输
+// 写入socket时等待fd_out可写, 否则从socket读出时等待fd_in可读;
+// 管道一端必须由调用方保证不会阻塞(空管道读/满管道写), 否则会在socket一端空等
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    // 借用只用来判断方向, do_io还要借用, 调用之前归还
+    webserver::FdManager::Borrowed out_ctx = webserver::FdMgr::GetInstance()->borrow(fd_out);
+    bool to_socket = out_ctx && out_ctx->isSocket();
+    out_ctx.reset();
+    auto fun = [=](int) {
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    };
+    if (to_socket) {
+        return do_io(fd_out, fun, "splice", webserver::IOManager::WRITE, SO_SNDTIMEO, nullptr);
+    }
+    return do_io(fd_in, fun, "splice", webserver::IOManager::READ, SO_RCVTIMEO, nullptr);
 }
 
 // 关闭socket
@@ -720,11 +771,14 @@ int close(int fd) {
         return close_f(fd);
     }
 
-    // 获取文件描述符的上下文信息
-    webserver::FdCtx::ptr ctx = webserver::FdMgr::GetInstance()->get(fd);
+    // 借用文件描述符的上下文信息, del之后借用期间仍然有效
+    webserver::FdManager::Borrowed ctx = webserver::FdMgr::GetInstance()->borrow(fd);
 
     // 如果文件描述符上下文信息存在
     if (ctx) {
+        // 先标记为已关闭, 被cancelAll唤醒的协程不会在close_f之前重新注册事件
+        ctx->setClose();
+
         // 获取当前的 IO 管理器实例
         auto iom = webserver::IOManager::GetThis();
 
@@ -758,8 +812,8 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
                 int arg = va_arg(va, int);
                 // 结束可变参数列表
                 va_end(va);
-                // 获取文件描述符的上下文信息
-                webserver::FdCtx::ptr ctx = webserver::FdMgr::GetInstance()->get(fd);
+                // 借用文件描述符的上下文信息
+                webserver::FdManager::Borrowed ctx = webserver::FdMgr::GetInstance()->borrow(fd);
                 // 如果文件描述符上下文信息不存在、已关闭或不是套接字，则调用原始的 fcntl 函数
                 if (!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return fcntl_f(fd, cmd, arg);
@@ -783,8 +837,8 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
                 va_end(va);
                 // 调用原始的 fcntl 函数获取文件状态标志
                 int arg = fcntl_f(fd, cmd);
-                // 获取文件描述符的上下文信息
-                webserver::FdCtx::ptr ctx = webserver::FdMgr::GetInstance()->get(fd);
+                // 借用文件描述符的上下文信息
+                webserver::FdManager::Borrowed ctx = webserver::FdMgr::GetInstance()->borrow(fd);
                 // 如果文件描述符上下文信息不存在、已关闭或不是套接字，则直接返回获取的结果
                 if (!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return arg;
@@ -885,8 +939,8 @@ int ioctl(int d, unsigned long int request, ...) {
     if (FIONBIO == request) {
         // 将参数转换为布尔值，表示是否设置非阻塞
         bool user_nonblock = !!*(int*)arg;
-        // 获取文件描述符的上下文信息
-        webserver::FdCtx::ptr ctx = webserver::FdMgr::GetInstance()->get(d);
+        // 借用文件描述符的上下文信息
+        webserver::FdManager::Borrowed ctx = webserver::FdMgr::GetInstance()->borrow(d);
         // 如果文件描述符上下文信息不存在、已关闭或不是套接字，则调用原始的 ioctl 函数
         if (!ctx || ctx->isClose() || !ctx->isSocket()) {
             return ioctl_f(d, request, arg);
@@ -917,8 +971,8 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     if (level == SOL_SOCKET) {
         // 如果选项是 SO_RCVTIMEO 或 SO_SNDTIMEO
         if (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            // 获取文件描述符的上下文信息
-            webserver::FdCtx::ptr ctx = webserver::FdMgr::GetInstance()->get(sockfd);
+            // 借用文件描述符的上下文信息
+            webserver::FdManager::Borrowed ctx = webserver::FdMgr::GetInstance()->borrow(sockfd);
             // 如果文件描述符上下文信息存在，则将超时时间设置到套接字上下文中
             if (ctx) {
                 const timeval* v = (const timeval*)optval;
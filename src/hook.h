@@ -101,6 +101,13 @@ extern sendto_fun sendto_f;
 typedef ssize_t (*sendmsg_fun)(int s, const struct msghdr *msg, int flags);
 extern sendmsg_fun sendmsg_f;
 
+//zero copy
+typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t *offset, size_t count);
+extern sendfile_fun sendfile_f;
+
+typedef ssize_t (*splice_fun)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+extern splice_fun splice_f;
+
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
 
@@ -292,45 +292,58 @@ std::string HttpRequest::toString() const {
  * 5. 支持链式调用，通过返回输出流对象的引用。
  */
 std::ostream& HttpRequest::dump(std::ostream& os) const {
-    os << HttpMethodToString(m_method)  // 将HTTP方法转换为字符串并写入流
-       << " "  // 添加空格分隔HTTP方法和请求路径
-       << m_path  // 添加请求的路径
-       << (m_query.empty() ? "" : "?")  // 如果查询字符串不为空，则添加问号
-       << m_query  // 添加查询字符串
-       << (m_fragment.empty() ? "" : "#")  // 如果fragment不为空，则添加井号
-       << m_fragment  // 添加fragment
-       << " HTTP/"  // 添加HTTP协议标识
-       << ((uint32_t)(m_version >> 4))  // 提取并输出HTTP版本号的主版本部分
-       << "."  // 添加点以分隔主副版本号
-       << ((uint32_t)(m_version & 0x0F))  // 提取并输出HTTP版本号的副版本部分
-       << "\r\n";  // 添加请求行结束符
+    std::string header;
+    dumpHeader(header);  // 请求行和头部
+    return os << header << m_body;  // 请求体
+}
+
+/**
+ * 将请求行和头部追加到out中, 格式与dump相同, 但不包括请求体。
+ *
+ * 功能描述:
+ * - 直接拼接字符串, 不经过stringstream。
+ * - out可以是连接上复用的缓冲区, 追加前不会清空。
+ */
+void HttpRequest::dumpHeader(std::string& out) const {
+    out.append(HttpMethodToString(m_method));  // HTTP方法
+    out.push_back(' ');
+    out.append(m_path);  // 请求的路径
+    if (!m_query.empty()) {  // 查询字符串
+        out.push_back('?');
+        out.append(m_query);
+    }
+    if (!m_fragment.empty()) {  // fragment
+        out.push_back('#');
+        out.append(m_fragment);
+    }
+    out.append(" HTTP/");
+    out.push_back('0' + (m_version >> 4));  // 主版本号
+    out.push_back('.');
+    out.push_back('0' + (m_version & 0x0F));  // 副版本号
+    out.append("\r\n");
 
     if (!m_websocket) {
-        os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";  // 输出连接头部
+        out.append(m_close ? "connection: close\r\n" : "connection: keep-alive\r\n");  // 输出连接头部
     }
 
     for (auto& i : m_headers) {
         if (!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
             continue;  // 对于非WebSocket连接，忽略connection头部
         }
-        os << i.first << ": " << i.second << "\r\n";  // 输出其他头部
+        out.append(i.first).append(": ").append(i.second).append("\r\n");  // 输出其他头部
     }
 
     if (!m_body.empty()) {
-        os << "content-length: " << m_body.size() << "\r\n\r\n"  // 输出内容长度头部和两个换行
-           << m_body;  // 输出请求体
-    } else {
-        os << "\r\n";  // 如果没有请求体，仅输出一个换行符
+        out.append("content-length: ").append(std::to_string(m_body.size())).append("\r\n");  // 内容长度头部
     }
-
-    return os;  // 返回输出流对象的引用
+    out.append("\r\n");  // 头部结束的空行
 }
 
 /**
  * 初始化HttpRequest对象，设置连接状态。
  * 
  * 功能描述:
- * - 根据"connection"头部的值设置m_close成员变量。
+ * - 根据"connection"头部的值设置m_close成员变量, 没有该头部时HTTP/1.1默认保持连接。
  * 
  * 参数: 无
  * 返回值: 无
@@ -343,6 +356,8 @@ void HttpRequest::init() {
         } else {  // 否则
             m_close = true;  // 设置m_close为true，表示关闭连接
         }
+    } else if (m_version == 0x11) {  // HTTP/1.1默认保持连接, 流水线请求依赖这一点
+        m_close = false;
     }
 }
 
@@ -613,40 +628,47 @@ std::string HttpResponse::toString() const {
  * - std::ostream&: 输出流的引用，允许链式调用。
  */
 std::ostream& HttpResponse::dump(std::ostream& os) const {
+    std::string header;
+    dumpHeader(header); // 状态行和头部
+    return os << header << m_body; // 正文
+}
+
+/**
+ * 将状态行和头部追加到out中, 格式与dump相同, 但不包括正文。
+ * 直接拼接字符串, 不经过stringstream; out可以是连接上复用的缓冲区, 追加前不会清空。
+ */
+void HttpResponse::dumpHeader(std::string& out) const {
     // 输出状态行
-    os << "HTTP/"
-       << ((uint32_t)(m_version >> 4)) // 主版本号
-       << "."
-       << ((uint32_t)(m_version & 0x0F)) // 副版本号
-       << " "
-       << (uint32_t)m_status // 状态码
-       << " "
-       << (m_reason.empty() ? HttpStatusToString(m_status) : m_reason) // 原因短语
-       << "\r\n";
+    out.append("HTTP/");
+    out.push_back('0' + (m_version >> 4)); // 主版本号
+    out.push_back('.');
+    out.push_back('0' + (m_version & 0x0F)); // 副版本号
+    out.push_back(' ');
+    out.append(std::to_string((uint32_t)m_status)); // 状态码
+    out.push_back(' ');
+    out.append(m_reason.empty() ? HttpStatusToString(m_status) : m_reason); // 原因短语
+    out.append("\r\n");
 
     // 输出头部，忽略 WebSocket 连接的 "connection" 头部
     for(auto& i : m_headers) {
         if(!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
             continue;
         }
-        os << i.first << ": " << i.second << "\r\n";
+        out.append(i.first).append(": ").append(i.second).append("\r\n");
     }
     // 输出 Cookies
     for(auto& i : m_cookies) {
-        os << "Set-Cookie: " << i << "\r\n";
+        out.append("Set-Cookie: ").append(i).append("\r\n");
     }
     // 输出连接状态
     if(!m_websocket) {
-        os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
+        out.append(m_close ? "connection: close\r\n" : "connection: keep-alive\r\n");
     }
-    // 如果有正文，输出正文长度和正文本身
+    // 如果有正文，输出正文长度
     if(!m_body.empty()) {
-        os << "content-length: " << m_body.size() << "\r\n\r\n"
-           << m_body;
-    } else {
-        os << "\r\n";
+        out.append("content-length: ").append(std::to_string(m_body.size())).append("\r\n");
     }
-    return os;
+    out.append("\r\n");
 }
 
 /**
@@ -533,6 +533,40 @@ public:
         return getAs(m_cookies, key, def);
     }
 
+    /**
+     * @brief 获取路由匹配出的路径参数
+     * @details 路由/users/:id匹配/users/42时id为42; 路由以通配段*path结尾时, path为通配段匹配到的剩余路径
+     * @param[in] key 参数名
+     * @param[in] def 默认值
+     * @return 如果存在则返回对应的值,否则返回def
+     */
+    std::string getPathParam(const std::string& key, const std::string& def = "") const {
+        auto it = m_pathParams.find(key);
+        return it == m_pathParams.end() ? def : it->second;
+    }
+
+    /**
+     * @brief 获取路由匹配出的路径参数并转成对应类型
+     * @tparam T 转换类型
+     * @param[in] key 参数名
+     * @param[in] def 默认值
+     * @return 如果存在且转换成功返回对应的值,否则返回def
+     */
+    template<class T>
+    T getPathParamAs(const std::string& key, const T& def = T()) const {
+        return getAs(m_pathParams, key, def);
+    }
+
+    /**
+     * @brief 返回全部路径参数
+     */
+    const MapType& getPathParams() const { return m_pathParams;}
+
+    /**
+     * @brief 设置路径参数, 由ServletDispatch在路由匹配时设置
+     */
+    void setPathParam(const std::string& key, const std::string& val) { m_pathParams[key] = val;}
+
     /**
      * @brief 序列化输出到流中
      * @param[in, out] os 输出流
@@ -540,6 +574,13 @@ public:
      */
     std::ostream& dump(std::ostream& os) const;
 
+    /**
+     * @brief 把请求行和头部(包括content-length和结尾的空行)追加到out, 不包括消息体
+     * @details 发送时消息体直接用getBody()的内存, 和头部一起writev, 不再拷贝
+     * @param[in, out] out 输出缓冲区
+     */
+    void dumpHeader(std::string& out) const;
+
     /**
      * @brief 转成字符串类型
      * @return 字符串
@@ -580,6 +621,8 @@ private:
     MapType m_params;
     /// 请求Cookie MAP
     MapType m_cookies;
+    /// 路由匹配出的路径参数MAP
+    MapType m_pathParams;
 };
 
 /**
@@ -730,6 +773,13 @@ public:
      */
     std::ostream& dump(std::ostream& os) const;
 
+    /**
+     * @brief 把状态行和头部(包括content-length和结尾的空行)追加到out, 不包括消息体
+     * @details 发送时消息体直接用getBody()的内存, 和头部一起writev, 不再拷贝
+     * @param[in, out] out 输出缓冲区
+     */
+    void dumpHeader(std::string& out) const;
+
     /**
      * @brief 转成字符串
      */
@@ -1,6 +1,7 @@
 #include "http_connection.h"
 #include "http_parser.h"
 #include "src/log.h"
+#include "src/clock.h"
 #include "src/streams/zlib_stream.h"
 
 namespace webserver {
@@ -217,13 +218,19 @@ HttpResponse::ptr HttpConnection::recvResponse() {
  * 返回值：
  *   - 返回值表示发送结果，大于等于0表示成功发送的字节数，小于0表示发送失败
  * 详细描述：
- *  - 将HttpRequest对象转换为字符串形式，并通过套接字发送出去。
+ *  - 将请求行和头部序列化到复用的缓冲区，和请求体一起通过套接字发送出去，请求体不拷贝。
  */
 int HttpConnection::sendRequest(HttpRequest::ptr rsp) {
-    std::stringstream ss; // 创建stringstream对象
-    ss << *rsp; // 将HttpRequest对象转换为字符串形式
-    std::string data = ss.str(); // 获取字符串形式的HTTP请求
-    return writeFixSize(data.c_str(), data.size()); // 发送HTTP请求
+    m_scratch.clear(); // 保留容量, 只清空内容
+    rsp->dumpHeader(m_scratch); // 序列化请求行和头部
+    const std::string& body = rsp->getBody();
+    iovec iovs[2];
+    iovs[0].iov_base = &m_scratch[0];
+    iovs[0].iov_len = m_scratch.size();
+    iovs[1].iov_base = (void*)body.c_str();
+    iovs[1].iov_len = body.size();
+    // 请求头和请求体一次writev发送
+    return writevFixSize(iovs, body.empty() ? 1 : 2); // 发送HTTP请求
 }
 
 /**
@@ -472,7 +479,7 @@ HttpConnectionPool::HttpConnectionPool(const std::string& host
  *  - 遍历连接池中的HttpConnection对象，选择合适的连接。如果找到可用的连接，则从连接池中移除该连接并返回；如果没有可用的连接，则创建一个新的连接。
  */
 HttpConnection::ptr HttpConnectionPool::getConnection() {
-    uint64_t now_ms = webserver::GetCurrentMS(); // 获取当前时间（毫秒）
+    uint64_t now_ms = webserver::Clock::NowMS(); // 获取当前时间（毫秒）
     // 非法的连接
     std::vector<HttpConnection*> invalid_conns; // 无效的连接列表
     HttpConnection* ptr = nullptr; // 指向选定的连接
@@ -539,7 +546,7 @@ void HttpConnectionPool::ReleasePtr(HttpConnection* ptr, HttpConnectionPool* poo
     ++ptr->m_request; // 增加连接的请求数量
     // 已经关闭了链接，超时，超过最大请求数量
     if(!ptr->isConnected() // 如果连接已断开
-            || ((ptr->m_createTime + pool->m_maxAliveTime) >= webserver::GetCurrentMS()) // 或者连接已经超过了最大存活时间
+            || ((ptr->m_createTime + pool->m_maxAliveTime) >= webserver::Clock::NowMS()) // 或者连接已经超过了最大存活时间
             || (ptr->m_request >= pool->m_maxRequest)) { // 或者连接已达到最大请求次数
         delete ptr; // 销毁连接
         --pool->m_total; // 更新连接池中连接的数量
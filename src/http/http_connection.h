@@ -196,6 +196,7 @@ public:
 
     /**
      * @brief 发送HTTP请求
+     * @details 请求行和头部序列化到连接复用的缓冲区, 和请求体一起writev, 请求体不拷贝
      * @param[in] req HTTP请求结构
      */
     int sendRequest(HttpRequest::ptr req);
@@ -205,6 +206,8 @@ private:
     uint64_t m_createTime = 0;
     // 请求超时时间
     uint64_t m_request = 0;
+    // 写缓冲区, 复用来序列化请求行和头部
+    std::string m_scratch;
 };
 
 class HttpConnectionPool {
@@ -378,6 +378,17 @@ uint64_t HttpRequestParser::getContentLength() {
     return m_data->getHeaderAs<uint64_t>("content-length", 0);
 }
 
+/**
+ * 重置解析器
+ * 同一连接上的多个请求复用一个解析器, 不必每个请求都重新创建并设置回调
+ */
+void HttpRequestParser::reset() {
+    m_error = 0;
+    m_data.reset(new webserver::http::HttpRequest);
+    // http_parser_init只重置状态, 回调和data保持不变
+    http_parser_init(&m_parser);
+}
+
 /**
  * 执行HTTP解析
  * 
@@ -38,6 +38,13 @@ public:
      */
     size_t execute(char* data, size_t len);
 
+    /**
+     * @brief 重置解析状态, 准备解析同一连接上的下一个请求
+     * @details 回调保持不变, 只重新初始化状态机并创建新的HttpRequest,
+     *          已经返回给调用者的HttpRequest不受影响
+     */
+    void reset();
+
     /**
      * @brief 是否解析完成
      * @return 是否解析完成
@@ -13,6 +13,12 @@ namespace http {
  */
 static webserver::Logger::ptr g_logger = WEBSERVER_LOG_NAME("system");
 
+/**
+ * 描述：servlet没有读完的请求消息体不超过这个大小时读出来丢弃, 连接继续处理下一个请求;
+ *       超过时关闭连接, 不为丢弃数据而读取大量消息体。
+ */
+static const uint64_t s_http_skip_body_size = 64 * 1024;
+
 /**
  * 类名：HttpServer
  * 功能：实现HTTP服务器，处理HTTP请求并响应客户端。
@@ -72,14 +78,16 @@ void HttpServer::setName(const std::string& v) {
  *  - 使用Logger对象记录处理客户端连接的日志。
  *  - 创建HttpSession对象处理HTTP会话。
  *  - 循环接收HTTP请求并处理，直到客户端断开连接或不再保持长连接。
+ *  - 流水线中连续到达的请求依次处理，响应合并后一次写出。
+ *  - 先只接收请求头，流式读取消息体的Servlet自己读取消息体，其他Servlet处理前先读完消息体。
  *  - 在处理完毕后关闭会话。
  */
 void HttpServer::handleClient(Socket::ptr client) {
     WEBSERVER_LOG_DEBUG(g_logger) << "handleClient " << *client; // 记录处理客户端连接的日志
     HttpSession::ptr session(new HttpSession(client)); // 创建HttpSession对象处理HTTP会话
     do {
-        // 接收请求报文
-        auto req = session->recvRequest(); // 接收HTTP请求
+        // 接收请求报文, 先只接收请求行和头部
+        auto req = session->recvRequestHeader(); // 接收HTTP请求
         if(!req) { // 如果接收失败
             WEBSERVER_LOG_DEBUG(g_logger) << "recv http request fail, errno="
                 << errno << " errstr=" << strerror(errno)
@@ -93,14 +101,47 @@ void HttpServer::handleClient(Socket::ptr client) {
                             ,req->isClose() || !m_isKeepalive));
         // 设置Server名Head
         rsp->setHeader("Server", getName()); // 设置响应头中的Server字段
+        bool close = !m_isKeepalive || req->isClose();
+        // 流式读取消息体的servlet自己读取, 其他servlet先读完整个消息体
+        // 按路径和方法匹配servlet, 路由的路径参数设置到req中
+        auto slt = m_dispatch->getMatchedServlet(req);
+        if(!slt || !slt->isStreamBody()) {
+            int rt = session->recvRequestBody(req);
+            if(rt == -2) {
+                rsp->setStatus(HttpStatus::PAYLOAD_TOO_LARGE);
+                rsp->setClose(true);
+                session->sendResponse(rsp);
+            }
+            if(rt < 0) {
+                WEBSERVER_LOG_DEBUG(g_logger) << "recv http request body fail, rt=" << rt
+                    << " errno=" << errno << " errstr=" << strerror(errno)
+                    << " cliet:" << *client;
+                break;
+            }
+        }
         // 执行操作
-        m_dispatch->handle(req, rsp, session); // 调用ServletDispatch处理HTTP请求
-        // 发送响应报文
-        session->sendResponse(rsp); // 发送HTTP响应
+        if(slt) {
+            slt->handle(req, rsp, session); // 调用匹配的servlet处理HTTP请求
+        }
+        // servlet没有读完的消息体: 不大时丢弃, 否则只能关闭连接
+        if(!session->skipBody(s_http_skip_body_size)) {
+            close = true;
+            rsp->setClose(true);
+        }
+        if(session->isStreamResponse(rsp)) {
+            // servlet已经流式发送了响应, 没有结束时补上结尾; 消息体不完整或HTTP/1.0时只能关闭连接
+            if(session->sendResponseEnd() < 0 || rsp->isClose()) {
+                close = true;
+            }
+        } else {
+            // 发送响应报文
+            // 缓冲区里已经有流水线的下一个请求时先不发送, 和后面的响应合并成一次写
+            session->sendResponse(rsp, !close && session->hasBufferedData()); // 发送HTTP响应
+        }
 
         // 如果不再保持长连接或请求要求关闭连接，则跳出循环
         // 若不支持长连接，关闭
-        if(!m_isKeepalive || req->isClose()) {
+        if(close) {
             break;
         }
     } while(true);
@@ -1,9 +1,16 @@
 #include "http_session.h"
 #include "http_parser.h"
+#include "src/clock.h"
+#include "src/log.h"
+#include "src/worker.h"
+#include <fcntl.h>
+#include <limits.h>
 
 namespace webserver {
 namespace http {
 
+static webserver::Logger::ptr g_logger = WEBSERVER_LOG_NAME("system");
+
 /**
  * 类名：HttpSession
  * 功能：实现HTTP会话管理，包括接收HTTP请求和发送HTTP响应等操作。
@@ -13,99 +20,276 @@ namespace http {
  *  - 提供sendResponse()函数用于发送HTTP响应，将HttpResponse对象转换为字符串后发送。
  */
 
+HttpBodyStream::HttpBodyStream(HttpSession* session)
+    :m_session(session)
+    ,m_length(session->getBodyLeft()) {
+}
+
+int HttpBodyStream::read(void* buffer, size_t length) {
+    return m_session->readBody(buffer, length);
+}
+
+int HttpBodyStream::read(ByteArray::ptr ba, size_t length) {
+    std::vector<iovec> iovs;
+    ba->getWriteBuffers(iovs, length);
+    int rt = m_session->readBody(iovs[0].iov_base, iovs[0].iov_len);
+    if(rt > 0) {
+        ba->setPosition(ba->getPosition() + rt);
+    }
+    return rt;
+}
+
+uint64_t HttpBodyStream::getLeft() const {
+    return m_session->getBodyLeft();
+}
+
+/**
+ * 把剩余的消息体写入文件
+ * 每次从连接读64K, 打开/写入/关闭文件都放到阻塞任务线程池中执行, 不卡住IO线程上的其他协程
+ */
+int64_t HttpBodyStream::saveToFile(const std::string& path) {
+    int fd = offload([&path]() {
+        return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    });
+    if(fd < 0) {
+        WEBSERVER_LOG_ERROR(g_logger) << "HttpBodyStream::saveToFile open " << path
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return -1;
+    }
+    std::vector<char> buf(64 * 1024);
+    int64_t total = 0;
+    while(true) {
+        int len = read(&buf[0], buf.size());
+        if(len <= 0) {
+            if(len < 0) {
+                total = -1;
+            }
+            break;
+        }
+        bool ok = offload([fd, &buf, len]() {
+            size_t offset = 0;
+            while(offset < (size_t)len) {
+                ssize_t rt = ::write(fd, &buf[offset], len - offset);
+                if(rt < 0) {
+                    if(errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                offset += rt;
+            }
+            return true;
+        });
+        if(!ok) {
+            WEBSERVER_LOG_ERROR(g_logger) << "HttpBodyStream::saveToFile write " << path
+                << " errno=" << errno << " errstr=" << strerror(errno);
+            total = -1;
+            break;
+        }
+        total += len;
+    }
+    // close要把脏页的元数据落盘, 在网络文件系统上可能阻塞很久
+    offload([fd]() {
+        return ::close(fd);
+    });
+    return total;
+}
+
+/**
+ * 合并的响应超过这个大小时立即发送, 避免一个连接上积压过多数据
+ */
+static const size_t s_max_pending_size = 64 * 1024;
+
 /**
  * 构造函数
  * 功能：创建HttpSession对象并初始化。
  * 参数：
  *   - sock: 指向Socket对象的智能指针，表示当前会话的套接字。
  *   - owner: bool类型，表示当前对象是否拥有套接字的所有权。
+ * 读缓冲区和解析器在第一次recvRequest时创建。
  */
 HttpSession::HttpSession(Socket::ptr sock, bool owner)
-    :SocketStream(sock, owner) { // 调用基类SocketStream的构造函数，初始化套接字流
+    :SocketStream(sock, owner) // 调用基类SocketStream的构造函数，初始化套接字流
+    ,m_bufferSize(0)
+    ,m_bufferLen(0)
+    ,m_pendingSize(0)
+    ,m_bodyLeft(0)
+    ,m_expectContinue(false)
+    ,m_streamLeft(-1)
+    ,m_streamChunked(false)
+    ,m_streamEnd(false)
+    ,m_streamNoBody(false)
+    ,m_headRequest(false) {
 }
 
 /**
  * 接收HTTP请求
  * 接收请求报文
  * 
- * 返回值：指向HttpRequest对象的智能指针，表示接收到的HTTP请求；如果接收失败或解析错误，则返回空指针。
+ * 返回值：指向HttpRequest对象的智能指针，表示接收到的HTTP请求；如果接收失败、解析错误或消息体过大，则返回空指针。
  * 详细描述：
- *  - 创建HttpRequestParser对象用于解析HTTP请求。
- *  - 读取套接字数据并填充缓冲区，调用HttpRequestParser的execute()方法解析HTTP请求。
- *  - 如果解析成功且请求完整，则返回解析得到的HttpRequest对象；否则返回空指针。
- *  - 如果请求中包含消息体，则继续读取消息体数据并填充HttpRequest对象。
+ *  - 先接收请求行和头部，再把消息体全部读入HttpRequest。
  */
 HttpRequest::ptr HttpSession::recvRequest() {
-    HttpRequestParser::ptr parser(new HttpRequestParser); // 创建HttpRequestParser对象
+    HttpRequest::ptr req = recvRequestHeader();
+    if(!req) {
+        return nullptr;
+    }
+    if(recvRequestBody(req) < 0) {
+        close();
+        return nullptr;
+    }
+    return req;
+}
+
+/**
+ * 接收请求行和头部
+ * 
+ * 返回值：指向HttpRequest对象的智能指针；如果接收失败或解析错误，则关闭连接并返回空指针。
+ * 详细描述：
+ *  - 复用连接上的HttpRequestParser, 解析前reset。
+ *  - 先解析读缓冲区中上一次剩下的数据, 不够时再从套接字读取。
+ *  - 解析完请求头后, 缓冲区中剩余的数据可能是消息体, 也可能是下一个请求,
+ *    消息体通过readBody读取, 最多读到Content-Length, 多出来的数据留给下一个请求。
+ */
+HttpRequest::ptr HttpSession::recvRequestHeader() {
+    m_streamRsp.reset();
+    m_bodyStream.reset();
+    m_bodyLeft = 0;
+    m_expectContinue = false;
+    if(!m_parser) {
+        m_parser.reset(new HttpRequestParser);
+    } else {
+        m_parser->reset();
+    }
     uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize(); // 获取HTTP请求缓冲区大小
-    // 交给智能指针托管
-    std::shared_ptr<char> buffer( // 创建共享指针buffer，指向char数组
-            new char[buff_size], [](char* ptr){ // 自定义删除器，释放buffer的内存
-                delete[] ptr;
-            });
-    char* data = buffer.get(); // 获取buffer指向的内存地址
-    int offset = 0; // 数据偏移量
+    if(buff_size > m_bufferSize) {
+        // 配置变大时扩容, 保留未处理的数据
+        std::shared_ptr<char> buffer(new char[buff_size], [](char* ptr){
+                    delete[] ptr;
+                });
+        if(m_bufferLen) {
+            memcpy(buffer.get(), m_buffer.get(), m_bufferLen);
+        }
+        m_buffer = buffer;
+        m_bufferSize = buff_size;
+    }
+    char* data = m_buffer.get();
 
     do {
-        // 在offset后面接着读数据
-        int len = read(data + offset, buff_size - offset); // 从套接字读取数据到缓冲区
-        if(len <= 0) { // 如果读取失败或连接断开
-            close(); // 关闭套接字
-            return nullptr; // 返回空指针
-        }
-        // 当前已经读取的数据长度
-        len += offset; // 更新已读取数据的长度
-        // 解析缓冲区data中的数据
-        // execute会将data向前移动nparse个字节，nparse为已经成功解析的字节数
-        size_t nparse = parser->execute(data, len); // 解析HTTP请求
-        if(parser->hasError()) { // 如果解析出错
-            close(); // 关闭套接字
-            return nullptr; // 返回空指针
+        if(m_bufferLen > 0) {
+            // execute会将data向前移动nparse个字节，nparse为已经成功解析的字节数
+            size_t nparse = m_parser->execute(data, m_bufferLen); // 解析HTTP请求
+            if(m_parser->hasError()) { // 如果解析出错
+                close(); // 关闭套接字
+                return nullptr; // 返回空指针
+            }
+            // 此时data还剩下已经读到的数据 - 解析过的数据
+            m_bufferLen -= nparse;
+            // 解析结束
+            if(m_parser->isFinished()) {
+                break;
+            }
+            // 缓冲区满了还没解析完
+            if(m_bufferLen == m_bufferSize) {
+                close();
+                return nullptr;
+            }
         }
-        // 此时data还剩下已经读到的数据 - 解析过的数据
-        offset = len - nparse; // 更新数据偏移量
-        // 缓冲区满了还没解析完
-        if(offset == (int)buff_size) { // 如果数据偏移量达到缓冲区大小
+        // 在已有数据后面接着读
+        int len = fill();
+        if(len <= 0) { // 如果读取失败或连接断开
             close(); // 关闭套接字
             return nullptr; // 返回空指针
         }
-        // 解析结束
-        if(parser->isFinished()) { // 如果解析完成
-            break; // 退出循环
-        }
     } while(true);
-    // 获得body的长度
-    int64_t length = parser->getContentLength(); // 获取HTTP请求内容长度
-    if(length > 0) { // 如果内容长度大于0
-        std::string body; // 创建字符串body
-        body.resize(length); // 调整body大小为内容长度
-
-        int len = 0;
-        // 如果body长度比缓冲区剩余的还大，将缓冲区全部加进来
-        if(length >= offset) { // 如果内容长度大于等于已读取数据长度
-            memcpy(&body[0], data, offset); // 将已读取数据复制到body
-            len = offset; // 更新已读取数据长度
-        } else { // 否则
-            // 否则将取length
-            memcpy(&body[0], data, length); // 将部分已读取数据复制到body
-            len = length; // 更新已读取数据长度
+    HttpRequest::ptr req = m_parser->getData();
+    req->init(); // 初始化HTTP请求数据
+    m_headRequest = req->getMethod() == HttpMethod::HEAD;
+    // 获得body的长度, 消息体留在连接上, 由recvRequestBody或getBodyStream读取
+    m_bodyLeft = m_parser->getContentLength();
+    m_expectContinue = m_bodyLeft > 0 && req->getVersion() >= 0x11
+            && !strcasecmp(req->getHeader("expect").c_str(), "100-continue");
+    //返回解析完的HttpRequest
+    return req;
+}
+
+/**
+ * 读取完整的消息体
+ * 返回值：0成功, -1读取失败, -2消息体超过http.request.max_body_size
+ */
+int HttpSession::recvRequestBody(HttpRequest::ptr req) {
+    if(m_bodyLeft == 0) {
+        return 0;
+    }
+    if(m_bodyLeft > HttpRequestParser::GetHttpRequestMaxBodySize()) {
+        return -2;
+    }
+    std::string body; // 创建字符串body
+    body.resize(m_bodyLeft); // 调整body大小为内容长度
+    size_t offset = 0;
+    // 先取缓冲区中的数据, 不够再从套接字读取
+    while(m_bodyLeft > 0) {
+        int rt = readBody(&body[offset], body.size() - offset);
+        if(rt <= 0) {
+            return -1;
         }
-        length -= offset; // 更新剩余内容长度
-        // 缓冲区里的数据也不够，继续读取直到满足length
-        if(length > 0) { // 如果剩余内容长度大于0
-            if(readFixSize(&body[len], length) <= 0) { // 从套接字继续读取剩余内容
-                close(); // 关闭套接字
-                return nullptr; // 返回空指针
-            }
+        offset += rt;
+    }
+    // 设置body
+    req->setBody(body); // 设置HTTP请求的消息体
+    return 0;
+}
+
+HttpBodyStream::ptr HttpSession::getBodyStream() {
+    if(!m_bodyStream) {
+        m_bodyStream.reset(new HttpBodyStream(this));
+    }
+    return m_bodyStream;
+}
+
+/**
+ * 读取消息体
+ * 对端发送了Expect: 100-continue时, 在第一次读取前回复100 Continue,
+ * 没有读取消息体就拒绝的请求不会让对端白白发送消息体
+ */
+int HttpSession::readBody(void* buffer, size_t length) {
+    if(m_bodyLeft == 0) {
+        return 0;
+    }
+    if(m_expectContinue) {
+        m_expectContinue = false;
+        static const char s_continue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        if(writeFixSize(s_continue, sizeof(s_continue) - 1) <= 0) {
+            return -1;
         }
-        // 设置body
-        parser->getData()->setBody(body); // 设置HTTP请求的消息体
     }
+    int rt = read(buffer, std::min((uint64_t)length, m_bodyLeft));
+    if(rt <= 0) { // 消息体没有读完连接就断开了
+        return -1;
+    }
+    m_bodyLeft -= rt;
+    return rt;
+}
 
-    
-    parser->getData()->init(); // 初始化HTTP请求数据
-    //返回解析完的HttpRequest
-    return parser->getData(); // 返回HTTP请求数据
+/**
+ * 丢弃剩余的消息体
+ * 对端还在等100 Continue时不会发送消息体, 无法丢弃
+ */
+bool HttpSession::skipBody(uint64_t max) {
+    if(m_bodyLeft == 0) {
+        return true;
+    }
+    if(m_expectContinue || m_bodyLeft > max) {
+        return false;
+    }
+    char buf[4096];
+    while(m_bodyLeft > 0) {
+        if(readBody(buf, sizeof(buf)) <= 0) {
+            return false;
+        }
+    }
+    return true;
 }
 
 /**
@@ -114,17 +298,308 @@ HttpRequest::ptr HttpSession::recvRequest() {
  * 
  * 参数：
  *   - rsp: 指向HttpResponse对象的智能指针，表示要发送的HTTP响应。
- * 返回值：int类型，表示发送的字节数；-1表示发送失败。
+ *   - more: 后面还有响应, 先合并起来, 和后面的响应一起发送。
+ * 返回值：int类型，表示发送(或合并)的字节数；-1表示发送失败。
+ * 详细描述：
+ *  - 状态行和头部追加到写缓冲区，消息体不拷贝，和头部一起writev发送。
+ */
+int HttpSession::sendResponse(HttpResponse::ptr rsp, bool more) {
+    // 补充Date头部, 每个线程每秒只格式化一次
+    if(rsp->getHeader("date").empty()) {
+        rsp->setHeader("date", Clock::HttpDate());
+    }
+    size_t begin = m_scratch.size();
+    rsp->dumpHeader(m_scratch); // 序列化状态行和头部
+    size_t size = m_scratch.size() - begin + rsp->getBody().size();
+    m_pending.push_back(std::make_pair(m_scratch.size(), rsp));
+    m_pendingSize += size;
+    if(more && m_pendingSize < s_max_pending_size
+            && m_pending.size() < IOV_MAX / 2) {
+        return size;
+    }
+    return flush();
+}
+
+/**
+ * 开始流式发送响应
+ * 
+ * 参数：
+ *   - rsp: HTTP响应, 已经设置的消息体作为第一块发送。
+ *   - length: 消息体长度, -1表示未知, 使用chunked(HTTP/1.0时发送完关闭连接)。
+ * 返回值：>0 成功, =0 对方关闭, <0 失败。
  * 详细描述：
- *  - 将HttpResponse对象转换为字符串形式，并通过套接字发送。
+ *  - 先发送合并起来的响应, 保证流水线中响应的顺序。
+ *  - 设置Content-Length或Transfer-Encoding后立即发送状态行和头部。
+ *  - HEAD请求和1xx, 204, 304响应没有消息体, 不使用chunked, 也不需要关闭连接来结束消息体。
+ */
+int HttpSession::sendResponseHeader(HttpResponse::ptr rsp, int64_t length) {
+    if(m_streamRsp && !m_streamEnd) { // 上一个流式响应还没有结束
+        return -1;
+    }
+    if(rsp->getHeader("date").empty()) {
+        rsp->setHeader("date", Clock::HttpDate());
+    }
+    std::string body = rsp->getBody();
+    rsp->setBody("");
+    m_streamRsp = rsp;
+    m_streamLeft = length;
+    m_streamChunked = false;
+    m_streamEnd = false;
+    int status = (int)rsp->getStatus();
+    bool no_content = status < 200 || status == (int)HttpStatus::NO_CONTENT;
+    m_streamNoBody = m_headRequest || no_content || status == (int)HttpStatus::NOT_MODIFIED;
+    if(m_streamNoBody) {
+        // HEAD和304的Content-Length表示对应GET响应的长度, 1xx和204不能带Content-Length
+        rsp->delHeader("transfer-encoding");
+        if(length >= 0 && !no_content) {
+            rsp->setHeader("content-length", std::to_string(length));
+        } else {
+            rsp->delHeader("content-length");
+        }
+        body.clear();
+    } else if(length >= 0) {
+        rsp->setHeader("content-length", std::to_string(length));
+    } else if(rsp->getVersion() >= 0x11) {
+        rsp->setHeader("transfer-encoding", "chunked");
+        m_streamChunked = true;
+    } else {
+        // HTTP/1.0不支持chunked, 以关闭连接表示消息体结束
+        rsp->setClose(true);
+    }
+    if(flush() < 0) {
+        return -1;
+    }
+    rsp->dumpHeader(m_scratch);
+    int rt = writeFixSize(m_scratch.c_str(), m_scratch.size());
+    m_scratch.clear();
+    if(rt <= 0) {
+        return rt;
+    }
+    if(!body.empty() && sendResponseBody(body) < 0) {
+        return -1;
+    }
+    return rt;
+}
+
+/**
+ * 发送一块消息体
+ * chunked时每块是"长度(16进制)\r\n数据\r\n", 三段一次writev发送
+ */
+int64_t HttpSession::sendResponseBody(const void* data, size_t length) {
+    if(!m_streamRsp || m_streamEnd) {
+        return -1;
+    }
+    if(length == 0) { // 长度为0的块表示结束, 不能发送
+        return 0;
+    }
+    if(m_streamNoBody) { // 响应没有消息体, 丢弃
+        return length;
+    }
+    int64_t rt = 0;
+    if(m_streamChunked) {
+        char head[32];
+        iovec iovs[3];
+        iovs[0].iov_base = head;
+        iovs[0].iov_len = snprintf(head, sizeof(head), "%zx\r\n", length);
+        iovs[1].iov_base = (void*)data;
+        iovs[1].iov_len = length;
+        iovs[2].iov_base = (void*)"\r\n";
+        iovs[2].iov_len = 2;
+        rt = writevFixSize(iovs, 3);
+    } else {
+        if(m_streamLeft >= 0) {
+            if((int64_t)length > m_streamLeft) { // 超出Content-Length
+                return -1;
+            }
+            m_streamLeft -= length;
+        }
+        // writeFixSize返回int, 超过2G的一块会溢出成负数, 用一段的writev
+        iovec iov;
+        iov.iov_base = (void*)data;
+        iov.iov_len = length;
+        rt = writevFixSize(&iov, 1);
+    }
+    return rt > 0 ? (int64_t)length : -1;
+}
+
+/**
+ * 结束流式响应
+ * chunked时发送结尾的空块; Content-Length没有发够时对端无法判断消息边界, 标记关闭连接
+ */
+int HttpSession::sendResponseEnd() {
+    if(!m_streamRsp) {
+        return -1;
+    }
+    if(m_streamEnd) {
+        return 0;
+    }
+    m_streamEnd = true;
+    if(m_streamNoBody) {
+        return 0;
+    }
+    if(m_streamChunked) {
+        return writeFixSize("0\r\n\r\n", 5) > 0 ? 0 : -1;
+    }
+    if(m_streamLeft > 0) {
+        m_streamRsp->setClose(true);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 发送合并起来的响应
+ * 每个响应的头部和消息体各一段, 一次writev发送.
+ * 先把待发送的响应换出来, 避免writevFixSize调用writev时再次进入flush
+ */
+int HttpSession::flush() {
+    if(m_pending.empty()) {
+        return 0;
+    }
+    std::vector<std::pair<size_t, HttpResponse::ptr> > pending;
+    pending.swap(m_pending);
+    m_pendingSize = 0;
+
+    std::vector<iovec> iovs;
+    iovs.reserve(pending.size() * 2);
+    size_t begin = 0;
+    for(auto& i : pending) {
+        iovec iov;
+        iov.iov_base = &m_scratch[begin];
+        iov.iov_len = i.first - begin;
+        iovs.push_back(iov);
+        const std::string& body = i.second->getBody();
+        if(!body.empty()) {
+            iov.iov_base = (void*)body.c_str();
+            iov.iov_len = body.size();
+            iovs.push_back(iov);
+        }
+        begin = i.first;
+    }
+    int64_t rt = writevFixSize(&iovs[0], iovs.size());
+    // 只清空内容, 保留写缓冲区的容量给后面的响应复用
+    m_scratch.clear();
+    return rt > 0 ? rt : -1;
+}
+
+/**
+ * 从套接字读取数据追加到读缓冲区
+ * 读之前先把合并的响应发出去, 否则对端可能在等响应而不再发送数据
+ */
+int HttpSession::fill() {
+    if(flush() < 0) {
+        return -1;
+    }
+    int rt = SocketStream::read(m_buffer.get() + m_bufferLen, m_bufferSize - m_bufferLen);
+    if(rt > 0) {
+        m_bufferLen += rt;
+    }
+    return rt;
+}
+
+int HttpSession::read(void* buffer, size_t length) {
+    if(m_bufferLen > 0) {
+        size_t n = std::min(length, m_bufferLen);
+        memcpy(buffer, m_buffer.get(), n);
+        m_bufferLen -= n;
+        memmove(m_buffer.get(), m_buffer.get() + n, m_bufferLen);
+        return n;
+    }
+    if(flush() < 0) {
+        return -1;
+    }
+    return SocketStream::read(buffer, length);
+}
+
+int HttpSession::read(ByteArray::ptr ba, size_t length) {
+    if(m_bufferLen > 0) {
+        size_t n = std::min(length, m_bufferLen);
+        ba->write(m_buffer.get(), n);
+        m_bufferLen -= n;
+        memmove(m_buffer.get(), m_buffer.get() + n, m_bufferLen);
+        return n;
+    }
+    if(flush() < 0) {
+        return -1;
+    }
+    return SocketStream::read(ba, length);
+}
+
+int HttpSession::write(const void* buffer, size_t length) {
+    if(flush() < 0) {
+        return -1;
+    }
+    return SocketStream::write(buffer, length);
+}
+
+int HttpSession::write(ByteArray::ptr ba, size_t length) {
+    if(flush() < 0) {
+        return -1;
+    }
+    return SocketStream::write(ba, length);
+}
+
+int HttpSession::writev(const iovec* iov, size_t iovcnt) {
+    if(flush() < 0) {
+        return -1;
+    }
+    return SocketStream::writev(iov, iovcnt);
+}
+
+int64_t HttpSession::writeFile(int fd, off_t offset, size_t length) {
+    if(flush() < 0) {
+        return -1;
+    }
+    return SocketStream::writeFile(fd, offset, length);
+}
+
+int64_t HttpSession::spliceFrom(Stream::ptr in, size_t length) {
+    if(flush() < 0) {
+        return -1;
+    }
+    return SocketStream::spliceFrom(in, length);
+}
+
+/**
+ * 作为数据来源转发到out
+ * 读缓冲区中的数据(消息体或者流水线中的下一个请求)和100 Continue经内存中转,
+ * 之后才直接从socket splice; 消息体没有读完时最多转发到消息体结尾
  */
-int HttpSession::sendResponse(HttpResponse::ptr rsp) {
-    std::stringstream ss; // 创建字符串流ss
-    ss << *rsp; // 将HTTP响应写入字符串流
-    std::string data = ss.str(); // 获取字符串流的字符串表示形式
-    return writeFixSize(data.c_str(), data.size()); // 向套接字写入数据并返回发送的字节数
+int64_t HttpSession::spliceTo(SocketStream& out, size_t length) {
+    bool body = m_bodyLeft > 0;
+    if(body) {
+        length = std::min((uint64_t)length, m_bodyLeft);
+    }
+    if(m_bufferLen > 0 || m_expectContinue) {
+        std::vector<char> buf(std::min(length, (size_t)64 * 1024));
+        int n = body ? readBody(&buf[0], buf.size()) : read(&buf[0], buf.size());
+        if(n <= 0) {
+            return n;
+        }
+        if(out.writeFixSize(&buf[0], n) <= 0) {
+            return -1;
+        }
+        return n;
+    }
+    if(flush() < 0) {
+        return -1;
+    }
+    int64_t rt = SocketStream::spliceTo(out, length);
+    if(body) {
+        if(rt <= 0) { // 消息体没有读完连接就断开了
+            return -1;
+        }
+        m_bodyLeft -= rt;
+    }
+    return rt;
 }
 
+void HttpSession::close() {
+    if(!m_pending.empty() && isConnected()) {
+        flush();
+    }
+    SocketStream::close();
+}
 
 }
 }
@@ -16,8 +16,75 @@
 namespace webserver {
 namespace http {
 
+class HttpRequestParser;
+class HttpSession;
+
+/**
+ * @brief 请求消息体流
+ * @details 流式读取消息体的servlet(Servlet::setStreamBody)在handle中通过HttpSession::getBodyStream得到,
+ *          按Content-Length从连接中增量读取, 消息体读完时read返回0.
+ *          只在处理当前请求期间有效
+ */
+class HttpBodyStream : public Stream {
+public:
+    /// 智能指针类型定义
+    typedef std::shared_ptr<HttpBodyStream> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] session 所属的HttpSession
+     */
+    HttpBodyStream(HttpSession* session);
+
+    /**
+     * @brief 读取消息体
+     * @return >0 读到的长度, =0 消息体已经读完, <0 连接出错或消息体不完整
+     */
+    virtual int read(void* buffer, size_t length) override;
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 消息体流不可写, 返回-1
+     */
+    virtual int write(const void* buffer, size_t length) override { return -1;}
+    virtual int write(ByteArray::ptr ba, size_t length) override { return -1;}
+
+    /**
+     * @brief 不关闭连接, 未读的消息体由HttpServer处理
+     */
+    virtual void close() override {}
+
+    /**
+     * @brief 消息体总长度(Content-Length)
+     */
+    uint64_t getLength() const { return m_length;}
+
+    /**
+     * @brief 剩余没有读取的长度
+     */
+    uint64_t getLeft() const;
+
+    /**
+     * @brief 把剩余的消息体写入文件, 用于接收不适合放在内存中的大文件
+     * @details 文件写入通过offload在阻塞任务线程池中执行
+     * @param[in] path 文件路径, 已存在时覆盖
+     * @return >=0 写入的长度, <0 失败
+     */
+    int64_t saveToFile(const std::string& path);
+private:
+    /// 所属的HttpSession
+    HttpSession* m_session;
+    /// 消息体总长度
+    uint64_t m_length;
+};
+
 /**
  * @brief HTTPSession封装
+ * @details 读缓冲区和解析器跟随连接, 在多个请求之间复用:
+ *          一次read读到的下一个请求(HTTP/1.1流水线)的数据留在缓冲区里, 由下一次recvRequest继续解析;
+ *          read会先消费缓冲区里剩余的数据, 再从socket读取.
+ *          sendResponse只把状态行和头部序列化到连接复用的写缓冲区, 和消息体一起writev发送, 消息体不拷贝;
+ *          响应可以先合并起来, 在下一次从socket读取, 写其他数据或关闭前一次性发出.
  */
 class HttpSession : public SocketStream {
 public:
@@ -32,18 +99,167 @@ public:
     HttpSession(Socket::ptr sock, bool owner = true);
 
     /**
-     * @brief 接收HTTP请求
+     * @brief 接收HTTP请求(包括完整的消息体)
      */
     HttpRequest::ptr recvRequest();
 
+    /**
+     * @brief 只接收HTTP请求行和头部, 消息体由recvRequestBody或getBodyStream读取
+     * @return 失败时关闭连接并返回nullptr
+     */
+    HttpRequest::ptr recvRequestHeader();
+
+    /**
+     * @brief 把剩余的消息体全部读入req
+     * @return 0 成功, -1 读取失败, -2 消息体超过http.request.max_body_size
+     */
+    int recvRequestBody(HttpRequest::ptr req);
+
+    /**
+     * @brief 当前请求的消息体流, 同一个请求多次调用返回同一个对象
+     */
+    HttpBodyStream::ptr getBodyStream();
+
+    /**
+     * @brief 读取当前请求的消息体, 最多读到消息体结尾
+     * @details 请求带Expect: 100-continue时, 第一次读取前先发送100 Continue
+     * @return >0 读到的长度, =0 消息体已经读完, <0 连接出错或消息体不完整
+     */
+    int readBody(void* buffer, size_t length);
+
+    /**
+     * @brief 当前请求剩余没有读取的消息体长度
+     */
+    uint64_t getBodyLeft() const { return m_bodyLeft;}
+
+    /**
+     * @brief 丢弃剩余的消息体, 使连接可以继续处理下一个请求
+     * @param[in] max 最多丢弃的长度
+     * @return 是否丢弃成功. 超过max, 对端还在等100 Continue或读取失败时返回false, 连接只能关闭
+     */
+    bool skipBody(uint64_t max);
+
     /**
      * @brief 发送HTTP响应
      * @param[in] rsp HTTP响应
-     * @return >0 发送成功
+     * @param[in] more 后面还有响应要发送, 为true时先合并到待发送数据中
+     * @return >0 发送成功(或已合并)
      *         =0 对方关闭
      *         <0 Socket异常
      */
-    int sendResponse(HttpResponse::ptr rsp);
+    int sendResponse(HttpResponse::ptr rsp, bool more = false);
+
+    /**
+     * @brief 开始流式发送响应: 先发送状态行和头部, 消息体用sendResponseBody分块发送
+     * @details length>=0时用Content-Length, 否则用Transfer-Encoding: chunked
+     *          (HTTP/1.0不支持chunked, 改为发送完后关闭连接).
+     *          HEAD请求以及1xx, 204, 304响应没有消息体(RFC 9112 6.3): 不设置Transfer-Encoding,
+     *          204和1xx也不设置Content-Length, 之后sendResponseBody的数据直接丢弃.
+     *          rsp中已经设置的消息体作为第一块发送.
+     *          之后HttpServer不会再发送rsp, servlet没有调用sendResponseEnd时由HttpServer补上
+     * @param[in] rsp HTTP响应
+     * @param[in] length 消息体长度, -1表示未知
+     * @return >0 发送成功, =0 对方关闭, <0 Socket异常
+     */
+    int sendResponseHeader(HttpResponse::ptr rsp, int64_t length = -1);
+
+    /**
+     * @brief 发送一块消息体
+     * @details 数据全部写入socket才返回, socket发送缓冲区满时挂起当前协程, 生成数据的速度受对端接收速度限制
+     * @param[in] data 数据
+     * @param[in] length 数据长度, 超过Content-Length剩余长度时失败
+     * @return >=0 发送(响应没有消息体时丢弃)的消息体长度, <0 对方关闭, Socket异常或超出长度
+     */
+    int64_t sendResponseBody(const void* data, size_t length);
+    int64_t sendResponseBody(const std::string& data) { return sendResponseBody(data.c_str(), data.size());}
+
+    /**
+     * @brief 结束流式响应, chunked时发送结尾的空块
+     * @details Content-Length没有发够时标记响应需要关闭连接
+     * @return >=0 成功, <0 失败
+     */
+    int sendResponseEnd();
+
+    /**
+     * @brief rsp是否已经通过sendResponseHeader开始流式发送
+     */
+    bool isStreamResponse(HttpResponse::ptr rsp) const { return m_streamRsp && m_streamRsp == rsp;}
+
+    /**
+     * @brief 发送合并起来的响应
+     * @return >0 发送的字节数, =0 没有待发送的数据, <0 发送失败
+     */
+    int flush();
+
+    /**
+     * @brief 读缓冲区中是否还有没有处理的数据(流水线中的下一个请求)
+     */
+    bool hasBufferedData() const { return m_bufferLen > 0;}
+
+    /**
+     * @brief 读取数据, 先消费读缓冲区中剩余的数据
+     */
+    virtual int read(void* buffer, size_t length) override;
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 写数据, 先发送合并起来的响应
+     */
+    virtual int write(const void* buffer, size_t length) override;
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+    virtual int writev(const iovec* iov, size_t iovcnt) override;
+    virtual int64_t writeFile(int fd, off_t offset, size_t length) override;
+    virtual int64_t spliceFrom(Stream::ptr in, size_t length) override;
+
+    /**
+     * @brief 作为数据来源转发到out
+     * @details 先转发读缓冲区中剩余的数据; 消息体没有读完时只转发消息体, 并扣减剩余长度
+     */
+    virtual int64_t spliceTo(SocketStream& out, size_t length) override;
+
+    /**
+     * @brief 发送合并起来的响应后关闭
+     */
+    virtual void close() override;
+private:
+    /**
+     * @brief 从socket读取数据追加到读缓冲区
+     * @return >0 读取的字节数, <=0 失败或对方关闭
+     */
+    int fill();
+private:
+    /// 请求解析器, 每个请求前reset
+    std::shared_ptr<HttpRequestParser> m_parser;
+    /// 读缓冲区
+    std::shared_ptr<char> m_buffer;
+    /// 读缓冲区大小
+    uint64_t m_bufferSize;
+    /// 读缓冲区中未处理的数据长度
+    size_t m_bufferLen;
+    /// 写缓冲区, 复用来存放待发送响应的状态行和头部
+    std::string m_scratch;
+    /// 合并起来待发送的响应<头部在m_scratch中的结束位置, 响应>, 消息体直接引用响应的内存
+    std::vector<std::pair<size_t, HttpResponse::ptr> > m_pending;
+    /// 待发送的数据大小
+    size_t m_pendingSize;
+    /// 当前请求剩余没有读取的消息体长度
+    uint64_t m_bodyLeft;
+    /// 对端在等100 Continue
+    bool m_expectContinue;
+    /// 当前请求的消息体流
+    HttpBodyStream::ptr m_bodyStream;
+    /// 正在(或已经)流式发送的响应
+    HttpResponse::ptr m_streamRsp;
+    /// Content-Length剩余的长度, -1表示没有Content-Length
+    int64_t m_streamLeft;
+    /// 是否chunked
+    bool m_streamChunked;
+    /// 是否已经结束
+    bool m_streamEnd;
+    /// 响应没有消息体(HEAD请求, 1xx, 204, 304)
+    bool m_streamNoBody;
+    /// 当前请求是否为HEAD
+    bool m_headRequest;
 };
 
 }
@@ -1,9 +1,14 @@
 #include "servlet.h"
+#include "src/log.h"
+#include "src/macro.h"
 #include <fnmatch.h>
+#include <algorithm>
 
 namespace webserver {
 namespace http {
 
+static webserver::Logger::ptr g_logger = WEBSERVER_LOG_NAME("system");
+
 /**
  * 描述：构造函数
  * 功能：创建FunctionServlet对象并初始化。
@@ -34,18 +39,398 @@ int32_t FunctionServlet::handle(webserver::http::HttpRequest::ptr request
     return m_cb(request, response, session);
 }
 
+/**
+ * 路由前缀树节点, 每个节点对应路由中的一段
+ */
+struct RouteNode {
+    typedef std::shared_ptr<RouteNode> ptr;
+    /// <方法(-1表示所有方法), servlet创建器>
+    typedef std::vector<std::pair<int, IServletCreator::ptr> > Handlers;
+
+    /// 静态段子节点, 按段排序
+    std::vector<std::pair<std::string, RouteNode::ptr> > statics;
+    /// 参数段(:name)子节点
+    RouteNode::ptr param;
+    /// 参数名
+    std::string paramName;
+    /// 结尾的通配段(*name)
+    Handlers wildcard;
+    /// 通配段的参数名, 可以为空
+    std::string wildcardName;
+    /// 在这个节点结束的路由
+    Handlers handlers;
+};
+
+/**
+ * 模糊匹配前缀树节点, 每个节点对应一个字符
+ */
+struct GlobNode {
+    typedef std::shared_ptr<GlobNode> ptr;
+    /// 子节点
+    std::vector<std::pair<char, GlobNode::ptr> > children;
+    /// 以这个前缀结束的模糊匹配在globs中的下标, -1表示没有
+    int index = -1;
+};
+
+/**
+ * 路由中的一段, 查找静态子节点时不必构造std::string
+ */
+struct Segment {
+    const char* data;
+    size_t size;
+};
+
+static bool SegmentLess(const std::pair<std::string, RouteNode::ptr>& n, const Segment& seg) {
+    return n.first.compare(0, std::string::npos, seg.data, seg.size) < 0;
+}
+
+/**
+ * 设置方法对应的处理者, 同一个方法重复设置时覆盖
+ */
+static void SetHandler(RouteNode::Handlers& hs, int method, IServletCreator::ptr creator) {
+    for(auto& i : hs) {
+        if(i.first == method) {
+            i.second = creator;
+            return;
+        }
+    }
+    hs.push_back(std::make_pair(method, creator));
+}
+
+/**
+ * 选择处理者: 优先指定的方法, 其次匹配所有方法的; method为-1(不区分方法)时取第一个
+ */
+static const IServletCreator::ptr* PickHandler(const RouteNode::Handlers& hs, int method) {
+    const IServletCreator::ptr* any = nullptr;
+    for(auto& i : hs) {
+        if(i.first == method) {
+            return &i.second;
+        }
+        if(i.first == -1) {
+            any = &i.second;
+        }
+    }
+    if(!any && method == -1 && !hs.empty()) {
+        return &hs[0].second;
+    }
+    return any;
+}
+
+/**
+ * 把路由插入前缀树
+ * 返回值：路由是否合法(以'/'开头, 参数名非空, 通配段在最后, 同一位置的参数名一致)
+ */
+static bool InsertRoute(RouteNode::ptr root, int method, const std::string& path, IServletCreator::ptr creator) {
+    if(path.empty() || path[0] != '/') {
+        return false;
+    }
+    RouteNode* node = root.get();
+    size_t pos = 1;
+    while(pos != std::string::npos) {
+        size_t end = path.find('/', pos);
+        size_t next = end == std::string::npos ? end : end + 1;
+        std::string seg = path.substr(pos, (end == std::string::npos ? path.size() : end) - pos);
+        pos = next;
+        if(!seg.empty() && seg[0] == ':') {
+            std::string name = seg.substr(1);
+            if(name.empty()) {
+                return false;
+            }
+            if(!node->param) {
+                node->param.reset(new RouteNode);
+                node->paramName = name;
+            } else if(node->paramName != name) {
+                return false;
+            }
+            node = node->param.get();
+        } else if(!seg.empty() && seg[0] == '*') {
+            if(pos != std::string::npos) { // 通配段只能在最后
+                return false;
+            }
+            std::string name = seg.substr(1);
+            if(!node->wildcard.empty() && node->wildcardName != name) {
+                return false;
+            }
+            node->wildcardName = name;
+            SetHandler(node->wildcard, method, creator);
+            return true;
+        } else {
+            Segment key = {seg.c_str(), seg.size()};
+            auto it = std::lower_bound(node->statics.begin(), node->statics.end(), key, SegmentLess);
+            if(it == node->statics.end() || it->first != seg) {
+                it = node->statics.insert(it, std::make_pair(seg, std::make_shared<RouteNode>()));
+            }
+            node = it->second.get();
+        }
+    }
+    SetHandler(node->handlers, method, creator);
+    return true;
+}
+
+/**
+ * 在前缀树中查找路由, 从path的pos位置开始匹配
+ * 每一段依次尝试静态段, 参数段, 通配段, 后面的段匹配不上时回溯
+ */
+static const IServletCreator::ptr* MatchRoute(const RouteNode* node, const std::string& path, size_t pos
+                        , int method, std::vector<std::pair<std::string, std::string> >& params) {
+    if(pos == std::string::npos) {
+        return PickHandler(node->handlers, method);
+    }
+    size_t end = path.find('/', pos);
+    size_t next = end == std::string::npos ? end : end + 1;
+    if(end == std::string::npos) {
+        end = path.size();
+    }
+    const IServletCreator::ptr* rt = nullptr;
+    // 静态段
+    Segment key = {path.c_str() + pos, end - pos};
+    auto it = std::lower_bound(node->statics.begin(), node->statics.end(), key, SegmentLess);
+    if(it != node->statics.end() && it->first.compare(0, std::string::npos, key.data, key.size) == 0) {
+        rt = MatchRoute(it->second.get(), path, next, method, params);
+        if(rt) {
+            return rt;
+        }
+    }
+    // 参数段, 不匹配空段
+    if(node->param && end > pos) {
+        params.push_back(std::make_pair(node->paramName, path.substr(pos, end - pos)));
+        rt = MatchRoute(node->param.get(), path, next, method, params);
+        if(rt) {
+            return rt;
+        }
+        params.pop_back();
+    }
+    // 通配段, 匹配剩余的全部路径
+    if(!node->wildcard.empty()) {
+        rt = PickHandler(node->wildcard, method);
+        if(rt && !node->wildcardName.empty()) {
+            params.push_back(std::make_pair(node->wildcardName, path.substr(pos)));
+        }
+    }
+    return rt;
+}
+
+/**
+ * 模糊匹配是否只是前缀匹配(/prefix*), 可以放入前缀树
+ */
+static bool IsPrefixGlob(const std::string& pattern) {
+    if(pattern.empty() || pattern[pattern.size() - 1] != '*') {
+        return false;
+    }
+    return pattern.find_first_of("*?[\\") == pattern.size() - 1;
+}
+
+/**
+ * 路由表
+ * 精准匹配, 模糊匹配和路由按添加顺序保存.
+ * 主表只用routeRoot检查新路由是否合法; 快照复制主表的数据后由build生成查找用的前缀树,
+ * 发布之后只读, 多个线程可以同时查找
+ */
+struct ServletDispatch::RouteTable {
+    /// 路由
+    struct Route {
+        /// HTTP方法, -1表示所有方法
+        int method;
+        /// 路由
+        std::string path;
+        /// servlet创建器
+        IServletCreator::ptr creator;
+    };
+
+    /// 精准匹配servlet MAP
+    /// uri(/webserver/xxx) -> servlet
+    std::unordered_map<std::string, IServletCreator::ptr> datas;
+    /// 模糊匹配servlet 数组
+    /// uri(/webserver/*) -> servlet
+    std::vector<std::pair<std::string, IServletCreator::ptr> > globs;
+    /// 路由数组
+    std::vector<Route> routes;
+
+    /// 路由前缀树
+    RouteNode::ptr routeRoot = std::make_shared<RouteNode>();
+    /// 前缀匹配的模糊匹配前缀树
+    GlobNode::ptr globRoot = std::make_shared<GlobNode>();
+    /// 其他模糊匹配在globs中的下标, 从小到大
+    std::vector<size_t> complexGlobs;
+
+    /**
+     * 添加或覆盖路由, 同时插入routeRoot检查格式
+     * 返回值：路由格式是否合法, 不合法时路由表不变
+     */
+    bool addRoute(int method, const std::string& path, IServletCreator::ptr creator) {
+        if(!InsertRoute(routeRoot, method, path, creator)) {
+            WEBSERVER_LOG_ERROR(g_logger) << "invalid route: " << path;
+            // 插入失败前可能已经建了部分节点, 按原来的路由重建
+            buildRoutes();
+            return false;
+        }
+        for(auto& r : routes) {
+            if(r.method == method && r.path == path) {
+                r.creator = creator;
+                return true;
+            }
+        }
+        Route r = {method, path, creator};
+        routes.push_back(r);
+        return true;
+    }
+
+    /**
+     * 按routes重新生成路由前缀树
+     */
+    void buildRoutes() {
+        routeRoot = std::make_shared<RouteNode>();
+        for(auto& r : routes) {
+            InsertRoute(routeRoot, r.method, r.path, r.creator);
+        }
+    }
+
+    /**
+     * 生成查找用的前缀树, 快照发布之前调用一次
+     */
+    void build() {
+        buildRoutes();
+        globRoot = std::make_shared<GlobNode>();
+        complexGlobs.clear();
+        for(size_t i = 0; i < globs.size(); ++i) {
+            const std::string& pattern = globs[i].first;
+            if(!IsPrefixGlob(pattern)) {
+                complexGlobs.push_back(i);
+                continue;
+            }
+            GlobNode* node = globRoot.get();
+            for(size_t n = 0; n < pattern.size() - 1; ++n) {
+                GlobNode::ptr child;
+                for(auto& c : node->children) {
+                    if(c.first == pattern[n]) {
+                        child = c.second;
+                        break;
+                    }
+                }
+                if(!child) {
+                    child = std::make_shared<GlobNode>();
+                    node->children.push_back(std::make_pair(pattern[n], child));
+                }
+                node = child.get();
+            }
+            node->index = i;
+        }
+    }
+
+    /**
+     * 查找路由
+     */
+    const IServletCreator::ptr* matchRoute(const std::string& path, int method
+                    , std::vector<std::pair<std::string, std::string> >& params) const {
+        if(path.empty() || path[0] != '/') {
+            return nullptr;
+        }
+        return MatchRoute(routeRoot.get(), path, 1, method, params);
+    }
+
+    /**
+     * 查找模糊匹配, 结果与按添加顺序依次fnmatch相同
+     * 返回值：匹配到的模糊匹配在globs中的下标, -1表示没有
+     */
+    int matchGlob(const std::string& uri) const {
+        const GlobNode* node = globRoot.get();
+        int best = node->index;
+        for(size_t n = 0; n < uri.size(); ++n) {
+            const GlobNode* child = nullptr;
+            for(auto& c : node->children) {
+                if(c.first == uri[n]) {
+                    child = c.second.get();
+                    break;
+                }
+            }
+            if(!child) {
+                break;
+            }
+            node = child;
+            if(node->index >= 0 && (best < 0 || node->index < best)) {
+                best = node->index;
+            }
+        }
+        // 添加顺序在best之前的其他模糊匹配优先
+        for(size_t i : complexGlobs) {
+            if(best >= 0 && (int)i > best) {
+                break;
+            }
+            if(!fnmatch(globs[i].first.c_str(), uri.c_str(), 0)) {
+                return i;
+            }
+        }
+        return best;
+    }
+};
+
 /**
  * 描述：构造函数
  * 功能：创建ServletDispatch对象并初始化。
  * 详细描述：
  *  - 调用基类Servlet的构造函数，设置Servlet的名称为"ServletDispatch"。
+ *  - 创建空的路由表。
  *  - 创建默认的NotFoundServlet，并交给智能指针管理。
  */
 ServletDispatch::ServletDispatch()
-    :Servlet("ServletDispatch") {
+    :Servlet("ServletDispatch")
+    ,m_master(std::make_shared<RouteTable>())
+    ,m_table(new RouteTable)
+    ,m_dirty(false) {
     m_default.reset(new NotFoundServlet("webserver/1.0"));
 }
 
+/**
+ * 描述：析构函数
+ * 详细描述：
+ *  - 释放当前的快照和所有被替换的快照，此时不能再有线程在查找。
+ */
+ServletDispatch::~ServletDispatch() {
+    delete m_table.load(std::memory_order_relaxed);
+    for(auto i : m_retired) {
+        delete i;
+    }
+}
+
+/**
+ * 描述：修改主表
+ * 详细描述：
+ *  - 加互斥锁，同时只有一个修改者。
+ *  - 直接修改主表，成功时标记快照需要重建，由下一次查找重建。
+ *  - 连续修改只重建一次快照，批量添加N条路由的开销是O(N)而不是O(N^2)。
+ */
+bool ServletDispatch::update(std::function<bool(RouteTable& table)> cb) {
+    MutexType::Lock lock(m_mutex); // 加互斥锁
+    if(!cb(*m_master)) {
+        return false;
+    }
+    m_dirty = true;
+    return true;
+}
+
+/**
+ * 描述：获取当前的只读快照
+ * 详细描述：
+ *  - 主表没有修改时只是两次原子读，不加锁也不修改共享的引用计数。
+ *  - 主表修改过时加锁，复制主表的数据并生成前缀树，用release发布。
+ *  - 查找者看到的要么是旧快照，要么是完整的新快照；旧快照可能还在被读取，放入m_retired。
+ */
+const ServletDispatch::RouteTable* ServletDispatch::getTable() {
+    if(WEBSERVER_UNLIKELY(m_dirty.load(std::memory_order_acquire))) {
+        MutexType::Lock lock(m_mutex);
+        if(m_dirty.load(std::memory_order_relaxed)) {
+            RouteTable* table = new RouteTable;
+            table->datas = m_master->datas;
+            table->globs = m_master->globs;
+            table->routes = m_master->routes;
+            table->build();
+            m_retired.push_back(m_table.exchange(table, std::memory_order_acq_rel));
+            m_dirty.store(false, std::memory_order_relaxed);
+        }
+    }
+    return m_table.load(std::memory_order_acquire);
+}
+
 /**
  * 描述：处理HTTP请求
  * 参数：
@@ -54,12 +439,12 @@ ServletDispatch::ServletDispatch()
  *   - session: 指向HttpSession对象的智能指针，表示HTTP会话。
  * 返回值：int32_t类型，表示处理结果，一般为0。
  * 详细描述：
- *  - 获取匹配的Servlet，并调用其处理函数处理HTTP请求。
+ *  - 按请求的路径和方法获取匹配的Servlet，并调用其处理函数处理HTTP请求。
  */
 int32_t ServletDispatch::handle(webserver::http::HttpRequest::ptr request
                , webserver::http::HttpResponse::ptr response
                , webserver::http::HttpSession::ptr session) {
-    auto slt = getMatchedServlet(request->getPath()); // 获取匹配的Servlet
+    auto slt = getMatchedServlet(request); // 获取匹配的Servlet
     if(slt) { // 如果找到匹配的Servlet
         slt->handle(request, response, session); // 调用其处理函数处理HTTP请求
     }
@@ -74,12 +459,10 @@ int32_t ServletDispatch::handle(webserver::http::HttpRequest::ptr request
  *   - uri: const std::string&类型，表示要添加的URI。
  *   - slt: Servlet::ptr类型，表示要添加的Servlet。
  * 详细描述：
- *  - 加写锁，保护共享资源m_datas。
- *  - 将URI与Servlet的映射关系存储到m_datas中。
+ *  - 将URI与Servlet的映射关系存储到主表的datas中。
  */
 void ServletDispatch::addServlet(const std::string& uri, Servlet::ptr slt) {
-    RWMutexType::WriteLock lock(m_mutex); // 加写锁
-    m_datas[uri] = std::make_shared<HoldServletCreator>(slt); // 存储URI与Servlet的映射关系
+    addServletCreator(uri, std::make_shared<HoldServletCreator>(slt));
 }
 
 /**
@@ -88,12 +471,13 @@ void ServletDispatch::addServlet(const std::string& uri, Servlet::ptr slt) {
  *   - uri: const std::string&类型，表示要添加的URI。
  *   - creator: IServletCreator::ptr类型，表示要添加的Servlet创建器。
  * 详细描述：
- *  - 加写锁，保护共享资源m_datas。
- *  - 将URI与Servlet创建器的映射关系存储到m_datas中。
+ *  - 将URI与Servlet创建器的映射关系存储到主表的datas中。
  */
 void ServletDispatch::addServletCreator(const std::string& uri, IServletCreator::ptr creator) {
-    RWMutexType::WriteLock lock(m_mutex); // 加写锁
-    m_datas[uri] = creator; // 存储URI与Servlet创建器的映射关系
+    update([&uri, &creator](RouteTable& t) {
+        t.datas[uri] = creator; // 存储URI与Servlet创建器的映射关系
+        return true;
+    });
 }
 
 /**
@@ -102,112 +486,143 @@ void ServletDispatch::addServletCreator(const std::string& uri, IServletCreator:
  *   - uri: const std::string&类型，表示要添加的URI模式。
  *   - creator: IServletCreator::ptr类型，表示要添加的Servlet创建器。
  * 详细描述：
- *  - 加写锁，保护共享资源m_globs。
- *  - 遍历m_globs，如果已存在相同URI模式，则先移除原有的。
- *  - 将URI模式与Servlet创建器的映射关系存储到m_globs中。
+ *  - 如果已存在相同的URI模式，先移除原有的。
+ *  - 将URI模式与Servlet创建器的映射关系追加到主表的globs中。
  */
 void ServletDispatch::addGlobServletCreator(const std::string& uri, IServletCreator::ptr creator) {
-    RWMutexType::WriteLock lock(m_mutex); // 加写锁
-    for(auto it = m_globs.begin();
-            it != m_globs.end(); ++it) {
-        if(it->first == uri) { // 如果已存在相同URI模式
-            m_globs.erase(it); // 先移除原有的
-            break;
+    update([&uri, &creator](RouteTable& t) {
+        for(auto it = t.globs.begin();
+                it != t.globs.end(); ++it) {
+            if(it->first == uri) { // 如果已存在相同URI模式
+                t.globs.erase(it); // 先移除原有的
+                break;
+            }
         }
-    }
-    m_globs.push_back(std::make_pair(uri, creator)); // 存储URI模式与Servlet创建器的映射关系
+        t.globs.push_back(std::make_pair(uri, creator)); // 存储URI模式与Servlet创建器的映射关系
+        return true;
+    });
 }
 
 /**
- * 构造函数
- * 
- * 添加精准Servlet，回调函数
+ * 描述：添加指定URI的函数式Servlet
  * 参数：
- *   - cb: FunctionServlet::callback类型的回调函数
- * 详细描述：
- *  - 使用提供的回调函数创建一个FunctionServlet对象，并将其添加到ServletDispatch中。
+ *   - uri: const std::string&类型，表示要添加的URI。
+ *   - cb: FunctionServlet::callback类型，表示回调函数。
  */
 void ServletDispatch::addServlet(const std::string& uri
                         ,FunctionServlet::callback cb) {
-    RWMutexType::WriteLock lock(m_mutex); // 加写锁
-    m_datas[uri] = std::make_shared<HoldServletCreator>( // 将FunctionServlet对象添加到m_datas中
-                        std::make_shared<FunctionServlet>(cb));
+    addServlet(uri, std::make_shared<FunctionServlet>(cb));
 }
 
 /**
- * 添加全局Servlet
- * 添加模糊Servlet，智能指针
- * 
+ * 描述：添加模糊匹配的Servlet
  * 参数：
- *   - uri: 表示要匹配的URI
- *   - slt: 指向Servlet对象的智能指针
- * 详细描述：
- *  - 将提供的Servlet对象添加到m_globs中，以匹配uri。
+ *   - uri: const std::string&类型，表示要添加的URI模式。
+ *   - slt: Servlet::ptr类型，表示要添加的Servlet。
  */
 void ServletDispatch::addGlobServlet(const std::string& uri
                                     ,Servlet::ptr slt) {
-    RWMutexType::WriteLock lock(m_mutex); // 加写锁
-    for(auto it = m_globs.begin(); // 遍历m_globs
-            it != m_globs.end(); ++it) {
-        if(it->first == uri) { // 如果找到相同uri的Servlet，删除之
-            m_globs.erase(it);
-            break;
-        }
-    }
-    m_globs.push_back(std::make_pair(uri // 将提供的Servlet对象添加到m_globs中
-                , std::make_shared<HoldServletCreator>(slt)));
+    addGlobServletCreator(uri, std::make_shared<HoldServletCreator>(slt));
 }
 
 /**
- * 添加全局FunctionServlet
- * 添加模糊Servlet，回调函数
- * 
+ * 描述：添加模糊匹配的函数式Servlet
  * 参数：
- *   - uri: 表示要匹配的URI
- *   - cb: FunctionServlet::callback类型的回调函数
- * 详细描述：
- *  - 使用提供的回调函数创建一个FunctionServlet对象，并将其作为Servlet对象添加到m_globs中，以匹配uri。
+ *   - uri: const std::string&类型，表示要添加的URI模式。
+ *   - cb: FunctionServlet::callback类型，表示回调函数。
  */
 void ServletDispatch::addGlobServlet(const std::string& uri
                                 ,FunctionServlet::callback cb) {
     return addGlobServlet(uri, std::make_shared<FunctionServlet>(cb)); // 调用上面的addGlobServlet函数
 }
 
+bool ServletDispatch::addRoute(const std::string& path, Servlet::ptr slt) {
+    return addRouteCreator(HttpMethod::INVALID_METHOD, path, std::make_shared<HoldServletCreator>(slt));
+}
+
+bool ServletDispatch::addRoute(const std::string& path, FunctionServlet::callback cb) {
+    return addRoute(path, std::make_shared<FunctionServlet>(cb));
+}
+
+bool ServletDispatch::addRoute(HttpMethod method, const std::string& path, Servlet::ptr slt) {
+    return addRouteCreator(method, path, std::make_shared<HoldServletCreator>(slt));
+}
+
+bool ServletDispatch::addRoute(HttpMethod method, const std::string& path, FunctionServlet::callback cb) {
+    return addRoute(method, path, std::make_shared<FunctionServlet>(cb));
+}
+
 /**
- * 删除指定URI的Servlet
- * 删除精准Servlet
- * 
+ * 描述：添加路由
  * 参数：
- *   - uri: 表示要删除的URI
+ *   - method: HTTP方法，INVALID_METHOD表示所有方法。
+ *   - path: 路由，支持静态段、:param参数段和结尾的*通配段。
+ *   - creator: Servlet创建器。
+ * 返回值：路由格式是否合法，不合法时路由表不变。
  * 详细描述：
- *  - 从m_datas中删除指定URI的Servlet。
+ *  - 相同方法和路由已存在时覆盖。
+ */
+bool ServletDispatch::addRouteCreator(HttpMethod method, const std::string& path, IServletCreator::ptr creator) {
+    int m = method == HttpMethod::INVALID_METHOD ? -1 : (int)method;
+    return update([m, &path, &creator](RouteTable& t) {
+        return t.addRoute(m, path, creator);
+    });
+}
+
+void ServletDispatch::delRoute(const std::string& path) {
+    update([&path](RouteTable& t) {
+        for(auto it = t.routes.begin(); it != t.routes.end();) {
+            if(it->path == path) {
+                it = t.routes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        t.buildRoutes();
+        return true;
+    });
+}
+
+void ServletDispatch::delRoute(HttpMethod method, const std::string& path) {
+    int m = method == HttpMethod::INVALID_METHOD ? -1 : (int)method;
+    update([m, &path](RouteTable& t) {
+        for(auto it = t.routes.begin(); it != t.routes.end(); ++it) {
+            if(it->method == m && it->path == path) {
+                t.routes.erase(it);
+                break;
+            }
+        }
+        t.buildRoutes();
+        return true;
+    });
+}
+
+/**
+ * 描述：删除指定URI的Servlet
  */
 void ServletDispatch::delServlet(const std::string& uri) {
-    RWMutexType::WriteLock lock(m_mutex); // 加写锁
-    m_datas.erase(uri); // 删除指定URI的Servlet
+    update([&uri](RouteTable& t) {
+        t.datas.erase(uri); // 删除指定URI的Servlet
+        return true;
+    });
 }
 
 /**
- * 删除指定URI的全局Servlet
- * 删除模糊Servlet
- * 
- * 参数：
- *   - uri: 表示要删除的URI
- * 详细描述：
- *  - 从m_globs中删除指定URI的全局Servlet。
+ * 描述：删除指定URI模式的模糊匹配Servlet
  */
 void ServletDispatch::delGlobServlet(const std::string& uri) {
-    RWMutexType::WriteLock lock(m_mutex); // 加写锁
-    for(auto it = m_globs.begin(); // 遍历m_globs
-            it != m_globs.end(); ++it) {
-        if(it->first == uri) { // 如果找到相同uri的全局Servlet，删除之
-            m_globs.erase(it);
-            break;
+    update([&uri](RouteTable& t) {
+        for(auto it = t.globs.begin(); // 遍历globs
+                it != t.globs.end(); ++it) {
+            if(it->first == uri) { // 如果找到相同uri的全局Servlet，删除之
+                t.globs.erase(it);
+                break;
+            }
         }
-    }
+        return true;
+    });
 }
 
-
 /**
  * 获取指定URI的Servlet
  * 参数：
@@ -215,29 +630,29 @@ void ServletDispatch::delGlobServlet(const std::string& uri) {
  * 返回值：
  *   - 返回指向Servlet对象的智能指针
  * 详细描述：
- *  - 使用读锁锁定m_mutex，查找指定URI的Servlet。
+ *  - 在当前的只读快照中查找指定URI的Servlet，不加锁。
  *  - 如果找到，返回对应的Servlet对象；否则返回nullptr。
  */
 Servlet::ptr ServletDispatch::getServlet(const std::string& uri) {
-    RWMutexType::ReadLock lock(m_mutex); // 加读锁
-    auto it = m_datas.find(uri); // 在m_datas中查找指定URI的Servlet
-    return it == m_datas.end() ? nullptr : it->second->get(); // 返回找到的Servlet对象，如果不存在则返回nullptr
+    const RouteTable* t = getTable();
+    auto it = t->datas.find(uri); // 在datas中查找指定URI的Servlet
+    return it == t->datas.end() ? nullptr : it->second->get(); // 返回找到的Servlet对象，如果不存在则返回nullptr
 }
 
 /**
- * 获取匹配的全局Servlet
+ * 获取指定URI模式的全局Servlet
  * 参数：
- *   - uri: 表示要匹配的URI
+ *   - uri: 表示URI模式
  * 返回值：
  *   - 返回指向Servlet对象的智能指针
  * 详细描述：
- *  - 使用读锁锁定m_mutex，遍历m_globs查找匹配的全局Servlet。
- *  - 如果找到匹配的URI，返回对应的Servlet对象；否则返回nullptr。
+ *  - 在当前路由表的globs中查找相同的URI模式。
+ *  - 如果找到，返回对应的Servlet对象；否则返回nullptr。
  */
 Servlet::ptr ServletDispatch::getGlobServlet(const std::string& uri) {
-    RWMutexType::ReadLock lock(m_mutex); // 加读锁
-    for(auto it = m_globs.begin(); // 遍历m_globs
-            it != m_globs.end(); ++it) {
+    const RouteTable* t = getTable();
+    for(auto it = t->globs.begin(); // 遍历globs
+            it != t->globs.end(); ++it) {
         if(it->first == uri) { // 如果找到相同uri的全局Servlet
             return it->second->get(); // 返回对应的Servlet对象
         }
@@ -252,35 +667,70 @@ Servlet::ptr ServletDispatch::getGlobServlet(const std::string& uri) {
  * 返回值：
  *   - 返回指向Servlet对象的智能指针
  * 详细描述：
- *  - 使用读锁锁定m_mutex，先在m_datas中查找匹配的Servlet，如果找到则返回对应的Servlet对象。
- *  - 如果在m_datas中未找到匹配的Servlet，则在m_globs中使用fnmatch函数进行模式匹配查找。
- *  - 如果找到匹配的全局Servlet，返回对应的Servlet对象；否则返回m_default指向的默认Servlet对象。
+ *  - 在当前的只读快照中查找，不加锁。
+ *  - 先精准匹配，再匹配路由(不区分方法)，再匹配模糊匹配。
+ *  - 都没有匹配到时返回m_default指向的默认Servlet对象。
  */
 Servlet::ptr ServletDispatch::getMatchedServlet(const std::string& uri) {
-    RWMutexType::ReadLock lock(m_mutex); // 加读锁
-    auto mit = m_datas.find(uri); // 在m_datas中查找指定URI的Servlet
-    if(mit != m_datas.end()) { // 如果找到
+    const RouteTable* t = getTable();
+    auto mit = t->datas.find(uri); // 在datas中查找指定URI的Servlet
+    if(mit != t->datas.end()) { // 如果找到
         return mit->second->get(); // 返回对应的Servlet对象
     }
-    for(auto it = m_globs.begin(); // 遍历m_globs
-            it != m_globs.end(); ++it) {
-        if(!fnmatch(it->first.c_str(), uri.c_str(), 0)) { // 使用fnmatch函数进行模式匹配
-            return it->second->get(); // 如果找到匹配的全局Servlet，返回对应的Servlet对象
-        }
+    std::vector<std::pair<std::string, std::string> > params;
+    auto creator = t->matchRoute(uri, -1, params);
+    if(creator) {
+        return (*creator)->get();
+    }
+    int idx = t->matchGlob(uri);
+    if(idx >= 0) {
+        return t->globs[idx].second->get();
     }
     return m_default; // 返回默认的NotFoundServlet对象
 }
 
+/**
+ * 获取处理请求的Servlet
+ * 参数：
+ *   - request: HTTP请求
+ * 返回值：
+ *   - 返回指向Servlet对象的智能指针
+ * 详细描述：
+ *  - 与getMatchedServlet(uri)相同，但路由按请求的方法匹配。
+ *  - 匹配到路由时，把路径参数设置到request中。
+ */
+Servlet::ptr ServletDispatch::getMatchedServlet(HttpRequest::ptr request) {
+    const RouteTable* t = getTable();
+    const std::string& uri = request->getPath();
+    auto mit = t->datas.find(uri);
+    if(mit != t->datas.end()) {
+        return mit->second->get();
+    }
+    std::vector<std::pair<std::string, std::string> > params;
+    auto creator = t->matchRoute(uri, (int)request->getMethod(), params);
+    if(creator) {
+        for(auto& i : params) {
+            request->setPathParam(i.first, i.second);
+        }
+        return (*creator)->get();
+    }
+    int idx = t->matchGlob(uri);
+    if(idx >= 0) {
+        return t->globs[idx].second->get();
+    }
+    return m_default;
+}
+
 /**
  * 获取所有Servlet的创建者
  * 参数：
  *   - infos: 保存Servlet URI与IServletCreator智能指针的映射
  * 详细描述：
- *  - 使用读锁锁定m_mutex，遍历m_datas，将所有的Servlet URI与对应的IServletCreator智能指针保存到infos中。
+ *  - 遍历当前路由表的datas，将所有的Servlet URI与对应的IServletCreator智能指针保存到infos中。
  */
 void ServletDispatch::listAllServletCreator(std::map<std::string, IServletCreator::ptr>& infos) {
-    RWMutexType::ReadLock lock(m_mutex); // 加读锁
-    for(auto& i : m_datas) { // 遍历m_datas
+    const RouteTable* t = getTable();
+    for(auto& i : t->datas) { // 遍历datas
         infos[i.first] = i.second; // 将Servlet URI与对应的IServletCreator智能指针保存到infos中
     }
 }
@@ -290,15 +740,27 @@ void ServletDispatch::listAllServletCreator(std::map<std::string, IServletCreato
  * 参数：
  *   - infos: 保存Servlet URI与IServletCreator智能指针的映射
  * 详细描述：
- *  - 使用读锁锁定m_mutex，遍历m_globs，将所有的Servlet URI与对应的IServletCreator智能指针保存到infos中。
+ *  - 遍历当前路由表的globs，将所有的Servlet URI与对应的IServletCreator智能指针保存到infos中。
  */
 void ServletDispatch::listAllGlobServletCreator(std::map<std::string, IServletCreator::ptr>& infos) {
-    RWMutexType::ReadLock lock(m_mutex); // 加读锁
-    for(auto& i : m_globs) { // 遍历m_globs
+    const RouteTable* t = getTable();
+    for(auto& i : t->globs) { // 遍历globs
         infos[i.first] = i.second; // 将Servlet URI与对应的IServletCreator智能指针保存到infos中
     }
 }
 
+/**
+ * 获取所有路由的创建者
+ * 参数：
+ *   - infos: 保存"方法 路由"与IServletCreator智能指针的映射
+ */
+void ServletDispatch::listAllRouteCreator(std::map<std::string, IServletCreator::ptr>& infos) {
+    const RouteTable* t = getTable();
+    for(auto& i : t->routes) {
+        std::string method = i.method < 0 ? "*" : HttpMethodToString((HttpMethod)i.method);
+        infos[method + " " + i.path] = i.creator;
+    }
+}
 
 /**
  * 构造函数
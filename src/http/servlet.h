@@ -10,6 +10,7 @@
 #define __SYLAR_HTTP_SERVLET_H__
 
 #include <memory>
+#include <atomic>
 #include <functional>
 #include <string>
 #include <vector>
@@ -58,9 +59,24 @@ public:
      * @brief 返回Servlet名称
      */
     const std::string& getName() const { return m_name;}
+
+    /**
+     * @brief 是否流式读取请求消息体
+     * @details 为true时HttpServer不预先读取消息体, handle只拿到请求行和头部,
+     *          消息体通过session->getBodyStream()增量读取, 也可以只看头部就直接拒绝.
+     *          不受http.request.max_body_size限制, 适合接收大文件
+     */
+    bool isStreamBody() const { return m_streamBody;}
+
+    /**
+     * @brief 设置是否流式读取请求消息体
+     */
+    void setStreamBody(bool v) { m_streamBody = v;}
 protected:
     /// 名称 servlet名字
     std::string m_name;
+    /// 是否流式读取请求消息体
+    bool m_streamBody = false;
 };
 
 /**
@@ -134,6 +150,12 @@ public:
 
 /**
  * @brief Servlet分发器
+ * @details 匹配顺序: 精准匹配 > 路由(addRoute) > 模糊匹配(addGlobServlet) > 默认servlet.
+ *          路由按'/'分段组织成前缀树, 支持静态段, :param参数段和结尾的*通配段, 可以按HTTP方法注册;
+ *          形如/prefix*的模糊匹配放在按字符的前缀树中, 其他模糊匹配仍按添加顺序用fnmatch.
+ *          修改只改主表(加锁), 查找通过原子指针读取发布出去的只读快照, 不加锁也不增加引用计数;
+ *          主表有修改时, 下一次查找重建一次快照再发布, 批量添加只重建一次.
+ *          被替换的快照可能还有线程在读, 保留到析构时释放(路由很少修改)
  */
 class ServletDispatch : public Servlet {
 public:
@@ -141,11 +163,18 @@ public:
     typedef std::shared_ptr<ServletDispatch> ptr;
     /// 读写锁类型定义
     typedef RWMutex RWMutexType;
+    /// 互斥锁类型定义, 只在修改路由表时使用
+    typedef Mutex MutexType;
 
     /**
      * @brief 构造函数
      */
     ServletDispatch();
+
+    /**
+     * @brief 析构函数
+     */
+    ~ServletDispatch();
     virtual int32_t handle(webserver::http::HttpRequest::ptr request
                    , webserver::http::HttpResponse::ptr response
                    , webserver::http::HttpSession::ptr session) override;
@@ -191,6 +220,64 @@ public:
         addGlobServletCreator(uri, std::make_shared<ServletCreator<T> >());
     }
 
+    /**
+     * @brief 添加路由, 匹配所有HTTP方法
+     * @param[in] path 路由, 例如 /users/:id/posts; 通配段写在最后, 例如 /static/ 后面接 *path
+     *             :name 匹配一个非空的段, 匹配到的值通过HttpRequest::getPathParam获取;
+     *             *name 只能是最后一段, 匹配剩余的全部路径(可以为空), name可以省略
+     * @param[in] slt servlet
+     * @return 路由格式是否合法
+     */
+    bool addRoute(const std::string& path, Servlet::ptr slt);
+
+    /**
+     * @brief 添加路由, 匹配所有HTTP方法
+     * @param[in] path 路由
+     * @param[in] cb FunctionServlet回调函数
+     * @return 路由格式是否合法
+     */
+    bool addRoute(const std::string& path, FunctionServlet::callback cb);
+
+    /**
+     * @brief 添加只匹配指定HTTP方法的路由, 优先于匹配所有方法的同一路由
+     * @param[in] method HTTP方法
+     * @param[in] path 路由
+     * @param[in] slt servlet
+     * @return 路由格式是否合法
+     */
+    bool addRoute(HttpMethod method, const std::string& path, Servlet::ptr slt);
+
+    /**
+     * @brief 添加只匹配指定HTTP方法的路由
+     * @param[in] method HTTP方法
+     * @param[in] path 路由
+     * @param[in] cb FunctionServlet回调函数
+     * @return 路由格式是否合法
+     */
+    bool addRoute(HttpMethod method, const std::string& path, FunctionServlet::callback cb);
+
+    /**
+     * @brief 添加路由
+     * @param[in] method HTTP方法, HttpMethod::INVALID_METHOD表示匹配所有方法
+     * @param[in] path 路由
+     * @param[in] creator servlet创建器
+     * @return 路由格式是否合法
+     */
+    bool addRouteCreator(HttpMethod method, const std::string& path, IServletCreator::ptr creator);
+
+    /**
+     * @brief 删除路由(所有方法)
+     * @param[in] path 路由
+     */
+    void delRoute(const std::string& path);
+
+    /**
+     * @brief 删除指定HTTP方法的路由
+     * @param[in] method HTTP方法, HttpMethod::INVALID_METHOD表示匹配所有方法的那一条
+     * @param[in] path 路由
+     */
+    void delRoute(HttpMethod method, const std::string& path);
+
     /**
      * @brief 删除servlet
      * @param[in] uri uri
@@ -232,21 +319,51 @@ public:
     /**
      * @brief 通过uri获取servlet
      * @param[in] uri uri
-     * @return 优先精准匹配,其次模糊匹配,最后返回默认
+     * @return 优先精准匹配,其次路由(不区分方法),再次模糊匹配,最后返回默认
      */
     Servlet::ptr getMatchedServlet(const std::string& uri);
 
+    /**
+     * @brief 获取处理请求的servlet
+     * @details 按请求的路径和方法匹配, 匹配到路由时把路径参数设置到request中
+     * @param[in] request HTTP请求
+     * @return 优先精准匹配,其次路由,再次模糊匹配,最后返回默认
+     */
+    Servlet::ptr getMatchedServlet(HttpRequest::ptr request);
+
     void listAllServletCreator(std::map<std::string, IServletCreator::ptr>& infos);
     void listAllGlobServletCreator(std::map<std::string, IServletCreator::ptr>& infos);
+
+    /**
+     * @brief 列出所有路由
+     * @param[out] infos <"方法 路由", servlet创建器>, 匹配所有方法的路由为"* 路由"
+     */
+    void listAllRouteCreator(std::map<std::string, IServletCreator::ptr>& infos);
+private:
+    struct RouteTable;
+
+    /**
+     * @brief 修改主表: 加锁调用cb, 成功时标记快照需要重建
+     * @details 不复制也不重建快照, 连续的修改(例如启动时批量添加)只在下一次查找时重建一次
+     * @return cb的返回值(路由格式不合法时为false, 主表不变)
+     */
+    bool update(std::function<bool(RouteTable& table)> cb);
+
+    /**
+     * @brief 返回当前的只读快照, 主表修改过时先重建并发布
+     */
+    const RouteTable* getTable();
 private:
-    /// 读写互斥量
-    RWMutexType m_mutex;
-    /// 精准匹配servlet MAP
-    /// uri(/webserver/xxx) -> servlet
-    std::unordered_map<std::string, IServletCreator::ptr> m_datas;
-    /// 模糊匹配servlet 数组
-    /// uri(/webserver/*) -> servlet
-    std::vector<std::pair<std::string, IServletCreator::ptr> > m_globs;
+    /// 修改路由表的互斥量
+    MutexType m_mutex;
+    /// 主表, 只在持有m_mutex时访问
+    std::shared_ptr<RouteTable> m_master;
+    /// 发布给查找者的只读快照, release发布, acquire读取
+    std::atomic<const RouteTable*> m_table;
+    /// 被替换的快照, 析构时释放, 只在持有m_mutex时访问
+    std::vector<const RouteTable*> m_retired;
+    /// 主表修改后快照是否需要重建
+    std::atomic<bool> m_dirty;
     // 默认servlet返回404 Not found，所有路径无匹配使用
     /// 默认servlet，所有路径都没匹配到时使用
     Servlet::ptr m_default;
@@ -66,6 +66,11 @@ int32_t StatusServlet::handle(webserver::http::HttpRequest::ptr request
     XX("main_running_time") << format_used_time(time(0) - ProcessInfoMgr::GetInstance()->main_start_time) << std::endl;
     ss << "===================================================" << std::endl;
     XX("fibers") << webserver::Fiber::TotalFibers() << std::endl;
+    XX("fiber_pool") << webserver::Fiber::PoolToString() << std::endl;
+    XX("fiber_shared_stack") << webserver::Fiber::SharedStackToString() << std::endl;
+    // 已提交的物理内存需要遍历所有栈, 只在请求带stack_resident=1时统计
+    XX("fiber_stacks") << webserver::StackAllocator::ToString(
+            request->getParamAs<int>("stack_resident", 0) != 0) << std::endl;
     ss << "===================================================" << std::endl;
     ss << "<Logger>" << std::endl;
     ss << webserver::LoggerMgr::GetInstance()->toYamlString() << std::endl;
@@ -1,11 +1,12 @@
 #include "session_data.h"
 #include "src/util.h"
+#include "src/clock.h"
 
 namespace webserver {
 namespace http {
 
 SessionData::SessionData(bool auto_gen)
-    :m_lastAccessTime(time(0)) {
+    :m_lastAccessTime(webserver::Clock::NowSec()) {
     if(auto_gen) {
         std::stringstream ss;
         ss << webserver::GetCurrentUS() << "|" << rand() << "|" << rand() << "|" << rand();
@@ -33,14 +34,14 @@ SessionData::ptr SessionDataManager::get(const std::string& id) {
     webserver::RWMutex::ReadLock lock(m_mutex);
     auto it = m_datas.find(id);
     if(it != m_datas.end()) {
-        it->second->setLastAccessTime(time(0));
+        it->second->setLastAccessTime(webserver::Clock::NowSec());
         return it->second;
     }
     return nullptr;
 }
 
 void SessionDataManager::check(int64_t ts) {
-    uint64_t now = time(0) - ts;
+    uint64_t now = webserver::Clock::NowSec() - ts;
     std::vector<std::string> keys;
     webserver::RWMutex::ReadLock lock(m_mutex);
     for(auto& i : m_datas) {
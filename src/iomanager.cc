@@ -1,17 +1,74 @@
 #include "iomanager.h"
+#include "config.h"
 #include "macro.h"
 #include "log.h"
+#include "uring.h"
+#include "clock.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <string.h>
 #include <unistd.h>
+#include <algorithm>
 
 namespace webserver {
 
 static webserver::Logger::ptr g_logger = WEBSERVER_LOG_NAME("system");
 
+// hook的socket操作是否通过io_uring执行, 创建IOManager时读取, 内核不支持时回退到epoll
+static webserver::ConfigVar<bool>::ptr g_iomanager_io_uring =
+    webserver::Config::Lookup("iomanager.io_uring", false, "use io_uring for hooked socket io");
+
+// 每次epoll_wait最多取回的事件数, 取满时翻倍, 从256开始增长到这个上限
+static webserver::ConfigVar<uint32_t>::ptr g_iomanager_max_events =
+    webserver::Config::Lookup("iomanager.max_events", (uint32_t)4096, "max events per epoll_wait");
+
+// poller阻塞在epoll_wait之前忙轮询的时间(微秒), 0表示不忙轮询; 适合独占CPU核的低延迟部署
+static webserver::ConfigVar<uint32_t>::ptr g_iomanager_busy_poll_us =
+    webserver::Config::Lookup("iomanager.busy_poll_us", (uint32_t)0, "busy poll budget in us before blocking");
+
+// 每个io_uring提交队列的长度
+static const uint32_t URING_ENTRIES = 256;
+// 攒够这么多请求时立即提交, 否则在线程空闲前统一提交
+static const uint32_t URING_BATCH = 32;
+
+struct IOManager::IoCompletion {
+    /// 等待的协程
+    Fiber::ptr fiber;
+    /// 所属的fd上下文
+    FdContext* fd_ctx = nullptr;
+    /// 提交到的io_uring
+    URing* ring = nullptr;
+    /// 事件类型
+    Event event = NONE;
+    /// 操作的返回值
+    int res = 0;
+};
+
+// 累加只由当前线程写的统计, 不需要带lock前缀的原子加
+static inline void AddStat(std::atomic<uint64_t>& stat, uint64_t n = 1) {
+    stat.store(stat.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// 创建io_uring并把它的完成通知注册到epoll中, 失败返回nullptr
+static URing* NewRing(int epfd) {
+    URing* ring = new URing(URING_ENTRIES);
+    if(!ring->isValid()) {
+        delete ring;
+        return nullptr;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = ring->getEventFd();
+    int rt = epoll_ctl(epfd, EPOLL_CTL_ADD, ring->getEventFd(), &event);
+    WEBSERVER_ASSERT(!rt);
+    return ring;
+}
+
 enum EpollCtlOp {
 };
 
@@ -81,6 +138,9 @@ IOManager::FdContext::EventContext& IOManager::FdContext::getContext(IOManager::
         // 如果事件类型为WRITE，返回write事件上下文对象的引用
         case IOManager::WRITE:
             return write;
+        // 错误队列事件
+        case IOManager::ERROR:
+            return error;
         // 如果事件类型不是READ或WRITE，执行默认操作
         default:
             // 断言失败，提示“getContext”错误，这通常用于开发阶段的错误检查
@@ -106,6 +166,8 @@ void IOManager::FdContext::resetContext(EventContext& ctx) {
     ctx.fiber.reset();
     // 将事件上下文对象中的回调函数指针设置为nullptr，表示没有回调函数
     ctx.cb = nullptr;
+    // 等待结束, 超时时间点作废
+    ctx.deadline = ~0ull;
 }
 
 
@@ -147,6 +209,8 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
 
     // 事件处理完毕，清空事件上下文中的调度器指针
     ctx.scheduler = nullptr;
+    // 等待结束, 超时时间点作废, fd上下文的定时器到期时不再处理
+    ctx.deadline = ~0ull;
 }
 
 
@@ -156,42 +220,87 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
  * @param threads 数量，指定创建的线程数，用于处理异步IO事件。
  * @param use_caller 布尔值，指定是否将调用者线程也用作事件处理线程之一。
  * @param name 字符串，为当前IO管理器实例指定一个名称，便于调试和管理。
+ * @param sharded 布尔值，指定是否每个线程使用独立的epoll实例(分片reactor)。
  * 构造函数，初始化IOManager，继承自Scheduler类。参数包括线程数、是否使用调用者线程和名称。
  * 这段代码主要完成以下功能：
 
 初始化IOManager实例，同时也初始化它的基类Scheduler。
 创建一个epoll实例来管理异步IO事件，其最大句柄数设置为5000。
-创建一个管道用于唤醒阻塞在epoll_wait调用中的线程。
-设置epoll事件监听管道的读端，确保在有数据（比如唤醒信号）到来时，能够及时处理。
-将管道读端设置为非阻塞模式，并添加到epoll实例中监听事件。
+创建一个eventfd用于唤醒阻塞在epoll_wait调用中的poller线程，并添加到epoll实例中监听事件。
+为每个工作线程创建一个eventfd，空闲的follower线程阻塞在自己的eventfd上，以便精确唤醒。
+sharded模式下每个工作线程还有独立的epoll实例，线程的eventfd注册在自己的epoll中，fd分配给某个线程后只由它等待和处理。
 调整内部资源，以便能够管理至少32个上下文。
 启动Scheduler，开始执行调度任务。
-这是一个针对异步IO和任务调度设计的高效构造函数，通过使用epoll和管道机制来实现高效的任务唤醒和管理。
+这是一个针对异步IO和任务调度设计的高效构造函数，通过使用epoll和eventfd机制来实现高效的任务唤醒和管理。
  */
-IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    :Scheduler(threads, use_caller, name) { // 调用基类Scheduler的构造函数进行初始化
+IOManager::IOManager(size_t threads, bool use_caller, const std::string& name, bool sharded)
+    :Scheduler(threads, use_caller, name) // 调用基类Scheduler的构造函数进行初始化
+    ,m_sharded(sharded) {
     m_epfd = epoll_create(5000); // 创建epoll实例，指定最大句柄数为5000
     WEBSERVER_ASSERT(m_epfd > 0); // 断言epoll实例创建成功
 
-    int rt = pipe(m_tickleFds); // 创建一个管道，用于唤醒epoll_wait
-    WEBSERVER_ASSERT(!rt); // 断言管道创建成功
+    // 唤醒poller的eventfd, 注册到epoll中
+    m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    WEBSERVER_ASSERT(m_tickleFd >= 0);
 
     epoll_event event; // 定义一个epoll事件
     memset(&event, 0, sizeof(epoll_event)); // 初始化epoll事件结构体
     event.events = EPOLLIN | EPOLLET; // 设置事件类型为输入事件和边缘触发
-    // fd关联pipe的读端
-    event.data.fd = m_tickleFds[0]; // 将管道读端设置为epoll事件的文件描述符
+    event.data.fd = m_tickleFd;
 
-    // 对一个打开的文件描述符执行一系列控制操作
-    // F_SETFL: 获取/设置文件状态标志
-    // O_NONBLOCK: 使I/O变成非阻塞模式，在读取不到数据或是写入缓冲区已满会马上return，而不会阻塞等待。
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK); // 设置管道读端为非阻塞模式
-    WEBSERVER_ASSERT(!rt); // 断言设置成功
-
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event); // 向epoll实例中添加管道读端的事件监听
+    int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFd, &event); // 向epoll实例中添加eventfd的事件监听
     WEBSERVER_ASSERT(!rt); // 断言事件添加成功
 
-    contextResize(32); // 预分配或调整某些内部资源的大小，以适应至少32个上下文
+    // 每个工作线程(包括use_caller线程)一个唤醒通道, follower阻塞在各自的eventfd上
+    m_wakers.resize(threads);
+    for(size_t i = 0; i < threads; ++i) {
+        m_wakers[i] = new Waker;
+        m_wakers[i]->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        WEBSERVER_ASSERT(m_wakers[i]->fd >= 0);
+        if(m_sharded) {
+            // 每个线程独立的epoll, 线程的eventfd注册在其中
+            m_wakers[i]->epfd = epoll_create(5000);
+            WEBSERVER_ASSERT(m_wakers[i]->epfd > 0);
+            event.data.fd = m_wakers[i]->fd;
+            rt = epoll_ctl(m_wakers[i]->epfd, EPOLL_CTL_ADD, m_wakers[i]->fd, &event);
+            WEBSERVER_ASSERT(!rt);
+        }
+    }
+
+    if(m_sharded) {
+        // 线程的fd只有它自己等待, 任务不断时也要定期处理自己epoll中的事件
+        m_pollInterval = 64;
+        // 每个分片一个时间轮, 定时器由添加它的线程等待和处理
+        setTimerWheels(m_wakers.size());
+    }
+
+    m_maxEvents = std::max(g_iomanager_max_events->getValue(), (uint32_t)1);
+    m_busyPollUs = g_iomanager_busy_poll_us->getValue();
+
+    if(g_iomanager_io_uring->getValue()) {
+        // sharded模式下每个分片一个io_uring, 完成事件由分片线程处理
+        m_uring = true;
+        if(m_sharded) {
+            for(auto w : m_wakers) {
+                w->ring = NewRing(w->epfd);
+                if(!w->ring) {
+                    m_uring = false;
+                    break;
+                }
+            }
+        } else {
+            m_ring = NewRing(m_epfd);
+            m_uring = m_ring != nullptr;
+        }
+        if(!m_uring) {
+            WEBSERVER_LOG_WARN(g_logger) << "name=" << name << " io_uring unavailable, use epoll";
+        }
+    }
+
+    // fd上下文的分块在fd第一次使用时才分配
+    for(size_t i = 0; i < FD_CHUNK_COUNT; ++i) {
+        m_fdChunks[i].store(nullptr, std::memory_order_relaxed);
+    }
 
     start(); // 启动Scheduler，开始调度执行
 }
@@ -206,7 +315,7 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
 
 停止IOManager的所有操作，包括任何正在进行的异步IO操作和事件循环。
 关闭epoll实例的文件描述符，确保相关资源被正确释放。
-关闭用于唤醒epoll等待状态的管道的读端和写端，释放管道资源。
+关闭用于唤醒等待线程的eventfd，释放唤醒通道。
 遍历所有的文件描述符上下文（如果有），并释放它们所占用的内存。
 这是必要的，因为每个文件描述符上下文可能关联着一些资源，如回调函数或缓冲区，它们需要在对象销毁时被清理，以防止内存泄漏。
  */
@@ -215,70 +324,33 @@ IOManager::~IOManager() {
 
     close(m_epfd); // 关闭epoll实例的文件描述符，释放epoll相关资源。
 
-    close(m_tickleFds[0]); // 关闭用于通知事件循环的管道读端。
-    close(m_tickleFds[1]); // 关闭用于通知事件循环的管道写端。
-
-    // 遍历并清理所有的文件描述符上下文对象 释放 m_fdContexts 内存
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if(m_fdContexts[i]) { // 如果上下文对象存在
-            delete m_fdContexts[i]; // 删除对象，释放内存
-            m_fdContexts[i] = nullptr; // 避免野指针，确保指针被正确地置空
+    close(m_tickleFd); // 关闭用于唤醒poller的eventfd。
+    delete m_ring;
+    for(auto w : m_wakers) { // 关闭并释放每个线程的唤醒通道。
+        close(w->fd);
+        if(w->epfd >= 0) {
+            close(w->epfd);
         }
+        delete w->ring;
+        delete w;
     }
-}
 
-
-
-/**
- * 调整文件描述符上下文数组的大小。
- * 该方法确保m_fdContexts数组有足够的容量来管理所有的文件描述符上下文。
- * 如果数组大小增加，新的位置将被初始化为新的FdContext对象。
- * 
- * @param size 新的数组大小。如果该值大于当前数组的大小，数组将扩展。
- * 
- * 这个方法是IOManager用于管理文件描述符上下文(FdContext)的重要组成部分，尤其在需要处理大量文件描述符时。
- * 通过动态调整m_fdContexts数组的大小，IOManager可以确保有足够的空间来存储每个文件描述符的上下文信息。
- * 此外，通过为新扩展的部分初始化FdContext对象，保证了即使是新加入的文件描述符也能够立即被正确管理。
- * 这种设计使得IOManager在处理IO事件时更加灵活和高效。
- * 
- * IOManager::contextResize函数的工作流程是专门设计来调整IO管理器中管理文件描述符（FD）上下文数组的大小，
- * 并确保每个文件描述符都有一个对应的上下文对象。
-
-调整数组大小：
-首先，根据传入的size参数，调整m_fdContexts数组的大小。
-这一步是通过resize方法实现的，它可以根据需要增大或减小数组的大小。
-如果size大于当前数组的大小，则数组将被扩展；
-如果size小于当前大小，该方法也能确保数组被正确缩减。
-
-遍历数组并初始化新元素：
-接下来，函数遍历m_fdContexts数组的每个元素。这一步是为了确认哪些新添加的位置是空的（即nullptr），需要初始化。
-对于数组中的每个位置，如果发现位置上的指针是空的（即之前没有分配FdContext对象），那么就在该位置上创建一个新的FdContext对象。
-
-设置文件描述符上下文：
-新创建的FdContext对象需要被正确初始化。这包括将FdContext对象的fd成员变量设置为其在数组中的索引。
-这一步骤是非常重要的，因为它确保了每个FdContext对象都能够明确地知道它是为哪个文件描述符服务的。
-
-通过这个流程，IOManager::contextResize方法不仅能够根据需要动态地调整文件描述符上下文数组的大小，
-而且还确保了数组中的每个位置都被正确地初始化并关联到一个具体的文件描述符。
-这样，无论何时添加新的文件描述符到IO管理器中，都可以保证有一个对应的上下文对象来管理相关的事件和状态，从而提高了IO管理的效率和可靠性。
- */
-void IOManager::contextResize(size_t size) {
-    // 调整m_fdContexts数组的大小至指定的size
-    m_fdContexts.resize(size);
-
-    // 遍历m_fdContexts数组
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        // 如果当前位置未初始化（即为nullptr）
-        if(!m_fdContexts[i]) {
-            // 为当前位置创建一个新的FdContext对象
-            m_fdContexts[i] = new FdContext;
-            // 设置新创建的FdContext对象的文件描述符为其在数组中的索引
-            m_fdContexts[i]->fd = i;
+    // 遍历并清理所有的文件描述符上下文对象和分块
+    for(size_t i = 0; i < FD_CHUNK_COUNT; ++i) {
+        FdChunk* chunk = m_fdChunks[i].load(std::memory_order_acquire);
+        if(!chunk) { // 分块从未使用
+            continue;
         }
+        for(size_t j = 0; j < FD_CHUNK_SIZE; ++j) {
+            delete chunk->slots[j].load(std::memory_order_acquire); // 删除对象，释放内存
+        }
+        delete chunk;
+        m_fdChunks[i].store(nullptr, std::memory_order_relaxed);
     }
 }
 
 
+
 /**
  * 向指定的文件描述符添加事件监听。
  * 
@@ -294,8 +366,8 @@ void IOManager::contextResize(size_t size) {
  * IOManager::addEvent函数的工作流程非常关键于异步事件处理的实现。这个流程可以分解为以下几个主要步骤：
  * 
  * 获取文件描述符上下文：
- * 首先，尝试以读锁的方式锁定资源，以减少对性能的影响。检查是否已经为该文件描述符（fd）创建了上下文（FdContext）。
- * 如果上下文已经存在，则直接使用该上下文。如果不存在，则释放读锁，加上写锁，扩展上下文数组的大小以包含该文件描述符，并为它创建新的上下文。
+ * 从两级上下文表中无锁地查找该文件描述符（fd）的上下文（FdContext）。
+ * 如果上下文已经存在，则直接使用该上下文。如果不存在，则创建分块和上下文并通过CAS发布，多个线程同时创建时只保留一个。
  * 
  * 设置事件和回调：
  * 在确定了文件描述符的上下文之后，方法会锁定该上下文，防止并发修改。
@@ -320,20 +392,11 @@ void IOManager::contextResize(size_t size) {
  * 通过细致地管理每个文件描述符的事件监听和回调，IOManager能够高效地处理大量并发的IO操作。
  */
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    // 初始化一个 FdContext
-    FdContext* fd_ctx = nullptr; // 定义文件描述符上下文指针。
-    
-    // 首先尝试以读锁的方式获取锁，避免写锁的高开销。
-    RWMutexType::ReadLock lock(m_mutex);
-    // 从 m_fdContexts 中拿到对应的 FdContext
-    if((int)m_fdContexts.size() > fd) { // 检查fd是否已经有对应的上下文。
-        fd_ctx = m_fdContexts[fd]; // 获取文件描述符上下文。
-        lock.unlock(); // 解锁读锁。
-    } else { // 如果没有对应的上下文，则需要扩展上下文数组并加写锁。
-        lock.unlock(); // 先解锁读锁。
-        RWMutexType::WriteLock lock2(m_mutex); // 加写锁。
-        contextResize(fd * 1.5); // 调整上下文数组的大小。
-        fd_ctx = m_fdContexts[fd]; // 获取新的文件描述符上下文。
+    // 拿到fd对应的 FdContext, 第一次使用时创建, 不需要加锁
+    FdContext* fd_ctx = getFdContext(fd);
+    if(WEBSERVER_UNLIKELY(!fd_ctx)) { // fd超出上下文表的上限
+        WEBSERVER_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+        return -1;
     }
 
     // 对文件描述符上下文加锁，避免并发修改。
@@ -347,6 +410,11 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         WEBSERVER_ASSERT(!(fd_ctx->events & event));
     }
 
+    // sharded模式下未分配的fd交给当前线程, 之后由当前线程等待它的事件
+    if(m_sharded && fd_ctx->shard < 0) {
+        fd_ctx->shard = pickShard(true);
+    }
+
     // 判断是修改现有事件监听（EPOLL_CTL_MOD）还是添加新的事件监听（EPOLL_CTL_ADD）。
     // 若已经有注册的事件则为修改操作，若没有则为添加操作
     int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
@@ -357,9 +425,10 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     epevent.data.ptr = fd_ctx; // 将文件描述符上下文作为回调数据。
 
     // 调用epoll_ctl添加或修改事件监听。
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int epfd = getEpfd(fd_ctx);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
     if(rt) { // 如果调用失败，记录错误并返回-1。
-        WEBSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        WEBSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
             << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
             << (EPOLL_EVENTS)fd_ctx->events;
@@ -413,10 +482,7 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
  * IOManager::delEvent方法的工作流程是为了从IO管理器中删除一个特定的事件监听。下面是这个函数的主要步骤：
 
 检查文件描述符有效性：
-使用读锁锁定资源，以检查提供的文件描述符（fd）是否有效且已有上下文。如果文件描述符超出了当前上下文数组的范围，则直接返回false。
-
-获取文件描述符上下文：
-获取对应文件描述符的上下文（FdContext），然后释放读锁。
+无锁地查找文件描述符（fd）的上下文（FdContext）。如果还没有创建过上下文（从未添加过事件），则直接返回false。
 
 锁定文件描述符上下文：
 对文件描述符上下文加锁，以保证在修改事件时的线程安全。
@@ -443,16 +509,11 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
 通过仔细管理每个文件描述符的事件监听和上下文状态，IOManager提供了强大的基础设施来支持复杂的异步IO操作。
 */
 bool IOManager::delEvent(int fd, Event event) {
-    // 加读锁以安全地访问文件描述符上下文数组
-    RWMutexType::ReadLock lock(m_mutex);
-    // 如果文件描述符超出当前管理的范围，则无法删除事件，返回false
-    if((int)m_fdContexts.size() <= fd) {
+    // 获取指定文件描述符的上下文, 从未添加过事件的fd没有上下文, 无法删除事件，返回false
+    FdContext* fd_ctx = findFdContext(fd);
+    if(!fd_ctx) {
         return false;
     }
-    // 获取指定文件描述符的上下文
-    FdContext* fd_ctx = m_fdContexts[fd];
-    // 释放读锁，因为后续操作将针对特定的文件描述符上下文
-    lock.unlock();
 
     // 对文件描述符上下文加锁，保证线程安全
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
@@ -472,10 +533,11 @@ bool IOManager::delEvent(int fd, Event event) {
     epevent.data.ptr = fd_ctx;
 
     // 调用epoll_ctl来更新epoll监听状态
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int epfd = getEpfd(fd_ctx);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
     // 如果更新失败，记录错误信息并返回false
     if(rt) {
-        WEBSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        WEBSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
             << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
@@ -514,8 +576,8 @@ bool IOManager::delEvent(int fd, Event event) {
  * 下面是该函数的具体工作流程：
 
 安全检查和锁定：
-使用读写锁（RWMutexType::ReadLock）安全地访问全局的文件描述符上下文数组（m_fdContexts）。这一步保证了在多线程环境下对数据的安全访问。
-检查传入的文件描述符（fd）是否在管理的范围内。如果超出范围，则函数返回false，表示取消事件失败。
+无锁地查找文件描述符上下文表, 上下文一旦创建就不会释放或移动, 不需要全局锁。
+如果传入的文件描述符（fd）还没有上下文，则函数返回false，表示取消事件失败。
 
 获取文件描述符上下文：
 根据文件描述符（fd）获取对应的上下文对象（FdContext）。每个文件描述符都有一个与之对应的上下文对象，用于管理该文件描述符上的事件监听和处理。
@@ -541,24 +603,28 @@ bool IOManager::delEvent(int fd, Event event) {
 这对于实现高性能和响应快速的IO管理至关重要。
  */
 bool IOManager::cancelEvent(int fd, Event event) {
-    // 加读锁以安全地访问文件描述符上下文数组
-    RWMutexType::ReadLock lock(m_mutex);
-    // 如果文件描述符超出当前管理的范围，直接返回false
-    if((int)m_fdContexts.size() <= fd) {
+    // 获取指定文件描述符的上下文, 不存在时直接返回false
+    FdContext* fd_ctx = findFdContext(fd);
+    if(!fd_ctx) {
         return false;
     }
-    // 获取指定文件描述符的上下文
-    FdContext* fd_ctx = m_fdContexts[fd];
-    // 释放读锁
-    lock.unlock();
 
     // 对文件描述符上下文加锁，保证线程安全
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    return cancelEvent(fd_ctx, event);
+}
+
+bool IOManager::cancelEvent(FdContext* fd_ctx, Event event) {
+    // 通过io_uring提交的操作, 取消后等待的协程收到-ECANCELED
+    if(cancelIo(fd_ctx, event)) {
+        return true;
+    }
     // 如果要取消的事件并未被监听，直接返回false
     if(WEBSERVER_UNLIKELY(!(fd_ctx->events & event))) {
         return false;
     }
 
+    int fd = fd_ctx->fd;
     // 计算取消指定事件后的新事件掩码
     Event new_events = (Event)(fd_ctx->events & ~event);
     // 确定epoll的操作类型：如果还有其他事件被监听，则修改；否则，删除
@@ -570,10 +636,11 @@ bool IOManager::cancelEvent(int fd, Event event) {
     epevent.data.ptr = fd_ctx;
 
     // 调用epoll_ctl来更新epoll监听状态
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int epfd = getEpfd(fd_ctx);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
     // 如果更新失败，记录错误信息并返回false
     if(rt) {
-        WEBSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        WEBSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
             << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
@@ -594,13 +661,8 @@ bool IOManager::cancelEvent(int fd, Event event) {
  * @param fd 文件描述符，表示需要取消所有事件监听的IO资源。
  * @return 如果成功取消所有事件并触发处理程序，则返回true；否则返回false。
  * 
- * 加读锁：
- * 首先，通过读写锁（RWMutexType）加读锁来安全地访问文件描述符上下文数组（m_fdContexts）。
-检查文件描述符有效性：
-检查传入的文件描述符fd是否有效。如果fd超出了m_fdContexts的大小，表示没有对应的文件描述符上下文，函数返回false。
-
-获取文件描述符上下文并释放读锁：
-通过索引访问m_fdContexts数组获取对应的FdContext对象，随后释放之前加的读锁。
+ * 获取文件描述符上下文：
+ * 无锁地查找文件描述符上下文表。如果fd还没有上下文，表示从未添加过事件，函数返回false。
 
 加上下文锁：
 对获取到的文件描述符上下文对象加锁（FdContext::MutexType::Lock），以保护对该上下文的操作。
@@ -630,22 +692,25 @@ bool IOManager::cancelEvent(int fd, Event event) {
 以及通过epoll_ctl与epoll交互来更新I/O事件的监听状态。
  */
 bool IOManager::cancelAll(int fd) {
-    // 使用读锁安全地访问文件描述符上下文数组
-    RWMutexType::ReadLock lock(m_mutex);
-    // 如果文件描述符超出当前管理的范围，则直接返回false
-    if((int)m_fdContexts.size() <= fd) {
+    // 获取指定文件描述符的上下文, 不存在时直接返回false
+    FdContext* fd_ctx = findFdContext(fd);
+    if(!fd_ctx) {
         return false;
     }
-    // 获取指定文件描述符的上下文
-    FdContext* fd_ctx = m_fdContexts[fd];
-    // 释放读锁
-    lock.unlock();
 
     // 对文件描述符上下文加锁，保证线程安全
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    // fd关闭后不再需要检查超时
+    if(fd_ctx->timerNext != ~0ull) {
+        fd_ctx->timer->cancel();
+        fd_ctx->timerNext = ~0ull;
+    }
+    bool cancelled = cancelIo(fd_ctx, (Event)(READ | WRITE));
     // 如果该文件描述符上没有注册任何事件，则返回false
     if(!fd_ctx->events) {
-        return false;
+        // fd不再属于任何分片, 句柄复用时重新分配
+        fd_ctx->shard = -1;
+        return cancelled;
     }
 
     // 准备删除操作，将该文件描述符上的所有事件从epoll监听中移除
@@ -655,10 +720,11 @@ bool IOManager::cancelAll(int fd) {
     epevent.data.ptr = fd_ctx; // 关联文件描述符上下文
 
     // 调用epoll_ctl执行删除操作
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int epfd = getEpfd(fd_ctx);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
     // 如果操作失败，记录错误信息并返回false
     if(rt) {
-        WEBSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        WEBSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
             << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
@@ -674,13 +740,379 @@ bool IOManager::cancelAll(int fd) {
         fd_ctx->triggerEvent(WRITE);
         --m_pendingEventCount; // 减少待处理的事件计数
     }
+    // 等待错误队列的协程同样唤醒
+    if(fd_ctx->events & ERROR) {
+        fd_ctx->triggerEvent(ERROR);
+        --m_pendingEventCount;
+    }
 
     // 断言：在触发所有事件的处理程序后，该文件描述符上不应再有任何事件被监听
     WEBSERVER_ASSERT(fd_ctx->events == 0);
+    fd_ctx->shard = -1;
     return true; // 成功取消所有事件监听并触发处理程序，返回true
 }
 
 
+int IOManager::waitEvent(int fd, Event event, uint64_t timeout_ms) {
+    if(addEvent(fd, event)) {
+        return -1;
+    }
+    FdContext* fd_ctx = getFdContext(fd);
+    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+    if(timeout_ms != ~0ull) {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        // 事件已经触发时不需要超时
+        if(fd_ctx->events & event) {
+            setDeadline(fd_ctx, event, timeout_ms);
+        }
+    }
+
+    Fiber::YieldToHold();
+
+    // 超时标记在触发事件之前设置, 协程被调度回来后不会再被修改
+    if(event_ctx.timedout) {
+        event_ctx.timedout = false;
+        return ETIMEDOUT;
+    }
+    return 0;
+}
+
+void IOManager::setDeadline(FdContext* fd_ctx, Event event, uint64_t timeout_ms) {
+    // 到期时间用精确时间计算, 到期检查用缓存的时间(定时器触发前刚刷新过)
+    uint64_t deadline = Clock::PreciseMS() + timeout_ms;
+    fd_ctx->getContext(event).deadline = deadline;
+    // 定时器会更早到期, 到时再检查这个时间点(惰性检查), 不用调整定时器;
+    // keep-alive连接每次读的超时都比上次晚, 大部分等待都不需要操作定时器
+    if(fd_ctx->timerNext <= deadline) {
+        return;
+    }
+    fd_ctx->timerNext = deadline;
+    // 只捕获两个指针, std::function不会分配内存
+    std::function<void()> cb = [this, fd_ctx](){ onDeadline(fd_ctx); };
+    if(fd_ctx->timer) {
+        fd_ctx->timer->restart(timeout_ms, cb);
+    } else {
+        // 每个fd上下文只创建一次定时器
+        fd_ctx->timer = addTimer(timeout_ms, cb);
+    }
+}
+
+void IOManager::onDeadline(FdContext* fd_ctx) {
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    fd_ctx->timerNext = ~0ull;
+    uint64_t now_ms = Clock::NowMS();
+    uint64_t next = ~0ull;
+    Event events[] = {READ, WRITE, ERROR};
+    for(auto event : events) {
+        FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+        if(event_ctx.deadline == ~0ull) {
+            continue;
+        }
+        IoCompletion* io = event == READ ? fd_ctx->readIo
+                : (event == WRITE ? fd_ctx->writeIo : nullptr);
+        if(!(fd_ctx->events & event) && !io) {
+            // 等待已经结束
+            event_ctx.deadline = ~0ull;
+            continue;
+        }
+        if(event_ctx.deadline > now_ms) {
+            // 还没到, 定时器启动之后又等待了更晚的时间点
+            next = std::min(next, event_ctx.deadline);
+            continue;
+        }
+        event_ctx.deadline = ~0ull;
+        event_ctx.timedout = true;
+        cancelEvent(fd_ctx, event);
+    }
+    if(next != ~0ull) {
+        fd_ctx->timerNext = next;
+        fd_ctx->timer->restart(next - now_ms, [this, fd_ctx](){ onDeadline(fd_ctx); });
+    }
+}
+
+int IOManager::assignShard(int fd, int shard) {
+    if(!m_sharded) {
+        return -1;
+    }
+    FdContext* fd_ctx = getFdContext(fd);
+    if(!fd_ctx) {
+        return -1;
+    }
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if(shard >= (int)m_wakers.size()) {
+        WEBSERVER_LOG_ERROR(g_logger) << "assignShard fd=" << fd << " invalid shard=" << shard
+            << " shards=" << m_wakers.size() << ", use round robin";
+        shard = -1;
+    }
+    if(shard < 0) {
+        shard = pickShard(false);
+    }
+    if(fd_ctx->shard == shard) {
+        return shard;
+    }
+    if(fd_ctx->events && fd_ctx->shard >= 0) {
+        // 已注册的事件从原来的epoll迁移到新分片的epoll
+        // 原线程已经取出但还没处理的事件, 处理时按新的分片操作epoll(见idle)
+        int old_epfd = getEpfd(fd_ctx);
+        int new_epfd = m_wakers[shard]->epfd;
+        epoll_event epevent;
+        epevent.events = EPOLLET | fd_ctx->events;
+        epevent.data.ptr = fd_ctx;
+        if(epoll_ctl(old_epfd, EPOLL_CTL_DEL, fd, &epevent)
+                || epoll_ctl(new_epfd, EPOLL_CTL_ADD, fd, &epevent)) {
+            WEBSERVER_LOG_ERROR(g_logger) << "assignShard fd=" << fd
+                << " from " << fd_ctx->shard << " to " << shard
+                << " errno=" << errno << " (" << strerror(errno) << ")";
+            return -1;
+        }
+    }
+    fd_ctx->shard = shard;
+    return shard;
+}
+
+int IOManager::getShard(int fd) {
+    FdContext* fd_ctx = findFdContext(fd);
+    if(!fd_ctx) {
+        return -1;
+    }
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    return fd_ctx->shard;
+}
+
+int IOManager::getEpfd(FdContext* fd_ctx) {
+    if(!m_sharded) {
+        return m_epfd;
+    }
+    return m_wakers[fd_ctx->shard]->epfd;
+}
+
+size_t IOManager::getTimerWheel() {
+    // 定时器放到当前线程的分片, 非工作线程添加的轮流分配
+    return m_sharded ? pickShard(true) : 0;
+}
+
+int IOManager::pickShard(bool local) {
+    // 分片按线程进入idle的顺序编号, 只在已经运行的线程间分配,
+    // use_caller线程在stop之前不进入idle, 不会被分配到fd
+    size_t n = m_wakerCount;
+    if(n > m_wakers.size()) {
+        n = m_wakers.size();
+    }
+    if(n == 0) {
+        // 还没有线程进入idle, 交给第一个进入idle的线程;
+        // 启动阶段每个addTimer/fd都会走到这里, 只记录一次
+        static std::atomic<bool> s_logged(false);
+        if(!s_logged.exchange(true, std::memory_order_relaxed)) {
+            WEBSERVER_LOG_DEBUG(g_logger) << getName() << " no shard is running yet, fall back to shard 0";
+        }
+        return 0;
+    }
+    if(local) {
+        int thread = webserver::GetThreadId();
+        for(size_t i = 0; i < n; ++i) {
+            if(m_wakers[i]->thread == thread) {
+                return i;
+            }
+        }
+    }
+    return m_nextShard++ % n;
+}
+
+IOManager::FdContext* IOManager::getFdContext(int fd) {
+    if(WEBSERVER_UNLIKELY(fd < 0 || (size_t)fd >= FD_CHUNK_SIZE * FD_CHUNK_COUNT)) {
+        return nullptr;
+    }
+    std::atomic<FdChunk*>& chunk_slot = m_fdChunks[fd / FD_CHUNK_SIZE];
+    FdChunk* chunk = chunk_slot.load(std::memory_order_acquire);
+    if(WEBSERVER_UNLIKELY(!chunk)) {
+        // 第一次用到这个分块, 多个线程同时创建时只有一个能发布成功
+        FdChunk* new_chunk = new FdChunk;
+        for(size_t i = 0; i < FD_CHUNK_SIZE; ++i) {
+            new_chunk->slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+        if(chunk_slot.compare_exchange_strong(chunk, new_chunk
+                    ,std::memory_order_acq_rel, std::memory_order_acquire)) {
+            chunk = new_chunk;
+        } else {
+            delete new_chunk;
+        }
+    }
+    std::atomic<FdContext*>& slot = chunk->slots[fd % FD_CHUNK_SIZE];
+    FdContext* fd_ctx = slot.load(std::memory_order_acquire);
+    if(WEBSERVER_UNLIKELY(!fd_ctx)) {
+        // 同样只有一个线程创建的上下文会被发布, 之后不会再改变
+        FdContext* new_ctx = new FdContext;
+        new_ctx->fd = fd;
+        if(slot.compare_exchange_strong(fd_ctx, new_ctx
+                    ,std::memory_order_acq_rel, std::memory_order_acquire)) {
+            fd_ctx = new_ctx;
+        } else {
+            delete new_ctx;
+        }
+    }
+    return fd_ctx;
+}
+
+IOManager::FdContext* IOManager::findFdContext(int fd) const {
+    if(WEBSERVER_UNLIKELY(fd < 0 || (size_t)fd >= FD_CHUNK_SIZE * FD_CHUNK_COUNT)) {
+        return nullptr;
+    }
+    FdChunk* chunk = m_fdChunks[fd / FD_CHUNK_SIZE].load(std::memory_order_acquire);
+    if(!chunk) {
+        return nullptr;
+    }
+    return chunk->slots[fd % FD_CHUNK_SIZE].load(std::memory_order_acquire);
+}
+
+URing* IOManager::getRing(FdContext* fd_ctx) {
+    if(!m_sharded) {
+        return m_ring;
+    }
+    // 操作提交到fd所属分片的io_uring, 完成事件由分片线程处理
+    if(fd_ctx->shard < 0) {
+        fd_ctx->shard = pickShard(true);
+    }
+    return m_wakers[fd_ctx->shard]->ring;
+}
+
+int IOManager::submitIo(int fd, Event event, const IoRequest& req, int& res
+                         ,uint64_t timeout_ms) {
+    if(!m_uring) {
+        return -1;
+    }
+    Fiber::ptr fiber = Fiber::GetThis();
+    // 共享栈协程切出后栈上的缓冲区会被其他协程覆盖, 内核不能异步写入, 只能用epoll
+    if(fiber->isSharedStack()) {
+        return -1;
+    }
+    FdContext* fd_ctx = getFdContext(fd);
+    if(!fd_ctx) {
+        return -1;
+    }
+    IoCompletion* c = new IoCompletion;
+    c->fiber.swap(fiber);
+    c->fd_ctx = fd_ctx;
+    c->event = event;
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        IoCompletion*& slot = event == READ ? fd_ctx->readIo : fd_ctx->writeIo;
+        WEBSERVER_ASSERT(!slot);
+        URing* ring = getRing(fd_ctx);
+        URing::MutexType::Lock lock2(ring->getMutex());
+        io_uring_sqe* sqe = ring->getSqe();
+        if(!sqe) {
+            delete c;
+            return -1;
+        }
+        sqe->opcode = req.opcode;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)req.addr;
+        sqe->len = req.len;
+        sqe->off = req.off;
+        sqe->rw_flags = req.flags;
+        sqe->ioprio = req.ioprio;
+        sqe->user_data = (uint64_t)c;
+        c->ring = ring;
+        slot = c;
+        ++m_pendingEventCount;
+        ++m_uringOps;
+        // 其他线程提交到本线程不负责的io_uring, 或者攒够一批, 或者没有其他任务时立即提交;
+        // 否则留到线程空闲前(idle)和其他请求一起提交
+        Waker* w = m_sharded ? getWaker(webserver::GetThreadId()) : nullptr;
+        bool own = !m_sharded || (w && w->ring == ring);
+        if(!own || ring->getPending() >= URING_BATCH || !hasTasks()) {
+            if(ring->submit() > 0) {
+                ++m_uringSubmits;
+            }
+        }
+        lock2.unlock();
+        if(timeout_ms != ~0ull) {
+            setDeadline(fd_ctx, event, timeout_ms);
+        }
+    }
+
+    Fiber::YieldToHold();
+
+    res = c->res;
+    delete c;
+    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+    if(event_ctx.timedout) {
+        event_ctx.timedout = false;
+        // 取消之前操作已经完成时保留操作的结果
+        if(res == -ECANCELED) {
+            res = -ETIMEDOUT;
+        }
+    }
+    return 0;
+}
+
+bool IOManager::cancelIo(FdContext* fd_ctx, Event event) {
+    bool cancelled = false;
+    IoCompletion* ops[2] = {nullptr, nullptr};
+    if(event & READ) {
+        ops[0] = fd_ctx->readIo;
+    }
+    if(event & WRITE) {
+        ops[1] = fd_ctx->writeIo;
+    }
+    for(auto c : ops) {
+        if(!c) {
+            continue;
+        }
+        // 按user_data取消, 不依赖fd, 可以在close之前或之后执行
+        URing::MutexType::Lock lock(c->ring->getMutex());
+        io_uring_sqe* sqe = c->ring->getSqe();
+        if(!sqe) {
+            WEBSERVER_LOG_ERROR(g_logger) << "cancelIo fd=" << fd_ctx->fd << " no sqe";
+            continue;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)c;
+        sqe->user_data = 0;
+        if(c->ring->submit() > 0) {
+            ++m_uringSubmits;
+        }
+        cancelled = true;
+    }
+    return cancelled;
+}
+
+void IOManager::flushIo(URing* ring) {
+    URing::MutexType::Lock lock(ring->getMutex());
+    if(ring->getPending() && ring->submit() > 0) {
+        ++m_uringSubmits;
+    }
+}
+
+void IOManager::reapIo(URing* ring) {
+    std::vector<IoCompletion*> done;
+    ring->reap([&done](uint64_t user_data, int res) {
+        // user_data为0的是取消请求自己的完成事件
+        if(!user_data) {
+            return;
+        }
+        IoCompletion* c = (IoCompletion*)user_data;
+        c->res = res;
+        done.push_back(c);
+    });
+    for(auto c : done) {
+        {
+            FdContext::MutexType::Lock lock(c->fd_ctx->mutex);
+            IoCompletion*& slot = c->event == READ ? c->fd_ctx->readIo : c->fd_ctx->writeIo;
+            if(slot == c) {
+                slot = nullptr;
+                c->fd_ctx->getContext(c->event).deadline = ~0ull;
+            }
+        }
+        --m_pendingEventCount;
+        // 调度之后协程可能立即运行并释放c, 不能再访问c
+        Fiber::ptr fiber;
+        fiber.swap(c->fiber);
+        schedule(fiber);
+    }
+}
+
 // 获取当前线程的 IOManager 实例。
 /*
 这个函数 IOManager::GetThis() 属于 IOManager 类，它的目的是获取当前线程的 IOManager 实例。
@@ -733,11 +1165,11 @@ IOManager* IOManager::GetThis() {
 
 // tickle函数：用于唤醒IO管理器进行任务处理
 /*
-这个函数首先检查是否有空闲线程可用来处理新的任务。
-如果有空闲线程，它会往一个预先设置的管道的写端（m_tickleFds[1]）写入字符 "T"。
-这个写操作通常会触发等待在管道读端的线程开始执行，从而处理新的事件或任务。
-函数中的断言 WEBSERVER_ASSERT(rt == 1); 确保写操作正常完成，确切地写入了一个字节。
-如果写入的字节数不是预期的一个字节，断言将触发，可能会导致程序中断或输出错误信息。
+同一时刻只有一个空闲线程(poller)阻塞在epoll_wait上，其他空闲线程(follower)各自阻塞在自己的eventfd上。
+有新任务时只唤醒一个线程：优先唤醒follower，这样不会打断poller对IO事件和定时器的等待；
+没有follower时才通过m_tickleFd唤醒poller。
+如果已经有被唤醒但还没醒来的线程，本次唤醒被合并：那个线程取到任务后发现还有任务，会在run中继续唤醒下一个线程。
+调度器停止时唤醒所有线程，让它们检查停止条件。
 */
 // 通知有任务
 void IOManager::tickle() {
@@ -747,13 +1179,156 @@ void IOManager::tickle() {
         return;
     }
 
-    // 往管道的写端写入字符"T"，以触发事件处理
-    // m_tickleFds[1] 是管道写端的文件描述符，"T"是要写入的数据，1是写入的字节数
-    int rt = write(m_tickleFds[1], "T", 1);
+    // 停止时唤醒所有线程
+    if(m_stopping) {
+        for(auto w : m_wakers) {
+            notify(w);
+        }
+        return;
+    }
+
+    // 已经有线程在醒来的路上, 合并本次唤醒
+    if(m_pendingWakes > 0) {
+        ++m_coalescedWakes;
+        return;
+    }
+
+    // 优先唤醒一个follower
+    for(auto w : m_wakers) {
+        if(w->state == SLEEPING && notify(w)) {
+            return;
+        }
+    }
+    if(m_sharded) {
+        // sharded模式下唤醒一个在epoll_wait中的线程, 新任务在全局队列中, 谁都能取
+        for(auto w : m_wakers) {
+            if(w->state == POLLING && notify(w)) {
+                return;
+            }
+        }
+        ++m_coalescedWakes;
+        return;
+    }
+    // 没有follower, 唤醒poller
+    Waker* poller = m_poller;
+    if(!poller || !notify(poller)) {
+        ++m_coalescedWakes;
+    }
+}
+
+// 唤醒指定线程
+void IOManager::tickle(int thread) {
+    Waker* w = getWaker(thread);
+    if(!w) {
+        tickle();
+        return;
+    }
+    if(!notify(w)) {
+        ++m_coalescedWakes;
+    }
+}
+
+IOManager::Waker* IOManager::registerWaker() {
+    size_t idx = m_wakerCount++;
+    WEBSERVER_ASSERT2(idx < m_wakers.size(), "too many worker threads");
+    Waker* w = m_wakers[idx];
+    w->thread = webserver::GetThreadId();
+    return w;
+}
+
+IOManager::Waker* IOManager::getWaker(int thread) {
+    // 线程数很少, 直接遍历, 不需要加锁
+    for(auto w : m_wakers) {
+        if(w->thread == thread) {
+            return w;
+        }
+    }
+    return nullptr;
+}
+
+bool IOManager::notify(Waker* waker) {
+    int fd = -1;
+    {
+        Waker::MutexType::Lock lock(waker->mutex);
+        if(waker->notified) {
+            return false;
+        }
+        int state = waker->state;
+        if(state == RUNNING) {
+            // 线程在运行, 只做标记, 它在下次等待前会看到
+            waker->notified = 1;
+            return true;
+        }
+        waker->notified = 2;
+        // sharded模式下线程在自己的epoll中等待, 自己的eventfd就注册在其中
+        fd = (state == POLLING && !m_sharded) ? m_tickleFd : waker->fd;
+    }
+    ++m_pendingWakes;
+    ++m_wakes;
+    uint64_t one = 1;
+    int rt = write(fd, &one, sizeof(one));
+    WEBSERVER_ASSERT(rt == sizeof(one));
+    return true;
+}
+
+bool IOManager::beginWait(Waker* waker, WaitState state) {
+    Waker::MutexType::Lock lock(waker->mutex);
+    if(waker->notified) {
+        if(waker->notified == 2) {
+            --m_pendingWakes;
+        }
+        waker->notified = 0;
+        return false;
+    }
+    waker->state = state;
+    return true;
+}
+
+bool IOManager::endWait(Waker* waker) {
+    Waker::MutexType::Lock lock(waker->mutex);
+    waker->state = RUNNING;
+    int notified = waker->notified;
+    waker->notified = 0;
+    if(notified == 2) {
+        --m_pendingWakes;
+    }
+    return notified != 0;
+}
+
+void IOManager::handoff() {
+    // 与follower先发布SLEEPING再检查m_poller相对应, 两者至少有一方能看到对方
+    for(auto w : m_wakers) {
+        if(w->state == SLEEPING) {
+            notify(w);
+            return;
+        }
+    }
+}
 
-    // 确认写入操作是否成功：要求实际写入的字节数(rt)必须等于1
-    // WEBSERVER_ASSERT 是一个断言宏，用于在条件不满足时提示错误或中断程序
-    WEBSERVER_ASSERT(rt == 1);
+std::ostream& IOManager::dump(std::ostream& os) {
+    Scheduler::dump(os);
+    // epoll统计分散在各线程的唤醒通道里, 这里汇总
+    uint64_t epoll_wakeups = 0, epoll_events = 0, blocked_us = 0, busy_polls = 0;
+    for(auto w : m_wakers) {
+        epoll_wakeups += w->epollWakeups.load(std::memory_order_relaxed);
+        epoll_events += w->epollEvents.load(std::memory_order_relaxed);
+        blocked_us += w->blockedUs.load(std::memory_order_relaxed);
+        busy_polls += w->busyPolls.load(std::memory_order_relaxed);
+    }
+    os << std::endl << "    [IOManager pending_events=" << m_pendingEventCount
+       << " wakes=" << m_wakes
+       << " coalesced_wakes=" << m_coalescedWakes
+       << " spurious_wakes=" << m_spuriousWakes
+       << " sharded=" << m_sharded
+       << " uring=" << m_uring
+       << " uring_ops=" << m_uringOps
+       << " uring_submits=" << m_uringSubmits
+       << " epoll_wakeups=" << epoll_wakeups
+       << " events_per_wakeup=" << (epoll_wakeups ? (double)epoll_events / epoll_wakeups : 0)
+       << " blocked_ms=" << blocked_us / 1000
+       << " busy_polls=" << busy_polls
+       << " ]";
+    return os;
 }
 
 /**
@@ -795,9 +1370,11 @@ bool IOManager::stopping(uint64_t& timeout) {
     // 如果没有定时器需要处理（timeout == ~0ull）、没有待处理的事件（m_pendingEventCount == 0）
     // 且调度器也在停止状态（Scheduler::stopping()为true），则返回true，表示IO管理器应该停止。
     // 否则，返回false，表示IO管理器不应该停止。
+    // sharded模式下timeout只反映当前线程的时间轮, 还要确认其他线程的时间轮也空了
     return timeout == ~0ull
         && m_pendingEventCount == 0
-        && Scheduler::stopping();
+        && Scheduler::stopping()
+        && (!m_sharded || !hasTimer());
 }
 
 /**
@@ -854,14 +1431,16 @@ bool IOManager::stopping() {
  *
  * 详细说明:
  *   - 函数首先记录进入idle状态的日志。
- *   - 定义了一个最大事件数量的常量，用于epoll_wait调用。
- *   - 使用智能指针管理epoll_event数组的生命周期，以自动处理资源回收。
+ *   - 同一时刻只有一个空闲线程(poller)调用epoll_wait等待IO事件和定时器，其他空闲线程(follower)阻塞在自己的eventfd上，只被tickle精确唤醒。
+ *   - poller离开去处理事件时，唤醒一个follower接替它。
+ *   - epoll_event数组从256开始, 一次取满时翻倍, 直到iomanager.max_events。
+ *   - 配置了iomanager.busy_poll_us时, poller先以0超时轮询epoll一段时间, 没有事件再阻塞。
  *   - 进入一个无限循环，循环体内首先检查IO管理器是否应当停止，如果是，则退出循环。
  *   - 调用epoll_wait等待事件的发生，等待时间由next_timeout确定。
  *   - 如果有事件发生，或者超时，或者因为信号中断而返回，则处理这些事件。
  *   - 检查是否有到期的回调函数，如果有，则调度它们执行。
  *   - 遍历所有发生的事件，对每个事件根据其类型和对应的文件描述符上下文进行处理。
- *     - 特别地，如果事件是tickler（用于唤醒）的读事件，则读取所有数据并忽略。
+ *     - 特别地，如果事件是tickle（用于唤醒）的eventfd读事件，则读取所有数据并忽略。
  *     - 对于其他事件，根据事件类型更新文件描述符上下文中的事件状态，并触发相应的事件处理。
  *   - 在处理完所有事件后，当前的协程让出执行权。
  * 
@@ -875,7 +1454,7 @@ bool IOManager::stopping() {
  * 1. 记录空闲状态日志：
  *    - 函数开始时，首先记录一条表示当前系统空闲状态的调试日志。
  * 2. 准备事件数组：
- *     - 通过动态分配一个epoll_event数组，准备用于接收epoll_wait返回的事件。利用智能指针管理这个数组，确保函数退出时自动释放资源，防止内存泄露。
+ *     - 准备用于接收epoll_wait返回的事件数组, 负载高(一次取满)时自动扩大。
  * 3. 进入主循环：
  *     - 函数通过一个无限循环开始监听IO事件和处理定时任务。这是事件驱动模型的核心，持续监听直到显式退出。
  * 4. 检查服务停止条件：
@@ -908,31 +1487,105 @@ void IOManager::idle() {
     // 记录调试级别日志，表示当前进入空闲状态。
     WEBSERVER_LOG_DEBUG(g_logger) << "idle";
 
-    // 最大事件数量，用于epoll_wait调用。
-    const uint64_t MAX_EVNETS = 256;
-    
-    // 动态分配一个足够大的epoll_event数组来接收epoll_wait的输出。
-    epoll_event* events = new epoll_event[MAX_EVNETS]();
-    // 使用智能指针托管events， 离开idle自动释放
-    // 使用智能指针管理epoll_event数组，确保异常安全，自动释放资源。
-    std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
-        delete[] ptr; // 自定义删除器，用于数组释放。
-    });
+    // 初始的事件数量，用于epoll_wait调用, 一次取满说明负载高, 翻倍直到m_maxEvents
+    static const size_t INIT_EVENTS = 256;
+    // 接收epoll_wait输出的epoll_event数组, 离开idle自动释放
+    std::vector<epoll_event> events_buf(std::min(INIT_EVENTS, m_maxEvents));
+    epoll_event* events = &events_buf[0];
+
+    // epoll_wait和follower等待的最大超时时间（毫秒）。
+    static const int MAX_TIMEOUT = 3000;
+    // 当前线程的唤醒通道，idle协程只在本线程上运行。
+    Waker* waker = registerWaker();
+    // 本线程负责提交和收割的io_uring
+    URing* ring = m_sharded ? waker->ring : m_ring;
 
     // 无限循环，直到显式退出，处理IO事件和定时任务。
     while(true) {
         // 初始化下次epoll_wait的超时时间。
         uint64_t next_timeout = 0;
 
+        // 等待之前提交攒下的io_uring请求
+        if(ring) {
+            flushIo(ring);
+        }
+
         // 检查是否满足停止条件，如果是，则记录信息并退出循环。
         if(WEBSERVER_UNLIKELY(stopping(next_timeout))) {
             WEBSERVER_LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
+            // 唤醒其他等待中的线程检查停止条件
+            tickle();
             break;
         }
 
+        // 已经有poller时作为follower阻塞在自己的eventfd上，只响应tickle。
+        // sharded模式下每个线程都等待自己的epoll, 没有follower
+        Waker* expected = nullptr;
+        if(!m_sharded && !m_poller.compare_exchange_strong(expected, waker)) {
+            if(beginWait(waker, SLEEPING)) {
+                int rt = 0;
+                // 发布SLEEPING后再检查poller，poller恰好离开时不睡眠(见handoff)
+                if(m_poller) {
+                    pollfd pfd;
+                    pfd.fd = waker->fd;
+                    pfd.events = POLLIN;
+                    pfd.revents = 0;
+                    rt = poll(&pfd, 1, MAX_TIMEOUT);
+                    if(rt > 0) {
+                        uint64_t dummy;
+                        while(read(waker->fd, &dummy, sizeof(dummy)) > 0);
+                    }
+                }
+                if(!endWait(waker) && rt > 0) {
+                    ++m_spuriousWakes;
+                }
+            }
+            // poller已经离开，回到循环开头接替它
+            if(!m_poller) {
+                continue;
+            }
+            Fiber::ptr cur = Fiber::GetThis();
+            auto raw_ptr = cur.get();
+            cur.reset();
+            raw_ptr->swapOut();
+            continue;
+        }
+
+        // 成为poller后已经有未处理的唤醒，不阻塞
+        bool woken = !beginWait(waker, POLLING);
+        // 成为poller之后再取定时器超时，与onTimerInsertedAtFront先插入定时器再唤醒poller相对应
+        // 先刷新缓存的时间, 否则按过时的当前时间算出的超时会偏长
+        Clock::Update();
+        next_timeout = getNextTimer();
+        if(woken || hasTasks()) {
+            next_timeout = 0;
+        }
+
         int rt = 0; // epoll_wait的返回值。
+        int epfd = m_sharded ? waker->epfd : m_epfd;
+        // 忙轮询: 不阻塞地检查epoll, 省掉睡眠和唤醒的开销; tickle仍然通过eventfd出现在epoll中
+        if(m_busyPollUs && next_timeout != 0) {
+            uint64_t end_us = Clock::NowUS() + m_busyPollUs;
+            uint64_t timer_us = next_timeout == ~0ull ? ~0ull : Clock::NowUS() + next_timeout * 1000;
+            end_us = std::min(end_us, timer_us);
+            do {
+                AddStat(waker->busyPolls);
+                rt = epoll_wait(epfd, events, events_buf.size(), 0);
+                if(rt != 0 || hasTasks()) {
+                    break;
+                }
+            } while(Clock::PreciseUS() < end_us);
+            Clock::Update();
+            if(rt > 0 || hasTasks()) {
+                next_timeout = 0;
+            } else if(timer_us != ~0ull) {
+                // 扣掉轮询用掉的时间
+                uint64_t now_us = Clock::NowUS();
+                next_timeout = now_us >= timer_us ? 0 : (timer_us - now_us + 999) / 1000;
+            }
+        }
+        uint64_t block_us = Clock::NowUS();
         do {
-            static const int MAX_TIMEOUT = 3000; // epoll_wait调用的最大超时时间（毫秒）。
             // 确保next_timeout不会超过MAX_TIMEOUT，除非特别指定为无限等待(~0ull)。
             if(next_timeout != ~0ull) {
                 next_timeout = (int)next_timeout > MAX_TIMEOUT ? MAX_TIMEOUT : next_timeout;
@@ -943,11 +1596,15 @@ void IOManager::idle() {
              * 阻塞在这里，但有3中情况能够唤醒epoll_wait
              * 1. 超时时间到了
              * 2. 关注的 soket 有数据来了
-             * 3. 通过 tickle 往 pipe 里发数据，表明有任务来了
+             * 3. 通过 tickle 往 eventfd 里写数据，表明有任务来了或者有更早的定时器
              */
 
             // 调用epoll_wait等待事件发生，或超时。
-            rt = epoll_wait(m_epfd, events, MAX_EVNETS, (int)next_timeout);
+            if(rt > 0) {
+                // 忙轮询已经取到了事件
+                break;
+            }
+            rt = epoll_wait(epfd, events, events_buf.size(), (int)next_timeout);
             // 处理epoll_wait被信号打断的情况。
             if(rt < 0 && errno == EINTR) {
                 // 信号中断，重试epoll_wait。
@@ -957,6 +1614,22 @@ void IOManager::idle() {
             }
         } while(true);
 
+        // 离开poller角色，处理事件期间由一个follower接替poll
+        woken = endWait(waker) || woken;
+        if(!m_sharded) {
+            m_poller = nullptr;
+            handoff();
+        }
+
+        // epoll_wait可能阻塞了很久, 刷新缓存的时间
+        Clock::Update();
+        if(next_timeout) {
+            AddStat(waker->blockedUs, Clock::NowUS() - block_us);
+        }
+        AddStat(waker->epollWakeups);
+        if(rt > 0) {
+            AddStat(waker->epollEvents, rt);
+        }
         // 处理所有到期的定时任务。
         std::vector<std::function<void()>> cbs;
         // 获取已经超时的任务
@@ -971,13 +1644,23 @@ void IOManager::idle() {
         // 遍历已经准备好的fd
         for(int i = 0; i < rt; ++i) {
             epoll_event& event = events[i];
-            // 如果获得的这个信息时来自 pipe
+            // 如果获得的这个信息时来自 eventfd
             // 检查是否为内部唤醒操作（tickle）的事件。
-            if(event.data.fd == m_tickleFds[0]) {
-                // 清空tickle fd的读缓冲区。
-                uint8_t dummy[256];
-                
-                while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+            // io_uring有完成事件
+            if(ring && event.data.fd == ring->getEventFd()) {
+                uint64_t dummy;
+                while(read(event.data.fd, &dummy, sizeof(dummy)) > 0);
+                reapIo(ring);
+                continue;
+            }
+            if(event.data.fd == m_tickleFd || event.data.fd == waker->fd) {
+                // 清空eventfd的计数。
+                uint64_t dummy;
+                while(read(event.data.fd, &dummy, sizeof(dummy)) > 0);
+                // 没有收到唤醒却被eventfd唤醒，是之前残留的计数
+                if(!woken) {
+                    ++m_spuriousWakes;
+                }
                 continue; // 处理下一个事件。
             }
 
@@ -999,6 +1682,10 @@ void IOManager::idle() {
             if(event.events & EPOLLOUT) {
                 real_events |= WRITE;
             }
+            // 错误队列有通知或连接挂断, 只在有协程等待时处理(epoll总是报告EPOLLERR)
+            if((event.events & (EPOLLERR | EPOLLHUP)) && (fd_ctx->events & ERROR)) {
+                real_events |= ERROR;
+            }
 
             // 如果没有与fd_ctx的事件匹配，继续下一个事件。
             // 没事件
@@ -1016,10 +1703,12 @@ void IOManager::idle() {
 
             // 更新epoll监听设置。
             // 重新注册事件
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            // fd可能已经迁移到其他分片, 按当前所属的epoll操作
+            int epfd = getEpfd(fd_ctx);
+            int rt2 = epoll_ctl(epfd, op, fd_ctx->fd, &event);
             if(rt2) {
                 // 如果epoll_ctl失败，记录错误日志。
-                WEBSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                WEBSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
                     << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
                     << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
                 continue; // 处理下一个事件。
@@ -1036,6 +1725,16 @@ void IOManager::idle() {
                 fd_ctx->triggerEvent(WRITE);
                 --m_pendingEventCount;
             }
+            // 错误事件
+            if(real_events & ERROR) {
+                fd_ctx->triggerEvent(ERROR);
+                --m_pendingEventCount;
+            }
+        }
+        // 一次取满了, 说明还有事件没取到, 扩大下次的批量
+        if(rt == (int)events_buf.size() && events_buf.size() < m_maxEvents) {
+            events_buf.resize(std::min(events_buf.size() * 2, m_maxEvents));
+            events = &events_buf[0];
         }
         // 执行完epoll_wait返回的事件
         // 获得当前协程
@@ -1064,8 +1763,7 @@ void IOManager::idle() {
  * 
  * 功能描述: 
  *    - 当一个定时器事件被插入到事件处理队列的最前端时调用。这通常意味着需要立即对该事件做出响应。
- *    - 该函数通过调用`tickle`方法来实现这一功能，`tickle`方法的具体实现依赖于IOManager类的详细设计，
- *    - 但它可能用于通知事件循环系统立即处理新加入的定时器事件。
+ *    - 只有poller线程按定时器超时等待，该函数直接唤醒poller，让它按新的定时器重新计算epoll_wait的超时时间。
  * 
  * 参数列表: 无
  * 
@@ -1111,9 +1809,18 @@ void IOManager::idle() {
  * 
  * 
  */
-void IOManager::onTimerInsertedAtFront() {
-    // 调用tickle方法来处理或响应新计时器的插入
-    tickle();
+void IOManager::onTimerInsertedAtFront(size_t wheel) {
+    // 只有poller按定时器超时等待，直接唤醒它重新计算超时；
+    // 没有poller时，下一个成为poller的线程会取到新的定时器
+    if(m_sharded) {
+        // sharded模式下时间轮属于分片线程, 唤醒它重新计算超时
+        notify(m_wakers[wheel]);
+        return;
+    }
+    Waker* poller = m_poller;
+    if(poller) {
+        notify(poller);
+    }
 }
 
 }
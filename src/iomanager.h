@@ -4,8 +4,12 @@
 #include "scheduler.h"
 #include "timer.h"
 
+struct io_uring_sqe;
+
 namespace webserver {
 
+class URing;
+
 /**
  * @brief 基于Epoll的IO协程调度器
  */
@@ -24,8 +28,34 @@ public:
         READ    = 0x1,
         /// 写事件(EPOLLOUT)
         WRITE   = 0x4,
+        /// 错误事件(EPOLLERR), 等待socket错误队列上的通知(如MSG_ZEROCOPY的完成通知)
+        /// epoll总是报告EPOLLERR, 只在有协程等待这个事件时才会触发它
+        ERROR   = 0x8,
+    };
+
+    /**
+     * @brief io_uring请求参数, 对应sqe中的字段
+     */
+    struct IoRequest {
+        /// 操作码 IORING_OP_XXX
+        uint8_t opcode = 0;
+        /// 缓冲区或地址
+        void* addr = nullptr;
+        /// 长度
+        uint32_t len = 0;
+        /// 偏移或第二个地址(accept的addrlen)
+        uint64_t off = 0;
+        /// 操作相关的标志(msg_flags/accept_flags/poll32_events)
+        uint32_t flags = 0;
+        /// 操作相关的ioprio(如IORING_RECVSEND_POLL_FIRST)
+        uint16_t ioprio = 0;
     };
 private:
+    /**
+     * @brief 通过io_uring提交的操作
+     */
+    struct IoCompletion;
+
     /**
      * @brief Socket事件上线文类
      */
@@ -42,6 +72,10 @@ private:
             Fiber::ptr fiber;
             /// 事件的回调函数
             std::function<void()> cb;
+            /// 等待的超时时间点(毫秒), ~0ull表示不超时
+            uint64_t deadline = ~0ull;
+            /// 等待是否因超时被取消
+            bool timedout = false;
         };
 
         /**
@@ -67,12 +101,68 @@ private:
         EventContext read;
         /// 写事件上下文
         EventContext write;
+        /// 错误事件上下文
+        EventContext error;
         /// 事件关联的句柄
         int fd = 0;
         /// 当前的事件
         Event events = NONE;
         /// 事件的Mutex 互斥锁
         MutexType mutex;
+        /// sharded模式下所属的分片(线程), -1表示未分配
+        int shard = -1;
+        /// 通过io_uring提交还未完成的读操作
+        IoCompletion* readIo = nullptr;
+        /// 通过io_uring提交还未完成的写操作
+        IoCompletion* writeIo = nullptr;
+        /// 检查读写超时的定时器, 在fd上下文中复用
+        Timer::ptr timer;
+        /// timer的到期时间, ~0ull表示没有启动
+        uint64_t timerNext = ~0ull;
+    };
+
+    /**
+     * @brief 工作线程在idle中的等待状态
+     */
+    enum WaitState {
+        /// 在执行任务(或正在进出idle)
+        RUNNING     = 0,
+        /// 作为follower阻塞在自己的eventfd上
+        SLEEPING    = 1,
+        /// 作为poller阻塞在epoll_wait上
+        POLLING     = 2,
+    };
+
+    /**
+     * @brief 工作线程的唤醒通道
+     * @details 同一时刻只有一个空闲线程(poller)在epoll_wait上等待IO事件和定时器,
+     *          其他空闲线程(follower)各自阻塞在自己的eventfd上, 这样tickle可以精确地唤醒一个线程
+     */
+    struct Waker {
+        typedef Spinlock MutexType;
+        /// eventfd, follower阻塞在它上面
+        int fd = -1;
+        /// sharded模式下本线程独占的epoll句柄
+        int epfd = -1;
+        /// sharded模式下本线程的io_uring
+        URing* ring = nullptr;
+        /// 线程id, 未注册为-1
+        std::atomic<int> thread = {-1};
+        /// 等待状态 WaitState
+        std::atomic<int> state = {RUNNING};
+        /// 未处理的唤醒: 0无, 1已标记(线程在运行, 下次等待前看到), 2已写eventfd
+        int notified = 0;
+        /// 保护state的切换和notified
+        MutexType mutex;
+        /// 以下统计只由所属线程写, 用relaxed的load/store累加, 避免所有线程争抢同一个缓存行
+        /// epoll_wait返回的次数
+        std::atomic<uint64_t> epollWakeups = {0};
+        /// epoll_wait取回的事件总数
+        std::atomic<uint64_t> epollEvents = {0};
+        /// 阻塞在epoll_wait中的总时间(微秒)
+        std::atomic<uint64_t> blockedUs = {0};
+        /// 忙轮询调用epoll_wait的次数
+        std::atomic<uint64_t> busyPolls = {0};
     };
 
 public:
@@ -81,8 +171,10 @@ public:
      * @param[in] threads 线程数量
      * @param[in] use_caller 是否将调用线程包含进去
      * @param[in] name 调度器的名称
+     * @param[in] sharded 是否每个线程使用独立的epoll(分片reactor), 每个fd只由所属的线程等待和处理
      */
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "");
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = ""
+              ,bool sharded = false);
 
     /**
      * @brief 析构函数
@@ -106,6 +198,17 @@ public:
      */
     bool delEvent(int fd, Event event);
 
+    /**
+     * @brief 添加事件并挂起当前协程, 直到事件触发、被取消或超时
+     * @details 超时时间点记录在fd上下文中, 由fd上下文复用的定时器到期时检查;
+     *          事件先触发时不取消定时器, 下次等待的超时更晚时也不调整定时器, 等待过程不分配内存
+     * @param[in] fd socket句柄
+     * @param[in] event 事件类型
+     * @param[in] timeout_ms 超时时间(毫秒), ~0ull表示不超时
+     * @return 事件触发或被取消返回0, 超时返回ETIMEDOUT, 添加事件失败返回-1
+     */
+    int waitEvent(int fd, Event event, uint64_t timeout_ms);
+
     /**
      * @brief 取消事件
      * @param[in] fd socket句柄
@@ -120,21 +223,75 @@ public:
      */
     bool cancelAll(int fd);
 
+    /**
+     * @brief 将fd分配给分片, 已注册的事件一起迁移到新分片的epoll
+     * @details 要在之后处理这个fd的IOManager上调用(不一定是IOManager::GetThis()),
+     *          分片只对该IOManager的epoll有效
+     * @param[in] fd socket句柄
+     * @param[in] shard 分片下标, -1表示在已运行的线程间轮流分配
+     * @return 分配的分片, 非sharded模式或失败返回-1
+     */
+    int assignShard(int fd, int shard = -1);
+
+    /**
+     * @brief 返回fd所属的分片, 未分配返回-1
+     */
+    int getShard(int fd);
+
+    /**
+     * @brief 是否每个线程使用独立的epoll
+     */
+    bool isSharded() const { return m_sharded;}
+
+    /**
+     * @brief 是否使用io_uring执行hook的socket操作(配置项iomanager.io_uring)
+     */
+    bool hasURing() const { return m_uring;}
+
+    /**
+     * @brief 通过io_uring执行一次fd上的操作, 成功提交后挂起当前协程直到操作完成
+     * @details 同一个fd同一种事件同时只能有一个操作, 与addEvent相同;
+     *          cancelEvent/cancelAll会取消对应的操作, 操作返回-ECANCELED;
+     *          共享栈协程的缓冲区可能在栈上, 不能异步读写, 直接返回-1
+     * @param[in] fd socket句柄
+     * @param[in] event 操作对应的事件类型, 用于取消
+     * @param[in] req 请求参数
+     * @param[out] res 操作的返回值, 失败为-errno, 超时为-ETIMEDOUT
+     * @param[in] timeout_ms 超时时间(毫秒), ~0ull表示不超时, 与waitEvent相同
+     * @return 提交成功返回0(已挂起并完成), 失败返回-1(未挂起, 应使用addEvent)
+     */
+    int submitIo(int fd, Event event, const IoRequest& req, int& res
+                 ,uint64_t timeout_ms = ~0ull);
+
     /**
      * @brief 返回当前的IOManager
      */
     static IOManager* GetThis();
+
+    /**
+     * @brief 输出调度器状态和唤醒统计
+     */
+    std::ostream& dump(std::ostream& os) override;
 protected:
+    /**
+     * @brief 唤醒一个空闲线程
+     * @details 优先唤醒follower, 不打断poller的epoll_wait;
+     *          已有被唤醒但还没开始运行的线程时合并本次唤醒, 由它取到任务后继续唤醒其他线程
+     */
     void tickle() override;
+
+    /**
+     * @brief 唤醒指定线程, 用于指定线程执行的任务
+     */
+    void tickle(int thread) override;
     bool stopping() override;
     void idle() override;
-    void onTimerInsertedAtFront() override;
+    void onTimerInsertedAtFront(size_t wheel) override;
 
     /**
-     * @brief 重置socket句柄上下文的容器大小
-     * @param[in] size 容量大小
+     * @brief sharded模式下每个分片一个时间轮, 返回当前线程的分片
      */
-    void contextResize(size_t size);
+    size_t getTimerWheel() override;
 
     /**
      * @brief 判断是否可以停止
@@ -142,17 +299,146 @@ protected:
      * @return 返回是否可以停止
      */
     bool stopping(uint64_t& timeout);
+private:
+    /**
+     * @brief 为当前线程分配唤醒通道
+     */
+    Waker* registerWaker();
+
+    /**
+     * @brief 返回线程的唤醒通道, 未注册返回nullptr
+     */
+    Waker* getWaker(int thread);
+
+    /**
+     * @brief 通知线程有任务
+     * @return 是否发出了新的唤醒(目标已有未处理的唤醒时返回false)
+     */
+    bool notify(Waker* waker);
+
+    /**
+     * @brief 进入等待状态
+     * @return 已有未处理的唤醒时返回false, 不应等待
+     */
+    bool beginWait(Waker* waker, WaitState state);
+
+    /**
+     * @brief 结束等待, 回到RUNNING状态
+     * @return 等待期间是否收到了唤醒
+     */
+    bool endWait(Waker* waker);
+
+    /**
+     * @brief poller离开后, 唤醒一个follower接替poll
+     */
+    void handoff();
+
+    /**
+     * @brief 返回fd所在的epoll句柄
+     */
+    int getEpfd(FdContext* fd_ctx);
+
+    /**
+     * @brief 为新的fd选择分片
+     * @param[in] local 是否优先选择当前线程
+     */
+    int pickShard(bool local);
+
+    /**
+     * @brief 返回fd的上下文, 第一次使用时创建
+     * @return fd超出上限时返回nullptr
+     */
+    FdContext* getFdContext(int fd);
+
+    /**
+     * @brief 查找fd的上下文, 不创建
+     * @return 不存在返回nullptr
+     */
+    FdContext* findFdContext(int fd) const;
+
+    /**
+     * @brief 返回fd的操作使用的io_uring, 调用者持有fd_ctx->mutex
+     */
+    URing* getRing(FdContext* fd_ctx);
+
+    /**
+     * @brief 取消fd上通过io_uring提交的操作, 调用者持有fd_ctx->mutex
+     * @return 是否有被取消的操作
+     */
+    bool cancelIo(FdContext* fd_ctx, Event event);
+
+    /**
+     * @brief 取消fd上的事件并触发, 调用者持有fd_ctx->mutex
+     */
+    bool cancelEvent(FdContext* fd_ctx, Event event);
+
+    /**
+     * @brief 设置等待的超时时间点, 调用者持有fd_ctx->mutex
+     * @details 只有新的时间点比定时器更早时才调整定时器
+     */
+    void setDeadline(FdContext* fd_ctx, Event event, uint64_t timeout_ms);
+
+    /**
+     * @brief fd上下文的定时器到期, 取消已经超时的等待, 还有未到期的等待时重新启动定时器
+     */
+    void onDeadline(FdContext* fd_ctx);
+
+    /**
+     * @brief 提交io_uring中攒下的请求
+     */
+    void flushIo(URing* ring);
+
+    /**
+     * @brief 收割io_uring的完成事件, 唤醒等待的协程
+     */
+    void reapIo(URing* ring);
 private:
     /// epoll 文件句柄
     int m_epfd = 0;
-    /// pipe 文件句柄
-    int m_tickleFds[2];
+    /// 唤醒poller的eventfd, 注册在m_epfd中
+    int m_tickleFd = -1;
+    /// 是否每个线程使用独立的epoll
+    bool m_sharded = false;
+    /// 轮流分配分片的计数
+    std::atomic<uint32_t> m_nextShard = {0};
+    /// 是否使用io_uring
+    bool m_uring = false;
+    /// 非sharded模式下共用的io_uring
+    URing* m_ring = nullptr;
+    /// 通过io_uring执行的操作数
+    std::atomic<uint64_t> m_uringOps = {0};
+    /// io_uring_enter提交的次数
+    std::atomic<uint64_t> m_uringSubmits = {0};
+    /// 每次epoll_wait最多取回的事件数
+    size_t m_maxEvents = 256;
+    /// 阻塞前忙轮询的时间(微秒), 0表示不忙轮询
+    uint32_t m_busyPollUs = 0;
+    /// 每个工作线程的唤醒通道
+    std::vector<Waker*> m_wakers;
+    /// 已注册的唤醒通道数
+    std::atomic<size_t> m_wakerCount = {0};
+    /// 当前的poller
+    std::atomic<Waker*> m_poller = {nullptr};
+    /// 已唤醒但还没有醒来的线程数
+    std::atomic<size_t> m_pendingWakes = {0};
+    /// 写eventfd的次数
+    std::atomic<uint64_t> m_wakes = {0};
+    /// 被合并的唤醒次数
+    std::atomic<uint64_t> m_coalescedWakes = {0};
+    /// 无事可做的唤醒次数(残留的eventfd计数)
+    std::atomic<uint64_t> m_spuriousWakes = {0};
     /// 当前等待执行的事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    /// IOManager的Mutex
-    RWMutexType m_mutex;
-    /// socket事件上下文的容器
-    std::vector<FdContext*> m_fdContexts;
+    /// 每个分块的fd上下文个数
+    static const size_t FD_CHUNK_SIZE = 1024;
+    /// 分块个数, 可容纳的fd上限为FD_CHUNK_SIZE * FD_CHUNK_COUNT
+    static const size_t FD_CHUNK_COUNT = 4096;
+    /// fd上下文的分块, 槽位在fd第一次使用时才创建
+    struct FdChunk {
+        std::atomic<FdContext*> slots[FD_CHUNK_SIZE];
+    };
+    /// socket事件上下文的两级表, 分块和上下文都只追加不释放, 查找不加锁
+    std::atomic<FdChunk*> m_fdChunks[FD_CHUNK_COUNT];
 };
 
 }
@@ -160,12 +160,8 @@ public:
     }
 
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
+        // 同一秒内的日志复用格式化好的时间
+        os << Clock::LocalTime(event->getTime(), m_format);
     }
 private:
     std::string m_format;
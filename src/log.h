@@ -19,6 +19,7 @@
 #include <stdarg.h>
 #include <map>
 #include "util.h"
+#include "clock.h"
 #include "singleton.h"
 #include "thread.h"
 
@@ -29,7 +30,7 @@
     if(logger->getLevel() <= level) \
         webserver::LogEventWrap(webserver::LogEvent::ptr(new webserver::LogEvent(logger, level, \
                         __FILE__, __LINE__, 0, webserver::GetThreadId(),\
-                webserver::GetFiberId(), time(0), webserver::Thread::GetName()))).getSS()
+                webserver::GetFiberId(), webserver::Clock::NowSec(), webserver::Thread::GetName()))).getSS()
 
 /**
  * @brief 使用流式方式将日志级别debug的日志写入到logger
@@ -63,7 +64,7 @@
     if(logger->getLevel() <= level) \
         webserver::LogEventWrap(webserver::LogEvent::ptr(new webserver::LogEvent(logger, level, \
                         __FILE__, __LINE__, 0, webserver::GetThreadId(),\
-                webserver::GetFiberId(), time(0), webserver::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+                webserver::GetFiberId(), webserver::Clock::NowSec(), webserver::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别debug的日志写入到logger
@@ -2,6 +2,9 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "clock.h"
+#include "work_steal_queue.h"
+#include <algorithm>
 
 namespace webserver {
 
@@ -12,6 +15,115 @@ static webserver::Logger::ptr g_logger = WEBSERVER_LOG_NAME("system");
 static thread_local Scheduler* t_scheduler = nullptr;
 // 线程局部变量，用于存储当前线程的主协程，主要用于调度器内部切换协程时使用
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+// 线程局部变量，当前线程在t_scheduler中占用的工作线程槽位
+static thread_local void* t_worker = nullptr;
+
+struct Scheduler::Worker {
+    /// 本线程的任务双端队列
+    WorkStealQueue<FiberAndThread*> queue;
+    /// pinned队列的锁
+    Spinlock mutex;
+    /// 指定在本线程执行的任务, 通过FiberAndThread::next串起来, 放入时不分配内存
+    FiberAndThread* pinnedHead = nullptr;
+    FiberAndThread* pinnedTail = nullptr;
+    /// pinned队列中的任务数
+    std::atomic<size_t> pinnedCount = {0};
+    /// 线程id, 注册后不再改变
+    std::atomic<int> thread = {-1};
+
+    /**
+     * @brief 放入pinned队列, 调用者持有mutex
+     */
+    void pushPinned(FiberAndThread* ft) {
+        ft->next = nullptr;
+        if(pinnedTail) {
+            pinnedTail->next = ft;
+        } else {
+            pinnedHead = ft;
+        }
+        pinnedTail = ft;
+        ++pinnedCount;
+    }
+
+    /**
+     * @brief 取出pinned队列的第一个任务, 调用者持有mutex
+     */
+    FiberAndThread* popPinned() {
+        FiberAndThread* ft = pinnedHead;
+        if(ft) {
+            pinnedHead = ft->next;
+            if(!pinnedHead) {
+                pinnedTail = nullptr;
+            }
+            --pinnedCount;
+        }
+        return ft;
+    }
+    /// 已处理的任务数, 用于定期检查全局注入队列
+    uint64_t ticks = 0;
+    /// 选择窃取对象的随机数种子
+    uint32_t seed = 0;
+};
+
+/**
+ * @brief 线程本地的任务内存块缓存
+ * @details 任务由执行它的线程释放, 放回执行线程的缓存; 工作线程上产生的任务大多也在本线程执行,
+ *          稳定运行时schedule不再分配内存. 空闲块的前8个字节保存下一个空闲块的地址
+ */
+struct TaskCache {
+    static const size_t MAX_COUNT = 1024;
+    void* head = nullptr;
+    size_t count = 0;
+
+    ~TaskCache() {
+        while(head) {
+            void* next = *(void**)head;
+            ::operator delete(head);
+            head = next;
+        }
+    }
+};
+
+// t_task_cache 在线程退出时由 s_holder 析构并置空, 之后释放的任务直接delete
+static thread_local TaskCache* t_task_cache = nullptr;
+
+struct TaskCacheHolder {
+    TaskCache cache;
+    TaskCacheHolder() {
+        t_task_cache = &cache;
+    }
+    ~TaskCacheHolder() {
+        t_task_cache = nullptr;
+    }
+};
+
+static TaskCache* GetTaskCache() {
+    static thread_local TaskCacheHolder s_holder;
+    return t_task_cache;
+}
+
+void* Scheduler::AllocTask() {
+    TaskCache* cache = GetTaskCache();
+    if(cache && cache->head) {
+        void* vp = cache->head;
+        cache->head = *(void**)vp;
+        --cache->count;
+        return vp;
+    }
+    return ::operator new(sizeof(FiberAndThread));
+}
+
+void Scheduler::FreeTask(FiberAndThread* ft) {
+    ft->~FiberAndThread();
+    TaskCache* cache = GetTaskCache();
+    if(cache && cache->count < TaskCache::MAX_COUNT) {
+        *(void**)ft = cache->head;
+        cache->head = ft;
+        ++cache->count;
+        return;
+    }
+    ::operator delete(ft);
+}
 
 /**
  * @brief Scheduler构造函数，初始化调度器实例。
@@ -24,6 +136,13 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     :m_name(name) { // 初始化成员变量m_name为提供的名称
     WEBSERVER_ASSERT(threads > 0); // 确保传入的线程数量大于0
 
+    // 每个工作线程(包括use_caller线程)一个槽位
+    m_workers.resize(threads);
+    for(size_t i = 0; i < threads; ++i) {
+        m_workers[i] = new Worker;
+        m_workers[i]->seed = (uint32_t)(i + 1) * 2654435761u;
+    }
+
     // 如果use_caller为true，表示将调用者线程作为调度器的一部分
     if(use_caller) {
         webserver::Fiber::GetThis(); // 确保调用者线程的主协程已被创建，这是协程调度的前提
@@ -39,6 +158,7 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         t_scheduler_fiber = m_rootFiber.get(); // 将根协程设置为当前线程的主协程
         m_rootThread = webserver::GetThreadId(); // 获取并设置当前线程ID为根线程ID
         m_threadIds.push_back(m_rootThread); // 将根线程ID添加到线程ID列表中
+        registerWorker(); // 调用者线程占用第一个槽位, 在run之前产生的任务也进入它的队列
     } else {
         m_rootThread = -1; // 如果不使用调用者线程，则将根线程ID设置为-1
     }
@@ -75,6 +195,21 @@ Scheduler::~Scheduler() {
     // 如果当前线程的调度器实例正是这个调度器实例，将其置为nullptr
     if(GetThis() == this) {
         t_scheduler = nullptr;
+        t_worker = nullptr;
+    }
+
+    // 释放未执行的任务
+    for(auto w : m_workers) {
+        while(FiberAndThread* ft = w->queue.pop()) {
+            FreeTask(ft);
+        }
+        while(FiberAndThread* ft = w->popPinned()) {
+            FreeTask(ft);
+        }
+        delete w;
+    }
+    for(auto ft : m_fibers) {
+        FreeTask(ft);
     }
 }
 // 返回当前协程调度器
@@ -257,12 +392,15 @@ void Scheduler::run() {
     setThis();
 
     // 检查当前线程是否为根线程，如果不是，则设置当前协程为调度器协程。
+    // 根线程在构造函数中已经占用了工作线程槽位
+    Worker* worker = (Worker*)t_worker;
     if(webserver::GetThreadId() != m_rootThread) {
         t_scheduler_fiber = Fiber::GetThis().get();
+        worker = registerWorker();
     }
 
     // 创建一个空闲协程，用于调度器在没有任务执行时切换至此协程，执行idle函数。
-    Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
+    Fiber::ptr idle_fiber = Fiber::Create(std::bind(&Scheduler::idle, this));
 
     // 用于执行回调任务的协程，初始状态为空。
     Fiber::ptr cb_fiber;
@@ -270,52 +408,58 @@ void Scheduler::run() {
     // 创建一个FiberAndThread结构体实例，用于记录待执行的协程或回调以及它们对应的线程ID。
     FiberAndThread ft;
 
+    // 距离上次切换空闲协程执行的轮数
+    uint32_t ticks = 0;
+
+    // 开启本线程的时间缓存
+    Clock::Update();
+
     // 调度器的主循环。
     while(true) {
         // 每轮循环开始时重置ft，准备接收新的任务。
         ft.reset();
 
-        // 用于记录是否需要唤醒其他线程来处理任务队列。
-        bool tickle_me = false;
-        // 标记当前是否有活跃的任务被处理。
-        bool is_active = false;
-
-        // 用互斥锁保护任务队列，防止多线程访问冲突。
-        {
-            MutexType::Lock lock(m_mutex);
-            auto it = m_fibers.begin();
-            // 遍历任务队列，寻找适合当前线程执行的任务。
-            while(it != m_fibers.end()) {
-                // 如果任务指定了执行线程，并且不是当前线程，则跳过。
-                if(it->thread != -1 && it->thread != webserver::GetThreadId()) {
-                    ++it;
-                    tickle_me = true; // 需要唤醒其他线程来处理任务。
-                    continue;
-                }
-
-                // 确保任务是有效的，即有协程或回调需要执行。
-                WEBSERVER_ASSERT(it->fiber || it->cb);
-
-                // 如果任务是协程，并且协程已经在执行中，则跳过。
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
+        // 任务一直不断时也定期进入空闲协程, 空闲协程看到还有任务不会阻塞
+        if(m_pollInterval && ++ticks >= m_pollInterval) {
+            ticks = 0;
+            if(idle_fiber->getState() != Fiber::TERM) {
+                ++m_idleThreadCount;
+                idle_fiber->swapIn();
+                --m_idleThreadCount;
+                Clock::Update();
+                if(idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEPT) {
+                    idle_fiber->m_state = Fiber::HOLD;
                 }
-
-                // 找到一个可执行的任务，从队列中移除并准备执行。
-                ft = *it;
-                m_fibers.erase(it++);
-                ++m_activeThreadCount; // 活跃任务计数增加。
-                is_active = true;
-                break;
             }
-            // 如果任务队列还有任务，则设置tickle_me为true。
-            tickle_me |= it != m_fibers.end();
         }
 
-        // 如果需要唤醒其他线程处理任务队列，则调用tickle函数。
-        if(tickle_me) {
-            tickle();
+        // 先增加活跃计数再取任务, 保证stopping()不会在任务出队和开始执行之间判断为可以停止
+        ++m_activeThreadCount;
+        FiberAndThread* task = take(worker);
+        // 标记当前是否有活跃的任务被处理。
+        bool is_active = task != nullptr;
+
+        if(task) {
+            // 如果任务是协程，并且协程还在其他线程上执行(刚被schedule, 尚未完全切出)，则放回全局队列稍后执行。
+            if(task->fiber && task->fiber->getState() == Fiber::EXEC) {
+                ++m_taskCount;
+                {
+                    MutexType::Lock lock(m_mutex);
+                    m_fibers.push_back(task);
+                    ++m_globalCount;
+                }
+                --m_activeThreadCount;
+                continue;
+            }
+            ft.fiber.swap(task->fiber);
+            ft.cb.swap(task->cb);
+            ft.thread = task->thread;
+            FreeTask(task);
+
+            // 如果还有其他任务，则唤醒其他线程来处理。
+            if(m_taskCount > 0) {
+                tickle();
+            }
         }
 
         // 如果找到的任务是协程，并且协程状态不是终止或异常，则执行协程。
@@ -331,11 +475,11 @@ void Scheduler::run() {
             }
             ft.reset(); // 重置ft，准备下一轮循环。
         } else if(ft.cb) { // 如果找到的任务是回调函数，则执行回调。
-            // 如果已有回调协程，则重置其任务为当前回调；否则创建新的回调协程。
+            // 如果已有回调协程，则重置其任务为当前回调；否则从协程池获取回调协程。
             if(cb_fiber) {
                 cb_fiber->reset(ft.cb);
             } else {
-                cb_fiber.reset(new Fiber(ft.cb));
+                cb_fiber = Fiber::Create(ft.cb, 0, false, m_sharedStack);
             }
             ft.reset(); // 重置ft，准备执行回调。
             cb_fiber->swapIn(); // 切换到回调协程执行。
@@ -352,20 +496,29 @@ void Scheduler::run() {
                 cb_fiber.reset();
             }
         } else { // 如果没有找到可执行的任务。
-            if(is_active) { // 如果本轮循环处理过活跃任务，则减少活跃任务计数并继续下一轮。
-                --m_activeThreadCount;
+            --m_activeThreadCount; // 取任务前增加的活跃计数
+            if(is_active) { // 如果本轮循环取到的是已结束的协程，则继续下一轮。
                 continue;
             }
             // 如果空闲协程已终止，则退出主循环。
             if(idle_fiber->getState() == Fiber::TERM) {
                 WEBSERVER_LOG_INFO(g_logger) << "idle fiber term";
+                // 离开调度循环后没有人刷新缓存的时间了(use_caller线程会回到用户代码)
+                Clock::Disable();
                 break;
             }
 
             // 没有任务执行时，切换到空闲协程，直到有新的任务到来。
             ++m_idleThreadCount; // 空闲线程计数增加。
+            // 先标记空闲再检查任务数, 与enqueue中先增加任务数再检查空闲线程相对应, 避免丢失唤醒
+            if(m_taskCount > 0) {
+                tickle();
+            }
             idle_fiber->swapIn(); // 切换到空闲协程执行。
             --m_idleThreadCount; // 执行完成后，空闲线程计数减少。
+            // 每轮反应器循环(从空闲协程返回)刷新一次缓存的时间, 之后的任务不再读系统时钟;
+            // follower被唤醒和没有epoll的调度器也走这里
+            Clock::Update();
 
             // 根据空闲协程执行后的状态，决定是否设置为保持状态。
             if(idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEPT) {
@@ -376,6 +529,130 @@ void Scheduler::run() {
 }
 
 
+Scheduler::Worker* Scheduler::registerWorker() {
+    size_t idx = m_workerCount++;
+    WEBSERVER_ASSERT2(idx < m_workers.size(), "too many worker threads");
+    Worker* w = m_workers[idx];
+    w->thread = webserver::GetThreadId();
+    t_worker = w;
+    return w;
+}
+
+Scheduler::Worker* Scheduler::getWorker(int thread) {
+    // 恢复到当前线程的协程(共享栈协程在自己的线程上被唤醒)不需要查找
+    Worker* cur = (Worker*)t_worker;
+    if(t_scheduler == this && cur && cur->thread == thread) {
+        return cur;
+    }
+    // 槽位数等于线程数, 顺序查找比加锁查哈希表更快; 还没设置线程id的槽位不会匹配,
+    // 这时任务进入全局注入队列, 由takeGlobal转交
+    size_t n = std::min(m_workerCount.load(), m_workers.size());
+    for(size_t i = 0; i < n; ++i) {
+        if(m_workers[i]->thread == thread) {
+            return m_workers[i];
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::enqueue(FiberAndThread* ft) {
+    // 先增加任务数再放入队列, 保证stopping()不会漏掉已放入的任务
+    size_t old = m_taskCount++;
+    if(ft->thread != -1) {
+        // 指定线程的任务直接放入目标线程的pinned队列
+        Worker* w = getWorker(ft->thread);
+        if(w) {
+            {
+                Spinlock::Lock lock(w->mutex);
+                w->pushPinned(ft);
+            }
+            tickle(w->thread);
+            return false;
+        }
+    } else if(t_scheduler == this && t_worker) {
+        // 本调度器的工作线程产生的任务放入自己的双端队列
+        ((Worker*)t_worker)->queue.push(ft);
+        return old == 0;
+    }
+    // 其他线程产生的任务(或目标线程尚未注册)放入全局注入队列
+    MutexType::Lock lock(m_mutex);
+    m_fibers.push_back(ft);
+    ++m_globalCount;
+    return old == 0 || ft->thread != -1;
+}
+
+Scheduler::FiberAndThread* Scheduler::takeGlobal(Worker* worker) {
+    FiberAndThread* ft = nullptr;
+    std::vector<int> rerouted;
+    {
+        MutexType::Lock lock(m_mutex);
+        auto it = m_fibers.begin();
+        while(it != m_fibers.end()) {
+            FiberAndThread* cur = *it;
+            if(cur->thread == -1 || cur->thread == worker->thread) {
+                ft = cur;
+                m_fibers.erase(it);
+                --m_globalCount;
+                break;
+            }
+            // 指定线程的任务在目标线程注册前进入了全局队列, 转交给目标线程
+            Worker* w = getWorker(cur->thread);
+            if(!w) {
+                ++it;
+                continue;
+            }
+            it = m_fibers.erase(it);
+            --m_globalCount;
+            Spinlock::Lock wlock(w->mutex);
+            w->pushPinned(cur);
+            rerouted.push_back(w->thread);
+        }
+    }
+    for(auto i : rerouted) {
+        tickle(i);
+    }
+    return ft;
+}
+
+Scheduler::FiberAndThread* Scheduler::take(Worker* worker) {
+    FiberAndThread* ft = nullptr;
+    // 1. 指定在本线程执行的任务
+    if(worker->pinnedCount) {
+        Spinlock::Lock lock(worker->mutex);
+        ft = worker->popPinned();
+    }
+    // 2. 定期优先检查全局注入队列, 避免本地任务不断产生时全局队列饥饿
+    if(!ft && (++worker->ticks % 61) == 0 && m_globalCount) {
+        ft = takeGlobal(worker);
+    }
+    // 3. 本线程的双端队列
+    if(!ft) {
+        ft = worker->queue.pop();
+    }
+    // 4. 全局注入队列
+    if(!ft && m_globalCount) {
+        ft = takeGlobal(worker);
+    }
+    // 5. 从随机的其他线程窃取
+    if(!ft && m_taskCount) {
+        size_t n = m_workers.size();
+        worker->seed ^= worker->seed << 13;
+        worker->seed ^= worker->seed >> 17;
+        worker->seed ^= worker->seed << 5;
+        size_t start = worker->seed % n;
+        for(size_t i = 0; i < n && !ft; ++i) {
+            Worker* victim = m_workers[(start + i) % n];
+            if(victim != worker) {
+                ft = victim->queue.steal();
+            }
+        }
+    }
+    if(ft) {
+        --m_taskCount;
+    }
+    return ft;
+}
+
 // 唤醒调度器以处理更多任务或进行清理操作。
 /*
 tickle函数的作用是向调度器发送一个信号，告知有新的任务需要处理或者有任务状态发生了变化。
@@ -386,20 +663,23 @@ void Scheduler::tickle() {
     WEBSERVER_LOG_INFO(g_logger) << "tickle";
 }
 
+void Scheduler::tickle(int thread) {
+    tickle();
+}
+
 // 检查调度器是否处于停止状态。
 /*
 stopping函数用于判断调度器是否应该停止运行。
 它检查是否启用了自动停止，调度器是否已被明确要求停止，以及是否所有任务都已处理完成。
 */
 bool Scheduler::stopping() {
-    // 通过互斥锁保护访问共享资源，以避免数据竞争。
-    MutexType::Lock lock(m_mutex);
+    // 任务总数和活跃线程数都是原子变量, 不需要加锁。
     // 如果满足以下所有条件，则返回true，表示调度器正在停止：
     // 1. 自动停止被启用；
     // 2. 明确要求停止；
     // 3. 没有待处理的协程；
     // 4. 没有活跃的线程。
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    return m_autoStop && m_stopping && m_taskCount == 0 && m_activeThreadCount == 0;
 }
 
 
@@ -454,6 +734,8 @@ std::ostream& Scheduler::dump(std::ostream& os) {
        << " active_count=" << m_activeThreadCount
        << " idle_count=" << m_idleThreadCount
        << " stopping=" << m_stopping
+       << " tasks=" << m_taskCount
+       << " global=" << m_globalCount
        << " ]" << std::endl << "    ";
 
     // 遍历所有线程ID，并将它们输出到流中，线程ID之间用逗号分隔。
@@ -467,6 +749,15 @@ std::ostream& Scheduler::dump(std::ostream& os) {
     return os;
 }
 
+std::vector<int> Scheduler::getWorkerThreadIds() {
+    MutexType::Lock lock(m_mutex);
+    std::vector<int> ids;
+    for(auto& i : m_threads) {
+        ids.push_back(i->getId());
+    }
+    return ids;
+}
+
 /*
 SchedulerSwitcher是一个辅助类，其构造函数用于在创建对象时自动切换到目标调度器，而析构函数则在对象销毁时自动切换回原来的调度器。
 这种设计利用了C++的RAII（资源获取即初始化）原则，
@@ -4,6 +4,7 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <new>
 #include <iostream>
 #include "fiber.h"
 #include "thread.h"
@@ -39,6 +40,12 @@ public:
      */
     const std::string& getName() const { return m_name;}
 
+    /**
+     * @brief 返回调度器创建的工作线程id, 不含use_caller线程
+     * @details 可以作为schedule的thread参数, 把任务固定到某个工作线程
+     */
+    std::vector<int> getWorkerThreadIds();
+
     /**
      * @brief 返回当前协程调度器
      */
@@ -67,18 +74,14 @@ public:
     * @param[in] thread 协程或函数执行的线程ID。默认为-1，表示不指定线程，由调度器决定在哪个线程上执行。
     *                   如果指定了线程ID，任务将尝试在指定的线程上执行。
     * @details
-    * 函数首先锁定互斥锁以确保线程安全，然后调用`scheduleNoLock`来实际安排任务。
+    * 函数调用`scheduleNoLock`来实际安排任务, 任务队列是按工作线程划分的, 不需要持有全局锁。
     * `scheduleNoLock`会根据当前任务队列的状态返回一个布尔值，指示是否需要通过`tickle`方法通知调度器有新的任务到来。
-    * 如果`scheduleNoLock`返回true，表示任务队列之前为空，现在有了新任务，因此需要调用`tickle`来唤醒调度器处理新的任务。
+    * 如果`scheduleNoLock`返回true，表示任务队列之前为空或任务指定了线程，因此需要调用`tickle`来唤醒调度器处理新的任务。
     */
 
     template<class FiberOrCb>
     void schedule(FiberOrCb fc, int thread = -1) {
-        bool need_tickle = false; // 标记是否需要唤醒调度器
-        {
-            MutexType::Lock lock(m_mutex); // 锁定互斥锁以确保线程安全
-            need_tickle = scheduleNoLock(fc, thread); // 安排任务，检查是否需要唤醒调度器
-        }
+        bool need_tickle = scheduleNoLock(fc, thread); // 安排任务，检查是否需要唤醒调度器
 
         if(need_tickle) {
             tickle(); // 如果需要，则唤醒调度器
@@ -98,23 +101,17 @@ public:
     * @param[in] end 结束迭代器，指向任务序列的结束，此迭代器本身不包含在内。
     * 
     * @details
-    * 函数首先获取调度器的互斥锁，以保证线程安全。
-    * 然后遍历从begin到end的每一个元素，对每个元素调用`scheduleNoLock`函数，尝试将其加入调度队列。
-    * 如果在任何点上`scheduleNoLock`返回true（表示调度队列在加入任务之前是空的，因此需要唤醒调度器），则记录这一信息。
-    * 遍历完成后，如果有需要唤醒调度器的情况，就调用`tickle`方法进行唤醒。
-    * 
-    * 这种批量调度方法适用于当有多个任务需要被同时调度时，可以减少对互斥锁的多次获取释放，提高效率。
+    * 遍历从begin到end的每一个元素，对每个元素调用`scheduleNoLock`函数，尝试将其加入调度队列。
+    * 如果在任何点上`scheduleNoLock`返回true（表示需要唤醒调度器），则记录这一信息。
+    * 遍历完成后，如果有需要唤醒调度器的情况，就调用`tickle`方法进行唤醒，只唤醒一次。
     */
     template<class InputIterator>
     void schedule(InputIterator begin, InputIterator end) {
         bool need_tickle = false; // 标记是否需要唤醒调度器
-        {
-            MutexType::Lock lock(m_mutex); // 锁定互斥锁以确保线程安全
-            while(begin != end) {
-                // 尝试将当前迭代器指向的任务加入调度队列，并检查是否需要唤醒调度器
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                ++begin; // 移动到下一个任务
-            }
+        while(begin != end) {
+            // 尝试将当前迭代器指向的任务加入调度队列，并检查是否需要唤醒调度器
+            need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
+            ++begin; // 移动到下一个任务
         }
         if(need_tickle) {
             tickle(); // 如果需要，唤醒调度器处理新加入的任务
@@ -123,13 +120,32 @@ public:
 
 
     void switchTo(int thread = -1);
-    std::ostream& dump(std::ostream& os);
+
+    /**
+     * @brief 设置回调任务是否运行在共享栈协程上
+     * @details 开启后schedule的回调函数使用共享栈协程执行(见Fiber构造函数),
+     *          协程挂起时只保存实际使用的栈, 适合大量长连接挂起的场景
+     */
+    void setSharedStack(bool v) { m_sharedStack = v;}
+
+    /**
+     * @brief 回调任务是否运行在共享栈协程上
+     */
+    bool isSharedStack() const { return m_sharedStack;}
+    virtual std::ostream& dump(std::ostream& os);
 protected:
     /**
      * @brief 通知协程调度器有任务了
      */
     virtual void tickle();
-    
+
+    /**
+     * @brief 通知指定线程有任务了(指定线程执行的任务)
+     * @param[in] thread 线程id
+     * @details 默认实现等同于tickle()
+     */
+    virtual void tickle(int thread);
+
     /**
      * @brief 协程调度函数
      */
@@ -154,38 +170,91 @@ protected:
      * @brief 是否有空闲线程
      */
     bool hasIdleThreads() { return m_idleThreadCount > 0;}
+
+    /**
+     * @brief 是否有待执行的任务
+     */
+    bool hasTasks() const { return m_taskCount > 0;}
 private:
+    struct FiberAndThread;
     /**
     * @brief 将协程或函数安排进调度队列中，不需要外部加锁。
     * 
-    * 这个函数在调度器的互斥锁已经被锁定的情况下调用，以安全地将任务添加到调度队列中。
     * 它检查任务队列是否为空，如果为空，表示调度器在等待状态，需要通过返回true来告知调用者发送唤醒信号。
     * 
     * @tparam FiberOrCb 协程或函数的类型。这使得函数能够以泛型的方式处理不同类型的任务，无论是协程对象还是可调用对象。
     * @param fc 要调度的协程或函数。它可以是一个协程对象（Fiber::ptr）或者是一个可调用对象，例如函数指针、lambda表达式等。
     * @param thread 指定任务应该在哪个线程上执行的线程ID。如果传入-1，则表示任务可以在任意线程上执行。
     * 
-    * @return bool 如果调度队列在添加任务前是空的，则返回true，表示需要唤醒调度器。否则，返回false。
+    * @return bool 如果调度队列在添加任务前是空的(或任务指定了线程)，则返回true，表示需要唤醒调度器。否则，返回false。
     * 
     * @details
-    * 函数首先检查调度队列是否为空，这是决定是否需要唤醒调度器的关键。
-    * 然后，它创建一个FiberAndThread结构体实例，封装了任务和目标线程ID。
-    * 如果该任务是有效的（即封装的协程对象或函数对象不为空），则将它添加到调度队列的末尾。
-    * 这种设计允许调度器以统一的方式处理协程和函数，同时保持高效和线程安全。
+    * 它创建一个FiberAndThread结构体实例，封装了任务和目标线程ID。
+    * 结构体的内存从线程本地的缓存中获取，不需要每次分配。
+    * 如果该任务是有效的（即封装的协程对象或函数对象不为空），则交给enqueue放入合适的队列。
     */
     template<class FiberOrCb>
     bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool need_tickle = m_fibers.empty(); // 检查调度队列是否为空
-        FiberAndThread ft(fc, thread); // 创建封装了任务和线程ID的结构体
+        FiberAndThread* ft = new (AllocTask()) FiberAndThread(fc, thread); // 创建封装了任务和线程ID的结构体
 
         // 如果任务是有效的，即有具体的协程或函数需要执行
-        if(ft.fiber || ft.cb) {
-            m_fibers.push_back(ft); // 将任务添加到调度队列
+        if(ft->fiber || ft->cb) {
+            return enqueue(ft);
         }
-
-        return need_tickle; // 返回是否需要唤醒调度器
+        FreeTask(ft);
+        return false;
     }
 
+    /**
+     * @brief 获取一个FiberAndThread大小的内存块, 优先从线程本地的缓存中取
+     */
+    static void* AllocTask();
+
+    /**
+     * @brief 析构任务并把内存块放回线程本地的缓存
+     */
+    static void FreeTask(FiberAndThread* ft);
+
+    /**
+     * @brief 工作线程
+     * @details 每个工作线程(包括use_caller线程)占用一个槽位:
+     *          queue 为Chase-Lev双端队列, 本线程产生的任务无锁地放入/取出, 空闲的线程从其他线程窃取
+     *          pinned 为指定在本线程执行的任务, 其他线程O(1)地放入
+     */
+    struct Worker;
+
+    /**
+     * @brief 将任务放入队列
+     * @details 指定线程的任务放入目标线程的pinned队列, 并直接唤醒目标线程;
+     *          在本调度器的工作线程上产生的任务放入该线程的双端队列;
+     *          其他线程产生的任务放入全局注入队列
+     * @return 是否需要唤醒调度器
+     */
+    bool enqueue(FiberAndThread* ft);
+
+    /**
+     * @brief 为当前线程分配工作线程槽位
+     */
+    Worker* registerWorker();
+
+    /**
+     * @brief 根据线程id返回工作线程, 未注册返回nullptr
+     * @details 当前线程直接返回线程本地的槽位, 其他线程顺序查找槽位数组, 不加锁
+     */
+    Worker* getWorker(int thread);
+
+    /**
+     * @brief 为工作线程获取下一个任务
+     * @details 依次检查: pinned队列, 自己的双端队列, 全局注入队列, 随机窃取其他线程
+     *          每处理一定数量的任务优先检查一次全局注入队列, 避免饥饿
+     */
+    FiberAndThread* take(Worker* worker);
+
+    /**
+     * @brief 从全局注入队列取出可在当前线程执行的任务
+     */
+    FiberAndThread* takeGlobal(Worker* worker);
+
 private:
     /**
      * @brief 协程/函数/线程组
@@ -197,6 +266,8 @@ private:
         std::function<void()> cb;
         /// 线程id
         int thread;
+        /// pinned队列中的下一个任务
+        FiberAndThread* next = nullptr;
 
         /**
          * @brief 构造函数
@@ -207,6 +278,10 @@ private:
          */
         FiberAndThread(Fiber::ptr f, int thr)
             :fiber(f), thread(thr) {
+            // 共享栈协程只能在绑定的线程上恢复执行
+            if(fiber && thread == -1) {
+                thread = fiber->getHomeThread();
+            }
         }
 
         /**
@@ -222,6 +297,9 @@ private:
         FiberAndThread(Fiber::ptr* f, int thr)
             :thread(thr) {
             fiber.swap(*f);
+            if(fiber && thread == -1) {
+                thread = fiber->getHomeThread();
+            }
         }
 
         /**
@@ -279,8 +357,16 @@ private:
     MutexType m_mutex;
     /// 线程池
     std::vector<Thread::ptr> m_threads;
-    /// 待执行的协程队列
-    std::list<FiberAndThread> m_fibers;
+    /// 全局注入队列(非工作线程产生的任务), 由m_mutex保护
+    std::list<FiberAndThread*> m_fibers;
+    /// 全局注入队列中的任务数
+    std::atomic<size_t> m_globalCount = {0};
+    /// 工作线程槽位
+    std::vector<Worker*> m_workers;
+    /// 已分配的槽位数
+    std::atomic<size_t> m_workerCount = {0};
+    /// 所有队列中待执行的任务总数
+    std::atomic<size_t> m_taskCount = {0};
     /// use_caller为true时有效, 调度协程
     Fiber::ptr m_rootFiber;
     /// 协程调度器名称
@@ -300,6 +386,10 @@ protected:
     bool m_autoStop = false;
     /// 主线程id(use_caller)
     int m_rootThread = 0;
+    /// 回调任务是否使用共享栈协程
+    bool m_sharedStack = false;
+    /// 有任务时每执行多少轮切换一次空闲协程(不阻塞地处理IO事件), 0表示只在没有任务时切换
+    uint32_t m_pollInterval = 0;
 };
 
 // class SchedulerSwitcher : public Noncopyable {
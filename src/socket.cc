@@ -4,12 +4,112 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
 #include <limits.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
 
 namespace webserver {
 
 static webserver::Logger::ptr g_logger = WEBSERVER_LOG_NAME("system");
 
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+/// send的数据不小于这个长度时用MSG_ZEROCOPY发送, 0表示不使用
+static webserver::ConfigVar<uint32_t>::ptr g_zerocopy_threshold =
+    webserver::Config::Lookup("socket.zerocopy_threshold", (uint32_t)0,
+            "send with MSG_ZEROCOPY when length >= threshold, 0 disables");
+
+/// splice使用的管道容量(字节), 决定一次最多转发多少数据
+static webserver::ConfigVar<uint32_t>::ptr g_splice_pipe_size =
+    webserver::Config::Lookup("socket.splice_pipe_size", (uint32_t)(256 * 1024),
+            "pipe size used by Socket::spliceFrom");
+
+/// SSL握手后是否把加解密交给内核(kTLS)
+static webserver::ConfigVar<bool>::ptr g_ssl_ktls =
+    webserver::Config::Lookup("ssl.ktls", false, "offload tls record layer to kernel after handshake");
+
+static uint32_t s_zerocopy_threshold = 0;
+static bool s_ktls = false;
+
+namespace {
+
+struct _SocketIniter {
+    _SocketIniter() {
+        s_zerocopy_threshold = g_zerocopy_threshold->getValue();
+        g_zerocopy_threshold->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            WEBSERVER_LOG_INFO(g_logger) << "socket zerocopy threshold changed from "
+                                         << old_value << " to " << new_value;
+            s_zerocopy_threshold = new_value;
+        });
+
+        s_ktls = g_ssl_ktls->getValue();
+        g_ssl_ktls->addListener([](const bool& old_value, const bool& new_value){
+            WEBSERVER_LOG_INFO(g_logger) << "ssl ktls changed from "
+                                         << old_value << " to " << new_value;
+            s_ktls = new_value;
+        });
+    }
+};
+
+static _SocketIniter s_socket_initer;
+
+}
+
+/**
+ * 经用户态内存把文件内容发送到socket, 用于不能sendfile的情况(SSL或文件不支持)。
+ */
+static int64_t SendFileByCopy(Socket* sock, int fd, off_t offset, size_t length) {
+    std::vector<char> buf(std::min(length, (size_t)64 * 1024));
+    int64_t total = 0;
+    while((size_t)total < length) {
+        ssize_t n = pread(fd, &buf[0], std::min(buf.size(), length - total), offset + total);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0) {
+            return -1;
+        }
+        if(n == 0) {
+            break;
+        }
+        for(ssize_t off = 0; off < n;) {
+            int w = sock->send(&buf[off], n - off);
+            if(w <= 0) {
+                return -1;
+            }
+            off += w;
+        }
+        total += n;
+    }
+    return total;
+}
+
+/**
+ * 经用户态内存从in读取一次并全部发送到out, 用于不能splice的情况(SSL)。
+ */
+static int64_t SpliceByCopy(Socket::ptr in, Socket* out, size_t length) {
+    std::vector<char> buf(std::min(length, (size_t)64 * 1024));
+    int n = in->recv(&buf[0], buf.size());
+    if(n <= 0) {
+        return n;
+    }
+    for(int off = 0; off < n;) {
+        int w = out->send(&buf[off], n - off);
+        if(w <= 0) {
+            return -1;
+        }
+        off += w;
+    }
+    return n;
+}
+
 /**
  * 创建TCP套接字对象，根据指定地址创建相应类型的套接字。
  * 根据地址创建TCP套接字
@@ -255,6 +355,54 @@ Socket::ptr Socket::accept() {
     return nullptr;  // 初始化失败时返回nullptr
 }
 
+/**
+ * 不等待地接收一个连接。
+ * 直接调用accept4(不经过hook), 队列为空时返回EAGAIN而不是挂起协程;
+ * 新句柄按hook中accept的方式登记到FdManager, 分片由处理连接的IOManager分配。
+ *
+ * @param newsock 输出参数, 新连接的句柄
+ * @return 成功返回true; 队列为空或失败返回false
+ */
+static bool TryAcceptFd(int sock, int& newsock) {
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
+    if(!ctx || !ctx->getSysNonblock()) {
+        // 阻塞句柄上调用accept4会卡住线程
+        errno = EAGAIN;
+        return false;
+    }
+    newsock = ::accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if(newsock == -1) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK) {
+            WEBSERVER_LOG_ERROR(g_logger) << "accept4(" << sock << ") errno="
+                << errno << " errstr=" << strerror(errno);
+        }
+        return false;
+    }
+    FdMgr::GetInstance()->get(newsock, true);
+    return true;
+}
+
+/**
+ * 不等待地接收一个连接。
+ *
+ * @return 成功返回新连接的Socket对象；队列为空或失败返回nullptr。
+ */
+Socket::ptr Socket::tryAccept() {
+    int newsock = -1;
+    if(!TryAcceptFd(m_sock, newsock)) {
+        return nullptr;
+    }
+    Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+    if(sock->init(newsock)) {
+        return sock;
+    }
+    if(!sock->isValid()) {
+        // init没有接管句柄时由这里关闭, 否则由sock析构时关闭
+        ::close(newsock);
+    }
+    return nullptr;
+}
+
 /**
  * 初始化Socket对象。
  * 初始化socket对象
@@ -278,6 +426,18 @@ bool Socket::init(int sock) {
     return false;  // 初始化失败时返回false
 }
 
+/**
+ * 创建套接字句柄(如果还没有创建)。
+ *
+ * @return 句柄有效返回true；否则返回false。
+ */
+bool Socket::open() {
+    if (!isValid()) {
+        newSock();
+    }
+    return isValid();
+}
+
 /**
  * 将Socket对象绑定到指定的地址。
  *
@@ -434,6 +594,13 @@ bool Socket::close() {
         ::close(m_sock);// 调用系统的close函数关闭套接字
         m_sock = -1;// 重置描述符为-1
     }
+    closePipe();
+    // 关闭回调只调用一次
+    if(m_closeCb) {
+        std::function<void()> cb;
+        cb.swap(m_closeCb);
+        cb();
+    }
     return false;
 }
 
@@ -448,6 +615,10 @@ bool Socket::close() {
  */
 int Socket::send(const void* buffer, size_t length, int flags) {
     if (isConnected()) {
+        // 大块数据用MSG_ZEROCOPY发送, 避免复制到内核
+        if (s_zerocopy_threshold && length >= s_zerocopy_threshold && m_zerocopy >= 0) {
+            return sendZeroCopy(buffer, length, flags);
+        }
         return ::send(m_sock, buffer, length, flags);  // 调用系统的send函数发送数据
     }
     return -1;  // 如果未连接，则返回-1
@@ -464,6 +635,15 @@ int Socket::send(const void* buffer, size_t length, int flags) {
  */
 int Socket::send(const iovec* buffers, size_t length, int flags) {
     if (isConnected()) {
+        if (s_zerocopy_threshold && m_zerocopy >= 0) {
+            size_t total = 0;
+            for (size_t i = 0; i < length; ++i) {
+                total += buffers[i].iov_len;
+            }
+            if (total >= s_zerocopy_threshold) {
+                return sendZeroCopy(buffers, length, flags);
+            }
+        }
         msghdr msg;
         memset(&msg, 0, sizeof(msg));
         msg.msg_iov = (iovec*)buffers;
@@ -473,6 +653,290 @@ int Socket::send(const iovec* buffers, size_t length, int flags) {
     return -1;  // 如果未连接，则返回-1
 }
 
+/**
+ * 用MSG_ZEROCOPY发送数据：单数据块
+ *
+ * @param buffer 要发送的数据缓冲区指针
+ * @param length 要发送的数据长度
+ * @param flags  发送操作的标志
+ * @return 如果发送成功，则返回发送的字节数；否则返回-1。
+ */
+int Socket::sendZeroCopy(const void* buffer, size_t length, int flags) {
+    iovec iov;
+    iov.iov_base = (void*)buffer;
+    iov.iov_len = length;
+    return sendZeroCopy(&iov, 1, flags);
+}
+
+/**
+ * 用MSG_ZEROCOPY发送数据：多数据块
+ * 循环发送直到全部发出(单次最多1G), 期间顺便取走已有的完成通知, 最后等待全部完成。
+ *
+ * @param buffers  要发送的数据缓冲区数组指针
+ * @param length   要发送的数据缓冲区个数
+ * @param flags    发送操作的标志
+ * @return 如果发送成功，则返回发送的字节数；否则返回-1。
+ */
+int Socket::sendZeroCopy(const iovec* buffers, size_t length, int flags) {
+    if (!isConnected()) {
+        return -1;
+    }
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    if (!enableZeroCopy()) {
+        msg.msg_iov = (iovec*)buffers;
+        msg.msg_iovlen = length;
+        return ::sendmsg(m_sock, &msg, flags);
+    }
+
+    std::vector<iovec> iov(buffers, buffers + length);
+    size_t idx = 0;
+    int total = 0;
+    int error = 0;
+    while (idx < iov.size() && total < (1 << 30)) {
+        if (iov[idx].iov_len == 0) {
+            ++idx;
+            continue;
+        }
+        msg.msg_iov = &iov[idx];
+        msg.msg_iovlen = iov.size() - idx;
+        // hook过的sendmsg在缓冲区满时挂起协程等待可写
+        ssize_t n = ::sendmsg(m_sock, &msg, flags | MSG_ZEROCOPY);
+        if (n < 0) {
+            // 通知占满了socket的optmem, 等之前的发送完成后重试
+            if (errno == ENOBUFS && m_zcCompleted != m_zcIssued && waitZeroCopy()) {
+                continue;
+            }
+            error = errno;
+            break;
+        }
+        ++m_zcIssued;
+        total += n;
+        // 跳过已发送的部分
+        size_t left = n;
+        while (left && idx < iov.size()) {
+            if (left >= iov[idx].iov_len) {
+                left -= iov[idx].iov_len;
+                ++idx;
+            } else {
+                iov[idx].iov_base = (char*)iov[idx].iov_base + left;
+                iov[idx].iov_len -= left;
+                left = 0;
+            }
+        }
+        // 错误队列积压时其他等待这个fd的协程会被EPOLLERR反复唤醒, 及时取走
+        reapZeroCopy();
+    }
+
+    // 等待内核释放用户内存
+    if (!waitZeroCopy()) {
+        return -1;
+    }
+    if (m_zcCopied) {
+        // 内核仍然复制了数据(回环或网卡不支持), MSG_ZEROCOPY只剩额外开销
+        WEBSERVER_LOG_DEBUG(g_logger) << "sendZeroCopy(" << m_sock
+            << ") data copied by kernel, fallback to send";
+        m_zerocopy = -1;
+    }
+    if (total == 0 && error) {
+        errno = error;
+        return -1;
+    }
+    return total;
+}
+
+/**
+ * 开启SO_ZEROCOPY, 只对TCP生效。
+ *
+ * @return 是否可以使用MSG_ZEROCOPY
+ */
+bool Socket::enableZeroCopy() {
+    if (m_zerocopy == 0) {
+        m_zerocopy = -1;
+        if (m_type == SOCK_STREAM && (m_family == AF_INET || m_family == AF_INET6)
+                && setOption(SOL_SOCKET, SO_ZEROCOPY, 1)) {
+            m_zerocopy = 1;
+        }
+    }
+    return m_zerocopy > 0;
+}
+
+/**
+ * 从错误队列中取出MSG_ZEROCOPY完成通知(不等待)。
+ * 每个通知是一段连续的调用编号[ee_info, ee_data], ee_code带ZEROCOPY_COPIED表示数据被复制过。
+ */
+void Socket::reapZeroCopy() {
+    char control[128];
+    while (m_zcCompleted != m_zcIssued) {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        // 用原始的recvmsg, 错误队列为空时hook会挂起协程等待可读
+        if (recvmsg_f(m_sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            break;
+        }
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            sock_extended_err* serr = (sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            m_zcCompleted += serr->ee_data - serr->ee_info + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                m_zcCopied = true;
+            }
+        }
+    }
+}
+
+/**
+ * 等待已发出的MSG_ZEROCOPY数据全部完成, 在协程中通过IOManager::ERROR事件等待,
+ * 否则用poll等待; 超时时间为发送超时。
+ *
+ * @return 全部完成返回true；超时或socket出错返回false。
+ */
+bool Socket::waitZeroCopy() {
+    int64_t timeout = getSendTimeout();
+    uint64_t deadline = timeout < 0 ? ~0ull : GetCurrentMS() + timeout;
+    while (true) {
+        reapZeroCopy();
+        if (m_zcCompleted == m_zcIssued) {
+            return true;
+        }
+        if (m_sock == -1) {
+            errno = EBADF;
+            return false;
+        }
+        uint64_t now = GetCurrentMS();
+        if (now >= deadline) {
+            errno = ETIMEDOUT;
+            return false;
+        }
+        uint64_t wait = deadline == ~0ull ? ~0ull : deadline - now;
+        pollfd pfd;
+        pfd.fd = m_sock;
+        pfd.events = 0;
+        pfd.revents = 0;
+        IOManager* iom = IOManager::GetThis();
+        if (iom && is_hook_enable()) {
+            // 连接挂断时EPOLLHUP会一直触发, 改为定时检查
+            if (::poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLHUP)) {
+                usleep(1000);
+                continue;
+            }
+            int rt = iom->waitEvent(m_sock, IOManager::ERROR, wait);
+            if (rt == -1) {
+                return false;
+            }
+        } else if (::poll(&pfd, 1, wait == ~0ull ? -1 : (int)std::min(wait, (uint64_t)INT_MAX)) == 1
+                && (pfd.revents & POLLHUP)) {
+            usleep(1000);
+        }
+    }
+}
+
+/**
+ * 发送文件内容：sendfile
+ *
+ * @param fd     文件句柄
+ * @param offset 文件偏移
+ * @param length 发送长度
+ * @return 实际发送的字节数, 文件不够长时小于length；出错返回-1。
+ */
+int64_t Socket::sendFile(int fd, off_t offset, size_t length) {
+    if (!isConnected()) {
+        return -1;
+    }
+    int64_t total = 0;
+    while ((size_t)total < length) {
+        // hook过的sendfile在缓冲区满时挂起协程等待可写
+        ssize_t n = ::sendfile(m_sock, fd, &offset, length - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            // 文件不支持sendfile
+            return SendFileByCopy(this, fd, offset, length);
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+/**
+ * 从另一个socket转发数据：splice
+ * in -> 管道 -> 本socket, 管道在两次调用之间保持为空, 从socket读入时不会因管道满而等待,
+ * 向socket写出时不会因管道空而等待。
+ *
+ * @param in     数据来源
+ * @param length 最多转发的长度
+ * @return 转发的字节数；in被关闭返回0；出错返回-1。
+ */
+int64_t Socket::spliceFrom(Socket::ptr in, size_t length) {
+    if (!isConnected() || !in || !in->isConnected()) {
+        return -1;
+    }
+    if (std::dynamic_pointer_cast<SSLSocket>(in)) {
+        // 加密的数据需要先解密
+        return SpliceByCopy(in, this, length);
+    }
+    if (m_pipe[0] == -1) {
+        if (pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC)) {
+            m_pipe[0] = m_pipe[1] = -1;
+            return SpliceByCopy(in, this, length);
+        }
+        fcntl(m_pipe[1], F_SETPIPE_SZ, (int)g_splice_pipe_size->getValue());
+        int size = fcntl(m_pipe[1], F_GETPIPE_SZ);
+        m_pipeSize = size > 0 ? size : 64 * 1024;
+    }
+    ssize_t n = ::splice(in->m_sock, nullptr, m_pipe[1], nullptr, std::min(length, m_pipeSize),
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    while (n < 0 && errno == EINTR) {
+        n = ::splice(in->m_sock, nullptr, m_pipe[1], nullptr, std::min(length, m_pipeSize),
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    }
+    if (n <= 0) {
+        return n;
+    }
+    for (ssize_t left = n; left > 0;) {
+        ssize_t w = ::splice(m_pipe[0], nullptr, m_sock, nullptr, left,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            // 管道中残留的数据作废, 下次重新创建
+            int err = errno;
+            closePipe();
+            errno = err;
+            return -1;
+        }
+        left -= w;
+    }
+    return n;
+}
+
+/**
+ * 关闭splice使用的管道。
+ */
+void Socket::closePipe() {
+    if (m_pipe[0] != -1) {
+        ::close(m_pipe[0]);
+        ::close(m_pipe[1]);
+        m_pipe[0] = m_pipe[1] = -1;
+    }
+}
+
 /**
  * 发送数据到指定地址。
  * 指定地址发送数据：单数据块
@@ -850,6 +1314,28 @@ Socket::ptr SSLSocket::accept() {
     return nullptr;
 }
 
+/**
+ * 不等待地接收一个SSL连接。
+ *
+ * @return 成功返回新连接的SSL套接字对象；队列为空或失败返回nullptr。
+ */
+Socket::ptr SSLSocket::tryAccept() {
+    int newsock = -1;
+    if(!TryAcceptFd(m_sock, newsock)) {
+        return nullptr;
+    }
+    SSLSocket::ptr sock(new SSLSocket(m_family, m_type, m_protocol));
+    sock->m_ctx = m_ctx;  // 复制SSL上下文
+    if(sock->init(newsock)) {
+        return sock;
+    }
+    if(!sock->isValid()) {
+        // init没有接管句柄时由这里关闭, 否则由sock析构时关闭
+        ::close(newsock);
+    }
+    return nullptr;
+}
+
 /**
  * 绑定SSL套接字到指定地址。
  *
@@ -874,7 +1360,11 @@ bool SSLSocket::connect(const Address::ptr addr, uint64_t timeout_ms) {
         m_ctx.reset(SSL_CTX_new(SSLv23_client_method()), SSL_CTX_free);
         m_ssl.reset(SSL_new(m_ctx.get()),  SSL_free);
         SSL_set_fd(m_ssl.get(), m_sock);
+        prepareKtls();
         v = (SSL_connect(m_ssl.get()) == 1);  // 发起SSL连接
+        if (v) {
+            checkKtls();
+        }
     }
     return v;
 }
@@ -889,6 +1379,43 @@ bool SSLSocket::listen(int backlog) {
     return Socket::listen(backlog);  // 调用基类Socket的listen函数启动监听
 }
 
+/**
+ * SSL连接的数据需要加密, 不能让内核直接引用用户内存, 按普通方式发送(kTLS也不支持MSG_ZEROCOPY)。
+ */
+int SSLSocket::sendZeroCopy(const void* buffer, size_t length, int flags) {
+    return send(buffer, length, flags);
+}
+
+int SSLSocket::sendZeroCopy(const iovec* buffers, size_t length, int flags) {
+    return send(buffers, length, flags);
+}
+
+/**
+ * kTLS时直接sendfile, 由内核加密; 否则经用户态读取文件后加密发送。
+ */
+int64_t SSLSocket::sendFile(int fd, off_t offset, size_t length) {
+    if (!m_ssl) {
+        return -1;
+    }
+    if (m_ktlsSend) {
+        return Socket::sendFile(fd, offset, length);
+    }
+    return SendFileByCopy(this, fd, offset, length);
+}
+
+/**
+ * kTLS时直接splice, 由内核加密; 否则经用户态转发。
+ */
+int64_t SSLSocket::spliceFrom(Socket::ptr in, size_t length) {
+    if (!m_ssl || !in) {
+        return -1;
+    }
+    if (m_ktlsSend) {
+        return Socket::spliceFrom(in, length);
+    }
+    return SpliceByCopy(in, this, length);
+}
+
 /**
  * 关闭SSL套接字。
  *
@@ -909,6 +1436,10 @@ bool SSLSocket::close() {
  */
 int SSLSocket::send(const void* buffer, size_t length, int flags) {
     if (m_ssl) {
+        if (m_ktlsSend) {
+            // kTLS: 明文直接写socket, 内核生成TLS记录
+            return ::send(m_sock, buffer, length, flags);
+        }
         return SSL_write(m_ssl.get(), buffer, length);  // 使用SSL_write函数发送数据
     }
     return -1;
@@ -926,6 +1457,14 @@ int SSLSocket::send(const iovec* buffers, size_t length, int flags) {
     if (!m_ssl) {
         return -1;
     }
+    if (m_ktlsSend) {
+        // kTLS: 一次sendmsg, 内核按记录大小切分并加密
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (iovec*)buffers;
+        msg.msg_iovlen = length;
+        return ::sendmsg(m_sock, &msg, flags);
+    }
     int total = 0;
     for (size_t i = 0; i < length; ++i) {
         int tmp = SSL_write(m_ssl.get(), buffers[i].iov_base, buffers[i].iov_len);  // 使用SSL_write函数发送数据
@@ -1051,12 +1590,48 @@ bool SSLSocket::init(int sock) {
         // 创建SSL对象，并将SSL对象与套接字关联
         m_ssl.reset(SSL_new(m_ctx.get()),  SSL_free);
         SSL_set_fd(m_ssl.get(), m_sock);
+        prepareKtls();
         // 发起SSL握手，如果握手成功则返回1，否则返回其他值
         v = (SSL_accept(m_ssl.get()) == 1);
+        if (v) {
+            checkKtls();
+        }
     }
     return v;
 }
 
+/**
+ * 握手之前按ssl.ktls配置请求OpenSSL开启kTLS。
+ * OpenSSL在握手完成、切换到应用数据密钥时把密钥和序号装入内核(setsockopt SOL_TLS, TLS_TX/TLS_RX),
+ * 内核没有tls模块、或者协商的套件内核不支持时不开启, 不影响握手。
+ */
+void SSLSocket::prepareKtls() {
+#ifdef SSL_OP_ENABLE_KTLS
+    if (s_ktls && m_ssl) {
+        SSL_set_options(m_ssl.get(), SSL_OP_ENABLE_KTLS);
+    }
+#endif
+}
+
+/**
+ * 握手之后检查kTLS是否生效。
+ * OpenSSL没有kTLS支持(3.0之前或编译时关闭)时没有BIO_get_ktls_*, 两个方向都保持用户态加解密。
+ */
+void SSLSocket::checkKtls() {
+#ifdef SSL_OP_ENABLE_KTLS
+    m_ktlsSend = BIO_get_ktls_send(SSL_get_wbio(m_ssl.get()));
+    m_ktlsRecv = BIO_get_ktls_recv(SSL_get_rbio(m_ssl.get()));
+#else
+    m_ktlsSend = false;
+    m_ktlsRecv = false;
+#endif
+    if (s_ktls) {
+        WEBSERVER_LOG_DEBUG(g_logger) << "ktls sock=" << m_sock << " cipher="
+            << SSL_get_cipher_name(m_ssl.get()) << " send=" << m_ktlsSend
+            << " recv=" << m_ktlsRecv;
+    }
+}
+
 /**
  * 加载SSL证书和密钥。
  *
@@ -1134,6 +1709,8 @@ SSLSocket::ptr SSLSocket::CreateTCPSocket6() {
 std::ostream& SSLSocket::dump(std::ostream& os) const {
     os << "[SSLSocket sock=" << m_sock
        << " is_connected=" << m_isConnected
+       << " ktls_send=" << m_ktlsSend
+       << " ktls_recv=" << m_ktlsRecv
        << " family=" << m_family
        << " type=" << m_type
        << " protocol=" << m_protocol;
@@ -10,6 +10,7 @@
 #define __WEBSERVER_SOCKET_H__
 
 #include <memory>
+#include <functional>
 #include <netinet/tcp.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -159,6 +160,13 @@ public:
         return setOption(level, option, &value, sizeof(T));
     }
 
+    /**
+     * @brief 创建socket句柄, 已创建时直接返回
+     * @details bind之前需要设置的选项(如SO_REUSEPORT)要求句柄已经存在
+     * @return 句柄是否有效
+     */
+    bool open();
+
     /**
      * @brief 接收connect链接
      * @return 成功返回新连接的socket,失败返回nullptr
@@ -166,6 +174,15 @@ public:
      */
     virtual Socket::ptr accept();
 
+    /**
+     * @brief 不等待地接收一个已完成握手的连接(accept4)
+     * @details 用于在accept()返回后把内核accept队列中剩余的连接一次取完,
+     *          队列为空(EAGAIN)时立即返回而不挂起协程
+     * @return 成功返回新连接的socket, 队列为空或失败返回nullptr(errno为EAGAIN表示队列为空)
+     * @pre Socket必须 bind , listen  成功, 且句柄为非阻塞(hook创建的socket都是)
+     */
+    virtual Socket::ptr tryAccept();
+
     /**
      * @brief 绑定地址
      * @param[in] addr 地址
@@ -195,6 +212,14 @@ public:
      */
     virtual bool close();
 
+    /**
+     * @brief 设置关闭回调
+     * @details 句柄第一次被关闭时(close或析构)调用一次, 用来把连接占用的资源和连接的生命周期绑定,
+     *          例如TcpServer在这里释放准入控制的名额
+     * @param[in] cb 回调函数
+     */
+    void setCloseCallback(std::function<void()> cb) { m_closeCb.swap(cb);}
+
     /**
      * @brief 发送数据
      * @param[in] buffer 待发送数据的内存
@@ -219,6 +244,50 @@ public:
      */
     virtual int send(const iovec* buffers, size_t length, int flags = 0);
 
+    /**
+     * @brief 用MSG_ZEROCOPY发送数据, 内核直接引用用户内存而不复制
+     * @details 数据全部发出后等待内核的完成通知(错误队列, 通过IOManager::ERROR事件等待),
+     *          返回时内核已经不再引用buffer, 调用方可以立即复用或释放.
+     *          完成通知要在对端确认数据之后才到达, 只适合大块数据(见socket.zerocopy_threshold).
+     *          不支持MSG_ZEROCOPY, 或内核报告数据仍被复制(如回环连接)时, 这个socket改为普通发送.
+     * @param[in] buffer 待发送数据的内存
+     * @param[in] length 待发送数据的长度
+     * @param[in] flags 标志字
+     * @return
+     *      @retval >0 发送成功对应大小的数据
+     *      @retval =0 socket被关闭
+     *      @retval <0 socket出错
+     */
+    virtual int sendZeroCopy(const void* buffer, size_t length, int flags = 0);
+
+    /**
+     * @brief 用MSG_ZEROCOPY发送数据(iovec数组), 同sendZeroCopy
+     */
+    virtual int sendZeroCopy(const iovec* buffers, size_t length, int flags = 0);
+
+    /**
+     * @brief 把文件的一段内容发送到socket(sendfile), 数据不经过用户态
+     * @param[in] fd 文件句柄
+     * @param[in] offset 文件偏移
+     * @param[in] length 发送长度
+     * @return
+     *      @retval >=0 实际发送的长度, 文件不够长时小于length
+     *      @retval <0 socket出错
+     */
+    virtual int64_t sendFile(int fd, off_t offset, size_t length);
+
+    /**
+     * @brief 从in读取数据发送到本socket(splice), 数据经内部管道转发, 不经过用户态
+     * @details 与recv一样等待in可读, 读到多少发送多少, 发送完才返回
+     * @param[in] in 数据来源
+     * @param[in] length 最多转发的长度
+     * @return
+     *      @retval >0 转发的长度
+     *      @retval =0 in被关闭
+     *      @retval <0 socket出错
+     */
+    virtual int64_t spliceFrom(Socket::ptr in, size_t length);
+
     /**
      * @brief 发送数据
      * @param[in] buffer 待发送数据的内存
@@ -381,6 +450,28 @@ protected:
      * @brief 初始化sock
      */
     virtual bool init(int sock);
+
+    /**
+     * @brief 开启SO_ZEROCOPY
+     * @return 是否可以使用MSG_ZEROCOPY
+     */
+    bool enableZeroCopy();
+
+    /**
+     * @brief 从错误队列中取出已有的MSG_ZEROCOPY完成通知, 不等待
+     */
+    void reapZeroCopy();
+
+    /**
+     * @brief 等待已发出的MSG_ZEROCOPY数据全部完成
+     * @return 是否全部完成(超时或socket出错时返回false)
+     */
+    bool waitZeroCopy();
+
+    /**
+     * @brief 关闭splice使用的管道
+     */
+    void closePipe();
 protected:
     /// socket句柄
     int m_sock;
@@ -396,6 +487,20 @@ protected:
     Address::ptr m_localAddress;
     /// 远端地址
     Address::ptr m_remoteAddress;
+    /// MSG_ZEROCOPY状态: 0未开启, 1已开启, -1不可用
+    int m_zerocopy = 0;
+    /// 发出的MSG_ZEROCOPY调用数(内核按调用编号)
+    uint32_t m_zcIssued = 0;
+    /// 已收到完成通知的调用数
+    uint32_t m_zcCompleted = 0;
+    /// 内核报告数据被复制过, 等待完成后不再使用MSG_ZEROCOPY
+    bool m_zcCopied = false;
+    /// spliceFrom使用的管道, 第一次使用时创建
+    int m_pipe[2] = {-1, -1};
+    /// 关闭回调
+    std::function<void()> m_closeCb;
+    /// 管道容量
+    size_t m_pipeSize = 0;
 };
 
 class SSLSocket : public Socket {
@@ -408,12 +513,17 @@ public:
 
     SSLSocket(int family, int type, int protocol = 0);
     virtual Socket::ptr accept() override;
+    virtual Socket::ptr tryAccept() override;
     virtual bool bind(const Address::ptr addr) override;
     virtual bool connect(const Address::ptr addr, uint64_t timeout_ms = -1) override;
     virtual bool listen(int backlog = SOMAXCONN) override;
     virtual bool close() override;
     virtual int send(const void* buffer, size_t length, int flags = 0) override;
     virtual int send(const iovec* buffers, size_t length, int flags = 0) override;
+    virtual int sendZeroCopy(const void* buffer, size_t length, int flags = 0) override;
+    virtual int sendZeroCopy(const iovec* buffers, size_t length, int flags = 0) override;
+    virtual int64_t sendFile(int fd, off_t offset, size_t length) override;
+    virtual int64_t spliceFrom(Socket::ptr in, size_t length) override;
     virtual int sendTo(const void* buffer, size_t length, const Address::ptr to, int flags = 0) override;
     virtual int sendTo(const iovec* buffers, size_t length, const Address::ptr to, int flags = 0) override;
     virtual int recv(void* buffer, size_t length, int flags = 0) override;
@@ -423,11 +533,37 @@ public:
 
     bool loadCertificates(const std::string& cert_file, const std::string& key_file);
     virtual std::ostream& dump(std::ostream& os) const override;
+
+    /**
+     * @brief 发送方向是否由内核加密(kTLS)
+     * @details 开启ssl.ktls且内核支持时, 握手后OpenSSL把密钥装入内核(setsockopt SOL_TLS),
+     *          之后send/sendfile/splice直接写socket, 由内核生成TLS记录
+     */
+    bool isKtlsSend() const { return m_ktlsSend;}
+
+    /**
+     * @brief 接收方向是否由内核解密(kTLS), 仍然通过SSL_read读取(由OpenSSL处理非数据记录)
+     */
+    bool isKtlsRecv() const { return m_ktlsRecv;}
 protected:
     virtual bool init(int sock) override;
+
+    /**
+     * @brief 握手之前按配置请求OpenSSL开启kTLS
+     */
+    void prepareKtls();
+
+    /**
+     * @brief 握手之后检查kTLS是否生效, 不生效时继续使用用户态TLS
+     */
+    void checkKtls();
 private:
     std::shared_ptr<SSL_CTX> m_ctx;
     std::shared_ptr<SSL> m_ssl;
+    /// 发送方向使用kTLS
+    bool m_ktlsSend = false;
+    /// 接收方向使用kTLS
+    bool m_ktlsRecv = false;
 };
 
 /**
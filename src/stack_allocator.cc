@@ -0,0 +1,314 @@
+#include "stack_allocator.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include "mutex.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <atomic>
+#include <sstream>
+#include <unordered_map>
+
+namespace webserver {
+
+static Logger::ptr g_logger = WEBSERVER_LOG_NAME("system");
+
+// 每个线程最多缓存的空闲栈个数, 0表示不缓存
+static ConfigVar<uint32_t>::ptr g_stack_cache_size =
+    Config::Lookup<uint32_t>("fiber.stack_cache_size", 64, "fiber stack cache size per thread");
+
+static std::atomic<uint32_t> s_stack_cache_size {64};
+
+static std::atomic<uint64_t> s_hits {0};
+static std::atomic<uint64_t> s_misses {0};
+static std::atomic<uint64_t> s_cached_frees {0};
+static std::atomic<uint64_t> s_unmaps {0};
+static std::atomic<uint64_t> s_mapped_stacks {0};
+static std::atomic<uint64_t> s_mapped_bytes {0};
+static std::atomic<uint64_t> s_cached_stacks {0};
+static std::atomic<uint64_t> s_cached_bytes {0};
+
+struct _StackAllocatorIniter {
+    _StackAllocatorIniter() {
+        s_stack_cache_size = g_stack_cache_size->getValue();
+        g_stack_cache_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            WEBSERVER_LOG_INFO(g_logger) << "fiber stack cache size changed from "
+                                     << old_value << " to " << new_value;
+            s_stack_cache_size = new_value;
+        });
+    }
+};
+
+static _StackAllocatorIniter s_stack_allocator_initer;
+
+size_t StackAllocator::GetPageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+// 栈大小向上取整到页大小
+static size_t RoundStackSize(size_t size) {
+    size_t page = StackAllocator::GetPageSize();
+    return (size + page - 1) & ~(page - 1);
+}
+
+/**
+ * @brief 已映射栈的登记表
+ * @details 只在mmap/munmap时更新(本身就是系统调用路径), 缓存命中的分配/释放不会访问
+ *          用于按需统计已提交的物理内存
+ */
+class StackRegistry {
+public:
+    typedef Mutex MutexType;
+
+    void add(void* vp, size_t size) {
+        MutexType::Lock lock(m_mutex);
+        m_stacks[vp] = size;
+    }
+
+    void del(void* vp) {
+        MutexType::Lock lock(m_mutex);
+        m_stacks.erase(vp);
+    }
+
+    /**
+     * @brief 统计已提交的物理内存
+     * @details 在锁内只复制栈的列表, mincore在锁外执行, 不阻塞其他线程的MapStack/UnmapStack.
+     *          期间被munmap的栈mincore返回ENOMEM, 直接跳过
+     */
+    uint64_t residentBytes() {
+        size_t page = StackAllocator::GetPageSize();
+        std::vector<std::pair<void*, size_t> > stacks;
+        {
+            MutexType::Lock lock(m_mutex);
+            stacks.assign(m_stacks.begin(), m_stacks.end());
+        }
+        std::vector<unsigned char> vec;
+        uint64_t total = 0;
+        for(auto& i : stacks) {
+            size_t pages = i.second / page;
+            vec.resize(pages);
+            if(mincore(i.first, i.second, &vec[0])) {
+                continue;
+            }
+            for(size_t n = 0; n < pages; ++n) {
+                if(vec[n] & 1) {
+                    total += page;
+                }
+            }
+        }
+        return total;
+    }
+private:
+    MutexType m_mutex;
+    std::unordered_map<void*, size_t> m_stacks;
+};
+
+static StackRegistry& GetRegistry() {
+    static StackRegistry* s_registry = new StackRegistry;
+    return *s_registry;
+}
+
+// 映射一个栈: [保护页][可用栈空间], 返回可用栈空间的起始地址
+static void* MapStack(size_t size) {
+    size_t page = StackAllocator::GetPageSize();
+    void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE
+                      ,MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED) {
+        WEBSERVER_LOG_ERROR(g_logger) << "mmap stack size=" << size
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return nullptr;
+    }
+    // 栈向低地址增长, 最低的一页作为保护页
+    if(mprotect(base, page, PROT_NONE)) {
+        WEBSERVER_LOG_ERROR(g_logger) << "mprotect stack guard errno=" << errno
+            << " errstr=" << strerror(errno);
+        munmap(base, size + page);
+        return nullptr;
+    }
+    void* vp = (char*)base + page;
+    GetRegistry().add(vp, size);
+    ++s_mapped_stacks;
+    s_mapped_bytes += size + page;
+    return vp;
+}
+
+static void UnmapStack(void* vp, size_t size) {
+    size_t page = StackAllocator::GetPageSize();
+    GetRegistry().del(vp);
+    if(munmap((char*)vp - page, size + page)) {
+        WEBSERVER_LOG_ERROR(g_logger) << "munmap stack size=" << size
+            << " errno=" << errno << " errstr=" << strerror(errno);
+    }
+    ++s_unmaps;
+    --s_mapped_stacks;
+    s_mapped_bytes -= size + page;
+}
+
+/**
+ * @brief 线程本地的空闲栈缓存
+ * @details 空闲链表的节点直接存放在空闲栈的最高地址处,不需要额外分配内存.
+ *          栈从高地址向下增长, 最高的一页在协程运行时已经提交, 放在这里不会多提交物理页
+ *          按栈大小分为少量的几个链表, 绝大多数协程使用默认栈大小
+ */
+class StackCache {
+public:
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    static FreeNode* NodeOf(void* vp, size_t size) {
+        return (FreeNode*)((char*)vp + size - sizeof(FreeNode));
+    }
+
+    static void* StackOf(FreeNode* node, size_t size) {
+        return (char*)node + sizeof(FreeNode) - size;
+    }
+
+    struct FreeList {
+        size_t size = 0;
+        FreeNode* head = nullptr;
+        uint32_t count = 0;
+    };
+
+    static const size_t MAX_CLASSES = 4;
+
+    ~StackCache() {
+        for(size_t i = 0; i < MAX_CLASSES; ++i) {
+            FreeList& fl = m_lists[i];
+            while(fl.head) {
+                FreeNode* node = fl.head;
+                fl.head = node->next;
+                --s_cached_stacks;
+                s_cached_bytes -= fl.size;
+                UnmapStack(StackOf(node, fl.size), fl.size);
+            }
+            fl.count = 0;
+        }
+    }
+
+    void* pop(size_t size) {
+        for(size_t i = 0; i < MAX_CLASSES; ++i) {
+            FreeList& fl = m_lists[i];
+            if(fl.size == size && fl.head) {
+                FreeNode* node = fl.head;
+                fl.head = node->next;
+                --fl.count;
+                --s_cached_stacks;
+                s_cached_bytes -= size;
+                return StackOf(node, size);
+            }
+        }
+        return nullptr;
+    }
+
+    bool push(void* vp, size_t size) {
+        uint32_t cap = s_stack_cache_size;
+        FreeList* target = nullptr;
+        for(size_t i = 0; i < MAX_CLASSES; ++i) {
+            FreeList& fl = m_lists[i];
+            if(fl.size == size) {
+                target = &fl;
+                break;
+            }
+            if(!target && !fl.head) {
+                target = &fl;
+            }
+        }
+        if(!target || target->count >= cap) {
+            return false;
+        }
+        target->size = size;
+        FreeNode* node = NodeOf(vp, size);
+        node->next = target->head;
+        target->head = node;
+        ++target->count;
+        ++s_cached_stacks;
+        s_cached_bytes += size;
+        return true;
+    }
+private:
+    FreeList m_lists[MAX_CLASSES];
+};
+
+// t_stack_cache 在线程退出时由 t_stack_cache_holder 析构并置空,
+// 之后(其他thread_local对象析构时)释放的栈直接munmap
+static thread_local StackCache* t_stack_cache = nullptr;
+
+struct StackCacheHolder {
+    StackCache cache;
+    StackCacheHolder() {
+        t_stack_cache = &cache;
+    }
+    ~StackCacheHolder() {
+        t_stack_cache = nullptr;
+    }
+};
+
+static StackCache* GetStackCache() {
+    static thread_local StackCacheHolder s_holder;
+    return t_stack_cache;
+}
+
+void* StackAllocator::Alloc(size_t size) {
+    size = RoundStackSize(size);
+    StackCache* cache = GetStackCache();
+    if(cache) {
+        void* vp = cache->pop(size);
+        if(vp) {
+            ++s_hits;
+            return vp;
+        }
+    }
+    ++s_misses;
+    return MapStack(size);
+}
+
+void StackAllocator::Dealloc(void* vp, size_t size) {
+    if(!vp) {
+        return;
+    }
+    size = RoundStackSize(size);
+    StackCache* cache = GetStackCache();
+    if(cache && cache->push(vp, size)) {
+        ++s_cached_frees;
+        return;
+    }
+    UnmapStack(vp, size);
+}
+
+void StackAllocator::GetStats(Stats& stats, bool count_resident) {
+    stats.hits = s_hits;
+    stats.misses = s_misses;
+    stats.cached_frees = s_cached_frees;
+    stats.unmaps = s_unmaps;
+    stats.mapped_stacks = s_mapped_stacks;
+    stats.mapped_bytes = s_mapped_bytes;
+    stats.cached_stacks = s_cached_stacks;
+    stats.cached_bytes = s_cached_bytes;
+    stats.resident_bytes = count_resident ? GetRegistry().residentBytes() : 0;
+}
+
+std::string StackAllocator::ToString(bool count_resident) {
+    Stats stats;
+    GetStats(stats, count_resident);
+    std::stringstream ss;
+    ss << "[StackAllocator hits=" << stats.hits
+       << " misses=" << stats.misses
+       << " cached_frees=" << stats.cached_frees
+       << " unmaps=" << stats.unmaps
+       << " mapped_stacks=" << stats.mapped_stacks
+       << " mapped_bytes=" << stats.mapped_bytes
+       << " cached_stacks=" << stats.cached_stacks
+       << " cached_bytes=" << stats.cached_bytes;
+    if(count_resident) {
+        ss << " resident_bytes=" << stats.resident_bytes;
+    }
+    ss << "]";
+    return ss.str();
+}
+
+}
@@ -0,0 +1,79 @@
+#ifndef __WEBSERVER_STACK_ALLOCATOR_H__
+#define __WEBSERVER_STACK_ALLOCATOR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace webserver {
+
+/**
+ * @brief 协程栈分配器
+ * @details 使用mmap为协程分配运行栈:
+ *          1. 栈的低地址端保留PROT_NONE保护页,栈溢出时直接触发SIGSEGV,而不是踩坏相邻的堆内存
+ *          2. 不使用MAP_POPULATE,物理页在首次访问时才提交(懒提交),128K的栈通常只占用几个页
+ *          3. 释放的栈放入线程本地的空闲链表,下次分配同样大小的栈时直接复用,避免mmap/munmap和缺页开销
+ *          空闲链表的容量由配置项fiber.stack_cache_size控制(每个线程最多缓存的栈个数)
+ */
+class StackAllocator {
+public:
+    /**
+     * @brief 分配器统计信息
+     */
+    struct Stats {
+        /// 从线程缓存命中的分配次数
+        uint64_t hits = 0;
+        /// 缓存未命中(需要mmap)的分配次数
+        uint64_t misses = 0;
+        /// 放回线程缓存的释放次数
+        uint64_t cached_frees = 0;
+        /// 直接munmap的释放次数(缓存已满或线程退出)
+        uint64_t unmaps = 0;
+        /// 当前已映射的栈个数(使用中+缓存中)
+        uint64_t mapped_stacks = 0;
+        /// 当前已映射的虚拟内存字节数(含保护页)
+        uint64_t mapped_bytes = 0;
+        /// 当前所有线程缓存中的栈个数
+        uint64_t cached_stacks = 0;
+        /// 当前所有线程缓存中的栈字节数
+        uint64_t cached_bytes = 0;
+        /// 已提交的物理内存字节数(仅在GetStats的count_resident为true时统计)
+        uint64_t resident_bytes = 0;
+    };
+
+    /**
+     * @brief 分配协程栈
+     * @param[in] size 栈大小(会向上取整到页大小)
+     * @return 返回可用栈空间的起始地址(保护页之上), 失败返回nullptr
+     */
+    static void* Alloc(size_t size);
+
+    /**
+     * @brief 释放协程栈
+     * @param[in] vp Alloc返回的地址
+     * @param[in] size 分配时传入的大小
+     */
+    static void Dealloc(void* vp, size_t size);
+
+    /**
+     * @brief 获取统计信息
+     * @param[out] stats 统计信息
+     * @param[in] count_resident 是否通过mincore统计已提交的物理内存(需要遍历所有栈,较慢)
+     */
+    static void GetStats(Stats& stats, bool count_resident = false);
+
+    /**
+     * @brief 返回统计信息的字符串描述
+     * @param[in] count_resident 是否统计已提交的物理内存(需要对每个栈执行mincore,较慢)
+     */
+    static std::string ToString(bool count_resident = false);
+
+    /**
+     * @brief 返回系统页大小
+     */
+    static size_t GetPageSize();
+};
+
+}
+
+#endif
@@ -1,4 +1,6 @@
 #include "stream.h"
+#include <unistd.h>
+#include <vector>
 
 namespace webserver {
 
@@ -86,5 +88,96 @@ int Stream::writeFixSize(ByteArray::ptr ba, size_t length) {
     return length; // 返回实际写入的数据长度
 }
 
+/**
+ * @brief 写多段内存的数据, 默认只写第一段
+ */
+int Stream::writev(const iovec* iov, size_t iovcnt) {
+    return write(iov[0].iov_base, iov[0].iov_len);
+}
+
+/**
+ * @brief 写完多段内存的全部数据
+ * 每次写完后跳过已经写完的段, 并调整写了一部分的段
+ * 
+ * @param iov 内存数组, 写的过程中会被修改
+ * @param iovcnt 数组长度
+ * @return int64_t 返回写入的数据总长度，若出错返回写入的返回值(<=0)
+ */
+int64_t Stream::writevFixSize(iovec* iov, size_t iovcnt) {
+    int64_t total = 0; // 已写入的总长度
+    while(iovcnt > 0) {
+        if(iov->iov_len == 0) { // 跳过空段
+            ++iov;
+            --iovcnt;
+            continue;
+        }
+        int len = writev(iov, iovcnt); // 向流中写入数据
+        if(len <= 0) { // 若出错，返回
+            return len;
+        }
+        total += len;
+        size_t n = len;
+        // 跳过已经写完的段
+        while(iovcnt > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        // 调整写了一部分的段
+        if(n > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return total;
+}
+
+/**
+ * @brief 把文件的一段内容写入流, 经64K的内存缓冲中转
+ * 
+ * @param fd 文件句柄
+ * @param offset 文件偏移
+ * @param length 要写入的数据长度
+ * @return int64_t 返回实际写入的数据长度(文件不够长时小于length)，若出错返回负值
+ */
+int64_t Stream::writeFile(int fd, off_t offset, size_t length) {
+    std::vector<char> buf(std::min(length, (size_t)64 * 1024));
+    int64_t total = 0; // 已写入的数据长度
+    while((size_t)total < length) {
+        ssize_t n = pread(fd, &buf[0], std::min(buf.size(), length - total), offset + total);
+        if(n < 0) {
+            return -1;
+        }
+        if(n == 0) { // 到达文件结尾
+            break;
+        }
+        int rt = writeFixSize(&buf[0], n);
+        if(rt <= 0) {
+            return -1;
+        }
+        total += n;
+    }
+    return total;
+}
+
+/**
+ * @brief 从另一个流读取一次数据并全部写入本流, 经内存缓冲中转
+ * 
+ * @param in 数据来源
+ * @param length 最多转发的数据长度
+ * @return int64_t 返回转发的数据长度，in被关闭返回0，若出错返回负值
+ */
+int64_t Stream::spliceFrom(Stream::ptr in, size_t length) {
+    std::vector<char> buf(std::min(length, (size_t)64 * 1024));
+    int n = in->read(&buf[0], buf.size());
+    if(n <= 0) {
+        return n;
+    }
+    int rt = writeFixSize(&buf[0], n);
+    if(rt <= 0) {
+        return -1;
+    }
+    return n;
+}
 
 }
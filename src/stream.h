@@ -124,6 +124,53 @@ public:
      */
     virtual int writeFixSize(ByteArray::ptr ba, size_t length);
 
+    /**
+     * @brief 写多段内存的数据
+     * @details 默认实现只写第一段, SocketStream用writev一次发送所有段
+     * @param[in] iov 内存数组, 第一段不能为空
+     * @param[in] iovcnt 数组长度
+     * @return
+     *      @retval >0 返回写入到的数据的实际大小
+     *      @retval =0 被关闭
+     *      @retval <0 出现流错误
+     */
+    virtual int writev(const iovec* iov, size_t iovcnt);
+
+    /**
+     * @brief 写完多段内存的全部数据
+     * @param[in, out] iov 内存数组, 写的过程中会被修改
+     * @param[in] iovcnt 数组长度
+     * @return
+     *      @retval >=0 返回写入的数据总大小
+     *      @retval <0 出现流错误(被关闭时也返回<=0)
+     */
+    virtual int64_t writevFixSize(iovec* iov, size_t iovcnt);
+
+    /**
+     * @brief 把文件的一段内容写入流
+     * @details 默认实现读到内存后writeFixSize, SocketStream用sendfile直接发送
+     * @param[in] fd 文件句柄
+     * @param[in] offset 文件偏移
+     * @param[in] length 写入长度
+     * @return
+     *      @retval >=0 实际写入的大小, 文件不够长时小于length
+     *      @retval <0 出现流错误
+     */
+    virtual int64_t writeFile(int fd, off_t offset, size_t length);
+
+    /**
+     * @brief 从另一个流读取数据写入本流
+     * @details 读一次(最多length), 读到的数据全部写完才返回.
+     *          默认实现经内存中转, 两端都是SocketStream时用splice转发, 数据不经过用户态
+     * @param[in] in 数据来源
+     * @param[in] length 最多转发的大小
+     * @return
+     *      @retval >0 返回转发的数据的实际大小
+     *      @retval =0 in被关闭
+     *      @retval <0 出现流错误
+     */
+    virtual int64_t spliceFrom(Stream::ptr in, size_t length);
+
     /**
      * @brief 关闭流
      */
@@ -141,7 +141,7 @@ std::string LoadBalance::statusString(const std::string& prefix) {
 }
 
 void LoadBalance::checkInit() {
-    uint64_t ts = webserver::GetCurrentMS();
+    uint64_t ts = webserver::Clock::NowMS();
     if(ts - m_lastInitTime > 500) {
         init();
         m_lastInitTime = ts;
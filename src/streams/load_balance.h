@@ -4,6 +4,7 @@
 #include "src/streams/socket_stream.h"
 #include "src/mutex.h"
 #include "src/util.h"
+#include "src/clock.h"
 #include "src/streams/service_discovery.h"
 #include <vector>
 #include <unordered_map>
@@ -46,9 +47,9 @@ private:
 class HolderStatsSet {
 public:
     HolderStatsSet(uint32_t size = 5);
-    HolderStats& get(const uint32_t& now = time(0));
+    HolderStats& get(const uint32_t& now = webserver::Clock::NowSec());
 
-    float getWeight(const uint32_t& now = time(0));
+    float getWeight(const uint32_t& now = webserver::Clock::NowSec());
 
     HolderStats getTotal();
 private:
@@ -69,7 +70,7 @@ public:
     void setId(uint64_t v) { m_id = v;}
     uint64_t getId() const { return m_id;}
 
-    HolderStats& get(const uint32_t& now = time(0));
+    HolderStats& get(const uint32_t& now = webserver::Clock::NowSec());
 
     template<class T>
     std::shared_ptr<T> getStreamAs() {
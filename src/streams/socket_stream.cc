@@ -1,5 +1,6 @@
 #include "socket_stream.h"
 #include "src/util.h"
+#include <limits.h>
 
 namespace webserver {
 
@@ -121,6 +122,57 @@ int SocketStream::write(ByteArray::ptr ba, size_t length) {
     return rt; // 返回写入的字节数
 }
 
+/**
+ * 向套接字写入多段内存的数据
+ * 参数：
+ *   - iov: iovec数组
+ *   - iovcnt: 数组长度, 超过IOV_MAX时只写前IOV_MAX段
+ * 返回值：int类型，表示实际写入的字节数，-1表示写入失败
+ */
+int SocketStream::writev(const iovec* iov, size_t iovcnt) {
+    if(!isConnected()) { // 如果套接字未连接
+        return -1; // 返回写入失败
+    }
+    return m_socket->send(iov, std::min(iovcnt, (size_t)IOV_MAX));
+}
+
+/**
+ * 把文件的一段内容写入套接字
+ * 说明：由Socket::sendFile用sendfile发送，数据不经过用户态。
+ */
+int64_t SocketStream::writeFile(int fd, off_t offset, size_t length) {
+    if(!isConnected()) { // 如果套接字未连接
+        return -1;
+    }
+    return m_socket->sendFile(fd, offset, length);
+}
+
+/**
+ * 从另一个流读取数据写入套接字
+ * 说明：两端都是SocketStream时交给数据来源的spliceTo, 由来源决定能否直接splice。
+ */
+int64_t SocketStream::spliceFrom(Stream::ptr in, size_t length) {
+    if(!isConnected()) { // 如果套接字未连接
+        return -1;
+    }
+    SocketStream::ptr sin = std::dynamic_pointer_cast<SocketStream>(in);
+    if(sin && sin->getSocket()) {
+        return sin->spliceTo(*this, length);
+    }
+    return Stream::spliceFrom(in, length);
+}
+
+/**
+ * 把套接字的数据转发到out
+ * 说明：由Socket::spliceFrom经管道转发，数据不经过用户态。
+ */
+int64_t SocketStream::spliceTo(SocketStream& out, size_t length) {
+    if(!isConnected() || !out.isConnected()) {
+        return -1;
+    }
+    return out.getSocket()->spliceFrom(m_socket, length);
+}
+
 /**
  * 关闭套接字
  * 说明：如果套接字不为空，则关闭套接字。
@@ -80,6 +80,34 @@ public:
      */
     virtual int write(ByteArray::ptr ba, size_t length) override;
 
+    /**
+     * @brief 用writev一次写入多段内存
+     * @details 一次最多IOV_MAX段
+     */
+    virtual int writev(const iovec* iov, size_t iovcnt) override;
+
+    /**
+     * @brief 把文件的一段内容写入socket(sendfile)
+     * @see Socket::sendFile
+     */
+    virtual int64_t writeFile(int fd, off_t offset, size_t length) override;
+
+    /**
+     * @brief 从另一个流读取数据写入socket
+     * @details in也是SocketStream时由in->spliceTo转发, 否则经内存中转
+     */
+    virtual int64_t spliceFrom(Stream::ptr in, size_t length) override;
+
+    /**
+     * @brief 把本流的数据转发到out, out->spliceFrom(本流)时调用
+     * @details 默认用splice直接从socket转发(Socket::spliceFrom);
+     *          有自己的读缓冲区或者要记录读取进度的子类需要重写, 不能被绕过
+     * @param[in] out 数据目的
+     * @param[in] length 最多转发的大小
+     * @return >0 转发的数据大小, =0 本流被关闭, <0 出错
+     */
+    virtual int64_t spliceTo(SocketStream& out, size_t length);
+
     /**
      * @brief 关闭socket
      */
@@ -1,6 +1,8 @@
 #include "tcp_server.h"
 #include "config.h"
 #include "log.h"
+#include "util.h"
+#include <linux/filter.h>
 
 namespace webserver {
 
@@ -19,6 +21,16 @@ static webserver::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
     webserver::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
             "tcp server read timeout");
 
+/// 一次accept唤醒后最多连续接收的连接数, 避免一直在accept循环里饿死其他协程
+static webserver::ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch =
+    webserver::Config::Lookup("tcp_server.accept_batch", (uint32_t)64,
+            "tcp server max connections accepted per wakeup");
+
+/// 暂停accept(连接数已满或句柄耗尽EMFILE)时的重试间隔(毫秒)
+static webserver::ConfigVar<uint32_t>::ptr g_tcp_server_accept_backoff =
+    webserver::Config::Lookup("tcp_server.accept_backoff_ms", (uint32_t)10,
+            "tcp server accept retry interval when paused");
+
 /**
  * 定义一个日志器，用于记录系统相关的日志信息。
  * 
@@ -68,7 +80,95 @@ TcpServer::~TcpServer() {
  * @param v TcpServer配置对象。
  */
 void TcpServer::setConf(const TcpServerConf& v) {
-    m_conf.reset(new TcpServerConf(v));  // 使用新配置对象更新m_conf。
+    setConf(std::make_shared<TcpServerConf>(v));  // 使用新配置对象更新m_conf。
+}
+
+/**
+ * @brief 设置TcpServer配置, 同时应用其中的reuseport设置(需要在bind之前)。
+ * 
+ * @param v TcpServer配置对象。
+ */
+void TcpServer::setConf(TcpServerConf::ptr v) {
+    m_conf = v;
+    if(v) {
+        setReuseport(v->reuseport, v->reuseport_cbpf);
+        setAdmission(std::max(v->max_connections, 0), std::max(v->max_connections_per_ip, 0)
+                     ,OverloadPolicyFromString(v->overload)
+                     ,std::max(v->overload_queue_size, 0), std::max(v->overload_queue_timeout, 0));
+    }
+}
+
+TcpServer::OverloadPolicy TcpServer::OverloadPolicyFromString(const std::string& v) {
+    if(strcasecmp(v.c_str(), "pause") == 0) {
+        return OVERLOAD_PAUSE;
+    }
+    if(strcasecmp(v.c_str(), "queue") == 0) {
+        return OVERLOAD_QUEUE;
+    }
+    return OVERLOAD_CLOSE;
+}
+
+const char* TcpServer::OverloadPolicyToString(OverloadPolicy v) {
+    switch(v) {
+        case OVERLOAD_PAUSE:
+            return "pause";
+        case OVERLOAD_QUEUE:
+            return "queue";
+        default:
+            return "close";
+    }
+}
+
+/**
+ * @brief 设置准入控制参数。
+ */
+void TcpServer::setAdmission(uint32_t max_conns, uint32_t max_conns_per_ip
+                             ,OverloadPolicy policy, uint32_t queue_size, uint64_t queue_timeout_ms) {
+    MutexType::Lock lock(m_admitMutex);
+    m_maxConns = max_conns;
+    m_maxConnsPerIp = max_conns_per_ip;
+    m_overload = policy;
+    m_queueSize = queue_size;
+    m_queueTimeout = queue_timeout_ms;
+}
+
+/**
+ * @brief 按对端IP(不含端口)生成计数用的键, 非IP地址返回空串(不做单IP限制)。
+ */
+static std::string GetIpKey(Socket::ptr client) {
+    Address::ptr addr = client->getRemoteAddress();
+    if(!addr) {
+        return "";
+    }
+    const sockaddr* sa = addr->getAddr();
+    if(sa->sa_family == AF_INET) {
+        return std::string((const char*)&((const sockaddr_in*)sa)->sin_addr, 4);
+    } else if(sa->sa_family == AF_INET6) {
+        return std::string((const char*)&((const sockaddr_in6*)sa)->sin6_addr, 16);
+    }
+    return "";
+}
+
+/**
+ * @brief 给reuseport组挂载CBPF程序, 按处理SYN的CPU选择组内第(cpu % n)个socket。
+ * 
+ * @param sock 组内任意一个socket(程序作用于整个组)。
+ * @param n 组内socket数量。
+ * @return 挂载成功返回true。
+ */
+static bool AttachReuseportCbpf(Socket::ptr sock, uint32_t n) {
+    struct sock_filter code[] = {
+        // A = 当前CPU
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+        // A = A % n
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, n },
+        // 返回组内下标
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    return sock->setOption(SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
 }
 
 /**
@@ -103,34 +203,66 @@ bool TcpServer::bind(webserver::Address::ptr addr, bool ssl) {
 bool TcpServer::bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails, bool ssl) {
     // 绑定多个地址
     m_ssl = ssl;  // 设置SSL标志。
+    // reuseport模式下每个地址为每个IO线程创建一个监听socket
+    m_reuseportGroup = 1;
+    if (m_reuseport && m_ioWorker) {
+        m_reuseportGroup = std::max((size_t)1, m_ioWorker->getWorkerThreadIds().size());
+    }
     for (auto& addr : addrs) {  // 遍历所有地址。
-        // 根据ssl标志创建TCP或SSL socket。
-        // 创建TCPsocket
-        Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
-        // bind
-        if (!sock->bind(addr)) {  // 尝试绑定地址。
-            // 记录绑定失败日志。
-            WEBSERVER_LOG_ERROR(g_logger) << "bind fail errno=" << errno << " errstr=" << strerror(errno)
-                                          << " addr=[" << addr->toString() << "]";
-            // bind失败放入失败数组
-            fails.push_back(addr);  // 添加到失败列表。
-            continue;
+        // 端口为0时组内后续的socket绑定第一个socket实际分配到的地址
+        Address::ptr bind_addr = addr;
+        bool ok = true;
+        // unix域socket不支持SO_REUSEPORT, 仍只创建一个
+        bool group = m_reuseport && m_reuseportGroup > 1 && addr->getFamily() != AF_UNIX;
+        for (size_t i = 0; i < (group ? m_reuseportGroup : 1) && ok; ++i) {
+            // 根据ssl标志创建TCP或SSL socket。
+            // 创建TCPsocket
+            Socket::ptr sock = ssl ? SSLSocket::CreateTCP(bind_addr) : Socket::CreateTCP(bind_addr);
+            if (group && (!sock->open() || !sock->setOption(SOL_SOCKET, SO_REUSEPORT, 1))) {
+                WEBSERVER_LOG_ERROR(g_logger) << "SO_REUSEPORT fail errno=" << errno << " errstr=" << strerror(errno)
+                                              << " addr=[" << addr->toString() << "]";
+                ok = false;
+                break;
+            }
+            // bind
+            if (!sock->bind(bind_addr)) {  // 尝试绑定地址。
+                // 记录绑定失败日志。
+                WEBSERVER_LOG_ERROR(g_logger) << "bind fail errno=" << errno << " errstr=" << strerror(errno)
+                                              << " addr=[" << addr->toString() << "]";
+                ok = false;
+                break;
+            }
+            // 监听
+            if (!sock->listen()) {  // 尝试监听地址。
+                // 记录监听失败日志。
+                WEBSERVER_LOG_ERROR(g_logger) << "listen fail errno=" << errno << " errstr=" << strerror(errno)
+                                              << " addr=[" << addr->toString() << "]";
+                ok = false;
+                break;
+            }
+            if (i == 0) {
+                bind_addr = sock->getLocalAddress();
+                if (group && m_reuseportCbpf && !AttachReuseportCbpf(sock, m_reuseportGroup)) {
+                    // 挂载失败时由内核按四元组哈希分配, 不影响使用
+                    WEBSERVER_LOG_WARN(g_logger) << "attach reuseport cbpf fail errno=" << errno
+                                                 << " errstr=" << strerror(errno)
+                                                 << " addr=[" << addr->toString() << "]";
+                }
+            }
+            m_socks.push_back(sock);  // 监听成功，添加到socket列表。
+            m_sockSlots.push_back(group ? (int)i : -1);
         }
-        // 监听
-        if (!sock->listen()) {  // 尝试监听地址。
-            // 记录监听失败日志。
-            WEBSERVER_LOG_ERROR(g_logger) << "listen fail errno=" << errno << " errstr=" << strerror(errno)
-                                          << " addr=[" << addr->toString() << "]";
+        if (!ok) {
+            // bind失败放入失败数组
             fails.push_back(addr);  // 添加到失败列表。
-            continue;
         }
-        m_socks.push_back(sock);  // 监听成功，添加到socket列表。
     }
 
     // 检查是否有失败的绑定。
     // 有绑定失败的地址，清空监听socket数组
     if (!fails.empty()) {
         m_socks.clear();  // 清空socket列表并返回失败。
+        m_sockSlots.clear();
         return false;
     }
 
@@ -149,23 +281,231 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs, std::vector<Address
  * @param sock 监听套接字
  */
 void TcpServer::startAccept(Socket::ptr sock) {
+    // reuseport模式下accept循环固定在一个IO线程上, 新连接也固定在这个线程上处理
+    int thread = -1;
+    for(size_t i = 0; i < m_socks.size(); ++i) {
+        if(m_socks[i] == sock && m_sockSlots[i] >= 0) {
+            thread = webserver::GetThreadId();
+            break;
+        }
+    }
     // 循环接受客户端连接，直到服务器停止运行
     while(!m_isStop) {
+        // pause模式下连接数已满时不再accept, 新连接留在内核的accept队列中(受listen的backlog限制)
+        bool paused = false;
+        while(!m_isStop && m_overload == OVERLOAD_PAUSE
+                && m_maxConns && m_connections >= m_maxConns) {
+            if(!paused) {
+                paused = true;
+                ++m_pauses;
+            }
+            usleep(g_tcp_server_accept_backoff->getValue() * 1000);
+        }
+        if(m_isStop) {
+            break;
+        }
         // 接受客户端连接
         Socket::ptr client = sock->accept();
         // 连接成功
-        if(client) {
-            // 设置客户端接收超时时间
-            client->setRecvTimeout(m_recvTimeout);
-            // handleClient 结束之前， TcpServer不能结束，shared_from_this，把自己传进去
-            // 将客户端处理任务加入到IO工作线程池中
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient,
-                        shared_from_this(), client));
-        } else {
+        if(!client) {
             // 打印错误日志
             WEBSERVER_LOG_ERROR(g_logger) << "accept errno=" << errno
                 << " errstr=" << strerror(errno);
+            if(errno == EMFILE || errno == ENFILE) {
+                // 句柄耗尽时监听socket一直可读, 立即重试只会空转, 等连接释放句柄
+                usleep(g_tcp_server_accept_backoff->getValue() * 1000);
+            }
+            continue;
+        }
+        // 一次唤醒把accept队列中已完成握手的连接取完, 减少epoll往返
+        uint32_t batch = std::max(g_tcp_server_accept_batch->getValue(), (uint32_t)1);
+        for(uint32_t n = 1; client; ++n) {
+            admit(client, thread);
+            if(n >= batch || m_isStop || (m_overload == OVERLOAD_PAUSE
+                    && m_maxConns && m_connections >= m_maxConns)) {
+                break;
+            }
+            client = sock->tryAccept();
+        }
+    }
+}
+
+/**
+ * @brief 不加锁地占用一个总连接数名额。
+ */
+bool TcpServer::reserve() {
+    uint32_t max_conns = m_maxConns;
+    if(!max_conns) {
+        ++m_connections;
+        return true;
+    }
+    uint64_t cur = m_connections;
+    do {
+        if(cur >= max_conns) {
+            return false;
+        }
+    } while(!m_connections.compare_exchange_weak(cur, cur + 1));
+    return true;
+}
+
+/**
+ * @brief 对新连接做准入控制。
+ * 
+ * 单个IP超过限制时立即关闭; 总连接数超过限制时按过载策略关闭或排队(pause模式下
+ * 多个reuseport监听socket同时accept可能略微超出, 此时也直接关闭)。
+ * 只限制总连接数且不排队时不加锁, 用CAS占用名额。
+ * 
+ * @param client 新连接
+ * @param thread 处理连接的线程, -1表示不指定
+ */
+void TcpServer::admit(Socket::ptr client, int thread) {
+    // 只有限制单个IP的连接数时才需要对端地址
+    std::string ip = m_maxConnsPerIp ? GetIpKey(client) : "";
+    if(ip.empty() && m_overload != OVERLOAD_QUEUE) {
+        if(!reserve()) {
+            ++m_rejected;
+            client->close();
+            return;
+        }
+        dispatch(client, ip, thread);
+        return;
+    }
+
+    bool queued = false;
+    uint64_t queue_timeout = 0;
+    {
+        MutexType::Lock lock(m_admitMutex);
+        uint32_t* ip_conns = nullptr;
+        if(!ip.empty()) {
+            ip_conns = &m_ipConns[ip];
+            if(*ip_conns >= m_maxConnsPerIp) {
+                lock.unlock();
+                ++m_rejectedIp;
+                client->close();
+                return;
+            }
+        }
+        // 排队的连接在release中持锁接替名额, 持锁占用名额不会越过排在前面的连接
+        if(!reserve()) {
+            if(m_overload != OVERLOAD_QUEUE || m_pending.size() >= m_queueSize) {
+                if(ip_conns && *ip_conns == 0) {
+                    m_ipConns.erase(ip);
+                }
+                lock.unlock();
+                ++m_rejected;
+                client->close();
+                return;
+            }
+            queue_timeout = m_queueTimeout;
+            m_pending.push_back({client, ip, GetCurrentMS() + queue_timeout, thread});
+            queued = true;
         }
+        if(ip_conns) {
+            ++*ip_conns;
+        }
+    }
+    if(queued) {
+        // 截止时间递增, 每个排队的连接各加一个定时器, 到期时从队头清理
+        m_ioWorker->addTimer(queue_timeout, std::bind(&TcpServer::expirePending,
+                    shared_from_this()));
+        return;
+    }
+    dispatch(client, ip, thread);
+}
+
+/**
+ * @brief 把已准入的连接交给IO调度器处理。
+ */
+void TcpServer::dispatch(Socket::ptr client, const std::string& ip, int thread) {
+    ++m_accepted;
+    // sharded模式下新连接轮流分配给IO调度器各线程的epoll; 不是accept_worker, 两者可能不同.
+    // 指定线程时(reuseport)在第一次等待事件时分给该线程
+    if(thread == -1 && m_ioWorker->isSharded()) {
+        m_ioWorker->assignShard(client->getSocket());
+    }
+    // 名额跟随连接的生命周期: socket关闭或析构时释放, 而不是handleClient返回时,
+    // 这样handleClient返回后仍异步处理连接的子类(如RockServer)也能正确计数
+    TcpServer::ptr self = shared_from_this();
+    client->setCloseCallback([self, ip]() {
+        self->release(ip);
+    });
+    // 设置客户端接收超时时间
+    client->setRecvTimeout(m_recvTimeout);
+    // handleClient 结束之前， TcpServer不能结束，shared_from_this，把自己传进去
+    // 将客户端处理任务加入到IO工作线程池中
+    m_ioWorker->schedule(std::bind(&TcpServer::handleClient,
+                self, client), thread);
+}
+
+void TcpServer::decIpConns(const std::string& ip) {
+    if(ip.empty()) {
+        return;
+    }
+    auto it = m_ipConns.find(ip);
+    if(it != m_ipConns.end() && --it->second == 0) {
+        m_ipConns.erase(it);
+    }
+}
+
+/**
+ * @brief 释放名额, 排队中的连接按顺序补上(跳过已超时的)。
+ */
+void TcpServer::release(const std::string& ip) {
+    // 没有单IP计数也不排队时只需要减少连接数
+    if(ip.empty() && m_overload != OVERLOAD_QUEUE) {
+        --m_connections;
+        return;
+    }
+    std::vector<Socket::ptr> expired;
+    PendingClient next;
+    bool has_next = false;
+    {
+        MutexType::Lock lock(m_admitMutex);
+        decIpConns(ip);
+        uint64_t now = GetCurrentMS();
+        while(!m_pending.empty()) {
+            PendingClient p = std::move(m_pending.front());
+            m_pending.pop_front();
+            if(p.deadline <= now || m_isStop) {
+                decIpConns(p.ip);
+                expired.push_back(p.sock);
+                continue;
+            }
+            next = std::move(p);
+            has_next = true;
+            break;
+        }
+        // 名额直接交给排队的下一个连接, 不经过递减, 不加锁的reserve不能抢走它
+        if(!has_next) {
+            --m_connections;
+        }
+    }
+    m_queueTimeouts += expired.size();
+    for(auto& i : expired) {
+        i->close();
+    }
+    if(has_next) {
+        dispatch(next.sock, next.ip, next.thread);
+    }
+}
+
+/**
+ * @brief 关闭排队超时的连接。
+ */
+void TcpServer::expirePending() {
+    std::vector<Socket::ptr> expired;
+    {
+        MutexType::Lock lock(m_admitMutex);
+        uint64_t now = GetCurrentMS();
+        while(!m_pending.empty() && (m_pending.front().deadline <= now || m_isStop)) {
+            decIpConns(m_pending.front().ip);
+            expired.push_back(m_pending.front().sock);
+            m_pending.pop_front();
+        }
+    }
+    m_queueTimeouts += expired.size();
+    for(auto& i : expired) {
+        i->close();
     }
 }
 
@@ -182,11 +522,21 @@ bool TcpServer::start() {
     }
     // 标记服务器开始运行
     m_isStop = false;
+    // reuseport模式: 每个地址的第i个监听socket在第i个IO线程上accept
+    std::vector<int> threads;
+    if(m_reuseport && m_reuseportGroup > 1) {
+        threads = m_ioWorker->getWorkerThreadIds();
+    }
     // 每个socket接收连接任务放入任务队列中
     // 遍历服务器监听套接字，为每一个套接字分配一个接受客户端连接的任务
-    for(auto& sock : m_socks) {
-        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
-                    shared_from_this(), sock));
+    for(size_t i = 0; i < m_socks.size(); ++i) {
+        if(m_sockSlots[i] >= 0 && !threads.empty()) {
+            m_ioWorker->schedule(std::bind(&TcpServer::startAccept,
+                        shared_from_this(), m_socks[i]), threads[m_sockSlots[i] % threads.size()]);
+        } else {
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
+                        shared_from_this(), m_socks[i]));
+        }
     }
     return true;
 }
@@ -211,6 +561,19 @@ void TcpServer::stop() {
         }
         // 清空套接字列表
         m_socks.clear();
+        m_sockSlots.clear();
+        // 关闭排队中的连接
+        std::deque<PendingClient> pending;
+        {
+            MutexType::Lock lock(m_admitMutex);
+            pending.swap(m_pending);
+            for(auto& i : pending) {
+                decIpConns(i.ip);
+            }
+        }
+        for(auto& i : pending) {
+            i.sock->close();
+        }
     });
 }
 
@@ -258,8 +621,28 @@ std::string TcpServer::toString(const std::string& prefix) {
        << " name=" << m_name << " ssl=" << m_ssl
        << " worker=" << (m_worker ? m_worker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
+       << " reuseport=" << (m_reuseport ? m_reuseportGroup : 0)
        << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
+    // 准入控制和连接统计
+    size_t pending = 0;
+    size_t ips = 0;
+    {
+        MutexType::Lock lock(m_admitMutex);
+        pending = m_pending.size();
+        ips = m_ipConns.size();
+    }
+    ss << pfx << "[connections=" << m_connections
+       << " max_connections=" << m_maxConns
+       << " max_connections_per_ip=" << m_maxConnsPerIp
+       << " overload=" << OverloadPolicyToString(m_overload)
+       << " accepted=" << m_accepted
+       << " rejected=" << m_rejected
+       << " rejected_ip=" << m_rejectedIp
+       << " queued=" << pending
+       << " queue_timeouts=" << m_queueTimeouts
+       << " accept_pauses=" << m_pauses
+       << " tracked_ips=" << ips << "]" << std::endl;
     // 将监听套接字信息加入到字符串流中
     for(auto& i : m_socks) {
         ss << pfx << pfx << *i << std::endl;
@@ -11,11 +11,15 @@
 
 #include <memory>
 #include <functional>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
 #include "address.h"
 #include "iomanager.h"
 #include "socket.h"
 #include "noncopyable.h"
 #include "config.h"
+#include "mutex.h"
 
 namespace webserver {
     /*
@@ -30,6 +34,20 @@ struct TcpServerConf {
     int keepalive = 0;
     int timeout = 1000 * 2 * 60;
     int ssl = 0;
+    /// 每个IO线程一个SO_REUSEPORT监听socket, 在服务连接的线程上直接accept
+    int reuseport = 0;
+    /// reuseport模式下按处理SYN的CPU挑选监听socket(CBPF), IO线程绑定CPU时使用
+    int reuseport_cbpf = 0;
+    /// 最大连接数, 0表示不限制
+    int max_connections = 0;
+    /// 单个IP的最大连接数, 0表示不限制
+    int max_connections_per_ip = 0;
+    /// 连接数达到max_connections时的处理方式: close(立即关闭), pause(暂停accept), queue(排队等待)
+    std::string overload = "close";
+    /// queue模式下的最大排队数
+    int overload_queue_size = 1024;
+    /// queue模式下的排队超时时间(毫秒), 超时后关闭连接
+    int overload_queue_timeout = 1000;
     std::string id;
     /// 服务器类型，http, ws, rock
     std::string type = "http";
@@ -51,6 +69,13 @@ struct TcpServerConf {
             && timeout == oth.timeout
             && name == oth.name
             && ssl == oth.ssl
+            && reuseport == oth.reuseport
+            && reuseport_cbpf == oth.reuseport_cbpf
+            && max_connections == oth.max_connections
+            && max_connections_per_ip == oth.max_connections_per_ip
+            && overload == oth.overload
+            && overload_queue_size == oth.overload_queue_size
+            && overload_queue_timeout == oth.overload_queue_timeout
             && cert_file == oth.cert_file
             && key_file == oth.key_file
             && accept_worker == oth.accept_worker
@@ -74,6 +99,13 @@ public:
         conf.timeout = node["timeout"].as<int>(conf.timeout);
         conf.name = node["name"].as<std::string>(conf.name);
         conf.ssl = node["ssl"].as<int>(conf.ssl);
+        conf.reuseport = node["reuseport"].as<int>(conf.reuseport);
+        conf.reuseport_cbpf = node["reuseport_cbpf"].as<int>(conf.reuseport_cbpf);
+        conf.max_connections = node["max_connections"].as<int>(conf.max_connections);
+        conf.max_connections_per_ip = node["max_connections_per_ip"].as<int>(conf.max_connections_per_ip);
+        conf.overload = node["overload"].as<std::string>(conf.overload);
+        conf.overload_queue_size = node["overload_queue_size"].as<int>(conf.overload_queue_size);
+        conf.overload_queue_timeout = node["overload_queue_timeout"].as<int>(conf.overload_queue_timeout);
         conf.cert_file = node["cert_file"].as<std::string>(conf.cert_file);
         conf.key_file = node["key_file"].as<std::string>(conf.key_file);
         conf.accept_worker = node["accept_worker"].as<std::string>();
@@ -101,6 +133,13 @@ public:
         node["keepalive"] = conf.keepalive;
         node["timeout"] = conf.timeout;
         node["ssl"] = conf.ssl;
+        node["reuseport"] = conf.reuseport;
+        node["reuseport_cbpf"] = conf.reuseport_cbpf;
+        node["max_connections"] = conf.max_connections;
+        node["max_connections_per_ip"] = conf.max_connections_per_ip;
+        node["overload"] = conf.overload;
+        node["overload_queue_size"] = conf.overload_queue_size;
+        node["overload_queue_timeout"] = conf.overload_queue_timeout;
         node["cert_file"] = conf.cert_file;
         node["key_file"] = conf.key_file;
         node["accept_worker"] = conf.accept_worker;
@@ -124,6 +163,30 @@ class TcpServer : public std::enable_shared_from_this<TcpServer>
                     , Noncopyable {
 public:
     typedef std::shared_ptr<TcpServer> ptr;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 连接数达到上限时的处理方式
+     */
+    enum OverloadPolicy {
+        /// accept后立即关闭新连接
+        OVERLOAD_CLOSE = 0,
+        /// 暂停accept, 新连接留在内核的accept队列中, 有连接结束后继续
+        OVERLOAD_PAUSE = 1,
+        /// accept后排队, 有连接结束时按顺序处理, 超过排队时间仍未处理则关闭
+        OVERLOAD_QUEUE = 2
+    };
+
+    /**
+     * @brief 字符串(close, pause, queue)转OverloadPolicy, 无法识别时返回OVERLOAD_CLOSE
+     */
+    static OverloadPolicy OverloadPolicyFromString(const std::string& v);
+
+    /**
+     * @brief OverloadPolicy转字符串
+     */
+    static const char* OverloadPolicyToString(OverloadPolicy v);
+
     /**
      * @brief 构造函数
      * @param[in] worker socket客户端工作的协程调度器
@@ -193,8 +256,59 @@ public:
      */
     bool isStop() const { return m_isStop;}
 
+    /**
+     * @brief 设置reuseport模式, 需要在bind之前设置
+     * @details 每个地址为m_ioWorker的每个工作线程创建一个SO_REUSEPORT监听socket,
+     *          由内核在这些socket间分配新连接; 每个socket的accept循环固定在对应的线程上,
+     *          新连接直接在accept它的线程上处理, 不再经过单独的accept线程转交.
+     *          m_ioWorker没有工作线程时退化为普通模式.
+     * @param[in] v 是否开启
+     * @param[in] cbpf 是否挂载按CPU选择socket的CBPF程序(IO线程绑定CPU时连接可以留在同一个CPU)
+     */
+    void setReuseport(bool v, bool cbpf = false) { m_reuseport = v; m_reuseportCbpf = cbpf;}
+
+    /**
+     * @brief 是否为reuseport模式
+     */
+    bool isReuseport() const { return m_reuseport;}
+
+    /**
+     * @brief 设置准入控制
+     * @details 连接从被接受开始占用名额, 到连接的socket关闭(或析构)时释放,
+     *          在handleClient返回后仍异步处理连接的子类(如RockServer)同样按连接的实际生命周期计数.
+     *          单个IP超过限制的连接总是立即关闭, 总连接数超过限制时按policy处理.
+     * @param[in] max_conns 最大连接数, 0表示不限制
+     * @param[in] max_conns_per_ip 单个IP的最大连接数, 0表示不限制
+     * @param[in] policy 总连接数达到上限时的处理方式
+     * @param[in] queue_size OVERLOAD_QUEUE时的最大排队数, 超过后立即关闭
+     * @param[in] queue_timeout_ms OVERLOAD_QUEUE时的排队超时时间(毫秒)
+     */
+    void setAdmission(uint32_t max_conns, uint32_t max_conns_per_ip = 0
+                      ,OverloadPolicy policy = OVERLOAD_CLOSE
+                      ,uint32_t queue_size = 1024, uint64_t queue_timeout_ms = 1000);
+
+    /**
+     * @brief 返回最大连接数, 0表示不限制
+     */
+    uint32_t getMaxConnections() const { return m_maxConns;}
+
+    /**
+     * @brief 返回单个IP的最大连接数, 0表示不限制
+     */
+    uint32_t getMaxConnectionsPerIp() const { return m_maxConnsPerIp;}
+
+    /**
+     * @brief 返回过载处理方式
+     */
+    OverloadPolicy getOverloadPolicy() const { return m_overload;}
+
+    /**
+     * @brief 返回当前正在处理的连接数(不含排队中的)
+     */
+    uint64_t getConnections() const { return m_connections;}
+
     TcpServerConf::ptr getConf() const { return m_conf;}
-    void setConf(TcpServerConf::ptr v) { m_conf = v;}
+    void setConf(TcpServerConf::ptr v);
     void setConf(const TcpServerConf& v);
 
     virtual std::string toString(const std::string& prefix = "");
@@ -209,8 +323,53 @@ protected:
 
     /**
      * @brief 开始接受连接
+     * @details accept到一个连接后用tryAccept把accept队列中剩余的连接一次取完(最多tcp_server.accept_batch个),
+     *          每个连接经过准入控制后交给m_ioWorker处理
      */
     virtual void startAccept(Socket::ptr sock);
+private:
+    /**
+     * @brief 排队中的连接
+     */
+    struct PendingClient {
+        Socket::ptr sock;
+        /// IP键(见GetIpKey)
+        std::string ip;
+        /// 排队截止时间(毫秒)
+        uint64_t deadline;
+        /// 处理连接的线程, -1表示不指定
+        int thread;
+    };
+
+    /**
+     * @brief 对新连接做准入控制, 通过后交给m_ioWorker处理, 否则关闭或排队
+     */
+    void admit(Socket::ptr client, int thread);
+
+    /**
+     * @brief 不加锁地占用一个总连接数名额, 已达到上限时返回false
+     */
+    bool reserve();
+
+    /**
+     * @brief 释放连接占用的名额, 并让排队中的下一个连接开始处理
+     */
+    void release(const std::string& ip);
+
+    /**
+     * @brief 关闭排队超时的连接
+     */
+    void expirePending();
+
+    /**
+     * @brief 设置连接关闭时释放名额, 并调度handleClient
+     */
+    void dispatch(Socket::ptr client, const std::string& ip, int thread);
+
+    /**
+     * @brief 单个IP的连接数减一, 需要持有m_admitMutex
+     */
+    void decIpConns(const std::string& ip);
 protected:
     /// 监听Socket数组
     // 多监听，多网卡
@@ -230,6 +389,35 @@ protected:
     bool m_isStop;
 
     bool m_ssl = false;
+    /// 是否为reuseport模式
+    bool m_reuseport = false;
+    /// reuseport模式下是否按CPU选择监听socket
+    bool m_reuseportCbpf = false;
+    /// reuseport模式下每个地址的监听socket数量(等于IO线程数)
+    size_t m_reuseportGroup = 1;
+    /// 与m_socks对应, 监听socket在reuseport组内的下标(对应第几个IO线程), -1表示不在组内
+    std::vector<int> m_sockSlots;
+
+    /// 准入控制, accept循环不加锁读取
+    std::atomic<uint32_t> m_maxConns{0};
+    std::atomic<uint32_t> m_maxConnsPerIp{0};
+    std::atomic<OverloadPolicy> m_overload{OVERLOAD_CLOSE};
+    uint32_t m_queueSize = 1024;
+    uint64_t m_queueTimeout = 1000;
+    /// 保护m_ipConns, m_pending, m_queueSize, m_queueTimeout;
+    /// 只限制总连接数且不排队时准入和释放不加锁
+    MutexType m_admitMutex;
+    /// <IP键, 连接数(含排队中的)>
+    std::unordered_map<std::string, uint32_t> m_ipConns;
+    /// 排队中的连接, 截止时间递增
+    std::deque<PendingClient> m_pending;
+    /// 统计: 当前连接数, 累计准入数, 因总连接数关闭数, 因单IP限制关闭数, 排队超时数, accept暂停次数
+    std::atomic<uint64_t> m_connections{0};
+    std::atomic<uint64_t> m_accepted{0};
+    std::atomic<uint64_t> m_rejected{0};
+    std::atomic<uint64_t> m_rejectedIp{0};
+    std::atomic<uint64_t> m_queueTimeouts{0};
+    std::atomic<uint64_t> m_pauses{0};
 
     TcpServerConf::ptr m_conf;
 };
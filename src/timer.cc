@@ -1,35 +1,34 @@
 #include "timer.h"
 #include "util.h"
+#include "clock.h"
+#include "config.h"
+
+#include <string.h>
 
 namespace webserver {
 
+static ConfigVar<uint32_t>::ptr g_timer_tick_ms =
+    Config::Lookup<uint32_t>("timer.tick_ms", 1, "timer wheel tick in ms");
+
 /**
- * @brief Timer::Comparator::operator() 是 Timer 类中的 Comparator 结构体的函数调用运算符重载，用于比较 Timer 智能指针的优先级。
- * @param lhs 一个 Timer 智能指针，用于比较。
- * @param rhs 另一个 Timer 智能指针，用于比较。
- * @return 如果 lhs 的 m_next 小于 rhs 的 m_next，或者如果 lhs 为空且 rhs 不为空，则返回 true；否则返回 false。
+ * @brief 返回位图中[from, to)范围内第一个置位的下标, 没有返回-1
+ * @param[in] bitmap 位图
+ * @param[in] from 起始位置
+ * @param[in] to 结束位置, 64的倍数
  */
-bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const {
-    // 检查 lhs 和 rhs 是否都为空 比较定时器的智能指针的大小(按执行时间排序)
-    if (!lhs && !rhs) {
-        return false;
-    }
-    if (!lhs) {
-        return true;
-    }
-    if (!rhs) {
-        return false;
-    }
-    if (lhs->m_next < rhs->m_next) {
-        return true;
-    }
-    if (rhs->m_next < lhs->m_next) {
-        return false;
+static int FindBit(const uint64_t* bitmap, int from, int to) {
+    for(int i = from >> 6; i < (to >> 6); ++i) {
+        uint64_t bits = bitmap[i];
+        if(i == (from >> 6)) {
+            bits &= ~0ull << (from & 63);
+        }
+        if(bits) {
+            return (i << 6) + __builtin_ctzll(bits);
+        }
     }
-    return lhs.get() < rhs.get();
+    return -1;
 }
 
-
 // 只能由TimerManager创建Timer
 Timer::Timer(uint64_t ms, std::function<void()> cb,
              bool recurring, TimerManager* manager)
@@ -38,88 +37,51 @@ Timer::Timer(uint64_t ms, std::function<void()> cb,
     ,m_cb(cb)
     ,m_manager(manager) {
         // 执行时间为当前时间+执行周期
-    m_next = webserver::GetCurrentMS() + m_ms;
-}
-
-Timer::Timer(uint64_t next)
-    :m_next(next) {
+        // 用精确时间计算到期时间, 缓存的时间可能落后于当前任务已经执行的时长, 会让定时器提前触发
+    m_next = Clock::PreciseMS() + m_ms;
 }
 
 // 取消定时器，防止其回调函数被执行。
 bool Timer::cancel() {
     /*
-    这段代码定义了Timer类的成员函数cancel，其作用是取消当前定时器，防止其回调函数在未来被调用。
-    如果定时器成功取消，函数返回true；如果定时器已经被取消或不存在，函数返回false。
-
-    首先通过锁定TimerManager的互斥锁来确保线程安全。
-    然后，它检查当前定时器是否有效（即回调函数是否已经设置）。
-    如果有效，它会将回调函数设为nullptr以表示定时器已被取消，并从TimerManager的定时器集合中移除该定时器。
-    如果定时器已经是无效状态（即回调函数已经是nullptr），则函数直接返回false，表示没有定时器被取消。
-    这种设计确保了定时器的正确取消，并防止了无效的回调执行。
+    定时器创建时就确定了所属的时间轮, 之后不再改变, 所以可以不加锁读取m_wheel。
+    在时间轮的锁内把回调取出并从槽位链表中摘除, 都是O(1)的操作。
+    回调和时间轮持有的引用在锁外释放, 避免回调捕获的对象析构时再操作同一个时间轮造成死锁。
     */
-    // 获取对应TimerManager的互斥锁，以保证线程安全。
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+    std::function<void()> cb;
+    Timer::ptr self;
+    TimerWheel::MutexType::Lock lock(m_wheel->m_mutex);
 
-    // 检查定时器的回调函数是否已经设置（即定时器是否有效）。
-    if(m_cb) {
-        // 将定时器的回调函数设置为nullptr，表示定时器已被取消。
-        m_cb = nullptr;
-
-        // 在TimerManager的定时器集合中找到当前定时器的迭代器。
-        // 使用shared_from_this获取当前对象的std::shared_ptr。
-        auto it = m_manager->m_timers.find(shared_from_this());
-
-        // 从TimerManager的定时器集合中移除当前定时器。
-        m_manager->m_timers.erase(it);
-
-        // 定时器成功取消，返回true。
-        return true;
+    // 回调为空表示定时器已经被取消或已经执行(非循环定时器)。
+    if(!m_cb) {
+        return false;
     }
-
-    // 如果定时器的回调函数已经是nullptr（即定时器已经被取消或无效），则返回false。
-    return false;
+    cb.swap(m_cb);
+    self = m_wheel->unlink(this);
+    return true;
 }
 
 
 // 重新设置定时器的到期时间。
 bool Timer::refresh() {
     /*
-    这段代码定义了Timer类的成员函数refresh，旨在重新设置定时器，以使其从当前时间开始再次计算到期时间。
-    如果操作成功，函数返回true；如果定时器无效或不存在于管理器中，函数返回false。
-
-    此函数通过锁定TimerManager的互斥锁来确保线程安全地操作定时器集合。
-    它首先检查定时器是否有效（即回调函数m_cb是否非空），然后确认定时器是否仍存在于TimerManager的定时器集合中。
-    如果这些检查通过，函数将从集合中移除定时器，重新计算其到期时间，并将其再次添加到集合中。
-    这样，定时器就被“刷新”了，即其倒计时重新开始。
-    这种机制允许动态调整定时器的触发时间，适应可能发生的时间变化或新的需求。
+    从当前时间开始重新计算到期时间: 从槽位中摘除, 更新m_next后按新的到期时间重新放入时间轮。
+    到期时间只会往后推, 不需要通知IOManager重新计算超时。
     */
-    // 获取对应TimerManager的互斥锁，以保证线程安全。
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-
-    // 检查定时器的回调函数是否存在。如果回调函数为空（m_cb），表示定时器已被取消或无效，因此返回false。
+    Timer::ptr self;
+    TimerWheel::MutexType::Lock lock(m_wheel->m_mutex);
     if(!m_cb) {
         return false;
     }
 
-    // 在TimerManager的定时器集合中查找当前定时器的迭代器。
-    // 使用shared_from_this来获取当前对象的std::shared_ptr。
-    auto it = m_manager->m_timers.find(shared_from_this());
-
-    // 如果定时器不存在于TimerManager的集合中，表示定时器无效或已被移除，因此返回false。
-    if(it == m_manager->m_timers.end()) {
+    // 不在时间轮中(正在被收集执行), 返回false。
+    self = m_wheel->unlink(this);
+    if(!self) {
         return false;
     }
 
-    // 从TimerManager的定时器集合中移除当前定时器。
-    m_manager->m_timers.erase(it);
-
-    // 重新计算定时器的到期时间。m_next设置为当前时间加上定时器原始的间隔时间m_ms。
-    m_next = webserver::GetCurrentMS() + m_ms;
-
-    // 将定时器重新插入到TimerManager的定时器集合中。
-    m_manager->m_timers.insert(shared_from_this());
-
-    // 定时器成功刷新，返回true。
+    m_next = Clock::PreciseMS() + m_ms;
+    m_wheel->link(self);
     return true;
 }
 
@@ -127,49 +89,29 @@ bool Timer::refresh() {
 // 重置定时器的超时时间。 from_now是否从当前时间开始计算
 bool Timer::reset(uint64_t ms, bool from_now) {
     /*
-    这段代码定义了Timer类的成员函数reset，其功能是重置定时器的超时时间。
-    根据参数from_now，重置操作要么基于当前时间（from_now为true），要么基于原始设定的超时时间（from_now为false）。
-    如果操作成功，函数返回true；如果定时器无效或不存在于管理器中，函数返回false。
-
-    这个函数通过锁定TimerManager的互斥锁来确保线程安全地操作定时器集合。
-    首先检查是否真的需要重置（基于新的间隔时间和是否从现在开始计时）。
-    如果需要重置，函数会从定时器集合中移除当前定时器，计算新的起始时间，更新定时器的间隔时间和下一个到期时间，然后再将定时器添加回定时器集合。
-    这样，定时器就按照新的设置被重置，准备再次触发。
-
-
-    
+    重置定时器的执行周期: from_now为true时从当前时间开始计算, 否则从上一次的起始时间开始计算。
+    新的到期时间可能比原来早, 所以通过TimerManager::addTimer放回时间轮, 必要时通知IOManager。
     */
     // 如果新的超时时间与当前设置相同，并且不是基于当前时间重置，则无需操作，直接返回true。
     if(ms == m_ms && !from_now) {
         return true;
     }
 
-    // 获取对应TimerManager的互斥锁，以保证线程安全。
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-
-    // 检查定时器的回调函数是否存在。如果回调函数为空（m_cb），表示定时器已被取消或无效，因此返回false。
+    TimerWheel::MutexType::Lock lock(m_wheel->m_mutex);
     if(!m_cb) {
         return false;
     }
 
-    // 在TimerManager的定时器集合中查找当前定时器的迭代器。
-    auto it = m_manager->m_timers.find(shared_from_this());
-
-    // 如果定时器不存在于TimerManager的集合中，表示定时器无效或已被移除，因此返回false。
-    if(it == m_manager->m_timers.end()) {
+    Timer::ptr self = m_wheel->unlink(this);
+    if(!self) {
         return false;
     }
 
-    // 从TimerManager的定时器集合中移除当前定时器。
-    m_manager->m_timers.erase(it);
-
     // 计算新的起始时间。
     uint64_t start = 0;
     if(from_now) {
-        // 如果from_now为true，起始时间为当前时间。
-        start = webserver::GetCurrentMS();
+        start = Clock::PreciseMS();
     } else {
-        // 如果from_now为false，起始时间为上一个到期时间减去原间隔时间。
         start = m_next - m_ms;
     }
 
@@ -177,71 +119,287 @@ bool Timer::reset(uint64_t ms, bool from_now) {
     m_ms = ms;
     m_next = start + m_ms;
 
-    // 将定时器重新添加到TimerManager的定时器集合中。
-    m_manager->addTimer(shared_from_this(), lock);
-
-    // 定时器成功重置，返回true。
+    // 放回时间轮, addTimer中会释放锁, self在锁外析构
+    m_manager->addTimer(self, lock);
     return true;
 }
 
 
+// 重新启动定时器, 复用定时器对象
+void Timer::restart(uint64_t ms, std::function<void()> cb) {
+    // 旧的回调在锁外析构
+    std::function<void()> old;
+    TimerWheel::MutexType::Lock lock(m_wheel->m_mutex);
+    Timer::ptr self = m_wheel->unlink(this);
+    if(!self) {
+        self = shared_from_this();
+    }
+    old.swap(m_cb);
+    m_cb.swap(cb);
+    m_ms = ms;
+    m_next = Clock::PreciseMS() + m_ms;
+
+    // 新的到期时间可能比原来早, 通过addTimer放回时间轮
+    m_manager->addTimer(self, lock);
+}
+
+
+TimerWheel::TimerWheel(uint64_t tick_ms, size_t index)
+    :m_tickMs(tick_ms)
+    ,m_index(index) {
+    m_previouseTime = Clock::NowMS();
+    m_current = m_previouseTime / m_tickMs;
+    memset(m_near, 0, sizeof(m_near));
+    memset(m_far, 0, sizeof(m_far));
+    memset(m_nearBitmap, 0, sizeof(m_nearBitmap));
+    memset(m_farBitmap, 0, sizeof(m_farBitmap));
+}
+
+TimerWheel::~TimerWheel() {
+    // 释放时间轮持有的引用, 外部仍持有的定时器不再触发
+    std::vector<Timer::ptr> timers;
+    takeAll(timers);
+    for(auto& i : timers) {
+        i->m_cb = nullptr;
+    }
+}
+
+void TimerWheel::link(Timer::ptr timer) {
+    Timer* t = timer.get();
+    // 到期的tick向上取整, 保证不会提前触发; 已经过期的放到当前槽
+    uint64_t tick = (t->m_next + m_tickMs - 1) / m_tickMs;
+    if(tick < m_current) {
+        tick = m_current;
+    }
+    uint64_t delta = tick - m_current;
+
+    Timer** head = nullptr;
+    if(delta < (uint64_t)NEAR_SIZE) {
+        t->m_level = 0;
+        t->m_slot = tick & (NEAR_SIZE - 1);
+        head = &m_near[t->m_slot];
+        m_nearBitmap[t->m_slot >> 6] |= 1ull << (t->m_slot & 63);
+    } else {
+        // 第level层的每个槽是1 << shift个tick
+        int level = 0;
+        int shift = NEAR_BITS;
+        while(level < FAR_LEVELS - 1 && delta >= (1ull << (shift + FAR_BITS))) {
+            ++level;
+            shift += FAR_BITS;
+        }
+        if(delta >= (1ull << (shift + FAR_BITS))) {
+            // 超出时间轮的范围, 放到最高层最远的槽, 到时再重新分配
+            tick = m_current + (1ull << (shift + FAR_BITS)) - 1;
+        }
+        t->m_level = level + 1;
+        t->m_slot = (tick >> shift) & (FAR_SIZE - 1);
+        head = &m_far[level][t->m_slot];
+        m_farBitmap[level] |= 1ull << t->m_slot;
+    }
+
+    t->m_listPrev = nullptr;
+    t->m_listNext = *head;
+    if(*head) {
+        (*head)->m_listPrev = t;
+    }
+    *head = t;
+    t->m_self.swap(timer);
+    ++m_count;
+}
+
+Timer::ptr TimerWheel::unlink(Timer* t) {
+    if(t->m_level < 0) {
+        return nullptr;
+    }
+    Timer** head = t->m_level == 0 ? &m_near[t->m_slot]
+                                   : &m_far[t->m_level - 1][t->m_slot];
+    if(t->m_listPrev) {
+        t->m_listPrev->m_listNext = t->m_listNext;
+    } else {
+        *head = t->m_listNext;
+    }
+    if(t->m_listNext) {
+        t->m_listNext->m_listPrev = t->m_listPrev;
+    }
+    if(!*head) {
+        // 槽空了, 清除位图
+        if(t->m_level == 0) {
+            m_nearBitmap[t->m_slot >> 6] &= ~(1ull << (t->m_slot & 63));
+        } else {
+            m_farBitmap[t->m_level - 1] &= ~(1ull << t->m_slot);
+        }
+    }
+    t->m_listPrev = t->m_listNext = nullptr;
+    t->m_level = -1;
+    --m_count;
+
+    Timer::ptr self;
+    self.swap(t->m_self);
+    return self;
+}
+
+void TimerWheel::takeSlot(Timer** head, std::vector<Timer::ptr>& timers) {
+    while(*head) {
+        timers.push_back(unlink(*head));
+    }
+}
+
+void TimerWheel::cascade() {
+    // m_current是第0层一圈的开始, 第1层当前槽的定时器都落在这一圈内;
+    // 第1层也转完一圈时继续处理第2层, 以此类推
+    std::vector<Timer::ptr> timers;
+    for(int level = 0; level < FAR_LEVELS; ++level) {
+        int shift = NEAR_BITS + level * FAR_BITS;
+        int slot = (m_current >> shift) & (FAR_SIZE - 1);
+        if(m_farBitmap[level] & (1ull << slot)) {
+            takeSlot(&m_far[level][slot], timers);
+            for(auto& i : timers) {
+                link(i);
+            }
+            timers.clear();
+        }
+        if(slot != 0) {
+            break;
+        }
+    }
+}
+
+void TimerWheel::advance(uint64_t now_ms, std::vector<Timer::ptr>& expired) {
+    uint64_t now_tick = now_ms / m_tickMs;
+    while(m_current <= now_tick) {
+        int idx = m_current & (NEAR_SIZE - 1);
+        if(idx == 0) {
+            cascade();
+        }
+        // 跳过空槽, 直接找到这一圈内下一个非空的槽
+        int slot = FindBit(m_nearBitmap, idx, NEAR_SIZE);
+        if(slot < 0) {
+            uint64_t end = m_current - idx + NEAR_SIZE;
+            m_current = end < now_tick + 1 ? end : now_tick + 1;
+            continue;
+        }
+        uint64_t tick = m_current - idx + slot;
+        if(tick > now_tick) {
+            m_current = now_tick + 1;
+            break;
+        }
+        takeSlot(&m_near[slot], expired);
+        m_current = tick + 1;
+    }
+}
+
+void TimerWheel::takeAll(std::vector<Timer::ptr>& timers) {
+    for(int i = 0; i < NEAR_SIZE; ++i) {
+        takeSlot(&m_near[i], timers);
+    }
+    for(int level = 0; level < FAR_LEVELS; ++level) {
+        for(int i = 0; i < FAR_SIZE; ++i) {
+            takeSlot(&m_far[level][i], timers);
+        }
+    }
+}
+
+uint64_t TimerWheel::nextTick() const {
+    uint64_t next = ~0ull;
+    int idx = m_current & (NEAR_SIZE - 1);
+    uint64_t base = m_current - idx;
+    // 第0层: 先找这一圈剩下的槽, 再找下一圈
+    int slot = FindBit(m_nearBitmap, idx, NEAR_SIZE);
+    if(slot >= 0) {
+        next = base + slot;
+    } else {
+        slot = FindBit(m_nearBitmap, 0, NEAR_SIZE);
+        if(slot >= 0) {
+            next = base + NEAR_SIZE + slot;
+        }
+    }
+    // 上层: 定时器还没有落到第0层, 返回所在槽需要cascade的时间
+    for(int level = 0; level < FAR_LEVELS; ++level) {
+        uint64_t bits = m_farBitmap[level];
+        if(!bits) {
+            continue;
+        }
+        int shift = NEAR_BITS + level * FAR_BITS;
+        uint64_t unit = m_current >> shift;
+        int cur = unit & (FAR_SIZE - 1);
+        uint64_t k = 0;
+        if((m_current & ((1ull << shift) - 1)) || !(bits & (1ull << cur))) {
+            // m_current不在槽的边界上时, 当前槽已经cascade过了, 要等转完一整圈
+            int s = FindBit(&bits, cur + 1, FAR_SIZE);
+            if(s < 0) {
+                s = FindBit(&bits, 0, FAR_SIZE);
+            }
+            k = s > cur ? s - cur : s + FAR_SIZE - cur;
+        }
+        uint64_t tick = (unit + k) << shift;
+        if(tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+// 检测服务器时间是否被调后了 21:00 -> 20:50 调后了
+bool TimerWheel::detectClockRollover(uint64_t now_ms) {
+    /*
+    如果当前时间小于上一次记录的时间，并且这两个时间的差值超过了一个预设的阈值（这里使用1小时作为阈值），则认为发生了时钟回滚。
+    该阈值用于排除正常的时间误差，只有在显著的时间差异出现时才认定为时钟回滚。
+    在每次检测后，函数会更新m_previouseTime为当前时间，以便进行下一次的回滚检测。
+    */
+    bool rollover = false;
+    if(now_ms < m_previouseTime && now_ms < (m_previouseTime - 60 * 60 * 1000)) {
+        rollover = true;
+    }
+    m_previouseTime = now_ms;
+    return rollover;
+}
+
+
 // TimerManager的构造函数。
 TimerManager::TimerManager() {
-    // 初始化成员变量m_previouseTime为当前时间。
-    // webserver::GetCurrentMS()是一个假定的函数，用于获取当前的系统时间，单位为毫秒。
-    m_previouseTime = webserver::GetCurrentMS();
+    m_tickMs = g_timer_tick_ms->getValue();
+    if(m_tickMs == 0) {
+        m_tickMs = 1;
+    }
+    m_wheels.push_back(new TimerWheel(m_tickMs, 0));
 }
 
 // TimerManager的析构函数。
 TimerManager::~TimerManager() {
-    // 析构函数体为空。
-    // 在这里，你可以添加必要的清理代码，比如释放资源、关闭文件等。
-    // 如果TimerManager持有需要手动释放或关闭的资源，在这里进行处理。
-    /*
-    在构造函数中，m_previouseTime成员变量被初始化为当前的系统时间。这个时间值主要用于检测系统时间的变化，包括可能的时钟回滚情况。
-
-析构函数在这段代码中是空的，这意味着没有特别的清理工作需要在TimerManager对象被销毁时执行。
-这是常见的，特别是当所有的资源都是自动管理的（例如，通过智能指针）。
-然而，如果TimerManager在其生命周期内获取了需要手动管理的资源（如动态分配的内存、打开的文件句柄、网络连接等），
-那么在析构函数中应该添加适当的代码来释放或关闭这些资源，以避免资源泄露。
-
+    for(auto i : m_wheels) {
+        delete i;
+    }
+}
 
+void TimerManager::setTimerWheels(size_t count) {
+    while(m_wheels.size() < count) {
+        m_wheels.push_back(new TimerWheel(m_tickMs, m_wheels.size()));
+    }
+}
 
-    */
+TimerWheel* TimerManager::currentWheel() {
+    size_t idx = getTimerWheel();
+    return m_wheels[idx < m_wheels.size() ? idx : 0];
 }
 
 
 // 添加定时器
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
-
     /*
-    在TimerManager中创建并添加一个新的定时器对象
-    在定时器管理器中添加一个新的定时器。
-    函数首先创建一个新的Timer对象，然后使用一个写锁来确保在添加定时器到管理器中时的线程安全。
-    最后，函数将新创建的定时器添加到管理器中，并返回该定时器的智能指针。
+    在TimerManager中创建并添加一个新的定时器对象。
+    定时器放到当前线程使用的时间轮中(sharded模式下每个线程一个时间轮), 之后的取消、刷新、重置和到期都在这个时间轮中完成。
     */
-    // 创建一个新的Timer对象，使用智能指针管理，避免内存泄漏。Timer的构造函数接收四个参数：
-    // 1. ms：定时器超时时间，单位为毫秒。
-    // 2. cb：定时器超时时调用的回调函数，类型为std::function<void()>，表示无参数、无返回值的函数。
-    // 3. recurring：一个布尔值，指示定时器是否应该重复触发。如果为true，定时器超时后会自动重新设置。
-    // 4. this：指向当前TimerManager对象的指针，表示定时器属于这个TimerManager。
     // Timer只能由TimerManager创建
     Timer::ptr timer(new Timer(ms, cb, recurring, this));
-    
-    // 创建一个写锁，用于同步对共享资源的访问。RWMutexType是一个读写互斥锁类型，
-    // WriteLock是其写锁的构造函数，m_mutex是TimerManager中定义的一个读写互斥锁变量。
-    // 创建写锁时，自动锁定互斥量，离开作用域时自动释放互斥量，防止死锁。
-    RWMutexType::WriteLock lock(m_mutex);
+    timer->m_wheel = currentWheel();
 
-    // 将新创建的定时器添加到定时器管理器中。addTimer是另一个成员函数，不是这个函数的递归调用。
-    // 它接收两个参数：刚刚创建的定时器智能指针和当前的写锁。这个内部addTimer函数负责将定时器插入到管理器的适当位置。
+    TimerWheel::MutexType::Lock lock(timer->m_wheel->m_mutex);
     addTimer(timer, lock);
 
     // 返回新创建的定时器的智能指针。调用方可以使用这个智能指针与定时器进行交互，例如取消定时器。
     return timer;
 }
 
-
 // 定义一个静态回调函数，用于带有条件检查的定时器。
 // 该函数首先尝试从一个弱智能指针中获取一个强引用，以确定关联对象的存活状态。
 static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
@@ -305,45 +463,37 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
 }
 
 
+
 // 获取距离下一个定时器事件发生的时间。
 // 最近一个定时器执行的时间间隔
 uint64_t TimerManager::getNextTimer() {
     /*
-    首先通过读锁来确保线程安全地访问定时器集合，
-    然后检查定时器集合是否为空，
-    如果为空则返回一个特定的最大值表示当前没有定时器需要处理。
-    如果定时器集合不为空，函数会计算距离下一个定时器事件发生的时间，并返回这个时间值。
-
-    此函数的返回值可以用于决定TimerManager需要在多长时间后检查并处理下一个定时器事件。
-    特别地，返回值为0表示有定时器事件需要立即处理，而返回~0ull表示当前没有任何定时器事件需要处理。
-    这个机制可以帮助实现定时器的高效调度和处理。
+    返回当前线程的时间轮中最近一个非空槽到期的时间间隔。
+    定时器还在上层时返回它所在槽cascade的时间, 此时可能提前醒来, 但不会错过定时器。
+    返回值为0表示有定时器事件需要立即处理，而返回~0ull表示当前没有任何定时器事件需要处理。
+    同时记录下这个到期时间, 之后插入的更早的定时器需要通知调用者重新计算超时。
     */
-    // 使用读锁来同步对定时器集合m_timers的访问。
-    // 这确保了在多线程环境中对定时器集合的安全访问。
-    RWMutexType::ReadLock lock(m_mutex);
+    TimerWheel* wheel = currentWheel();
+    TimerWheel::MutexType::Lock lock(wheel->m_mutex);
 
-    // 将m_tickled标志重置为false。
-    // m_tickled用于指示是否有定时器事件即将发生。
-    m_tickled = false;
+    // m_tickled用于指示是否已经通知过onTimerInsertedAtFront。
+    wheel->m_tickled = false;
 
-    // 如果定时器集合为空，则返回一个特殊值(~0ull)，表示当前没有定时器需要处理。
-    if(m_timers.empty()) {
-        return ~0ull; // 使用~0ull作为特殊值，表示无定时器。
+    // 如果时间轮为空，则返回一个特殊值(~0ull)，表示当前没有定时器需要处理。
+    if(!wheel->m_count) {
+        wheel->m_deadline = ~0ull;
+        return ~0ull;
     }
 
-    // 获取集合中的第一个（即最近的）定时器事件。
-    const Timer::ptr& next = *m_timers.begin();
-
-    // 获取当前的时间（以毫秒为单位）。
-    uint64_t now_ms = webserver::GetCurrentMS();
+    uint64_t next = wheel->nextTick() * m_tickMs;
+    wheel->m_deadline = next;
+    lock.unlock();
 
-    // 如果当前时间已经超过或等于下一个定时器事件的预定时间，
-    // 则表示下一个定时器事件应该立即执行，因此返回0。
-    if(now_ms >= next->m_next) {
+    uint64_t now_ms = Clock::NowMS();
+    if(now_ms >= next) {
         return 0;
     } else {
-        // 否则，计算并返回距离下一个定时器事件发生的时间。
-        return next->m_next - now_ms;
+        return next - now_ms;
     }
 }
 
@@ -351,161 +501,83 @@ uint64_t TimerManager::getNextTimer() {
 // 收集所有已过期的定时器回调函数。
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
     /*
-    收集所有已过期的定时器回调，并根据需要重新安排循环定时器。
-    
-    检查定时器集合是否为空，检测系统时钟是否发生了回滚，收集所有已过期的定时器，
-    将过期定时器的回调函数添加到提供的向量中，并根据需要重新安排循环定时器。
-    通过这种方式，TimerManager能够高效地管理大量的定时器，确保它们按时触发并在不再需要时被清理。
+    推进当前线程的时间轮, 收集所有已过期的定时器回调，并根据需要重新安排循环定时器。
+    时钟回滚时所有定时器都按过期处理, 和原来的实现一致。
     */
-    // 获取当前时间（毫秒）。
-    uint64_t now_ms = webserver::GetCurrentMS();
-    // 用于存储所有已过期的定时器。
+    uint64_t now_ms = Clock::NowMS();
+    // 用于存储所有已过期的定时器, 在锁外析构
     std::vector<Timer::ptr> expired;
 
-    {
-        // 使用读锁来检查定时器集合是否为空。
-        RWMutexType::ReadLock lock(m_mutex);
-        if(m_timers.empty()) {
-            // 如果定时器集合为空，则直接返回。
-            return;
-        }
-    }
-
-    // 使用写锁来修改定时器集合。
-    RWMutexType::WriteLock lock(m_mutex);
-    if(m_timers.empty()) {
-        // 再次检查定时器集合是否为空，因为在获取写锁之前的状态可能已经改变。
+    TimerWheel* wheel = currentWheel();
+    TimerWheel::MutexType::Lock lock(wheel->m_mutex);
+    if(!wheel->m_count) {
         return;
     }
 
     // 检测系统时钟是否回滚。
-    bool rollover = detectClockRollover(now_ms);
-    // 如果没有发生时钟回滚，并且集合中的第一个定时器尚未过期，则直接返回。
-    if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
-        return;
+    if(wheel->detectClockRollover(now_ms)) {
+        wheel->takeAll(expired);
+        wheel->m_current = now_ms / m_tickMs;
+    } else {
+        wheel->advance(now_ms, expired);
     }
-
-    // 创建一个临时定时器对象，以当前时间为过期时间。
-    Timer::ptr now_timer(new Timer(now_ms));
-    // 根据是否发生时钟回滚来确定搜索的起始位置。
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    // 寻找所有在当前时间点或之前就已经过期的定时器。
-    while(it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
+    if(expired.empty()) {
+        return;
     }
-    // 将所有已过期的定时器从定时器集合中移动到`expired`向量中。
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    // 从定时器集合中移除所有已过期的定时器。
-    m_timers.erase(m_timers.begin(), it);
-    // 为收集的回调预留足够的空间。
-    cbs.reserve(expired.size());
+    cbs.reserve(cbs.size() + expired.size());
 
-    // 遍历所有已过期的定时器。
     for(auto& timer : expired) {
-        // 将定时器的回调函数添加到回调向量中。
         cbs.push_back(timer->m_cb);
-        // 如果定时器是循环的，则重新计算其下一个触发时间并重新添加到定时器集合中。
+        // 如果定时器是循环的，则重新计算其下一个触发时间并重新放入时间轮。
         if(timer->m_recurring) {
             timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
+            wheel->link(timer);
         } else {
-            // 如果定时器不是循环的，则清除其回调函数以释放相关资源。
+            // 回调已经复制到cbs中, 清空表示定时器已执行
             timer->m_cb = nullptr;
         }
     }
 }
 
 
-// 这个成员函数用于向TimerManager中添加一个新的Timer对象。
-// 参数val是要添加的Timer对象的智能指针，lock是一个写锁引用，保证了线程安全地修改定时器容器。
-void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-    /*
-    专门用于将新的定时器对象插入到定时器管理器中的容器。
-    此函数负责将新的定时器对象按照预定的顺序添加到TimerManager管理的容器中，
-    并根据定时器插入的位置决定是否需要执行额外的操作（如调整最近的定时事件）。
-    通过在适当的时候释放写锁，函数优化了线程同步的开销，保证了既高效又安全的操作。
-    */
-    // 将新的Timer对象插入到定时器管理器的容器m_timers中，并获取插入位置的迭代器。
-    // m_timers是一个排序容器，保证了定时器的顺序。
-    auto it = m_timers.insert(val).first;
-
-    // 判断新插入的定时器是否位于容器的最前端，且m_tickled标志为假。
-    // m_tickled是一个布尔标志，用于指示是否需要触发对定时器的处理。
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
+// 这个成员函数用于向定时器所属的时间轮中添加一个定时器。
+// 参数val是要添加的Timer对象的智能指针，lock是持有的时间轮锁。
+void TimerManager::addTimer(Timer::ptr val, TimerWheel::MutexType::Lock& lock) {
+    TimerWheel* wheel = val->m_wheel;
+    if(!wheel->m_count) {
+        // 时间轮为空时没有推进m_current, 直接追上当前时间, 避免定时器被放到过远的层
+        uint64_t now_tick = Clock::NowMS() / m_tickMs;
+        if(now_tick > wheel->m_current) {
+            wheel->m_current = now_tick;
+        }
+    }
+    wheel->link(val);
 
-    // 如果新的定时器是第一个元素，并且之前没有设置m_tickled标志，
-    // 则设置m_tickled为true，表示定时器容器的最前端有变动，可能需要处理。
+    // 比上次getNextTimer返回的时间更早, 等待的线程需要重新计算超时;
+    // m_tickled保证在下次getNextTimer之前只通知一次
+    bool at_front = val->m_next < wheel->m_deadline && !wheel->m_tickled;
     if(at_front) {
-        m_tickled = true;
+        wheel->m_tickled = true;
     }
-
-    // 释放之前获取的写锁。因为下面的操作可能不需要对定时器容器进行修改，
-    // 所以在执行可能会阻塞的操作之前释放锁是一个好习惯。
     lock.unlock();
 
-    // 如果新的定时器位于容器的最前端，表示最近的定时事件有变动，
-    // 则调用onTimerInsertedAtFront函数。这个函数通常用于执行一些必要的操作，
-    // 比如重新设置定时器，以确保最新的定时事件得到处理。
     /* 触发onTimerInsertedAtFront()
-	 * onTimerInsertedAtFront()在IOManager中就是做了一次tickle()的操作 */
+	 * onTimerInsertedAtFront()在IOManager中就是唤醒等待这个时间轮的线程 */
     if(at_front) {
-        onTimerInsertedAtFront();
+        onTimerInsertedAtFront(wheel->m_index);
     }
 }
 
-
-// 检测系统时钟是否发生了回滚。
-// 检测服务器时间是否被调后了 21:00 -> 20:50 调后了
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    /*
-    检测系统时钟是否发生了回滚。
-    时钟回滚可能发生在某些系统中，特别是在使用相对时间计时的系统中调整系统时间时。
-    如果检测到回滚，函数返回true；否则返回false。
-
-    这个函数通过比较当前时间now_ms与上一次记录的时间m_previouseTime来判断是否发生了时钟回滚。
-    如果当前时间小于上一次记录的时间，并且这两个时间的差值超过了一个预设的阈值（这里使用1小时作为阈值），则认为发生了时钟回滚。
-    该阈值用于排除正常的时间误差，只有在显著的时间差异出现时才认定为时钟回滚。
-    在每次检测后，函数会更新m_previouseTime为当前时间，以便进行下一次的回滚检测。
-    */
-    // 初始化回滚标志为false。
-    bool rollover = false;
-
-    // 检查当前时间是否小于上一次记录的时间，且当前时间与上一次记录的时间差距超过1小时（60分钟*60秒*1000毫秒）。
-    // 这种情况表明可能发生了时钟回滚。
-    if(now_ms < m_previouseTime && now_ms < (m_previouseTime - 60 * 60 * 1000)) {
-        // 如果满足上述条件，则设置回滚标志为true。
-        rollover = true;
-    }
-
-    // 更新上一次记录的时间为当前时间，以便下一次调用时使用。
-    m_previouseTime = now_ms;
-
-    // 返回时钟回滚检测结果。
-    return rollover;
-}
-
 // 检查TimerManager是否至少拥有一个定时器。
 // 是否有定时器
 bool TimerManager::hasTimer() {
-    /*
-    检查定时器管理器是否至少拥有一个定时器。
-    通过检查定时器容器m_timers是否为空来实现的。
-    如果m_timers不为空，即至少包含一个定时器，函数返回true；
-    否则返回false。
-
-    这个函数利用了读写锁（RWMutexType::ReadLock）来保护m_timers容器，确保在并发环境下的线程安全。
-    读锁允许多个线程同时读取m_timers，但在写入时会阻塞，直到所有的读锁都被释放。
-    这种锁策略是高效的，特别是在读操作远多于写操作的场景中。
-    通过这种方式，TimerManager可以准确地提供关于其是否有活动定时器的信息，这对于调度和管理定时任务至关重要。
-    */
-    // 使用读锁来同步对定时器容器m_timers的访问。
-    // 这确保了在多线程环境中对定时器容器的安全访问。
-    RWMutexType::ReadLock lock(m_mutex);
-
-    // 检查定时器容器m_timers是否为空。
-    // 如果不为空（即至少有一个定时器），则返回true。
-    // 如果为空（即没有任何定时器），则返回false。
-    return !m_timers.empty();
+    for(auto i : m_wheels) {
+        TimerWheel::MutexType::Lock lock(i->m_mutex);
+        if(i->m_count) {
+            return true;
+        }
+    }
+    return false;
 }
 
 
@@ -4,17 +4,20 @@
 
 #include <memory>
 #include <vector>
-#include <set>
 #include "thread.h"
+#include "mutex.h"
+#include "noncopyable.h"
 
 namespace webserver {
 
 class TimerManager;
+class TimerWheel;
 /**
  * @brief 定时器
  */
 class Timer : public std::enable_shared_from_this<Timer> {
 friend class TimerManager;
+friend class TimerWheel;
 public:
     /// 定时器的智能指针类型
     typedef std::shared_ptr<Timer> ptr;
@@ -35,6 +38,14 @@ public:
      * @param[in] from_now 是否从当前时间开始计算
      */
     bool reset(uint64_t ms, bool from_now);
+
+    /**
+     * @brief 从当前时间开始重新启动定时器
+     * @details 已经执行或取消的定时器也可以重新启动, 复用定时器对象, 不需要重新分配
+     * @param[in] ms 定时器执行间隔时间(毫秒)
+     * @param[in] cb 回调函数
+     */
+    void restart(uint64_t ms, std::function<void()> cb);
 private:
     /**
      * @brief 构造函数
@@ -45,11 +56,6 @@ private:
      */
     Timer(uint64_t ms, std::function<void()> cb,
           bool recurring, TimerManager* manager);
-    /**
-     * @brief 构造函数
-     * @param[in] next 执行的时间戳(毫秒)
-     */
-    Timer(uint64_t next);
 private:
     /// 是否循环定时器
     bool m_recurring = false;
@@ -61,18 +67,118 @@ private:
     std::function<void()> m_cb;
     /// 定时器管理器
     TimerManager* m_manager = nullptr;
+    /// 所属的时间轮, 创建时确定, 之后不再改变
+    TimerWheel* m_wheel = nullptr;
+    /// 槽位链表中的前一个定时器
+    Timer* m_listPrev = nullptr;
+    /// 槽位链表中的后一个定时器
+    Timer* m_listNext = nullptr;
+    /// 所在的层, -1表示不在时间轮中
+    int8_t m_level = -1;
+    /// 所在的槽位
+    uint16_t m_slot = 0;
+    /// 在时间轮中时持有自身, 保证到期前不被释放
+    Timer::ptr m_self;
+};
+
+/**
+ * @brief 分层时间轮
+ * @details 第0层256个槽, 每个槽一个tick; 第1~4层各64个槽, 每个槽是下一层一整圈,
+ *          可以表示2^32个tick以内的定时器, 更远的定时器放在最高层, 到时再重新分配
+ *          1. 每个槽是侵入式双向链表, 插入和删除都是O(1)
+ *          2. 每层有一个位图记录非空的槽, 推进时间和计算下次超时时跳过空槽
+ *          3. 第0层转完一圈时, 把上层对应槽中的定时器重新分配到下层(cascade)
+ */
+class TimerWheel : Noncopyable {
+friend class Timer;
+friend class TimerManager;
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 构造函数
+     * @param[in] tick_ms 每个tick的毫秒数
+     * @param[in] index 在TimerManager中的下标
+     */
+    TimerWheel(uint64_t tick_ms, size_t index);
+
+    /**
+     * @brief 析构函数, 释放还在时间轮中的定时器
+     */
+    ~TimerWheel();
 private:
     /**
-     * @brief 定时器比较仿函数
+     * @brief 加入定时器, 调用者持有m_mutex
+     * @details 按m_next向上取整到tick, 保证定时器不会提前触发
+     */
+    void link(Timer::ptr timer);
+
+    /**
+     * @brief 移除定时器, 调用者持有m_mutex
+     * @return 时间轮持有的引用, 不在时间轮中返回nullptr
+     */
+    Timer::ptr unlink(Timer* timer);
+
+    /**
+     * @brief 移除一个槽中的所有定时器
+     */
+    void takeSlot(Timer** head, std::vector<Timer::ptr>& timers);
+
+    /**
+     * @brief 把上层当前槽中的定时器重新分配到下层
+     */
+    void cascade();
+
+    /**
+     * @brief 推进到now_ms, 取出所有到期的定时器
+     */
+    void advance(uint64_t now_ms, std::vector<Timer::ptr>& expired);
+
+    /**
+     * @brief 取出所有定时器(时钟回拨时全部按到期处理)
+     */
+    void takeAll(std::vector<Timer::ptr>& timers);
+
+    /**
+     * @brief 最近一个非空槽到期(或需要cascade)的tick, 没有定时器返回~0ull
      */
-    struct Comparator {
-        /**
-         * @brief 比较定时器的智能指针的大小(按执行时间排序)
-         * @param[in] lhs 定时器智能指针
-         * @param[in] rhs 定时器智能指针
-         */
-        bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
-    };
+    uint64_t nextTick() const;
+
+    /**
+     * @brief 检测服务器时间是否被调后了
+     */
+    bool detectClockRollover(uint64_t now_ms);
+private:
+    static const int NEAR_BITS = 8;
+    static const int NEAR_SIZE = 1 << NEAR_BITS;
+    static const int FAR_BITS = 6;
+    static const int FAR_SIZE = 1 << FAR_BITS;
+    static const int FAR_LEVELS = 4;
+
+    /// Mutex
+    MutexType m_mutex;
+    /// 每个tick的毫秒数
+    uint64_t m_tickMs;
+    /// 在TimerManager中的下标
+    size_t m_index;
+    /// 下一个要处理的tick
+    uint64_t m_current;
+    /// 定时器个数
+    size_t m_count = 0;
+    /// 第0层的槽
+    Timer* m_near[NEAR_SIZE];
+    /// 第1~4层的槽
+    Timer* m_far[FAR_LEVELS][FAR_SIZE];
+    /// 第0层非空槽的位图
+    uint64_t m_nearBitmap[NEAR_SIZE / 64];
+    /// 第1~4层非空槽的位图
+    uint64_t m_farBitmap[FAR_LEVELS];
+    /// 上次getNextTimer返回的到期时间, 更早的定时器插入时需要通知
+    uint64_t m_deadline = ~0ull;
+    /// 是否触发onTimerInsertedAtFront
+    bool m_tickled = false;
+    /// 上次执行时间
+    uint64_t m_previouseTime = 0;
 };
 
 /**
@@ -81,11 +187,9 @@ private:
 class TimerManager {
 friend class Timer;
 public:
-    /// 读写锁类型
-    typedef RWMutex RWMutexType;
-
     /**
      * @brief 构造函数
+     * @details 默认只有一个时间轮, tick大小由配置项timer.tick_ms决定
      */
     TimerManager();
 
@@ -115,12 +219,12 @@ public:
                         ,bool recurring = false);
 
     /**
-     * @brief 到最近一个定时器执行的时间间隔(毫秒)
+     * @brief 当前线程的时间轮到最近一个定时器执行的时间间隔(毫秒)
      */
     uint64_t getNextTimer();
 
     /**
-     * @brief 获取需要执行的定时器的回调函数列表
+     * @brief 获取当前线程的时间轮中需要执行的定时器的回调函数列表
      * @param[out] cbs 回调函数数组
      */
     void listExpiredCb(std::vector<std::function<void()> >& cbs);
@@ -132,28 +236,36 @@ public:
 protected:
 
     /**
-     * @brief 当有新的定时器插入到定时器的首部,执行该函数
+     * @brief 当有新的定时器插入到时间轮的首部,执行该函数
+     * @param[in] wheel 时间轮的下标
+     */
+    virtual void onTimerInsertedAtFront(size_t wheel) = 0;
+
+    /**
+     * @brief 返回当前线程使用的时间轮下标
+     */
+    virtual size_t getTimerWheel() { return 0;}
+
+    /**
+     * @brief 设置时间轮个数, 只能在添加定时器之前调用
      */
-    virtual void onTimerInsertedAtFront() = 0;
+    void setTimerWheels(size_t count);
 
     /**
-     * @brief 将定时器添加到管理器中
+     * @brief 将定时器添加到所属的时间轮中
+     * @param[in] lock 持有的时间轮锁, 函数返回前释放
      */
-    void addTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
+    void addTimer(Timer::ptr val, TimerWheel::MutexType::Lock& lock);
 private:
     /**
-     * @brief 检测服务器时间是否被调后了
+     * @brief 返回当前线程使用的时间轮
      */
-    bool detectClockRollover(uint64_t now_ms);
+    TimerWheel* currentWheel();
 private:
-    /// Mutex 锁
-    RWMutexType m_mutex;
-    /// 定时器集合
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    /// 是否触发onTimerInsertedAtFront
-    bool m_tickled = false;
-    /// 上次执行时间
-    uint64_t m_previouseTime = 0;
+    /// 每个tick的毫秒数
+    uint64_t m_tickMs;
+    /// 时间轮
+    std::vector<TimerWheel*> m_wheels;
 };
 
 }
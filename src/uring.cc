@@ -0,0 +1,179 @@
+#include "uring.h"
+#include "log.h"
+#include "macro.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+namespace webserver {
+
+static Logger::ptr g_logger = WEBSERVER_LOG_NAME("system");
+
+static int io_uring_setup(uint32_t entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, uint32_t opcode, const void* arg, uint32_t nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+URing::URing(uint32_t entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // 每个等待中的协程占用一个cqe, 完成队列要比提交队列大得多
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    p.cq_entries = entries * 8;
+    m_fd = io_uring_setup(entries, &p);
+    if(m_fd < 0) {
+        WEBSERVER_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") errno="
+            << errno << " (" << strerror(errno) << ")";
+        return;
+    }
+    // 溢出的cqe不会丢失, 否则完成队列满时可能丢失唤醒
+    if(!(p.features & IORING_FEAT_NODROP)) {
+        WEBSERVER_LOG_WARN(g_logger) << "io_uring without IORING_FEAT_NODROP, disabled";
+        return;
+    }
+
+    m_sqSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    m_cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) {
+        m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+    }
+    m_sqPtr = mmap(nullptr, m_sqSize, PROT_READ | PROT_WRITE
+                    ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(m_sqPtr == MAP_FAILED) {
+        m_sqPtr = nullptr;
+        WEBSERVER_LOG_WARN(g_logger) << "io_uring mmap sq errno=" << errno;
+        return;
+    }
+    if(single) {
+        m_cqPtr = m_sqPtr;
+    } else {
+        m_cqPtr = mmap(nullptr, m_cqSize, PROT_READ | PROT_WRITE
+                        ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if(m_cqPtr == MAP_FAILED) {
+            m_cqPtr = nullptr;
+            WEBSERVER_LOG_WARN(g_logger) << "io_uring mmap cq errno=" << errno;
+            return;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                        ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        WEBSERVER_LOG_WARN(g_logger) << "io_uring mmap sqes errno=" << errno;
+        return;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)m_sqPtr;
+    m_sqHead = (uint32_t*)(sq + p.sq_off.head);
+    m_sqTail = (uint32_t*)(sq + p.sq_off.tail);
+    m_sqMask = (uint32_t*)(sq + p.sq_off.ring_mask);
+    m_sqFlags = (uint32_t*)(sq + p.sq_off.flags);
+    m_sqArray = (uint32_t*)(sq + p.sq_off.array);
+    m_sqEntries = p.sq_entries;
+    m_sqeTail = *m_sqTail;
+
+    char* cq = (char*)m_cqPtr;
+    m_cqHead = (uint32_t*)(cq + p.cq_off.head);
+    m_cqTail = (uint32_t*)(cq + p.cq_off.tail);
+    m_cqMask = (uint32_t*)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(efd < 0) {
+        WEBSERVER_LOG_WARN(g_logger) << "io_uring eventfd errno=" << errno;
+        return;
+    }
+    if(io_uring_register(m_fd, IORING_REGISTER_EVENTFD, &efd, 1)) {
+        WEBSERVER_LOG_WARN(g_logger) << "io_uring register eventfd errno=" << errno
+            << " (" << strerror(errno) << ")";
+        close(efd);
+        return;
+    }
+    m_eventFd = efd;
+}
+
+URing::~URing() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqPtr && m_cqPtr != m_sqPtr) {
+        munmap(m_cqPtr, m_cqSize);
+    }
+    if(m_sqPtr) {
+        munmap(m_sqPtr, m_sqSize);
+    }
+    if(m_eventFd >= 0) {
+        close(m_eventFd);
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+io_uring_sqe* URing::getSqe() {
+    uint32_t head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if(m_sqeTail - head >= m_sqEntries) {
+        // 提交队列满, 先把已填充的提交给内核
+        if(submit() < 0) {
+            return nullptr;
+        }
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if(m_sqeTail - head >= m_sqEntries) {
+            return nullptr;
+        }
+    }
+    uint32_t idx = m_sqeTail & *m_sqMask;
+    io_uring_sqe* sqe = &m_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[idx] = idx;
+    ++m_sqeTail;
+    ++m_pending;
+    return sqe;
+}
+
+int URing::submit() {
+    if(!m_pending) {
+        return 0;
+    }
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+    uint32_t n = m_pending;
+    while(true) {
+        int rt = io_uring_enter(m_fd, n, 0, 0);
+        if(rt >= 0) {
+            // 内核可能只消费了一部分(如完成队列背压), 剩下的下次再提交
+            m_pending = n - rt;
+            return rt;
+        }
+        if(errno == EINTR) {
+            continue;
+        }
+        if(errno == EAGAIN || errno == EBUSY) {
+            // 内核暂时无法接收, 已经发布的sqe留在队列中下次提交
+            return 0;
+        }
+        WEBSERVER_LOG_ERROR(g_logger) << "io_uring_enter(" << m_fd << ", " << n
+            << ") errno=" << errno << " (" << strerror(errno) << ")";
+        return -errno;
+    }
+}
+
+int URing::flushOverflow() {
+    int rt = io_uring_enter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+    return rt < 0 ? -errno : rt;
+}
+
+}
@@ -0,0 +1,143 @@
+#ifndef __WEBSERVER_URING_H__
+#define __WEBSERVER_URING_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace webserver {
+
+/**
+ * @brief io_uring 提交/完成队列的封装
+ * @details 直接使用io_uring_setup/io_uring_enter系统调用, 不依赖liburing
+ *          1. 提交端由m_mutex保护, 任意线程都可以填充sqe, submit时一次io_uring_enter提交所有已填充的sqe
+ *          2. 完成端由m_cqMutex保护, 任意线程都可以收割cqe
+ *          3. 注册了eventfd, 有cqe产生时eventfd可读, 可以放到epoll中和其他事件一起等待
+ */
+class URing : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 构造函数
+     * @param[in] entries 提交队列长度, 完成队列长度为它的8倍
+     */
+    URing(uint32_t entries);
+
+    /**
+     * @brief 析构函数
+     */
+    ~URing();
+
+    /**
+     * @brief 是否创建成功(内核不支持或被禁用时失败)
+     */
+    bool isValid() const { return m_eventFd >= 0;}
+
+    /**
+     * @brief 返回完成通知的eventfd
+     */
+    int getEventFd() const { return m_eventFd;}
+
+    /**
+     * @brief 返回提交端的锁
+     */
+    MutexType& getMutex() { return m_mutex;}
+
+    /**
+     * @brief 获取一个空闲的sqe, 调用者需持有getMutex()
+     * @details 提交队列满时先提交已填充的sqe
+     * @return 已清零的sqe, 失败返回nullptr
+     */
+    io_uring_sqe* getSqe();
+
+    /**
+     * @brief 提交所有已填充的sqe, 调用者需持有getMutex()
+     * @return 提交的个数, 失败返回-errno
+     */
+    int submit();
+
+    /**
+     * @brief 已填充但还没有提交的sqe个数
+     */
+    uint32_t getPending() const { return m_pending;}
+
+    /**
+     * @brief 收割完成队列中所有的cqe
+     * @param[in] cb 对每个cqe调用cb(user_data, res)
+     * @return 收割的个数
+     */
+    template<class Callback>
+    size_t reap(Callback cb) {
+        MutexType::Lock lock(m_cqMutex);
+        size_t count = 0;
+        while(true) {
+            uint32_t head = *m_cqHead;
+            uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+            if(head == tail) {
+                // 完成队列溢出时内核把cqe暂存在溢出链表, 需要进入内核刷回
+                if(!(__atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)
+                        || flushOverflow() < 0) {
+                    break;
+                }
+                if(*m_cqHead == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+                    break;
+                }
+                continue;
+            }
+            for(; head != tail; ++head) {
+                io_uring_cqe& cqe = m_cqes[head & *m_cqMask];
+                cb(cqe.user_data, cqe.res);
+                ++count;
+            }
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        }
+        return count;
+    }
+private:
+    /**
+     * @brief 刷回溢出的cqe
+     */
+    int flushOverflow();
+private:
+    /// io_uring句柄
+    int m_fd = -1;
+    /// 完成通知eventfd
+    int m_eventFd = -1;
+    /// 提交端的锁
+    MutexType m_mutex;
+    /// 完成端的锁
+    MutexType m_cqMutex;
+
+    /// 提交队列映射
+    void* m_sqPtr = nullptr;
+    size_t m_sqSize = 0;
+    /// 完成队列映射(内核支持IORING_FEAT_SINGLE_MMAP时与提交队列共用)
+    void* m_cqPtr = nullptr;
+    size_t m_cqSize = 0;
+    /// sqe数组映射
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    uint32_t* m_sqHead = nullptr;
+    uint32_t* m_sqTail = nullptr;
+    uint32_t* m_sqMask = nullptr;
+    uint32_t* m_sqFlags = nullptr;
+    uint32_t* m_sqArray = nullptr;
+    uint32_t m_sqEntries = 0;
+    /// 本地的sqe尾部位置, submit时发布到m_sqTail
+    uint32_t m_sqeTail = 0;
+    /// 已填充未提交的sqe个数
+    uint32_t m_pending = 0;
+
+    uint32_t* m_cqHead = nullptr;
+    uint32_t* m_cqTail = nullptr;
+    uint32_t* m_cqMask = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+};
+
+}
+
+#endif
@@ -30,6 +30,15 @@ uint32_t GetFiberId(){
     return webserver::Fiber::GetFiberId();
 }
 
+// 不能内联, 否则errno的地址又会被调用者缓存
+__attribute__((noinline)) int GetErrno() {
+    return errno;
+}
+
+__attribute__((noinline)) void SetErrno(int v) {
+    errno = v;
+}
+
 // 尽量不要在栈上分配很大的对象，能用指针用指针
 /**
  * @brief 捕获当前线程的调用栈。
@@ -33,6 +33,19 @@ pid_t GetThreadId();
 // 返回当前协程的ID
 uint32_t GetFiberId();
 
+/**
+ * @brief 读取当前线程的errno
+ * @details __errno_location()被声明为const, 编译器会在一个函数内缓存errno的地址.
+ *          协程挂起后可能在其他线程上恢复, 恢复后还用缓存的地址读写的是原来线程的errno.
+ *          协程切换之后读写errno要通过GetErrno/SetErrno, 每次重新取地址
+ */
+int GetErrno();
+
+/**
+ * @brief 设置当前线程的errno, 见GetErrno
+ */
+void SetErrno(int v);
+
 
 
 
@@ -4,8 +4,10 @@
 #include "address.h"
 #include "application.h"
 #include "bytearray.h"
+#include "clock.h"
 #include "config.h"
 #include "daemon.h"
+#include "dns.h"
 #include "endian.h"
 #include "env.h"
 #include "fd_manager.h"
@@ -22,12 +24,15 @@
 #include "scheduler.h"
 #include "singleton.h"
 #include "socket.h"
+#include "stack_allocator.h"
 #include "stream.h"
 #include "tcp_server.h"
 #include "thread.h"
 #include "timer.h"
 #include "uri.h"
+#include "uring.h"
 #include "util.h"
+#include "work_steal_queue.h"
 #include "worker.h"
 
 // #include "db/db.h"
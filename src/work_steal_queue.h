@@ -0,0 +1,165 @@
+#ifndef __WEBSERVER_WORK_STEAL_QUEUE_H__
+#define __WEBSERVER_WORK_STEAL_QUEUE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "noncopyable.h"
+
+namespace webserver {
+
+/**
+ * @brief Chase-Lev 工作窃取双端队列
+ * @details 只有拥有者线程可以调用push/pop(在底部操作, 无锁且通常无CAS),
+ *          其他线程通过steal从顶部窃取. 内存序参考
+ *          "Correct and Efficient Work-Stealing for Weak Memory Models"(Lê et al. 2013)
+ *          扩容时旧数组保留到队列析构, 避免窃取者访问已释放的内存
+ * @tparam T 元素类型, 必须是指针类型, nullptr表示队列为空或窃取失败
+ */
+template<class T>
+class WorkStealQueue : Noncopyable {
+private:
+    /**
+     * @brief 环形数组
+     */
+    struct Array {
+        Array(int64_t c)
+            :capacity(c)
+            ,mask(c - 1)
+            ,buffer(new std::atomic<T>[c]) {
+        }
+
+        ~Array() {
+            delete[] buffer;
+        }
+
+        T get(int64_t i) {
+            return buffer[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T v) {
+            buffer[i & mask].store(v, std::memory_order_relaxed);
+        }
+
+        Array* resize(int64_t b, int64_t t) {
+            Array* a = new Array(capacity * 2);
+            for(int64_t i = t; i != b; ++i) {
+                a->put(i, get(i));
+            }
+            return a;
+        }
+
+        int64_t capacity;
+        int64_t mask;
+        std::atomic<T>* buffer;
+    };
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 初始容量, 必须是2的幂
+     */
+    WorkStealQueue(int64_t capacity = 256)
+        :m_top(0)
+        ,m_bottom(0)
+        ,m_array(new Array(capacity)) {
+    }
+
+    ~WorkStealQueue() {
+        for(auto i : m_garbage) {
+            delete i;
+        }
+        delete m_array.load();
+    }
+
+    /**
+     * @brief 放入元素, 只能由拥有者线程调用
+     */
+    void push(T item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        Array* a = m_array.load(std::memory_order_relaxed);
+        if(b - t > a->capacity - 1) {
+            Array* tmp = a->resize(b, t);
+            m_garbage.push_back(a);
+            a = tmp;
+            m_array.store(a, std::memory_order_release);
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 取出最后放入的元素, 只能由拥有者线程调用
+     * @return 队列为空返回nullptr
+     */
+    T pop() {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        T x = nullptr;
+        if(t <= b) {
+            x = a->get(b);
+            if(t == b) {
+                // 最后一个元素, 和窃取者竞争
+                if(!m_top.compare_exchange_strong(t, t + 1
+                            ,std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    x = nullptr;
+                }
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    /**
+     * @brief 从顶部窃取最早放入的元素, 任意线程可调用
+     * @return 队列为空或竞争失败返回nullptr
+     */
+    T steal() {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        T x = nullptr;
+        if(t < b) {
+            Array* a = m_array.load(std::memory_order_acquire);
+            x = a->get(t);
+            if(!m_top.compare_exchange_strong(t, t + 1
+                        ,std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return nullptr;
+            }
+        }
+        return x;
+    }
+
+    /**
+     * @brief 返回队列中的元素个数(近似值)
+     */
+    size_t size() const {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    /**
+     * @brief 队列是否为空(近似值)
+     */
+    bool empty() const { return size() == 0;}
+private:
+    /// 窃取端位置
+    std::atomic<int64_t> m_top;
+    /// 拥有者端位置
+    std::atomic<int64_t> m_bottom;
+    /// 当前环形数组
+    std::atomic<Array*> m_array;
+    /// 扩容后被替换的数组
+    std::vector<Array*> m_garbage;
+};
+
+}
+
+#endif
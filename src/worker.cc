@@ -1,12 +1,17 @@
 #include "worker.h"
 #include "config.h"
 #include "util.h"
+#include "hook.h"
+#include <exception>
 
 namespace webserver {
 
 static webserver::ConfigVar<std::map<std::string, std::map<std::string, std::string> > >::ptr g_worker_config
     = webserver::Config::Lookup("workers", std::map<std::string, std::map<std::string, std::string> >(), "worker config");
 
+static webserver::ConfigVar<uint32_t>::ptr g_offload_threads
+    = webserver::Config::Lookup("offload.threads", (uint32_t)4, "blocking pool thread num");
+
 WorkerGroup::WorkerGroup(uint32_t batch_size, webserver::Scheduler* s)
     :m_batchSize(batch_size)
     ,m_finish(false)
@@ -66,14 +71,19 @@ bool WorkerManager::init(const std::map<std::string, std::map<std::string, std::
         std::string name = i.first;
         int32_t thread_num = webserver::GetParamValue(i.second, "thread_num", 1);
         int32_t worker_num = webserver::GetParamValue(i.second, "worker_num", 1);
+        // 回调任务是否运行在共享栈协程上
+        bool shared_stack = webserver::GetParamValue(i.second, "shared_stack", 0);
+        // 是否每个线程使用独立的epoll
+        bool sharded = webserver::GetParamValue(i.second, "sharded", 0);
 
         for(int32_t x = 0; x < worker_num; ++x) {
             Scheduler::ptr s;
             if(!x) {
-                s = std::make_shared<IOManager>(thread_num, false, name);
+                s = std::make_shared<IOManager>(thread_num, false, name, sharded);
             } else {
-                s = std::make_shared<IOManager>(thread_num, false, name + "-" + std::to_string(x));
+                s = std::make_shared<IOManager>(thread_num, false, name + "-" + std::to_string(x), sharded);
             }
+            s->setSharedStack(shared_stack);
             add(s);
         }
     }
@@ -104,13 +114,62 @@ uint32_t WorkerManager::getCount() {
     return m_datas.size();
 }
 
+Scheduler::ptr WorkerManager::getBlockingPool() {
+    Mutex::Lock lock(m_blockingMutex);
+    if(!m_blocking) {
+        m_blocking = get("blocking");
+        if(!m_blocking) {
+            m_blocking = std::make_shared<IOManager>(
+                    std::max(g_offload_threads->getValue(), 1u), false, "blocking");
+        }
+    }
+    return m_blocking;
+}
+
 std::ostream& WorkerManager::dump(std::ostream& os) {
     for(auto& i : m_datas) {
         for(auto& n : i.second) {
             n->dump(os) << std::endl;
         }
     }
+    Mutex::Lock lock(m_blockingMutex);
+    if(m_blocking && m_datas.find("blocking") == m_datas.end()) {
+        m_blocking->dump(os) << std::endl;
+    }
     return os;
 }
 
+void offload_call(std::function<void()> cb) {
+    Scheduler* self = Scheduler::GetThis();
+    Scheduler::ptr pool;
+    if(self && is_hook_enable()) {
+        pool = WorkerMgr::GetInstance()->getBlockingPool();
+    }
+    // 共享栈协程切出后栈上的内容会被其他协程覆盖, 线程池不能引用它栈上的变量, 直接在当前线程执行
+    if(!pool || pool.get() == self || Fiber::GetThis()->isSharedStack()) {
+        cb();
+        return;
+    }
+
+    // 当前协程使用独立栈, 在cb完成前不会恢复, 栈上的变量可以直接引用
+    Fiber::ptr fiber = Fiber::GetThis();
+    std::exception_ptr error;
+    int err = 0;
+    pool->schedule([&cb, &error, &err, self, fiber]() {
+        try {
+            cb();
+        } catch(...) {
+            error = std::current_exception();
+        }
+        err = errno;
+        self->schedule(fiber);
+    });
+    Fiber::YieldToHold();
+    // 恢复后可能在另一个线程上, 不能用切换前缓存的errno地址
+    SetErrno(err);
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
+
 }
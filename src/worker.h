@@ -68,13 +68,68 @@ public:
     std::ostream& dump(std::ostream& os);
 
     uint32_t getCount();
+
+    /**
+     * @brief 返回执行阻塞任务的线程池
+     * @details workers中配置了名为blocking的调度器时使用它,
+     *          否则第一次调用时按offload.threads创建
+     */
+    Scheduler::ptr getBlockingPool();
 private:
     std::map<std::string, std::vector<Scheduler::ptr> > m_datas;
     bool m_stop;
+    /// 保护m_blocking的创建
+    Mutex m_blockingMutex;
+    Scheduler::ptr m_blocking;
 };
 
 typedef webserver::Singleton<WorkerManager> WorkerMgr;
 
+/**
+ * @brief 在阻塞任务线程池中执行cb, 当前协程挂起直到cb执行完成
+ * @details cb中的errno会带回当前协程, cb抛出的异常在当前协程中重新抛出.
+ *          不在调度器的协程中, 已经在阻塞任务线程池中, 或者当前协程使用共享栈时直接执行cb.
+ */
+void offload_call(std::function<void()> cb);
+
+/**
+ * @brief offload的返回值
+ */
+template<class T>
+class OffloadResult {
+public:
+    template<class F>
+    void run(F& fn) { m_value.reset(new T(fn()));}
+    T get() { return std::move(*m_value);}
+private:
+    std::unique_ptr<T> m_value;
+};
+
+template<>
+class OffloadResult<void> {
+public:
+    template<class F>
+    void run(F& fn) { fn();}
+    void get() {}
+};
+
+/**
+ * @brief 把阻塞调用(磁盘IO, 压缩, 加解密等)放到阻塞任务线程池中执行
+ * @details hook只让socket变成非阻塞, 磁盘IO和计算密集的调用会卡住IO线程上的所有协程.
+ *          offload挂起当前协程而不是当前线程, 例如:
+ *          ssize_t n = webserver::offload([&](){ return ::pread(fd, buf, len, off); });
+ * @param[in] fn 可调用对象
+ * @return fn的返回值
+ */
+template<class F>
+typename std::result_of<F()>::type offload(F fn) {
+    OffloadResult<typename std::result_of<F()>::type> rt;
+    offload_call([&rt, &fn]() {
+        rt.run(fn);
+    });
+    return rt.get();
+}
+
 }
 
 #endif
@@ -0,0 +1,278 @@
+#include "src/webserver.h"
+#include <netinet/in.h>
+#include <string.h>
+#include <fstream>
+
+static webserver::Logger::ptr g_logger = WEBSERVER_LOG_ROOT();
+
+static uint16_t g_port = 0;
+static int g_udp = -1;
+static int g_tcp = -1;
+
+/**
+ * 本地的DNS桩服务器:
+ *  test.local  A 10.0.0.1, 10.0.0.2 (ttl 1), AAAA 无记录
+ *  alias.local CNAME test.local
+ *  slow.local  A 10.0.0.3, 200ms后应答
+ *  big.local   UDP应答带TC标志, TCP应答 A 10.0.0.4
+ *  其他         NXDOMAIN
+ */
+static void put16(std::string& out, uint16_t v) {
+    out.push_back(v >> 8);
+    out.push_back(v & 0xff);
+}
+
+static void put32(std::string& out, uint32_t v) {
+    put16(out, v >> 16);
+    put16(out, v & 0xffff);
+}
+
+static void addA(std::string& out, uint16_t name_ptr, const char* ip, uint32_t ttl) {
+    put16(out, name_ptr);
+    put16(out, 1);
+    put16(out, 1);
+    put32(out, ttl);
+    put16(out, 4);
+    in_addr addr;
+    inet_pton(AF_INET, ip, &addr);
+    out.append((const char*)&addr, 4);
+}
+
+static void addSoa(std::string& out, uint32_t minimum) {
+    put16(out, 0xC00C);
+    put16(out, 6);
+    put16(out, 1);
+    put32(out, 60);
+    put16(out, 1 + 1 + 20);
+    out.push_back(0);   // mname
+    out.push_back(0);   // rname
+    put32(out, 1);
+    put32(out, 60);
+    put32(out, 60);
+    put32(out, 60);
+    put32(out, minimum);
+}
+
+static std::string buildReply(const std::string& query, bool tcp, bool& delay) {
+    delay = false;
+    // 读取问题中的域名
+    size_t pos = 12;
+    std::string name;
+    while(pos < query.size() && query[pos]) {
+        uint8_t len = query[pos];
+        if(!name.empty()) {
+            name.push_back('.');
+        }
+        name.append(query, pos + 1, len);
+        pos += 1 + len;
+    }
+    pos += 5;
+    uint16_t qtype = ((uint8_t)query[pos - 4] << 8) | (uint8_t)query[pos - 3];
+
+    std::string answers;
+    int ancount = 0;
+    int nscount = 0;
+    int rcode = 0;
+    bool tc = false;
+    if(name == "test.local" && qtype == 1) {
+        addA(answers, 0xC00C, "10.0.0.1", 1);
+        addA(answers, 0xC00C, "10.0.0.2", 1);
+        ancount = 2;
+    } else if(name == "test.local") {
+        addSoa(answers, 1);
+        nscount = 1;
+    } else if(name == "alias.local" && qtype == 1) {
+        put16(answers, 0xC00C);
+        put16(answers, 5);
+        put16(answers, 1);
+        put32(answers, 60);
+        put16(answers, 12);
+        answers.append("\x04test\x05local", 11);
+        answers.push_back(0);
+        // A记录的名字是指向CNAME rdata的压缩指针
+        addA(answers, 0xC000 | (pos + 12), "10.0.0.1", 60);
+        ancount = 2;
+    } else if(name == "slow.local" && qtype == 1) {
+        addA(answers, 0xC00C, "10.0.0.3", 60);
+        ancount = 1;
+        delay = true;
+    } else if(name == "big.local" && qtype == 1) {
+        if(tcp) {
+            addA(answers, 0xC00C, "10.0.0.4", 60);
+            ancount = 1;
+        } else {
+            tc = true;
+        }
+    } else {
+        addSoa(answers, 1);
+        nscount = 1;
+        rcode = 3;
+    }
+
+    std::string out;
+    out.append(query, 0, 2);
+    put16(out, 0x8180 | (tc ? 0x0200 : 0) | rcode);
+    put16(out, 1);
+    put16(out, ancount);
+    put16(out, nscount);
+    put16(out, 0);
+    out.append(query, 12, pos - 12);
+    out.append(answers);
+    return out;
+}
+
+static std::atomic<int> g_queries{0};
+
+void run_udp_server() {
+    char buf[1024];
+    while(true) {
+        sockaddr_in from;
+        socklen_t len = sizeof(from);
+        int n = recvfrom(g_udp, buf, sizeof(buf), 0, (sockaddr*)&from, &len);
+        if(n <= 0) {
+            break;
+        }
+        ++g_queries;
+        bool delay = false;
+        std::string reply = buildReply(std::string(buf, n), false, delay);
+        if(delay) {
+            webserver::IOManager::GetThis()->schedule([reply, from](){
+                usleep(200 * 1000);
+                sendto(g_udp, reply.c_str(), reply.size(), 0, (const sockaddr*)&from, sizeof(from));
+            });
+        } else {
+            sendto(g_udp, reply.c_str(), reply.size(), 0, (sockaddr*)&from, len);
+        }
+    }
+}
+
+void run_tcp_server() {
+    while(true) {
+        int fd = accept(g_tcp, nullptr, nullptr);
+        if(fd < 0) {
+            break;
+        }
+        uint8_t head[2];
+        char buf[1024];
+        if(recv(fd, head, 2, MSG_WAITALL) == 2) {
+            size_t len = (head[0] << 8) | head[1];
+            if(len <= sizeof(buf) && recv(fd, buf, len, MSG_WAITALL) == (int)len) {
+                bool delay;
+                std::string reply = buildReply(std::string(buf, len), true, delay);
+                std::string out;
+                put16(out, reply.size());
+                out.append(reply);
+                send(fd, out.c_str(), out.size(), 0);
+            }
+        }
+        close(fd);
+    }
+}
+
+void start_server() {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    g_udp = socket(AF_INET, SOCK_DGRAM, 0);
+    bind(g_udp, (sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(g_udp, (sockaddr*)&addr, &len);
+    g_port = ntohs(addr.sin_port);
+
+    g_tcp = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(g_tcp, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    bind(g_tcp, (sockaddr*)&addr, sizeof(addr));
+    listen(g_tcp, 16);
+
+    webserver::IOManager::GetThis()->schedule(run_udp_server);
+    webserver::IOManager::GetThis()->schedule(run_tcp_server);
+}
+
+std::string lookup(const std::string& host) {
+    std::vector<webserver::Address::ptr> addrs;
+    if(!webserver::Address::Lookup(addrs, host)) {
+        return "";
+    }
+    std::stringstream ss;
+    for(size_t i = 0; i < addrs.size(); ++i) {
+        ss << (i ? "," : "") << *addrs[i];
+    }
+    return ss.str();
+}
+
+void test_dns() {
+    start_server();
+    auto r = webserver::DnsResolverMgr::GetInstance();
+    r->setServers({webserver::IPAddress::Create("127.0.0.1", g_port)});
+    r->clearCache();
+
+    // 查询和端口
+    WEBSERVER_ASSERT(lookup("test.local:80") == "10.0.0.1:80,10.0.0.2:80");
+    WEBSERVER_ASSERT(g_queries == 1);
+    // 缓存命中
+    WEBSERVER_ASSERT(lookup("TEST.local:81") == "10.0.0.1:81,10.0.0.2:81");
+    WEBSERVER_ASSERT(g_queries == 1);
+
+    // A和AAAA在一个socket上同时查询
+    std::vector<webserver::IPAddress::ptr> addrs;
+    WEBSERVER_ASSERT(r->resolve(addrs, "test.local", AF_UNSPEC) == 0 && addrs.size() == 2);
+    WEBSERVER_ASSERT(g_queries == 3);
+
+    // CNAME
+    WEBSERVER_ASSERT(lookup("alias.local") == "10.0.0.1:0");
+
+    // 否定缓存
+    WEBSERVER_ASSERT(lookup("nx.local") == "");
+    int q = g_queries;
+    WEBSERVER_ASSERT(lookup("nx.local") == "");
+    WEBSERVER_ASSERT(g_queries == q);
+
+    // TC后改用TCP
+    WEBSERVER_ASSERT(lookup("big.local") == "10.0.0.4:0");
+
+    // 相同域名的并发查询只发出一次
+    q = g_queries;
+    static std::atomic<int> done{0};
+    for(int i = 0; i < 10; ++i) {
+        webserver::IOManager::GetThis()->schedule([](){
+            WEBSERVER_ASSERT(lookup("slow.local:8080") == "10.0.0.3:8080");
+            ++done;
+        });
+    }
+    while(done < 10) {
+        usleep(10 * 1000);
+    }
+    WEBSERVER_ASSERT(g_queries == q + 1);
+
+    // TTL过期后重新查询
+    q = g_queries;
+    sleep(2);
+    WEBSERVER_ASSERT(lookup("test.local") == "10.0.0.1:0,10.0.0.2:0");
+    WEBSERVER_ASSERT(g_queries == q + 1);
+
+    // hosts优先
+    {
+        std::ofstream ofs("/tmp/test_dns_hosts");
+        ofs << "# test\n10.1.1.1 myhost.local myhost\n::1 myhost6\n";
+    }
+    r->loadHosts("/tmp/test_dns_hosts");
+    q = g_queries;
+    WEBSERVER_ASSERT(lookup("myhost:22") == "10.1.1.1:22");
+    WEBSERVER_ASSERT(g_queries == q);
+
+    std::stringstream ss;
+    r->dump(ss);
+    WEBSERVER_LOG_INFO(g_logger) << ss.str();
+    WEBSERVER_LOG_INFO(g_logger) << "test_dns ok";
+
+    close(g_udp);
+    close(g_tcp);
+}
+
+int main(int argc, char** argv) {
+    webserver::IOManager iom(2);
+    iom.schedule(test_dns);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "src/webserver.h"
+#include <ucontext.h>
+#include <stdlib.h>
+
+webserver::Logger::ptr g_logger = WEBSERVER_LOG_ROOT();
+
+static uint64_t s_count = 1000000;
+
+// 原始ucontext切换, 作为对照(每次切换都有rt_sigprocmask系统调用)
+static ucontext_t s_main_uc;
+static ucontext_t s_fiber_uc;
+
+static void uc_func() {
+    while(true) {
+        swapcontext(&s_fiber_uc, &s_main_uc);
+    }
+}
+
+void bench_ucontext() {
+    size_t size = 128 * 1024;
+    void* stack = malloc(size);
+    getcontext(&s_fiber_uc);
+    s_fiber_uc.uc_link = nullptr;
+    s_fiber_uc.uc_stack.ss_sp = stack;
+    s_fiber_uc.uc_stack.ss_size = size;
+    makecontext(&s_fiber_uc, &uc_func, 0);
+
+    uint64_t begin = webserver::GetCurrentUS();
+    for(uint64_t i = 0; i < s_count; ++i) {
+        swapcontext(&s_main_uc, &s_fiber_uc);
+    }
+    uint64_t used = webserver::GetCurrentUS() - begin;
+    free(stack);
+
+    WEBSERVER_LOG_INFO(g_logger) << "ucontext: switches=" << s_count * 2
+        << " used=" << used << "us"
+        << " switches/s=" << (uint64_t)(s_count * 2 * 1000000.0 / (used ? used : 1));
+}
+
+// Fiber::call/back 切换, 使用当前编译的上下文切换后端
+void bench_fiber() {
+    webserver::Fiber::GetThis();
+    webserver::Fiber::ptr fiber(new webserver::Fiber([](){
+        webserver::Fiber* cur = webserver::Fiber::GetThis().get();
+        for(uint64_t i = 1; i < s_count; ++i) {
+            cur->back();
+        }
+    }, 0, true));
+
+    uint64_t begin = webserver::GetCurrentUS();
+    for(uint64_t i = 0; i < s_count; ++i) {
+        fiber->call();
+    }
+    uint64_t used = webserver::GetCurrentUS() - begin;
+
+    WEBSERVER_LOG_INFO(g_logger) << "fiber(" << webserver::FiberContextBackend() << "): switches=" << s_count * 2
+        << " used=" << used << "us"
+        << " switches/s=" << (uint64_t)(s_count * 2 * 1000000.0 / (used ? used : 1));
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_count = atoll(argv[1]);
+    }
+    bench_ucontext();
+    bench_fiber();
+    return 0;
+}
@@ -126,6 +126,40 @@ void run() {
             return 0; // 返回处理结果
     });
 
+    // 添加流式响应的处理函数，逐块生成响应体，不在内存中拼出完整响应
+    sd->addServlet("/sylar/stream", [](webserver::http::HttpRequest::ptr req
+                ,webserver::http::HttpResponse::ptr rsp
+                ,webserver::http::HttpSession::ptr session) {
+            int n = req->getParamAs<int>("n", 10); // 块数
+            session->sendResponseHeader(rsp); // 长度未知, 使用chunked
+            for(int i = 0; i < n; ++i) {
+                if(session->sendResponseBody("line " + std::to_string(i) + "\r\n") < 0) {
+                    break;
+                }
+            }
+            session->sendResponseEnd();
+            return 0; // 返回处理结果
+    });
+
+    // 添加流式读取请求消息体的处理函数，上传的文件直接写入磁盘，不在内存中保存完整消息体
+    auto upload = std::make_shared<webserver::http::FunctionServlet>([](webserver::http::HttpRequest::ptr req
+                ,webserver::http::HttpResponse::ptr rsp
+                ,webserver::http::HttpSession::ptr session) {
+            int64_t n = session->getBodyStream()->saveToFile("/tmp/test_http_server_upload");
+            rsp->setBody("saved " + std::to_string(n) + " bytes\r\n");
+            return 0; // 返回处理结果
+    });
+    upload->setStreamBody(true);
+    sd->addServlet("/sylar/upload", upload);
+
+    // 添加带路径参数的路由，只匹配GET方法，优先于上面的/sylar/*模糊匹配
+    sd->addRoute(webserver::http::HttpMethod::GET, "/sylar/users/:id/*path", [](webserver::http::HttpRequest::ptr req
+                ,webserver::http::HttpResponse::ptr rsp
+                ,webserver::http::HttpSession::ptr session) {
+            rsp->setBody("user " + req->getPathParam("id") + " path " + req->getPathParam("path") + "\r\n");
+            return 0; // 返回处理结果
+    });
+
     server->start(); // 启动HTTP服务器
 }
 
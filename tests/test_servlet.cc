@@ -0,0 +1,166 @@
+#include "src/http/servlet.h" // 包含Servlet头文件
+#include "src/log.h" // 包含日志头文件
+#include "src/macro.h" // 包含断言宏
+
+static webserver::Logger::ptr g_logger = WEBSERVER_LOG_ROOT(); // 定义全局Logger对象
+
+using namespace webserver::http;
+
+/**
+ * 函数名：S
+ * 功能：创建一个把名字写入响应体的Servlet, 用来判断匹配到了哪一个
+ */
+static Servlet::ptr S(const std::string& name) {
+    return std::make_shared<FunctionServlet>([name](HttpRequest::ptr req
+                ,HttpResponse::ptr rsp
+                ,HttpSession::ptr session) {
+            rsp->setBody(name);
+            return 0;
+    });
+}
+
+/**
+ * 函数名：match
+ * 功能：按方法和路径匹配, 返回匹配到的Servlet的名字, 没有匹配到时返回"default"
+ */
+static std::string match(ServletDispatch::ptr sd, HttpMethod method, const std::string& path
+                         ,HttpRequest::ptr* out = nullptr) {
+    HttpRequest::ptr req(new HttpRequest);
+    req->setMethod(method);
+    req->setPath(path);
+    Servlet::ptr slt = sd->getMatchedServlet(req);
+    if(slt == sd->getDefault()) {
+        return "default";
+    }
+    HttpResponse::ptr rsp(new HttpResponse);
+    slt->handle(req, rsp, nullptr);
+    if(out) {
+        *out = req;
+    }
+    return rsp->getBody();
+}
+
+/**
+ * 函数名：test_route
+ * 功能：静态段, :param参数段, *通配段以及按方法匹配
+ */
+void test_route() {
+    ServletDispatch::ptr sd(new ServletDispatch);
+    WEBSERVER_ASSERT(sd->addRoute("/users/me", S("me")));
+    WEBSERVER_ASSERT(sd->addRoute("/users/:id", S("user")));
+    WEBSERVER_ASSERT(sd->addRoute(HttpMethod::POST, "/users/:id", S("post_user")));
+    WEBSERVER_ASSERT(sd->addRoute("/users/:id/posts/:pid", S("post")));
+    WEBSERVER_ASSERT(sd->addRoute("/static/*path", S("static")));
+    WEBSERVER_ASSERT(sd->addRoute("/files/*", S("files")));
+
+    HttpRequest::ptr req;
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/users/me") == "me");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/users/42", &req) == "user");
+    WEBSERVER_ASSERT(req->getPathParam("id") == "42");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::POST, "/users/42") == "post_user");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/users/42/posts/7", &req) == "post");
+    WEBSERVER_ASSERT(req->getPathParam("id") == "42" && req->getPathParam("pid") == "7");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/static/css/a.css", &req) == "static");
+    WEBSERVER_ASSERT(req->getPathParam("path") == "css/a.css");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/static/", &req) == "static");
+    WEBSERVER_ASSERT(req->getPathParam("path") == "");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/files/a/b") == "files");
+    // 参数段不匹配空段
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/users/") == "default");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/users/42/posts") == "default");
+
+    // 非法路由不修改路由表: 参数段名字冲突, 通配段不在最后, 参数名为空
+    WEBSERVER_ASSERT(!sd->addRoute("/users/:uid/x", S("bad")));
+    WEBSERVER_ASSERT(!sd->addRoute("/a/*rest/b", S("bad")));
+    WEBSERVER_ASSERT(!sd->addRoute("/a/:", S("bad")));
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/users/42") == "user");
+    WEBSERVER_ASSERT(sd->addRoute("/users/:id/x", S("x")));
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/users/42/x") == "x");
+    WEBSERVER_LOG_INFO(g_logger) << "test_route ok";
+}
+
+/**
+ * 函数名：test_backtrack
+ * 功能：静态段匹配上但后面的段匹配不上时, 回溯到同一位置的参数段
+ */
+void test_backtrack() {
+    ServletDispatch::ptr sd(new ServletDispatch);
+    WEBSERVER_ASSERT(sd->addRoute("/a/b/c", S("static")));
+    WEBSERVER_ASSERT(sd->addRoute("/a/:x/d", S("param")));
+    WEBSERVER_ASSERT(sd->addRoute("/a/*rest", S("wildcard")));
+
+    HttpRequest::ptr req;
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/a/b/c") == "static");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/a/b/d", &req) == "param");
+    WEBSERVER_ASSERT(req->getPathParam("x") == "b");
+    // 回溯时撤销失败分支上的参数
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/a/b/e", &req) == "wildcard");
+    WEBSERVER_ASSERT(req->getPathParam("rest") == "b/e");
+    WEBSERVER_ASSERT(req->getPathParam("x") == "");
+    WEBSERVER_LOG_INFO(g_logger) << "test_backtrack ok";
+}
+
+/**
+ * 函数名：test_order
+ * 功能：精准匹配 > 路由 > 模糊匹配(按添加顺序) > 默认servlet
+ */
+void test_order() {
+    ServletDispatch::ptr sd(new ServletDispatch);
+    sd->addGlobServlet("/api/*", S("glob_api"));
+    sd->addGlobServlet("/api/v?/*", S("glob_v"));
+    sd->addGlobServlet("/*", S("glob_all"));
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/api/v1/x") == "glob_api");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/other") == "glob_all");
+
+    // 重新添加的模式排到最后: 先添加的复杂模式和更短的前缀模式都优先于它
+    sd->delGlobServlet("/api/*");
+    sd->addGlobServlet("/api/*", S("glob_api"));
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/api/v1/x") == "glob_v");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/api/x") == "glob_all");
+
+    WEBSERVER_ASSERT(sd->addRoute("/api/:name", S("route")));
+    sd->addServlet("/api/exact", S("exact"));
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/api/exact") == "exact");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/api/x") == "route");
+
+    // 删除后依次回落
+    sd->delServlet("/api/exact");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/api/exact") == "route");
+    sd->delRoute("/api/:name");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/api/exact") == "glob_all");
+    sd->delGlobServlet("/*");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/api/exact") == "glob_api");
+    sd->delGlobServlet("/api/*");
+    WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/api/exact") == "default");
+    WEBSERVER_ASSERT(!sd->getServlet("/api/exact"));
+    WEBSERVER_LOG_INFO(g_logger) << "test_order ok";
+}
+
+/**
+ * 函数名：test_bulk
+ * 功能：批量添加大量路由, 查找结果与逐条添加一致
+ */
+void test_bulk() {
+    ServletDispatch::ptr sd(new ServletDispatch);
+    const int n = 10000;
+    for(int i = 0; i < n; ++i) {
+        sd->addServlet("/exact/" + std::to_string(i), S("e" + std::to_string(i)));
+        WEBSERVER_ASSERT(sd->addRoute("/r" + std::to_string(i) + "/:id", S("r" + std::to_string(i))));
+    }
+    for(int i = 0; i < n; i += 997) {
+        WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/exact/" + std::to_string(i)) == "e" + std::to_string(i));
+        WEBSERVER_ASSERT(match(sd, HttpMethod::GET, "/r" + std::to_string(i) + "/1") == "r" + std::to_string(i));
+    }
+    std::map<std::string, IServletCreator::ptr> infos;
+    sd->listAllRouteCreator(infos);
+    WEBSERVER_ASSERT(infos.size() == (size_t)n);
+    WEBSERVER_LOG_INFO(g_logger) << "test_bulk ok";
+}
+
+int main(int argc, char** argv) {
+    test_route();
+    test_backtrack();
+    test_order();
+    test_bulk();
+    return 0;
+}